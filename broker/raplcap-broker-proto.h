@@ -0,0 +1,159 @@
+/**
+ * Wire protocol between raplcapd and the raplcap-broker client library.
+ *
+ * Clients connect to a SOCK_SEQPACKET UNIX domain socket, so message boundaries are preserved.
+ * Each request message is a header followed by n_ops operations, which the daemon executes in order.
+ * The response message is a header with the same n_ops, followed by one result per operation, in the same order.
+ * Operations and results have a fixed-size part followed by an op-specific payload (which may be empty).
+ * All sizes are multiples of 8 bytes, so payloads stay aligned.
+ * Both ends are on the same host, so values are in native byte order.
+ *
+ * @author Connor Imes
+ * @date 2020-10-16
+ */
+#ifndef _RAPLCAP_BROKER_PROTO_H_
+#define _RAPLCAP_BROKER_PROTO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Environment variable to override the socket path used by clients
+#define RAPLCAP_BROKER_ENV_SOCKET "RAPLCAP_BROKER_SOCKET"
+#define RAPLCAP_BROKER_SOCKET_DEFAULT "/run/raplcapd.sock"
+
+#define RAPLCAP_BROKER_MAGIC 0x52434252
+#define RAPLCAP_BROKER_VERSION 1
+
+// The maximum number of operations in a single message
+#define RAPLCAP_BROKER_MAX_OPS 256
+
+typedef enum raplcap_broker_op_code {
+  // result ret is the number of packages
+  RAPLCAP_BROKER_OP_GET_NUM_PACKAGES = 0,
+  // result ret is the number of die in pkg
+  RAPLCAP_BROKER_OP_GET_NUM_DIE,
+  RAPLCAP_BROKER_OP_IS_ZONE_SUPPORTED,
+  RAPLCAP_BROKER_OP_IS_ZONE_ENABLED,
+  // op flags is the enabled value
+  RAPLCAP_BROKER_OP_SET_ZONE_ENABLED,
+  // op flags selects which limits to get; op payload is raplcap_broker_limits with the caller's current values (which
+  // are kept if the zone doesn't have them) and result payload is raplcap_broker_limits
+  RAPLCAP_BROKER_OP_GET_LIMITS,
+  // op flags selects which limits to set; op payload is raplcap_broker_limits
+  RAPLCAP_BROKER_OP_SET_LIMITS,
+  // op flags selects which limits to quantize; op and result payloads are raplcap_broker_limits
+  RAPLCAP_BROKER_OP_QUANTIZE_LIMITS,
+  // result payload is raplcap_broker_zone
+  RAPLCAP_BROKER_OP_GET_ZONE_STATUS,
+  // result payload is a double
+  RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER,
+  // result payload is a double
+  RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER_MAX,
+  // like GET_ZONE_STATUS, but doesn't fail for unsupported zones; result payload is raplcap_broker_zone
+  RAPLCAP_BROKER_OP_SNAPSHOT_ZONE,
+  // create or renew the connection's lease on a zone's limits
+  // op flags selects which limits the lease constrains; op payload is raplcap_broker_lease
+  RAPLCAP_BROKER_OP_REQUEST_LIMITS,
+  // release the connection's lease on a zone's limits
+  RAPLCAP_BROKER_OP_RELEASE_LIMITS,
+} raplcap_broker_op_code;
+
+#define RAPLCAP_BROKER_NUM_OPS (RAPLCAP_BROKER_OP_RELEASE_LIMITS + 1)
+
+// Op flags for limits
+#define RAPLCAP_BROKER_FLAG_LONG 0x1
+#define RAPLCAP_BROKER_FLAG_SHORT 0x2
+
+typedef struct raplcap_broker_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t n_ops;
+} raplcap_broker_header;
+
+typedef struct raplcap_broker_op {
+  uint8_t code;
+  uint8_t zone;
+  uint8_t flags;
+  uint8_t reserved;
+  uint16_t pkg;
+  uint16_t die;
+} raplcap_broker_op;
+
+typedef struct raplcap_broker_result {
+  // the function's return value (or -1 on error)
+  int32_t ret;
+  // errno if the function failed, otherwise 0
+  int32_t err;
+} raplcap_broker_result;
+
+typedef struct raplcap_broker_limits {
+  double seconds_long;
+  double watts_long;
+  double seconds_short;
+  double watts_short;
+} raplcap_broker_limits;
+
+typedef struct raplcap_broker_lease {
+  raplcap_broker_limits limits;
+  // the lease expires after this many seconds, unless renewed (<= 0 to hold it until released or disconnected)
+  double ttl_sec;
+  int32_t priority;
+  int32_t reserved;
+} raplcap_broker_lease;
+
+typedef struct raplcap_broker_zone {
+  raplcap_broker_limits limits;
+  double joules;
+  double joules_max;
+  int32_t supported;
+  int32_t enabled;
+  int32_t clamped;
+  int32_t locked;
+} raplcap_broker_zone;
+
+static inline size_t raplcap_broker_op_payload_size(uint8_t code) {
+  switch (code) {
+    case RAPLCAP_BROKER_OP_GET_LIMITS:
+    case RAPLCAP_BROKER_OP_SET_LIMITS:
+    case RAPLCAP_BROKER_OP_QUANTIZE_LIMITS:
+      return sizeof(raplcap_broker_limits);
+    case RAPLCAP_BROKER_OP_REQUEST_LIMITS:
+      return sizeof(raplcap_broker_lease);
+    default:
+      return 0;
+  }
+}
+
+static inline size_t raplcap_broker_result_payload_size(uint8_t code) {
+  switch (code) {
+    case RAPLCAP_BROKER_OP_GET_LIMITS:
+    case RAPLCAP_BROKER_OP_QUANTIZE_LIMITS:
+      return sizeof(raplcap_broker_limits);
+    case RAPLCAP_BROKER_OP_GET_ZONE_STATUS:
+    case RAPLCAP_BROKER_OP_SNAPSHOT_ZONE:
+      return sizeof(raplcap_broker_zone);
+    case RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER:
+    case RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER_MAX:
+      return sizeof(double);
+    default:
+      return 0;
+  }
+}
+
+// The largest possible messages
+#define RAPLCAP_BROKER_REQUEST_MAX \
+  (sizeof(raplcap_broker_header) + \
+   RAPLCAP_BROKER_MAX_OPS * (sizeof(raplcap_broker_op) + sizeof(raplcap_broker_lease)))
+#define RAPLCAP_BROKER_RESPONSE_MAX \
+  (sizeof(raplcap_broker_header) + \
+   RAPLCAP_BROKER_MAX_OPS * (sizeof(raplcap_broker_result) + sizeof(raplcap_broker_zone)))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,706 @@
+/**
+ * Implementation that forwards requests to raplcapd over a UNIX domain socket.
+ * See raplcap-broker-proto.h for the protocol.
+ *
+ * @author Connor Imes
+ * @date 2020-10-16
+ */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "raplcap.h"
+#include "raplcap-wrappers.h"
+#define RAPLCAP_IMPL "raplcap-broker"
+#include "raplcap-common.h"
+#include "raplcap-async-common.h"
+#include "raplcap-snapshot-common.h"
+#include "raplcap-broker.h"
+#include "raplcap-broker-proto.h"
+
+typedef struct raplcap_broker raplcap_broker;
+
+struct raplcap_zone_handle {
+  raplcap_broker* state;
+  uint32_t pkg;
+  uint32_t die;
+  raplcap_zone zone;
+  double joules_max;
+};
+
+struct raplcap_broker {
+  int fd;
+  uint32_t n_pkg;
+  // currently only support homogeneous die count per package
+  uint32_t n_die;
+  // lazily resolved, indexed by ((pkg * n_die) + die) * RAPLCAP_NZONES + zone
+  raplcap_zone_handle* handles;
+  // serializes exchanges, so a context can be shared with background threads, e.g., accumulators
+  pthread_mutex_t lock;
+  // the batch being built or decoded
+  uint16_t n_ops;
+  size_t req_len;
+  size_t resp_len;
+  size_t resp_off;
+  uint8_t codes[RAPLCAP_BROKER_MAX_OPS];
+  // uint64_t keeps payloads aligned
+  uint64_t req[(RAPLCAP_BROKER_REQUEST_MAX + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+  uint64_t resp[(RAPLCAP_BROKER_RESPONSE_MAX + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+};
+
+static raplcap rc_default;
+
+static raplcap_broker* broker_open(void) {
+  struct sockaddr_un addr;
+  raplcap_broker* state;
+  int err_save;
+  const char* path = getenv(RAPLCAP_BROKER_ENV_SOCKET);
+  if (path == NULL || *path == '\0') {
+    path = RAPLCAP_BROKER_SOCKET_DEFAULT;
+  }
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    raplcap_log(ERROR, "broker_open: Socket path too long: %s\n", path);
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  if ((state = calloc(1, sizeof(raplcap_broker))) == NULL) {
+    raplcap_perror(ERROR, "broker_open: calloc");
+    return NULL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if ((state->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+    raplcap_perror(ERROR, "broker_open: socket");
+    free(state);
+    return NULL;
+  }
+  if (connect(state->fd, (const struct sockaddr*) &addr, sizeof(addr))) {
+    err_save = errno;
+    raplcap_log(ERROR, "broker_open: connect: %s: %s\n", path, strerror(err_save));
+    close(state->fd);
+    free(state);
+    errno = err_save;
+    return NULL;
+  }
+  if ((errno = pthread_mutex_init(&state->lock, NULL))) {
+    raplcap_perror(ERROR, "broker_open: pthread_mutex_init");
+    err_save = errno;
+    close(state->fd);
+    free(state);
+    errno = err_save;
+    return NULL;
+  }
+  raplcap_log(DEBUG, "broker_open: Connected to %s\n", path);
+  return state;
+}
+
+static int broker_close(raplcap_broker* state) {
+  int ret = close(state->fd);
+  pthread_mutex_destroy(&state->lock);
+  free(state->handles);
+  free(state);
+  return ret;
+}
+
+// Batches are built and decoded with the lock held
+
+static void batch_begin(raplcap_broker* state) {
+  state->n_ops = 0;
+  state->req_len = sizeof(raplcap_broker_header);
+}
+
+static void batch_add(raplcap_broker* state, raplcap_broker_op_code code, uint32_t pkg, uint32_t die,
+                      raplcap_zone zone, uint8_t flags, const void* in) {
+  unsigned char* req = (unsigned char*) state->req;
+  raplcap_broker_op op;
+  size_t in_len = raplcap_broker_op_payload_size((uint8_t) code);
+  // parameters are validated against the topology first, so they fit
+  op.code = (uint8_t) code;
+  op.zone = (uint8_t) zone;
+  op.flags = flags;
+  op.reserved = 0;
+  op.pkg = (uint16_t) pkg;
+  op.die = (uint16_t) die;
+  memcpy(req + state->req_len, &op, sizeof(op));
+  state->req_len += sizeof(op);
+  if (in_len > 0) {
+    memcpy(req + state->req_len, in, in_len);
+    state->req_len += in_len;
+  }
+  state->codes[state->n_ops++] = (uint8_t) code;
+}
+
+static int batch_exchange(raplcap_broker* state) {
+  raplcap_broker_header hdr;
+  ssize_t len;
+  hdr.magic = RAPLCAP_BROKER_MAGIC;
+  hdr.version = RAPLCAP_BROKER_VERSION;
+  hdr.n_ops = state->n_ops;
+  memcpy(state->req, &hdr, sizeof(hdr));
+  if (send(state->fd, state->req, state->req_len, MSG_NOSIGNAL) < 0) {
+    raplcap_perror(ERROR, "batch_exchange: send");
+    return -1;
+  }
+  do {
+    len = recv(state->fd, state->resp, sizeof(state->resp), MSG_TRUNC);
+  } while (len < 0 && errno == EINTR);
+  if (len < 0) {
+    raplcap_perror(ERROR, "batch_exchange: recv");
+    return -1;
+  }
+  memcpy(&hdr, state->resp, sizeof(hdr) < (size_t) len ? sizeof(hdr) : (size_t) len);
+  if (len == 0 || (size_t) len > sizeof(state->resp) || (size_t) len < sizeof(hdr) ||
+      hdr.magic != RAPLCAP_BROKER_MAGIC || hdr.n_ops != state->n_ops) {
+    // the daemon disconnects clients that send bad requests, so it's not worth trying to resynchronize
+    raplcap_log(ERROR, "batch_exchange: Bad or missing response from daemon\n");
+    errno = len == 0 ? ECONNRESET : EPROTO;
+    return -1;
+  }
+  state->resp_len = (size_t) len;
+  state->resp_off = sizeof(hdr);
+  state->n_ops = 0;
+  return 0;
+}
+
+// Decode the next result - out may be NULL to discard the payload
+static int batch_next(raplcap_broker* state, raplcap_broker_result* res, void* out) {
+  const unsigned char* resp = (const unsigned char*) state->resp;
+  size_t out_len = raplcap_broker_result_payload_size(state->codes[state->n_ops]);
+  if (state->resp_off + sizeof(*res) + out_len > state->resp_len) {
+    raplcap_log(ERROR, "batch_next: Response truncated\n");
+    errno = EPROTO;
+    return -1;
+  }
+  memcpy(res, resp + state->resp_off, sizeof(*res));
+  state->resp_off += sizeof(*res);
+  if (out != NULL) {
+    memcpy(out, resp + state->resp_off, out_len);
+  }
+  state->resp_off += out_len;
+  state->n_ops++;
+  return 0;
+}
+
+// Execute a single operation, returning the remote function's result (with errno set on failure)
+static int broker_call(raplcap_broker* state, raplcap_broker_op_code code, uint32_t pkg, uint32_t die,
+                       raplcap_zone zone, uint8_t flags, const void* in, void* out) {
+  raplcap_broker_result res;
+  int ret;
+  pthread_mutex_lock(&state->lock);
+  batch_begin(state);
+  batch_add(state, code, pkg, die, zone, flags, in);
+  if ((ret = batch_exchange(state)) == 0 && (ret = batch_next(state, &res, out)) == 0) {
+    if ((ret = res.ret) < 0) {
+      errno = res.err;
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+  return ret;
+}
+
+static raplcap_broker* get_state(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_broker* state;
+  if (rc == NULL) {
+    rc = &rc_default;
+  }
+  if ((state = (raplcap_broker*) rc->state) == NULL) {
+    // unfortunately can't detect if the context just contains garbage
+    raplcap_log(ERROR, "get_state: Context is not initialized\n");
+    errno = EINVAL;
+    return NULL;
+  }
+  if (pkg >= state->n_pkg) {
+    raplcap_log(ERROR, "get_state: Package %"PRIu32" not in range [0, %"PRIu32")\n", pkg, state->n_pkg);
+    errno = EINVAL;
+    return NULL;
+  }
+  if (die >= state->n_die) {
+    raplcap_log(ERROR, "get_state: Die %"PRIu32" not in range [0, %"PRIu32")\n", die, state->n_die);
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((int) zone < 0 || (int) zone > RAPLCAP_ZONE_PSYS) {
+    raplcap_log(ERROR, "get_state: Unknown zone: %d\n", zone);
+    errno = EINVAL;
+    return NULL;
+  }
+  return state;
+}
+
+static int get_topology(raplcap_broker* state, uint32_t* n_pkg, uint32_t* n_die) {
+  raplcap_broker_result res_pkg;
+  raplcap_broker_result res_die;
+  int ret;
+  pthread_mutex_lock(&state->lock);
+  batch_begin(state);
+  batch_add(state, RAPLCAP_BROKER_OP_GET_NUM_PACKAGES, 0, 0, RAPLCAP_ZONE_PACKAGE, 0, NULL);
+  batch_add(state, RAPLCAP_BROKER_OP_GET_NUM_DIE, 0, 0, RAPLCAP_ZONE_PACKAGE, 0, NULL);
+  if ((ret = batch_exchange(state)) == 0 &&
+      (ret = batch_next(state, &res_pkg, NULL)) == 0 &&
+      (ret = batch_next(state, &res_die, NULL)) == 0) {
+    if (res_pkg.ret <= 0 || res_die.ret <= 0) {
+      errno = res_pkg.ret <= 0 ? res_pkg.err : res_die.err;
+      ret = -1;
+    } else {
+      *n_pkg = (uint32_t) res_pkg.ret;
+      *n_die = (uint32_t) res_die.ret;
+      raplcap_log(DEBUG, "get_topology: packages=%"PRIu32", die=%"PRIu32"\n", *n_pkg, *n_die);
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+  return ret;
+}
+
+int raplcap_init(raplcap* rc) {
+  raplcap_broker* state;
+  int err_save;
+  if (rc == NULL) {
+    rc = &rc_default;
+  }
+  if ((state = broker_open()) == NULL) {
+    return -1;
+  }
+  if (get_topology(state, &state->n_pkg, &state->n_die)) {
+    err_save = errno;
+    broker_close(state);
+    errno = err_save;
+    return -1;
+  }
+  if ((state->handles = calloc(state->n_pkg * state->n_die * RAPLCAP_NZONES, sizeof(*state->handles))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_init: calloc");
+    err_save = errno;
+    broker_close(state);
+    errno = err_save;
+    return -1;
+  }
+  rc->state = state;
+  rc->nsockets = state->n_pkg;
+  raplcap_log(DEBUG, "raplcap_init: Initialized\n");
+  return 0;
+}
+
+int raplcap_destroy(raplcap* rc) {
+  int err_save = 0;
+  if (rc == NULL) {
+    rc = &rc_default;
+  }
+  if (rc->state != NULL) {
+    if (broker_close((raplcap_broker*) rc->state)) {
+      raplcap_perror(ERROR, "raplcap_destroy: close");
+      err_save = errno;
+    }
+    rc->state = NULL;
+  }
+  rc->nsockets = 0;
+  raplcap_log(DEBUG, "raplcap_destroy: Destroyed\n");
+  errno = err_save;
+  return err_save ? -1 : 0;
+}
+
+static int get_topology_uninit(uint32_t* n_pkg, uint32_t* n_die) {
+  raplcap_broker* state;
+  int ret;
+  if ((state = broker_open()) == NULL) {
+    return -1;
+  }
+  ret = get_topology(state, n_pkg, n_die);
+  broker_close(state);
+  return ret;
+}
+
+uint32_t raplcap_get_num_packages(const raplcap* rc) {
+  const raplcap_broker* state;
+  uint32_t n_pkg = 0;
+  uint32_t n_die;
+  if (rc == NULL) {
+    rc = &rc_default;
+  }
+  if ((state = (raplcap_broker*) rc->state) != NULL) {
+    return state->n_pkg;
+  }
+  return get_topology_uninit(&n_pkg, &n_die) ? 0 : n_pkg;
+}
+
+uint32_t raplcap_get_num_die(const raplcap* rc, uint32_t pkg) {
+  const raplcap_broker* state;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  if (rc == NULL) {
+    rc = &rc_default;
+  }
+  if ((state = (raplcap_broker*) rc->state) != NULL) {
+    if (pkg >= state->n_pkg) {
+      raplcap_log(ERROR, "raplcap_get_num_die: Package %"PRIu32" not in range [0, %"PRIu32")\n", pkg, state->n_pkg);
+      errno = EINVAL;
+      return 0;
+    }
+    return state->n_die;
+  }
+  if (get_topology_uninit(&n_pkg, &n_die)) {
+    return 0;
+  }
+  if (pkg >= n_pkg) {
+    raplcap_log(ERROR, "raplcap_get_num_die: Package %"PRIu32" not in range [0, %"PRIu32")\n", pkg, n_pkg);
+    errno = EINVAL;
+    return 0;
+  }
+  return n_die;
+}
+
+int raplcap_pd_is_zone_supported(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  return broker_call(state, RAPLCAP_BROKER_OP_IS_ZONE_SUPPORTED, pkg, die, zone, 0, NULL, NULL);
+}
+
+int raplcap_pd_is_zone_enabled(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  return broker_call(state, RAPLCAP_BROKER_OP_IS_ZONE_ENABLED, pkg, die, zone, 0, NULL, NULL);
+}
+
+int raplcap_pd_set_zone_enabled(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone, int enabled) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_pd_set_zone_enabled: pkg=%"PRIu32", die=%"PRIu32", zone=%d, enabled=%d\n",
+              pkg, die, zone, enabled);
+  return broker_call(state, RAPLCAP_BROKER_OP_SET_ZONE_ENABLED, pkg, die, zone, enabled ? 1 : 0, NULL, NULL);
+}
+
+static uint8_t limits_to_wire(const raplcap_limit* limit_long, const raplcap_limit* limit_short,
+                              raplcap_broker_limits* bl) {
+  uint8_t flags = 0;
+  memset(bl, 0, sizeof(*bl));
+  if (limit_long != NULL) {
+    bl->seconds_long = limit_long->seconds;
+    bl->watts_long = limit_long->watts;
+    flags |= RAPLCAP_BROKER_FLAG_LONG;
+  }
+  if (limit_short != NULL) {
+    bl->seconds_short = limit_short->seconds;
+    bl->watts_short = limit_short->watts;
+    flags |= RAPLCAP_BROKER_FLAG_SHORT;
+  }
+  return flags;
+}
+
+static void limits_from_wire(const raplcap_broker_limits* bl, raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  if (limit_long != NULL) {
+    limit_long->seconds = bl->seconds_long;
+    limit_long->watts = bl->watts_long;
+  }
+  if (limit_short != NULL) {
+    limit_short->seconds = bl->seconds_short;
+    limit_short->watts = bl->watts_short;
+  }
+}
+
+static int get_limits(raplcap_broker* state, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                      raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  raplcap_broker_limits bl;
+  // send the current values, which are kept for limits the zone doesn't have
+  uint8_t flags = limits_to_wire(limit_long, limit_short, &bl);
+  int ret = broker_call(state, RAPLCAP_BROKER_OP_GET_LIMITS, pkg, die, zone, flags, &bl, &bl);
+  if (ret == 0) {
+    limits_from_wire(&bl, limit_long, limit_short);
+  }
+  return ret;
+}
+
+static int set_limits(raplcap_broker* state, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                      const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  raplcap_broker_limits bl;
+  uint8_t flags = limits_to_wire(limit_long, limit_short, &bl);
+  return broker_call(state, RAPLCAP_BROKER_OP_SET_LIMITS, pkg, die, zone, flags, &bl, NULL);
+}
+
+int raplcap_pd_get_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                          raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_pd_get_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  return get_limits(state, pkg, die, zone, limit_long, limit_short);
+}
+
+int raplcap_pd_set_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                          const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_pd_set_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  return set_limits(state, pkg, die, zone, limit_long, limit_short);
+}
+
+int raplcap_pd_quantize_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  raplcap_broker_limits bl;
+  uint8_t flags;
+  int ret;
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_pd_quantize_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  flags = limits_to_wire(limit_long, limit_short, &bl);
+  if ((ret = broker_call(state, RAPLCAP_BROKER_OP_QUANTIZE_LIMITS, pkg, die, zone, flags, &bl, &bl)) >= 0) {
+    limits_from_wire(&bl, limit_long, limit_short);
+  }
+  return ret;
+}
+
+int raplcap_pd_get_zone_status(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_zone_status* status) {
+  raplcap_broker_zone bz;
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  if (status == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_pd_get_zone_status: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (broker_call(state, RAPLCAP_BROKER_OP_GET_ZONE_STATUS, pkg, die, zone, 0, NULL, &bz)) {
+    return -1;
+  }
+  limits_from_wire(&bz.limits, &status->limit_long, &status->limit_short);
+  status->enabled = bz.enabled;
+  status->clamped = bz.clamped;
+  status->locked = bz.locked;
+  return 0;
+}
+
+static double get_energy(raplcap_broker* state, raplcap_broker_op_code code, uint32_t pkg, uint32_t die,
+                         raplcap_zone zone) {
+  double joules;
+  if (broker_call(state, code, pkg, die, zone, 0, NULL, &joules)) {
+    return -1;
+  }
+  return joules;
+}
+
+double raplcap_pd_get_energy_counter(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  return get_energy(state, RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER, pkg, die, zone);
+}
+
+double raplcap_pd_get_energy_counter_max(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  return get_energy(state, RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER_MAX, pkg, die, zone);
+}
+
+const raplcap_zone_handle* raplcap_pd_get_zone_handle(const raplcap* rc, uint32_t pkg, uint32_t die,
+                                                      raplcap_zone zone) {
+  raplcap_broker_result res_supported;
+  raplcap_broker_result res_max;
+  raplcap_zone_handle* zh;
+  double joules_max;
+  int ret;
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  raplcap_log(DEBUG, "raplcap_pd_get_zone_handle: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (state == NULL) {
+    return NULL;
+  }
+  zh = &state->handles[(((pkg * state->n_die) + die) * RAPLCAP_NZONES) + zone];
+  pthread_mutex_lock(&state->lock);
+  if (zh->state == NULL) {
+    // resolve in a single round trip
+    batch_begin(state);
+    batch_add(state, RAPLCAP_BROKER_OP_IS_ZONE_SUPPORTED, pkg, die, zone, 0, NULL);
+    batch_add(state, RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER_MAX, pkg, die, zone, 0, NULL);
+    if ((ret = batch_exchange(state)) == 0 &&
+        (ret = batch_next(state, &res_supported, NULL)) == 0 &&
+        (ret = batch_next(state, &res_max, &joules_max)) == 0) {
+      if (res_supported.ret == 0) {
+        raplcap_log(ERROR, "raplcap_pd_get_zone_handle: Zone not supported: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+                    pkg, die, zone);
+        errno = ENOTSUP;
+        ret = -1;
+      } else if (res_supported.ret < 0 || res_max.ret < 0) {
+        errno = res_supported.ret < 0 ? res_supported.err : res_max.err;
+        ret = -1;
+      } else {
+        zh->pkg = pkg;
+        zh->die = die;
+        zh->zone = zone;
+        zh->joules_max = joules_max;
+        zh->state = state;
+      }
+    }
+    if (ret) {
+      zh = NULL;
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+  return zh;
+}
+
+int raplcap_zone_handle_get_limits(const raplcap_zone_handle* zh, raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  return get_limits(zh->state, zh->pkg, zh->die, zh->zone, limit_long, limit_short);
+}
+
+int raplcap_zone_handle_set_limits(const raplcap_zone_handle* zh,
+                                   const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  return set_limits(zh->state, zh->pkg, zh->die, zh->zone, limit_long, limit_short);
+}
+
+double raplcap_zone_handle_get_energy_counter(const raplcap_zone_handle* zh) {
+  return get_energy(zh->state, RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER, zh->pkg, zh->die, zh->zone);
+}
+
+double raplcap_zone_handle_get_energy_counter_max(const raplcap_zone_handle* zh) {
+  return zh->joules_max;
+}
+
+raplcap_snapshot* raplcap_snapshot_alloc(const raplcap* rc) {
+  const raplcap_broker* state = (const raplcap_broker*) (rc == NULL ? rc_default.state : rc->state);
+  if (state == NULL) {
+    raplcap_log(ERROR, "raplcap_snapshot_alloc: Context not initialized\n");
+    errno = EINVAL;
+    return NULL;
+  }
+  return snapshot_alloc(state->n_pkg, state->n_die);
+}
+
+// Decode the results of a batch of SNAPSHOT_ZONE operations, starting at zone index first
+static int snapshot_decode(raplcap_broker* state, raplcap_snapshot* snap, uint32_t first) {
+  raplcap_broker_result res;
+  raplcap_broker_zone bz;
+  raplcap_snapshot_zone* sz;
+  uint32_t n = state->n_ops;
+  uint32_t i;
+  int ret = 0;
+  if (batch_exchange(state)) {
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    if (batch_next(state, &res, &bz)) {
+      return -1;
+    }
+    sz = &snap->zones[first + i];
+    sz->limit_long.seconds = bz.limits.seconds_long;
+    sz->limit_long.watts = bz.limits.watts_long;
+    sz->limit_short.seconds = bz.limits.seconds_short;
+    sz->limit_short.watts = bz.limits.watts_short;
+    sz->joules = bz.joules;
+    sz->joules_max = bz.joules_max;
+    sz->supported = bz.supported;
+    sz->enabled = bz.enabled;
+    sz->clamped = bz.clamped;
+    sz->locked = bz.locked;
+    if (res.ret < 0) {
+      errno = res.err;
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+int raplcap_snapshot_read(const raplcap* rc, raplcap_snapshot* snap) {
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t first = 0;
+  uint32_t idx = 0;
+  int zone;
+  int ret = 0;
+  raplcap_broker* state = (raplcap_broker*) (rc == NULL ? rc_default.state : rc->state);
+  raplcap_log(DEBUG, "raplcap_snapshot_read\n");
+  if (state == NULL || snap == NULL || snap->n_pkg != state->n_pkg || snap->n_die != state->n_die) {
+    raplcap_log(ERROR, "raplcap_snapshot_read: Context not initialized or snapshot not allocated for it\n");
+    errno = EINVAL;
+    return -1;
+  }
+  // as few round trips as possible - zones are requested in the same order they're stored
+  pthread_mutex_lock(&state->lock);
+  batch_begin(state);
+  for (pkg = 0; pkg < snap->n_pkg; pkg++) {
+    for (die = 0; die < snap->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++, idx++) {
+        snapshot_zone_reset(snapshot_zone(snap, pkg, die, (raplcap_zone) zone));
+        batch_add(state, RAPLCAP_BROKER_OP_SNAPSHOT_ZONE, pkg, die, (raplcap_zone) zone, 0, NULL);
+        if (state->n_ops == RAPLCAP_BROKER_MAX_OPS) {
+          if (snapshot_decode(state, snap, first)) {
+            ret = -1;
+          }
+          first = idx + 1;
+          batch_begin(state);
+        }
+      }
+    }
+  }
+  if (state->n_ops > 0 && snapshot_decode(state, snap, first)) {
+    ret = -1;
+  }
+  pthread_mutex_unlock(&state->lock);
+  snap->timestamp_ns = snapshot_now_ns();
+  return ret;
+}
+
+int raplcap_broker_pd_request_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                     int32_t priority, double ttl_sec,
+                                     const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  raplcap_broker_lease lease;
+  uint8_t flags;
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_broker_pd_request_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d, priority=%"PRId32", "
+              "ttl_sec=%f\n", pkg, die, zone, priority, ttl_sec);
+  memset(&lease, 0, sizeof(lease));
+  flags = limits_to_wire(limit_long, limit_short, &lease.limits);
+  lease.ttl_sec = ttl_sec;
+  lease.priority = priority;
+  return broker_call(state, RAPLCAP_BROKER_OP_REQUEST_LIMITS, pkg, die, zone, flags, &lease, NULL);
+}
+
+int raplcap_broker_pd_release_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_broker* state = get_state(rc, pkg, die, zone);
+  if (state == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_broker_pd_release_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  return broker_call(state, RAPLCAP_BROKER_OP_RELEASE_LIMITS, pkg, die, zone, 0, NULL, NULL);
+}
+
+int raplcap_async_impl_get_sources(const raplcap* rc, raplcap_async_source* sources, uint32_t max) {
+  (void) rc;
+  (void) sources;
+  (void) max;
+  // there are no local files to read - energy counters are only available through the daemon
+  raplcap_log(ERROR, "raplcap_async_impl_get_sources: Not supported by this implementation\n");
+  errno = ENOTSUP;
+  return -1;
+}
+
+double raplcap_async_impl_decode(const raplcap* rc, const raplcap_async_source* src, const char* buf, size_t len) {
+  (void) rc;
+  (void) src;
+  (void) buf;
+  (void) len;
+  errno = ENOTSUP;
+  return -1;
+}
@@ -0,0 +1,57 @@
+/**
+ * Functionality specific to raplcap-broker.
+ *
+ * @author Connor Imes
+ * @date 2020-10-17
+ */
+#ifndef _RAPLCAP_BROKER_H_
+#define _RAPLCAP_BROKER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <raplcap.h>
+
+/**
+ * Request power limits for a zone with a lease, rather than setting them directly.
+ * The daemon chooses each zone's effective limits from all clients' leases using its configured policy, e.g., the
+ * lowest power limit or the highest priority, and only writes them when they change.
+ * When a zone's last lease is released or expires, the zone reverts to the limits it had before its first lease.
+ * While a zone has leases, raplcap_pd_set_limits changes the limits it reverts to, rather than the current limits.
+ *
+ * A context holds at most one lease per zone - requesting again renews or replaces it.
+ * Leases are released when the context is destroyed.
+ * Either limit may be NULL if the lease doesn't constrain it, and a limit's seconds may be 0 to keep the current value.
+ *
+ * @param rc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param priority higher values take precedence, depending on the daemon's policy
+ * @param ttl_sec the lease expires if not renewed within this time (<= 0 to hold it until released)
+ * @param limit_long
+ * @param limit_short
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_broker_pd_request_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                     int32_t priority, double ttl_sec,
+                                     const raplcap_limit* limit_long, const raplcap_limit* limit_short);
+
+/**
+ * Release a lease on a zone's limits.
+ *
+ * @param rc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @return 0 on success, a negative value on error (errno is ENOENT if the context doesn't have a lease on the zone)
+ */
+int raplcap_broker_pd_release_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,394 @@
+/**
+ * Power limit arbitration for raplcapd.
+ *
+ * @author Connor Imes
+ * @date 2020-10-17
+ */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "raplcap.h"
+#define RAPLCAP_IMPL "raplcapd"
+#include "raplcap-common.h"
+#include "raplcapd-arbiter.h"
+
+typedef struct arbiter_lease {
+  uint64_t owner;
+  // creation order, for breaking ties
+  uint64_t seq;
+  // 0 if the lease doesn't expire
+  uint64_t expires_ns;
+  uint32_t zone_idx;
+  int32_t priority;
+  int active;
+  int has_long;
+  int has_short;
+  raplcap_limit limit_long;
+  raplcap_limit limit_short;
+} arbiter_lease;
+
+typedef struct arbiter_zone {
+  raplcap_limit baseline_long;
+  raplcap_limit baseline_short;
+  raplcap_limit applied_long;
+  raplcap_limit applied_short;
+  uint32_t n_leases;
+  // needs to be reapplied
+  int dirty;
+} arbiter_zone;
+
+struct raplcapd_arbiter {
+  const raplcap* rc;
+  raplcapd_policy policy;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  // indexed by ((pkg * n_die) + die) * RAPLCAP_NZONES + zone
+  arbiter_zone* zones;
+  uint32_t max_leases;
+  arbiter_lease* leases;
+  uint64_t seq;
+};
+
+raplcapd_arbiter* raplcapd_arbiter_init(const raplcap* rc, raplcapd_policy policy, uint32_t max_leases) {
+  raplcapd_arbiter* arb;
+  if (max_leases == 0 || (policy != RAPLCAPD_POLICY_MIN && policy != RAPLCAPD_POLICY_PRIORITY)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((arb = calloc(1, sizeof(*arb))) == NULL) {
+    raplcap_perror(ERROR, "raplcapd_arbiter_init: calloc");
+    return NULL;
+  }
+  arb->rc = rc;
+  arb->policy = policy;
+  arb->max_leases = max_leases;
+  if ((arb->n_pkg = raplcap_get_num_packages(rc)) == 0 || (arb->n_die = raplcap_get_num_die(rc, 0)) == 0) {
+    free(arb);
+    return NULL;
+  }
+  if ((arb->zones = calloc(arb->n_pkg * arb->n_die * RAPLCAP_NZONES, sizeof(*arb->zones))) == NULL ||
+      (arb->leases = calloc(max_leases, sizeof(*arb->leases))) == NULL) {
+    raplcap_perror(ERROR, "raplcapd_arbiter_init: calloc");
+    free(arb->zones);
+    free(arb);
+    return NULL;
+  }
+  return arb;
+}
+
+static int get_zone_idx(const raplcapd_arbiter* arb, uint32_t pkg, uint32_t die, raplcap_zone zone, uint32_t* idx) {
+  if (pkg >= arb->n_pkg || die >= arb->n_die || (int) zone < 0 || (int) zone >= RAPLCAP_NZONES) {
+    errno = EINVAL;
+    return -1;
+  }
+  *idx = (((pkg * arb->n_die) + die) * RAPLCAP_NZONES) + zone;
+  return 0;
+}
+
+// Returns non-zero if lease a's limit la takes precedence over lease b's limit lb
+static int lease_wins(raplcapd_policy policy, const arbiter_lease* a, const raplcap_limit* la,
+                      const arbiter_lease* b, const raplcap_limit* lb) {
+  if (policy == RAPLCAPD_POLICY_PRIORITY && a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+  if (la->watts < lb->watts) {
+    return 1;
+  }
+  if (la->watts > lb->watts) {
+    return 0;
+  }
+  if (a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+  return a->seq < b->seq;
+}
+
+// Choose the effective limit for one constraint of a zone
+static void select_limit(const raplcapd_arbiter* arb, uint32_t zone_idx, int is_short, const raplcap_limit* baseline,
+                         raplcap_limit* effective) {
+  const arbiter_lease* winner = NULL;
+  const raplcap_limit* lw = NULL;
+  const raplcap_limit* l;
+  uint32_t i;
+  for (i = 0; i < arb->max_leases; i++) {
+    if (!arb->leases[i].active || arb->leases[i].zone_idx != zone_idx ||
+        !(is_short ? arb->leases[i].has_short : arb->leases[i].has_long)) {
+      continue;
+    }
+    l = is_short ? &arb->leases[i].limit_short : &arb->leases[i].limit_long;
+    if (winner == NULL || lease_wins(arb->policy, &arb->leases[i], l, winner, lw)) {
+      winner = &arb->leases[i];
+      lw = l;
+    }
+  }
+  *effective = *baseline;
+  if (lw != NULL) {
+    effective->watts = lw->watts;
+    // leases may leave the time window unspecified
+    if (lw->seconds > 0) {
+      effective->seconds = lw->seconds;
+    }
+  }
+}
+
+static int limit_equal(const raplcap_limit* a, const raplcap_limit* b) {
+  return is_zero_dbl(a->seconds - b->seconds) && is_zero_dbl(a->watts - b->watts);
+}
+
+// Compute and write a zone's effective limits, if they changed
+static int apply(raplcapd_arbiter* arb, uint32_t zone_idx) {
+  arbiter_zone* z = &arb->zones[zone_idx];
+  raplcap_limit eff_long;
+  raplcap_limit eff_short;
+  int changed_long;
+  int changed_short;
+  const uint32_t pkg = zone_idx / (arb->n_die * RAPLCAP_NZONES);
+  const uint32_t die = (zone_idx / RAPLCAP_NZONES) % arb->n_die;
+  const raplcap_zone zone = (raplcap_zone) (zone_idx % RAPLCAP_NZONES);
+  // stays dirty until the effective limits are written, so failures are retried
+  z->dirty = 1;
+  select_limit(arb, zone_idx, 0, &z->baseline_long, &eff_long);
+  select_limit(arb, zone_idx, 1, &z->baseline_short, &eff_short);
+  // compare the values that would actually be written
+  if (raplcap_pd_quantize_limits(arb->rc, pkg, die, zone, &eff_long, &eff_short) < 0) {
+    return -1;
+  }
+  changed_long = !limit_equal(&eff_long, &z->applied_long);
+  changed_short = !limit_equal(&eff_short, &z->applied_short);
+  raplcap_log(DEBUG, "apply: pkg=%"PRIu32", die=%"PRIu32", zone=%d, leases=%"PRIu32", "
+              "long=(%f s, %f W)%s, short=(%f s, %f W)%s\n", pkg, die, zone, z->n_leases,
+              eff_long.seconds, eff_long.watts, changed_long ? " changed" : "",
+              eff_short.seconds, eff_short.watts, changed_short ? " changed" : "");
+  if (!changed_long && !changed_short) {
+    z->dirty = 0;
+    return 0;
+  }
+  if (raplcap_pd_set_limits(arb->rc, pkg, die, zone, changed_long ? &eff_long : NULL,
+                            changed_short ? &eff_short : NULL)) {
+    return -1;
+  }
+  z->applied_long = eff_long;
+  z->applied_short = eff_short;
+  z->dirty = 0;
+  return 0;
+}
+
+static void apply_dirty(raplcapd_arbiter* arb) {
+  uint32_t i;
+  for (i = 0; i < arb->n_pkg * arb->n_die * RAPLCAP_NZONES; i++) {
+    if (arb->zones[i].dirty && apply(arb, i)) {
+      raplcap_perror(WARN, "apply_dirty: Failed to apply limits");
+    }
+  }
+}
+
+static void lease_remove(raplcapd_arbiter* arb, arbiter_lease* lease) {
+  lease->active = 0;
+  arb->zones[lease->zone_idx].n_leases--;
+  arb->zones[lease->zone_idx].dirty = 1;
+}
+
+static arbiter_lease* lease_find(raplcapd_arbiter* arb, uint64_t owner, uint32_t zone_idx) {
+  uint32_t i;
+  for (i = 0; i < arb->max_leases; i++) {
+    if (arb->leases[i].active && arb->leases[i].owner == owner && arb->leases[i].zone_idx == zone_idx) {
+      return &arb->leases[i];
+    }
+  }
+  return NULL;
+}
+
+void raplcapd_arbiter_destroy(raplcapd_arbiter* arb) {
+  uint32_t i;
+  if (arb == NULL) {
+    return;
+  }
+  for (i = 0; i < arb->max_leases; i++) {
+    if (arb->leases[i].active) {
+      lease_remove(arb, &arb->leases[i]);
+    }
+  }
+  apply_dirty(arb);
+  free(arb->leases);
+  free(arb->zones);
+  free(arb);
+}
+
+int raplcapd_arbiter_request(raplcapd_arbiter* arb, uint64_t owner, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                             int32_t priority, double ttl_sec,
+                             const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  arbiter_lease* lease;
+  arbiter_lease prev;
+  arbiter_zone* z;
+  uint32_t zone_idx;
+  uint32_t i;
+  int err_save;
+  if (get_zone_idx(arb, pkg, die, zone, &zone_idx) ||
+      (limit_long == NULL && limit_short == NULL) ||
+      (limit_long != NULL && !(limit_long->watts > 0)) ||
+      (limit_short != NULL && !(limit_short->watts > 0))) {
+    errno = EINVAL;
+    return -1;
+  }
+  z = &arb->zones[zone_idx];
+  if ((lease = lease_find(arb, owner, zone_idx)) != NULL) {
+    // renewing keeps the original creation order
+    prev = *lease;
+  } else {
+    for (i = 0; i < arb->max_leases && arb->leases[i].active; i++);
+    if (i == arb->max_leases) {
+      raplcap_log(WARN, "raplcapd_arbiter_request: Too many leases\n");
+      errno = ENOSPC;
+      return -1;
+    }
+    lease = &arb->leases[i];
+    prev.active = 0;
+    // a dirty zone is still reverting to its baseline, so its current limits aren't the baseline
+    if (z->n_leases == 0 && !z->dirty) {
+      // the baseline is what the zone reverts to when its last lease ends
+      memset(&z->baseline_long, 0, sizeof(z->baseline_long));
+      memset(&z->baseline_short, 0, sizeof(z->baseline_short));
+      if (raplcap_pd_get_limits(arb->rc, pkg, die, zone, &z->baseline_long, &z->baseline_short)) {
+        return -1;
+      }
+      z->applied_long = z->baseline_long;
+      z->applied_short = z->baseline_short;
+    }
+    lease->owner = owner;
+    lease->seq = arb->seq++;
+    lease->zone_idx = zone_idx;
+    lease->active = 1;
+    z->n_leases++;
+  }
+  lease->priority = priority;
+  lease->expires_ns = ttl_sec > 0 ? raplcap_clock_ns(CLOCK_MONOTONIC) + (uint64_t) (ttl_sec * 1000000000.0) : 0;
+  lease->has_long = limit_long != NULL;
+  lease->has_short = limit_short != NULL;
+  if (limit_long != NULL) {
+    lease->limit_long = *limit_long;
+  }
+  if (limit_short != NULL) {
+    lease->limit_short = *limit_short;
+  }
+  raplcap_log(DEBUG, "raplcapd_arbiter_request: owner=%"PRIu64", pkg=%"PRIu32", die=%"PRIu32", zone=%d, "
+              "priority=%"PRId32", ttl_sec=%f\n", owner, pkg, die, zone, priority, ttl_sec);
+  if (apply(arb, zone_idx)) {
+    // limits weren't written, so the request has no effect
+    err_save = errno;
+    if (prev.active) {
+      *lease = prev;
+    } else {
+      lease->active = 0;
+      z->n_leases--;
+    }
+    errno = err_save;
+    return -1;
+  }
+  return 0;
+}
+
+int raplcapd_arbiter_release(raplcapd_arbiter* arb, uint64_t owner, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  arbiter_lease* lease;
+  uint32_t zone_idx;
+  if (get_zone_idx(arb, pkg, die, zone, &zone_idx)) {
+    return -1;
+  }
+  if ((lease = lease_find(arb, owner, zone_idx)) == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcapd_arbiter_release: owner=%"PRIu64", pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+              owner, pkg, die, zone);
+  lease_remove(arb, lease);
+  // the lease is gone either way, the zone stays dirty so the write is retried
+  if (apply(arb, zone_idx)) {
+    raplcap_perror(WARN, "raplcapd_arbiter_release: Failed to apply limits");
+  }
+  return 0;
+}
+
+void raplcapd_arbiter_release_owner(raplcapd_arbiter* arb, uint64_t owner) {
+  uint32_t i;
+  for (i = 0; i < arb->max_leases; i++) {
+    if (arb->leases[i].active && arb->leases[i].owner == owner) {
+      lease_remove(arb, &arb->leases[i]);
+    }
+  }
+  apply_dirty(arb);
+}
+
+int raplcapd_arbiter_set_baseline(raplcapd_arbiter* arb, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                  const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  arbiter_zone* z;
+  raplcap_limit prev_long;
+  raplcap_limit prev_short;
+  uint32_t zone_idx;
+  int err_save;
+  if (get_zone_idx(arb, pkg, die, zone, &zone_idx) || arb->zones[zone_idx].n_leases == 0) {
+    return 0;
+  }
+  z = &arb->zones[zone_idx];
+  prev_long = z->baseline_long;
+  prev_short = z->baseline_short;
+  // same semantics as setting limits - only positive values are set
+  if (limit_long != NULL) {
+    if (limit_long->seconds > 0) {
+      z->baseline_long.seconds = limit_long->seconds;
+    }
+    if (limit_long->watts > 0) {
+      z->baseline_long.watts = limit_long->watts;
+    }
+  }
+  if (limit_short != NULL) {
+    if (limit_short->seconds > 0) {
+      z->baseline_short.seconds = limit_short->seconds;
+    }
+    if (limit_short->watts > 0) {
+      z->baseline_short.watts = limit_short->watts;
+    }
+  }
+  raplcap_log(DEBUG, "raplcapd_arbiter_set_baseline: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  // the baseline may still be effective for a constraint that no lease covers
+  if (apply(arb, zone_idx)) {
+    // limits weren't written, so the request has no effect
+    err_save = errno;
+    z->baseline_long = prev_long;
+    z->baseline_short = prev_short;
+    errno = err_save;
+    return -1;
+  }
+  return 1;
+}
+
+uint64_t raplcapd_arbiter_expire(raplcapd_arbiter* arb, uint64_t now) {
+  uint64_t next = 0;
+  uint32_t i;
+  for (i = 0; i < arb->max_leases; i++) {
+    if (!arb->leases[i].active || arb->leases[i].expires_ns == 0) {
+      continue;
+    }
+    if (arb->leases[i].expires_ns <= now) {
+      raplcap_log(DEBUG, "raplcapd_arbiter_expire: owner=%"PRIu64", zone_idx=%"PRIu32"\n",
+                  arb->leases[i].owner, arb->leases[i].zone_idx);
+      lease_remove(arb, &arb->leases[i]);
+    } else if (next == 0 || arb->leases[i].expires_ns < next) {
+      next = arb->leases[i].expires_ns;
+    }
+  }
+  apply_dirty(arb);
+  return next;
+}
+
+int raplcapd_arbiter_has_pending(const raplcapd_arbiter* arb) {
+  uint32_t i;
+  for (i = 0; i < arb->n_pkg * arb->n_die * RAPLCAP_NZONES; i++) {
+    if (arb->zones[i].dirty) {
+      return 1;
+    }
+  }
+  return 0;
+}
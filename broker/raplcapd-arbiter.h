@@ -0,0 +1,88 @@
+/**
+ * Power limit arbitration for raplcapd.
+ *
+ * Clients hold leases on zones' limits, each with a priority and an optional expiration.
+ * A zone's effective limits are computed from its active leases by a deterministic policy, and are only written when
+ * they change (after quantization).
+ * The limits a zone had before its first lease are its baseline, which are restored when its last lease is released or
+ * expires.
+ * While a zone has leases, limits set without a lease update the baseline instead of being written.
+ *
+ * @author Connor Imes
+ * @date 2020-10-17
+ */
+#ifndef _RAPLCAPD_ARBITER_H_
+#define _RAPLCAPD_ARBITER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <raplcap.h>
+
+typedef enum raplcapd_policy {
+  // the lowest power wins, ties go to the highest priority, then to the oldest lease
+  RAPLCAPD_POLICY_MIN = 0,
+  // the highest priority wins, ties go to the lowest power, then to the oldest lease
+  RAPLCAPD_POLICY_PRIORITY,
+} raplcapd_policy;
+
+typedef struct raplcapd_arbiter raplcapd_arbiter;
+
+/**
+ * Returns an arbiter on success, NULL on error.
+ */
+raplcapd_arbiter* raplcapd_arbiter_init(const raplcap* rc, raplcapd_policy policy, uint32_t max_leases);
+
+/**
+ * Restore all zones with leases to their baselines and destroy the arbiter.
+ */
+void raplcapd_arbiter_destroy(raplcapd_arbiter* arb);
+
+/**
+ * Create or replace the owner's lease on a zone and apply the effective limits.
+ * Either limit may be NULL if the lease doesn't constrain it.
+ * Leases with ttl_sec <= 0 don't expire.
+ * Returns 0 on success, -1 with errno set on error (in which case the lease isn't held).
+ */
+int raplcapd_arbiter_request(raplcapd_arbiter* arb, uint64_t owner, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                             int32_t priority, double ttl_sec,
+                             const raplcap_limit* limit_long, const raplcap_limit* limit_short);
+
+/**
+ * Release the owner's lease on a zone and apply the effective limits.
+ * The lease is released even if the effective limits can't be written - they're retried by raplcapd_arbiter_expire.
+ * Returns 0 on success, -1 with errno set on error (ENOENT if the owner doesn't have a lease on the zone).
+ */
+int raplcapd_arbiter_release(raplcapd_arbiter* arb, uint64_t owner, uint32_t pkg, uint32_t die, raplcap_zone zone);
+
+/**
+ * Release all of the owner's leases.
+ */
+void raplcapd_arbiter_release_owner(raplcapd_arbiter* arb, uint64_t owner);
+
+/**
+ * If the zone has leases, update its baseline and return 1, otherwise return 0 (the caller should set the limits).
+ * Returns -1 with errno set if the effective limits can't be applied, in which case the baseline isn't changed.
+ */
+int raplcapd_arbiter_set_baseline(raplcapd_arbiter* arb, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                  const raplcap_limit* limit_long, const raplcap_limit* limit_short);
+
+/**
+ * Remove leases that expired by now (CLOCK_MONOTONIC nanoseconds) and apply the effective limits of their zones.
+ * Zones whose effective limits previously failed to be written are retried.
+ * Returns the time of the next expiration, or 0 if no leases expire.
+ */
+uint64_t raplcapd_arbiter_expire(raplcapd_arbiter* arb, uint64_t now);
+
+/**
+ * Returns 1 if any zone's effective limits failed to be written and are waiting to be retried, 0 otherwise.
+ */
+int raplcapd_arbiter_has_pending(const raplcapd_arbiter* arb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,576 @@
+/**
+ * RAPLCap broker daemon - owns a RAPLCap context and serves clients over a UNIX domain socket.
+ * See raplcap-broker-proto.h for the protocol.
+ *
+ * The daemon is single-threaded: requests are executed one at a time, and each request's operations are executed in
+ * order, so batched operations from one client are never interleaved with another client's.
+ *
+ * @author Connor Imes
+ * @date 2020-10-16
+ */
+// for accept4, SO_PEERCRED, struct ucred
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "raplcap.h"
+#include "raplcap-shm.h"
+#define RAPLCAP_IMPL "raplcapd"
+#include "raplcap-common.h"
+#include "raplcap-broker-proto.h"
+#include "raplcapd-arbiter.h"
+
+#define RAPLCAPD_MAX_CLIENTS 64
+#define RAPLCAPD_MAX_LEASES 1024
+// how long to wait before retrying limits that failed to be written
+#define RAPLCAPD_RETRY_NS 1000000000ULL
+
+typedef struct raplcapd_client {
+  int fd;
+  // unlike fds, IDs aren't reused, so they identify lease owners
+  uint64_t id;
+  // whether the client may change settings
+  int can_write;
+} raplcapd_client;
+
+typedef struct raplcapd_ctx {
+  raplcap rc;
+  const char* socket_path;
+  mode_t socket_mode;
+  int allow_all_writes;
+  const char* shm_name;
+  double shm_interval_sec;
+  raplcap_shm_publisher* pub;
+  raplcapd_policy policy;
+  raplcapd_arbiter* arb;
+  int listen_fd;
+  uint64_t next_client_id;
+  uint32_t n_clients;
+  raplcapd_client clients[RAPLCAPD_MAX_CLIENTS];
+  // + 1 for the listening socket
+  struct pollfd pfds[RAPLCAPD_MAX_CLIENTS + 1];
+  // uint64_t keeps payloads aligned
+  uint64_t req[(RAPLCAP_BROKER_REQUEST_MAX + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+  uint64_t resp[(RAPLCAP_BROKER_RESPONSE_MAX + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+} raplcapd_ctx;
+
+static volatile sig_atomic_t running = 1;
+
+static const char* prog;
+static const char short_options[] = "s:m:wP:S:i:h";
+static const struct option long_options[] = {
+  {"socket",           required_argument, NULL, 's'},
+  {"mode",             required_argument, NULL, 'm'},
+  {"allow-all-writes", no_argument,       NULL, 'w'},
+  {"policy",           required_argument, NULL, 'P'},
+  {"shm",              required_argument, NULL, 'S'},
+  {"interval",         required_argument, NULL, 'i'},
+  {"help",             no_argument,       NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+static void print_usage(int exit_code) {
+  fprintf(exit_code ? stderr : stdout,
+          "Usage: %s [OPTION]...\n"
+          "Serve RAPLCap requests from unprivileged clients over a UNIX domain socket.\n\n"
+          "Options:\n"
+          "  -s, --socket=PATH        The socket path (default: %s)\n"
+          "  -m, --mode=MODE          The socket file permissions, in octal (default: 0660)\n"
+          "  -w, --allow-all-writes   Allow any client to change settings, not just root and the daemon's user\n"
+          "  -P, --policy=POLICY      How to choose the effective limits of zones with leases. Allowable values:\n"
+          "                           MIN - the lowest power limit, then the highest priority (default)\n"
+          "                           PRIORITY - the highest priority, then the lowest power limit\n"
+          "  -S, --shm=NAME           Also publish energy counters to a shared memory segment, e.g., %s\n"
+          "  -i, --interval=SECONDS   The shared memory publishing interval (default: 0.1)\n"
+          "  -h, --help               Print this message and exit\n\n"
+          "Clients linked with raplcap-broker use the socket in environment variable %s, if set.\n",
+          prog, RAPLCAP_BROKER_SOCKET_DEFAULT, RAPLCAP_SHM_DEFAULT_NAME, RAPLCAP_BROKER_ENV_SOCKET);
+  exit(exit_code);
+}
+
+static void handle_signal(int sig) {
+  (void) sig;
+  running = 0;
+}
+
+static void limits_from_wire(const raplcap_broker_limits* bl, raplcap_limit* ll, raplcap_limit* ls) {
+  ll->seconds = bl->seconds_long;
+  ll->watts = bl->watts_long;
+  ls->seconds = bl->seconds_short;
+  ls->watts = bl->watts_short;
+}
+
+static void limits_to_wire(const raplcap_limit* ll, const raplcap_limit* ls, raplcap_broker_limits* bl) {
+  bl->seconds_long = ll->seconds;
+  bl->watts_long = ll->watts;
+  bl->seconds_short = ls->seconds;
+  bl->watts_short = ls->watts;
+}
+
+static int exec_snapshot_zone(const raplcap* rc, const raplcap_broker_op* op, raplcap_broker_zone* bz) {
+  const raplcap_zone_handle* zh;
+  raplcap_zone_status status;
+  int ret;
+  bz->limits.seconds_long = -1;
+  bz->limits.watts_long = -1;
+  bz->limits.seconds_short = -1;
+  bz->limits.watts_short = -1;
+  bz->joules = -1;
+  bz->joules_max = -1;
+  bz->supported = 0;
+  bz->enabled = -1;
+  bz->clamped = -1;
+  bz->locked = -1;
+  // check support first to avoid logging errors for zones that aren't expected to exist
+  if ((ret = raplcap_pd_is_zone_supported(rc, op->pkg, op->die, (raplcap_zone) op->zone)) <= 0) {
+    return ret;
+  }
+  bz->supported = 1;
+  if (raplcap_pd_get_zone_status(rc, op->pkg, op->die, (raplcap_zone) op->zone, &status) ||
+      (zh = raplcap_pd_get_zone_handle(rc, op->pkg, op->die, (raplcap_zone) op->zone)) == NULL) {
+    return -1;
+  }
+  limits_to_wire(&status.limit_long, &status.limit_short, &bz->limits);
+  bz->enabled = status.enabled;
+  bz->clamped = status.clamped;
+  bz->locked = status.locked;
+  bz->joules_max = raplcap_zone_handle_get_energy_counter_max(zh);
+  return (bz->joules = raplcap_zone_handle_get_energy_counter(zh)) < 0 ? -1 : 1;
+}
+
+static int exec_op(raplcapd_ctx* ctx, const raplcapd_client* client, const raplcap_broker_op* op,
+                   const void* in, void* out) {
+  const raplcap* rc = &ctx->rc;
+  const int can_write = client->can_write;
+  const raplcap_zone zone = (raplcap_zone) op->zone;
+  raplcap_broker_lease lease;
+  raplcap_broker_limits bl;
+  raplcap_broker_zone bz;
+  raplcap_zone_status status;
+  raplcap_limit ll;
+  raplcap_limit ls;
+  double joules;
+  uint32_t n;
+  int ret;
+  switch (op->code) {
+    case RAPLCAP_BROKER_OP_GET_NUM_PACKAGES:
+      return (n = raplcap_get_num_packages(rc)) == 0 ? -1 : (int) n;
+    case RAPLCAP_BROKER_OP_GET_NUM_DIE:
+      return (n = raplcap_get_num_die(rc, op->pkg)) == 0 ? -1 : (int) n;
+    case RAPLCAP_BROKER_OP_IS_ZONE_SUPPORTED:
+      return raplcap_pd_is_zone_supported(rc, op->pkg, op->die, zone);
+    case RAPLCAP_BROKER_OP_IS_ZONE_ENABLED:
+      return raplcap_pd_is_zone_enabled(rc, op->pkg, op->die, zone);
+    case RAPLCAP_BROKER_OP_SET_ZONE_ENABLED:
+      if (!can_write) {
+        errno = EPERM;
+        return -1;
+      }
+      return raplcap_pd_set_zone_enabled(rc, op->pkg, op->die, zone, op->flags);
+    case RAPLCAP_BROKER_OP_GET_LIMITS:
+      memcpy(&bl, in, sizeof(bl));
+      limits_from_wire(&bl, &ll, &ls);
+      ret = raplcap_pd_get_limits(rc, op->pkg, op->die, zone,
+                                  (op->flags & RAPLCAP_BROKER_FLAG_LONG) ? &ll : NULL,
+                                  (op->flags & RAPLCAP_BROKER_FLAG_SHORT) ? &ls : NULL);
+      limits_to_wire(&ll, &ls, &bl);
+      memcpy(out, &bl, sizeof(bl));
+      return ret;
+    case RAPLCAP_BROKER_OP_SET_LIMITS:
+      if (!can_write) {
+        errno = EPERM;
+        return -1;
+      }
+      memcpy(&bl, in, sizeof(bl));
+      limits_from_wire(&bl, &ll, &ls);
+      // don't override arbitrated limits, but revert to these ones when leases end
+      if ((ret = raplcapd_arbiter_set_baseline(ctx->arb, op->pkg, op->die, zone,
+                                               (op->flags & RAPLCAP_BROKER_FLAG_LONG) ? &ll : NULL,
+                                               (op->flags & RAPLCAP_BROKER_FLAG_SHORT) ? &ls : NULL)) != 0) {
+        return ret < 0 ? -1 : 0;
+      }
+      return raplcap_pd_set_limits(rc, op->pkg, op->die, zone,
+                                   (op->flags & RAPLCAP_BROKER_FLAG_LONG) ? &ll : NULL,
+                                   (op->flags & RAPLCAP_BROKER_FLAG_SHORT) ? &ls : NULL);
+    case RAPLCAP_BROKER_OP_QUANTIZE_LIMITS:
+      memcpy(&bl, in, sizeof(bl));
+      limits_from_wire(&bl, &ll, &ls);
+      ret = raplcap_pd_quantize_limits(rc, op->pkg, op->die, zone,
+                                       (op->flags & RAPLCAP_BROKER_FLAG_LONG) ? &ll : NULL,
+                                       (op->flags & RAPLCAP_BROKER_FLAG_SHORT) ? &ls : NULL);
+      limits_to_wire(&ll, &ls, &bl);
+      memcpy(out, &bl, sizeof(bl));
+      return ret;
+    case RAPLCAP_BROKER_OP_GET_ZONE_STATUS:
+      memset(&bz, 0, sizeof(bz));
+      if ((ret = raplcap_pd_get_zone_status(rc, op->pkg, op->die, zone, &status)) == 0) {
+        limits_to_wire(&status.limit_long, &status.limit_short, &bz.limits);
+        bz.supported = 1;
+        bz.enabled = status.enabled;
+        bz.clamped = status.clamped;
+        bz.locked = status.locked;
+      }
+      memcpy(out, &bz, sizeof(bz));
+      return ret;
+    case RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER:
+      joules = raplcap_pd_get_energy_counter(rc, op->pkg, op->die, zone);
+      memcpy(out, &joules, sizeof(joules));
+      return joules < 0 ? -1 : 0;
+    case RAPLCAP_BROKER_OP_GET_ENERGY_COUNTER_MAX:
+      joules = raplcap_pd_get_energy_counter_max(rc, op->pkg, op->die, zone);
+      memcpy(out, &joules, sizeof(joules));
+      return joules < 0 ? -1 : 0;
+    case RAPLCAP_BROKER_OP_SNAPSHOT_ZONE:
+      ret = exec_snapshot_zone(rc, op, &bz);
+      memcpy(out, &bz, sizeof(bz));
+      return ret;
+    case RAPLCAP_BROKER_OP_REQUEST_LIMITS:
+      if (!can_write) {
+        errno = EPERM;
+        return -1;
+      }
+      memcpy(&lease, in, sizeof(lease));
+      limits_from_wire(&lease.limits, &ll, &ls);
+      return raplcapd_arbiter_request(ctx->arb, client->id, op->pkg, op->die, zone, lease.priority, lease.ttl_sec,
+                                      (op->flags & RAPLCAP_BROKER_FLAG_LONG) ? &ll : NULL,
+                                      (op->flags & RAPLCAP_BROKER_FLAG_SHORT) ? &ls : NULL);
+    case RAPLCAP_BROKER_OP_RELEASE_LIMITS:
+      return raplcapd_arbiter_release(ctx->arb, client->id, op->pkg, op->die, zone);
+    default:
+      raplcap_log(WARN, "exec_op: Unknown operation: %u\n", op->code);
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+// Returns the response length, or 0 if the request is malformed
+static size_t handle_request(raplcapd_ctx* ctx, const raplcapd_client* client, size_t req_len) {
+  raplcap_broker_header hdr;
+  raplcap_broker_op op;
+  raplcap_broker_result res;
+  const unsigned char* req = (const unsigned char*) ctx->req;
+  unsigned char* resp = (unsigned char*) ctx->resp;
+  size_t req_off = sizeof(hdr);
+  size_t resp_off = sizeof(hdr);
+  size_t in_len;
+  size_t out_len;
+  uint16_t i;
+  if (req_len < sizeof(hdr)) {
+    raplcap_log(WARN, "handle_request: Message too short: %zu\n", req_len);
+    return 0;
+  }
+  memcpy(&hdr, req, sizeof(hdr));
+  if (hdr.magic != RAPLCAP_BROKER_MAGIC || hdr.version != RAPLCAP_BROKER_VERSION ||
+      hdr.n_ops > RAPLCAP_BROKER_MAX_OPS) {
+    raplcap_log(WARN, "handle_request: Bad header: magic=0x%08"PRIx32", version=%"PRIu16", n_ops=%"PRIu16"\n",
+                hdr.magic, hdr.version, hdr.n_ops);
+    return 0;
+  }
+  for (i = 0; i < hdr.n_ops; i++) {
+    if (req_off + sizeof(op) > req_len) {
+      raplcap_log(WARN, "handle_request: Message truncated at op %"PRIu16"\n", i);
+      return 0;
+    }
+    memcpy(&op, req + req_off, sizeof(op));
+    req_off += sizeof(op);
+    in_len = raplcap_broker_op_payload_size(op.code);
+    out_len = raplcap_broker_result_payload_size(op.code);
+    if (req_off + in_len > req_len) {
+      raplcap_log(WARN, "handle_request: Message truncated at op %"PRIu16"\n", i);
+      return 0;
+    }
+    errno = 0;
+    res.ret = exec_op(ctx, client, &op, req + req_off, resp + resp_off + sizeof(res));
+    res.err = res.ret < 0 ? (errno ? errno : EIO) : 0;
+    memcpy(resp + resp_off, &res, sizeof(res));
+    req_off += in_len;
+    resp_off += sizeof(res) + out_len;
+  }
+  memcpy(resp, &hdr, sizeof(hdr));
+  return resp_off;
+}
+
+static void client_close(raplcapd_ctx* ctx, uint32_t idx) {
+  raplcap_log(DEBUG, "client_close: fd=%d, id=%"PRIu64"\n", ctx->clients[idx].fd, ctx->clients[idx].id);
+  close(ctx->clients[idx].fd);
+  // a client's leases end with its connection
+  raplcapd_arbiter_release_owner(ctx->arb, ctx->clients[idx].id);
+  // keep the array dense
+  ctx->n_clients--;
+  ctx->clients[idx] = ctx->clients[ctx->n_clients];
+}
+
+// Returns 0 to keep the client connected, -1 to disconnect it
+static int client_serve(raplcapd_ctx* ctx, const raplcapd_client* client) {
+  ssize_t req_len;
+  size_t resp_len;
+  // MSG_TRUNC returns the real message length, so oversized messages are detected
+  if ((req_len = recv(client->fd, ctx->req, sizeof(ctx->req), MSG_TRUNC)) <= 0) {
+    if (req_len < 0 && (errno == EINTR || errno == EAGAIN)) {
+      return 0;
+    }
+    return -1;
+  }
+  if ((size_t) req_len > sizeof(ctx->req)) {
+    raplcap_log(WARN, "client_serve: Message too long: %zd\n", req_len);
+    return -1;
+  }
+  if ((resp_len = handle_request(ctx, client, (size_t) req_len)) == 0) {
+    return -1;
+  }
+  // never block the loop on a client that isn't reading its responses - it stalls every other client and lease expiry
+  if (send(client->fd, ctx->resp, resp_len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      raplcap_log(WARN, "client_serve: Client isn't reading responses, disconnecting: id=%"PRIu64"\n", client->id);
+    } else {
+      raplcap_perror(WARN, "client_serve: send");
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static void client_accept(raplcapd_ctx* ctx) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  raplcapd_client* client;
+  int fd;
+  if ((fd = accept4(ctx->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) < 0) {
+    raplcap_perror(WARN, "client_accept: accept4");
+    return;
+  }
+  if (ctx->n_clients == RAPLCAPD_MAX_CLIENTS) {
+    raplcap_log(WARN, "client_accept: Too many clients, rejecting connection\n");
+    close(fd);
+    return;
+  }
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+    raplcap_perror(WARN, "client_accept: getsockopt(SO_PEERCRED)");
+    close(fd);
+    return;
+  }
+  client = &ctx->clients[ctx->n_clients++];
+  client->fd = fd;
+  client->id = ctx->next_client_id++;
+  client->can_write = ctx->allow_all_writes || cred.uid == 0 || cred.uid == geteuid();
+  raplcap_log(DEBUG, "client_accept: fd=%d, id=%"PRIu64", pid=%ld, uid=%ld, can_write=%d\n",
+              fd, client->id, (long) cred.pid, (long) cred.uid, client->can_write);
+}
+
+static int listen_open(raplcapd_ctx* ctx) {
+  struct sockaddr_un addr;
+  mode_t mask;
+  int ret;
+  if (strlen(ctx->socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", ctx->socket_path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, ctx->socket_path);
+  if ((ctx->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+    perror("socket");
+    return -1;
+  }
+  // remove a stale socket left by a daemon that didn't exit cleanly
+  if (unlink(ctx->socket_path) && errno != ENOENT) {
+    perror(ctx->socket_path);
+    close(ctx->listen_fd);
+    return -1;
+  }
+  // create the socket file with its final permissions, so there's no window where it has the umask's instead
+  mask = umask(~ctx->socket_mode & 0777);
+  ret = bind(ctx->listen_fd, (const struct sockaddr*) &addr, sizeof(addr));
+  umask(mask);
+  if (ret) {
+    perror("bind");
+    close(ctx->listen_fd);
+    return -1;
+  }
+  if (listen(ctx->listen_fd, SOMAXCONN)) {
+    perror("listen");
+    close(ctx->listen_fd);
+    unlink(ctx->socket_path);
+    return -1;
+  }
+  return 0;
+}
+
+static int serve(raplcapd_ctx* ctx) {
+  uint64_t next_publish_ns = 0;
+  uint64_t next_expire_ns;
+  uint64_t interval_ns = (uint64_t) (ctx->shm_interval_sec * 1000000000.0);
+  uint64_t deadline;
+  uint64_t now;
+  uint32_t i;
+  int timeout_ms;
+  int n;
+  if (ctx->pub != NULL) {
+    next_publish_ns = raplcap_clock_ns(CLOCK_MONOTONIC) + interval_ns;
+  }
+  while (running) {
+    now = raplcap_clock_ns(CLOCK_MONOTONIC);
+    next_expire_ns = raplcapd_arbiter_expire(ctx->arb, now);
+    if (ctx->pub != NULL && now >= next_publish_ns) {
+      if (raplcap_shm_publish(ctx->pub)) {
+        raplcap_perror(WARN, "serve: raplcap_shm_publish");
+      }
+      // skip missed intervals rather than publishing in a burst
+      do {
+        next_publish_ns += interval_ns;
+      } while (next_publish_ns <= now);
+    }
+    // 0 means there's nothing to wait for
+    deadline = next_publish_ns;
+    if (next_expire_ns > 0 && (deadline == 0 || next_expire_ns < deadline)) {
+      deadline = next_expire_ns;
+    }
+    // don't wait for unrelated activity to retry failed writes
+    if (raplcapd_arbiter_has_pending(ctx->arb) && (deadline == 0 || deadline - now > RAPLCAPD_RETRY_NS)) {
+      deadline = now + RAPLCAPD_RETRY_NS;
+    }
+    // round up so we don't wake early and spin
+    timeout_ms = deadline == 0 ? -1 : (int) ((deadline - now + 999999) / 1000000);
+    ctx->pfds[0].fd = ctx->listen_fd;
+    ctx->pfds[0].events = POLLIN;
+    for (i = 0; i < ctx->n_clients; i++) {
+      ctx->pfds[i + 1].fd = ctx->clients[i].fd;
+      ctx->pfds[i + 1].events = POLLIN;
+    }
+    if ((n = poll(ctx->pfds, ctx->n_clients + 1, timeout_ms)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      return -1;
+    }
+    // serve clients first, in reverse so that closing a client doesn't move one we haven't checked yet
+    for (i = ctx->n_clients; i > 0; i--) {
+      if (ctx->pfds[i].revents && ((ctx->pfds[i].revents & (POLLERR | POLLNVAL)) ||
+                                   client_serve(ctx, &ctx->clients[i - 1]))) {
+        client_close(ctx, i - 1);
+      }
+    }
+    if (ctx->pfds[0].revents & POLLIN) {
+      client_accept(ctx);
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  raplcapd_ctx* ctx;
+  struct sigaction sa;
+  char* endptr;
+  int ret = EXIT_FAILURE;
+  int c;
+  prog = argv[0];
+  if ((ctx = calloc(1, sizeof(raplcapd_ctx))) == NULL) {
+    perror("calloc");
+    return EXIT_FAILURE;
+  }
+  ctx->socket_path = RAPLCAP_BROKER_SOCKET_DEFAULT;
+  ctx->socket_mode = 0660;
+  ctx->shm_interval_sec = 0.1;
+  ctx->policy = RAPLCAPD_POLICY_MIN;
+  while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    switch (c) {
+      case 'h':
+        free(ctx);
+        print_usage(0);
+        break;
+      case 's':
+        ctx->socket_path = optarg;
+        break;
+      case 'm':
+        ctx->socket_mode = (mode_t) strtoul(optarg, &endptr, 8);
+        if (*endptr != '\0' || ctx->socket_mode > 0777) {
+          fprintf(stderr, "Invalid mode: %s\n", optarg);
+          free(ctx);
+          print_usage(1);
+        }
+        break;
+      case 'w':
+        ctx->allow_all_writes = 1;
+        break;
+      case 'P':
+        if (!strcmp(optarg, "MIN") || !strcmp(optarg, "min")) {
+          ctx->policy = RAPLCAPD_POLICY_MIN;
+        } else if (!strcmp(optarg, "PRIORITY") || !strcmp(optarg, "priority")) {
+          ctx->policy = RAPLCAPD_POLICY_PRIORITY;
+        } else {
+          fprintf(stderr, "Invalid policy: %s\n", optarg);
+          free(ctx);
+          print_usage(1);
+        }
+        break;
+      case 'S':
+        ctx->shm_name = optarg;
+        break;
+      case 'i':
+        ctx->shm_interval_sec = strtod(optarg, &endptr);
+        if (*endptr != '\0' || !(ctx->shm_interval_sec > 0)) {
+          fprintf(stderr, "Invalid interval: %s\n", optarg);
+          free(ctx);
+          print_usage(1);
+        }
+        break;
+      case '?':
+      default:
+        free(ctx);
+        print_usage(1);
+        break;
+    }
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // topology is discovered once, here, instead of by every client
+  if (raplcap_init(&ctx->rc)) {
+    perror("raplcap_init");
+    free(ctx);
+    return EXIT_FAILURE;
+  }
+  // publishing is driven from the main loop, so the context is only ever accessed by one thread
+  if ((ctx->arb = raplcapd_arbiter_init(&ctx->rc, ctx->policy, RAPLCAPD_MAX_LEASES)) == NULL) {
+    perror("raplcapd_arbiter_init");
+  } else if (ctx->shm_name != NULL &&
+             (ctx->pub = raplcap_shm_publisher_init(&ctx->rc, ctx->shm_name, 0)) == NULL) {
+    perror("raplcap_shm_publisher_init");
+  } else if (listen_open(ctx) == 0) {
+    raplcap_log(INFO, "main: Listening on %s\n", ctx->socket_path);
+    ret = serve(ctx) ? EXIT_FAILURE : EXIT_SUCCESS;
+    while (ctx->n_clients > 0) {
+      client_close(ctx, ctx->n_clients - 1);
+    }
+    close(ctx->listen_fd);
+    unlink(ctx->socket_path);
+  }
+
+  if (ctx->pub != NULL && raplcap_shm_publisher_destroy(ctx->pub)) {
+    perror("raplcap_shm_publisher_destroy");
+  }
+  // restores limits of zones that still have leases
+  raplcapd_arbiter_destroy(ctx->arb);
+  if (raplcap_destroy(&ctx->rc)) {
+    perror("raplcap_destroy");
+  }
+  free(ctx);
+  return ret;
+}
@@ -0,0 +1,122 @@
+/**
+ * Tests limit arbitration with two clients of a running daemon.
+ * The daemon's policy must be given as the first argument: MIN or PRIORITY.
+ */
+/* force assertions */
+#undef NDEBUG
+// for nanosleep
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "raplcap.h"
+#include "raplcap-broker.h"
+
+#define ZONE RAPLCAP_ZONE_PACKAGE
+
+static double get_watts(raplcap* rc) {
+  raplcap_limit ll;
+  assert(raplcap_pd_get_limits(rc, 0, 0, ZONE, &ll, NULL) == 0);
+  return ll.watts;
+}
+
+static int equal_dbl(double a, double b) {
+  return (a > b ? a - b : b - a) < DBL_EPSILON;
+}
+
+static void sleep_ms(long ms) {
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+  nanosleep(&ts, NULL);
+}
+
+// the daemon handles requests and disconnects asynchronously, so changes caused by other events need some time
+static int wait_for_watts(raplcap* rc, double watts) {
+  int i;
+  for (i = 0; i < 200; i++) {
+    if (equal_dbl(get_watts(rc), watts)) {
+      return 1;
+    }
+    sleep_ms(10);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  raplcap rc1;
+  raplcap rc2;
+  raplcap_limit baseline;
+  raplcap_limit l;
+  int priority;
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <MIN|PRIORITY>\n", argv[0]);
+    return 1;
+  }
+  priority = !strcmp(argv[1], "PRIORITY");
+  // each context is its own connection, so they own separate leases
+  assert(raplcap_init(&rc1) == 0);
+  assert(raplcap_init(&rc2) == 0);
+  assert(raplcap_pd_get_limits(&rc1, 0, 0, ZONE, &baseline, NULL) == 0);
+  memset(&l, 0, sizeof(l));
+
+  printf("Testing lease arbitration\n");
+  l.watts = 50;
+  assert(raplcap_broker_pd_request_limits(&rc1, 0, 0, ZONE, 1, 0, &l, NULL) == 0);
+  assert(equal_dbl(get_watts(&rc1), 50));
+  l.watts = 40;
+  assert(raplcap_broker_pd_request_limits(&rc2, 0, 0, ZONE, 0, 0, &l, NULL) == 0);
+  assert(equal_dbl(get_watts(&rc1), priority ? 50 : 40));
+  assert(raplcap_broker_pd_release_limits(&rc2, 0, 0, ZONE) == 0);
+  assert(equal_dbl(get_watts(&rc1), 50));
+  // renewing replaces the lease
+  l.watts = 45;
+  assert(raplcap_broker_pd_request_limits(&rc1, 0, 0, ZONE, 1, 0, &l, NULL) == 0);
+  assert(equal_dbl(get_watts(&rc1), 45));
+
+  printf("Testing lease expiration\n");
+  l.watts = 60;
+  assert(raplcap_broker_pd_request_limits(&rc2, 0, 0, ZONE, 2, 0.2, &l, NULL) == 0);
+  assert(equal_dbl(get_watts(&rc1), priority ? 60 : 45));
+  assert(raplcap_broker_pd_release_limits(&rc1, 0, 0, ZONE) == 0);
+  assert(equal_dbl(get_watts(&rc1), 60));
+  assert(wait_for_watts(&rc1, baseline.watts));
+  errno = 0;
+  assert(raplcap_broker_pd_release_limits(&rc2, 0, 0, ZONE) < 0);
+  assert(errno == ENOENT);
+
+  printf("Testing setting limits while leased\n");
+  l.watts = 45;
+  assert(raplcap_broker_pd_request_limits(&rc1, 0, 0, ZONE, 0, 0, &l, NULL) == 0);
+  l.watts = 70;
+  assert(raplcap_pd_set_limits(&rc2, 0, 0, ZONE, &l, NULL) == 0);
+  assert(equal_dbl(get_watts(&rc1), 45));
+  assert(raplcap_broker_pd_release_limits(&rc1, 0, 0, ZONE) == 0);
+  assert(equal_dbl(get_watts(&rc1), 70));
+  assert(raplcap_pd_set_limits(&rc1, 0, 0, ZONE, &baseline, NULL) == 0);
+  assert(equal_dbl(get_watts(&rc1), baseline.watts));
+
+  printf("Testing disconnecting with a lease\n");
+  l.watts = 35;
+  assert(raplcap_broker_pd_request_limits(&rc2, 0, 0, ZONE, 0, 0, &l, NULL) == 0);
+  assert(equal_dbl(get_watts(&rc1), 35));
+  assert(raplcap_destroy(&rc2) == 0);
+  assert(wait_for_watts(&rc1, baseline.watts));
+
+  printf("Testing bad parameters\n");
+  errno = 0;
+  assert(raplcap_broker_pd_request_limits(&rc1, 0, 0, ZONE, 0, 0, NULL, NULL) < 0);
+  assert(errno == EINVAL);
+  l.watts = 0;
+  errno = 0;
+  assert(raplcap_broker_pd_request_limits(&rc1, 0, 0, ZONE, 0, 0, &l, NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_broker_pd_request_limits(&rc1, raplcap_get_num_packages(&rc1), 0, ZONE, 0, 0, &l, NULL) < 0);
+  assert(errno == EINVAL);
+
+  assert(raplcap_destroy(&rc1) == 0);
+  printf("Tests successful\n");
+  return 0;
+}
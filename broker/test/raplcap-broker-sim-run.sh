@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Run a command as a raplcap-broker client of a private raplcapd instance.
+# The daemon listens on a socket in a temporary directory and is stopped when the command exits.
+# The environment is passed to both, e.g., so the daemon can use a simulated backend.
+# Additional daemon options may be set in RAPLCAPD_OPTS.
+#
+# Usage: raplcap-broker-sim-run.sh <raplcapd> <command> [args...]
+#
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <raplcapd> <command> [args...]" >&2
+  exit 1
+fi
+
+DAEMON=$1
+shift
+
+SOCK_DIR=$(mktemp -d) || exit 1
+SOCK="$SOCK_DIR/raplcapd.sock"
+
+# shellcheck disable=SC2086
+"$DAEMON" -s "$SOCK" $RAPLCAPD_OPTS &
+PID=$!
+
+# wait up to 5 seconds for the daemon to start listening
+i=0
+while [ ! -S "$SOCK" ]; do
+  if [ $i -ge 50 ] || ! kill -0 $PID 2>/dev/null; then
+    echo "$0: raplcapd failed to start" >&2
+    kill $PID 2>/dev/null
+    rm -rf "$SOCK_DIR"
+    exit 1
+  fi
+  sleep 0.1
+  i=$((i + 1))
+done
+
+RAPLCAP_BROKER_SOCKET="$SOCK" "$@"
+RET=$?
+
+kill $PID
+wait $PID || RET=1
+rm -rf "$SOCK_DIR"
+exit $RET
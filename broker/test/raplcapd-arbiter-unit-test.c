@@ -0,0 +1,140 @@
+/**
+ * Tests the arbiter's handling of failed writes against a stub RAPLCap implementation.
+ */
+/* force assertions */
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include "raplcap.h"
+#include "raplcapd-arbiter.h"
+
+#define ZONE RAPLCAP_ZONE_PACKAGE
+#define BASELINE_LONG 100
+#define BASELINE_SHORT 120
+
+static raplcap_limit hw_long = { 1, BASELINE_LONG };
+static raplcap_limit hw_short = { 0.01, BASELINE_SHORT };
+static int fail_writes;
+
+uint32_t raplcap_get_num_packages(const raplcap* rc) {
+  (void) rc;
+  return 1;
+}
+
+uint32_t raplcap_get_num_die(const raplcap* rc, uint32_t pkg) {
+  (void) rc;
+  (void) pkg;
+  return 1;
+}
+
+int raplcap_pd_get_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                          raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  (void) rc;
+  (void) pkg;
+  (void) die;
+  (void) zone;
+  if (limit_long != NULL) {
+    *limit_long = hw_long;
+  }
+  if (limit_short != NULL) {
+    *limit_short = hw_short;
+  }
+  return 0;
+}
+
+int raplcap_pd_set_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                          const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  (void) rc;
+  (void) pkg;
+  (void) die;
+  (void) zone;
+  if (fail_writes) {
+    errno = EIO;
+    return -1;
+  }
+  if (limit_long != NULL) {
+    hw_long = *limit_long;
+  }
+  if (limit_short != NULL) {
+    hw_short = *limit_short;
+  }
+  return 0;
+}
+
+int raplcap_pd_quantize_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  (void) rc;
+  (void) pkg;
+  (void) die;
+  (void) zone;
+  (void) limit_long;
+  (void) limit_short;
+  return 0;
+}
+
+static int equal_dbl(double a, double b) {
+  return (a > b ? a - b : b - a) < DBL_EPSILON;
+}
+
+int main(void) {
+  raplcap rc;
+  raplcapd_arbiter* arb;
+  raplcap_limit l = { 0, 50 };
+  raplcap_limit ls = { 0, 80 };
+  memset(&rc, 0, sizeof(rc));
+  assert((arb = raplcapd_arbiter_init(&rc, RAPLCAPD_POLICY_MIN, 4)) != NULL);
+
+  printf("Testing failed requests\n");
+  assert(raplcapd_arbiter_has_pending(arb) == 0);
+  assert(raplcapd_arbiter_request(arb, 1, 0, 0, ZONE, 0, 0, &l, NULL) == 0);
+  assert(equal_dbl(hw_long.watts, 50));
+  fail_writes = 1;
+  l.watts = 40;
+  errno = 0;
+  assert(raplcapd_arbiter_request(arb, 2, 0, 0, ZONE, 0, 0, &l, NULL) < 0);
+  assert(errno == EIO);
+  errno = 0;
+  assert(raplcapd_arbiter_release(arb, 2, 0, 0, ZONE) < 0);
+  assert(errno == ENOENT);
+
+  printf("Testing failed baseline changes\n");
+  // the lease doesn't cover the short term constraint, so the new baseline must be written
+  errno = 0;
+  assert(raplcapd_arbiter_set_baseline(arb, 0, 0, ZONE, NULL, &ls) < 0);
+  assert(errno == EIO);
+  assert(equal_dbl(hw_short.watts, BASELINE_SHORT));
+
+  printf("Testing retrying failed writes\n");
+  // the lease is released even though the limits can't be reverted yet
+  assert(raplcapd_arbiter_release(arb, 1, 0, 0, ZONE) == 0);
+  assert(raplcapd_arbiter_has_pending(arb));
+  errno = 0;
+  assert(raplcapd_arbiter_release(arb, 1, 0, 0, ZONE) < 0);
+  assert(errno == ENOENT);
+  raplcapd_arbiter_expire(arb, 0);
+  assert(equal_dbl(hw_long.watts, 50));
+  assert(raplcapd_arbiter_has_pending(arb));
+  // the zone hasn't reverted yet, so a new lease must not capture its current limits as the baseline
+  fail_writes = 0;
+  l.watts = 60;
+  assert(raplcapd_arbiter_request(arb, 2, 0, 0, ZONE, 0, 0, &l, NULL) == 0);
+  assert(equal_dbl(hw_long.watts, 60));
+  assert(raplcapd_arbiter_has_pending(arb) == 0);
+  fail_writes = 1;
+  assert(raplcapd_arbiter_release(arb, 2, 0, 0, ZONE) == 0);
+  assert(equal_dbl(hw_long.watts, 60));
+  assert(raplcapd_arbiter_has_pending(arb));
+  fail_writes = 0;
+  raplcapd_arbiter_expire(arb, 0);
+  assert(equal_dbl(hw_long.watts, BASELINE_LONG));
+  assert(raplcapd_arbiter_has_pending(arb) == 0);
+  // the failed baseline change wasn't kept
+  assert(equal_dbl(hw_short.watts, BASELINE_SHORT));
+
+  raplcapd_arbiter_destroy(arb);
+  printf("Tests successful\n");
+  return 0;
+}
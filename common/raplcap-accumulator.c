@@ -0,0 +1,265 @@
+/**
+ * Energy accumulators built on the raplcap interface.
+ *
+ * @author Connor Imes
+ * @date 2020-09-21
+ */
+// for pthread_condattr_setclock, clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "raplcap.h"
+#include "raplcap-accumulator.h"
+#include "raplcap-common.h"
+
+typedef struct raplcap_accumulator_zone {
+  const raplcap_zone_handle* zh;
+  double joules_max;
+  double joules_start;
+  double joules_last;
+  uint64_t n_rollovers;
+  int supported;
+} raplcap_accumulator_zone;
+
+struct raplcap_accumulator {
+  raplcap_accumulator_zone* zones;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  pthread_mutex_t lock;
+  // background refresh
+  pthread_t thread;
+  pthread_cond_t cond;
+  pthread_condattr_t cond_attr;
+  double refresh_sec;
+  int running;
+};
+
+static raplcap_accumulator_zone* get_zone(raplcap_accumulator* acc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  if (pkg >= acc->n_pkg || die >= acc->n_die || (int) zone < 0 || (int) zone >= RAPLCAP_NZONES) {
+    raplcap_log(ERROR, "get_zone: Invalid zone: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+    errno = EINVAL;
+    return NULL;
+  }
+  return &acc->zones[(((pkg * acc->n_die) + die) * RAPLCAP_NZONES) + zone];
+}
+
+// Must hold the lock
+static int update_zone(raplcap_accumulator_zone* z, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  const double joules = raplcap_zone_handle_get_energy_counter(z->zh);
+  if (joules < 0) {
+    return -1;
+  }
+  if (joules < z->joules_last) {
+    z->n_rollovers++;
+    raplcap_log(DEBUG, "update_zone: pkg=%"PRIu32", die=%"PRIu32", zone=%d, rollovers=%"PRIu64"\n",
+                pkg, die, zone, z->n_rollovers);
+  }
+  z->joules_last = joules;
+  return 0;
+}
+
+// Must hold the lock
+static int update_all(raplcap_accumulator* acc) {
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  int ret = 0;
+  for (pkg = 0; pkg < acc->n_pkg; pkg++) {
+    for (die = 0; die < acc->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        raplcap_accumulator_zone* z = get_zone(acc, pkg, die, (raplcap_zone) zone);
+        if (z->supported && update_zone(z, pkg, die, (raplcap_zone) zone)) {
+          ret = -1;
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+static void* refresh_thread(void* arg) {
+  raplcap_accumulator* acc = (raplcap_accumulator*) arg;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // schedule on absolute deadlines so that the refresh rate doesn't drift
+  raplcap_timespec_add_sec(&ts, acc->refresh_sec);
+  pthread_mutex_lock(&acc->lock);
+  while (acc->running) {
+    if (pthread_cond_timedwait(&acc->cond, &acc->lock, &ts) == ETIMEDOUT && acc->running) {
+      if (update_all(acc)) {
+        raplcap_perror(WARN, "refresh_thread: update_all");
+      }
+      raplcap_timespec_add_sec(&ts, acc->refresh_sec);
+    }
+  }
+  pthread_mutex_unlock(&acc->lock);
+  return NULL;
+}
+
+static int start_refresh_thread(raplcap_accumulator* acc) {
+  int err;
+  // the condition variable must use the same clock as the refresh deadlines
+  if ((err = pthread_condattr_init(&acc->cond_attr)) != 0) {
+    errno = err;
+    return -1;
+  }
+  if ((err = pthread_condattr_setclock(&acc->cond_attr, CLOCK_MONOTONIC)) == 0) {
+    err = pthread_cond_init(&acc->cond, &acc->cond_attr);
+  }
+  pthread_condattr_destroy(&acc->cond_attr);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  acc->running = 1;
+  if ((err = pthread_create(&acc->thread, NULL, refresh_thread, acc)) != 0) {
+    acc->running = 0;
+    pthread_cond_destroy(&acc->cond);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+raplcap_accumulator* raplcap_accumulator_init(const raplcap* rc, double refresh_sec) {
+  raplcap_accumulator* acc;
+  raplcap_accumulator_zone* z;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  int err;
+  if (refresh_sec < 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((acc = calloc(1, sizeof(*acc))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_accumulator_init: calloc");
+    return NULL;
+  }
+  acc->refresh_sec = refresh_sec;
+  if ((acc->n_pkg = raplcap_get_num_packages(rc)) == 0 || (acc->n_die = raplcap_get_num_die(rc, 0)) == 0) {
+    free(acc);
+    return NULL;
+  }
+  if ((acc->zones = calloc(acc->n_pkg * acc->n_die * RAPLCAP_NZONES, sizeof(*acc->zones))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_accumulator_init: calloc");
+    free(acc);
+    return NULL;
+  }
+  for (pkg = 0; pkg < acc->n_pkg; pkg++) {
+    for (die = 0; die < acc->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        z = get_zone(acc, pkg, die, (raplcap_zone) zone);
+        if ((err = raplcap_pd_is_zone_supported(rc, pkg, die, (raplcap_zone) zone)) < 0) {
+          err = errno;
+          free(acc->zones);
+          free(acc);
+          errno = err;
+          return NULL;
+        }
+        if (err == 0 ||
+            (z->zh = raplcap_pd_get_zone_handle(rc, pkg, die, (raplcap_zone) zone)) == NULL ||
+            (z->joules_max = raplcap_zone_handle_get_energy_counter_max(z->zh)) <= 0 ||
+            (z->joules_last = raplcap_zone_handle_get_energy_counter(z->zh)) < 0) {
+          raplcap_log(DEBUG, "raplcap_accumulator_init: Skipping pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+                      pkg, die, zone);
+          continue;
+        }
+        // rollovers are only detected if there's at most one per refresh period
+        if (refresh_sec >= z->joules_max / RAPLCAP_MAX_WATTS) {
+          raplcap_log(ERROR, "raplcap_accumulator_init: refresh_sec must be < %f to detect rollovers of "
+                      "pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", z->joules_max / RAPLCAP_MAX_WATTS, pkg, die, zone);
+          free(acc->zones);
+          free(acc);
+          errno = EINVAL;
+          return NULL;
+        }
+        z->joules_start = z->joules_last;
+        z->supported = 1;
+      }
+    }
+  }
+  if ((err = pthread_mutex_init(&acc->lock, NULL)) != 0) {
+    free(acc->zones);
+    free(acc);
+    errno = err;
+    return NULL;
+  }
+  if (refresh_sec > 0 && start_refresh_thread(acc)) {
+    raplcap_perror(ERROR, "raplcap_accumulator_init: start_refresh_thread");
+    err = errno;
+    pthread_mutex_destroy(&acc->lock);
+    free(acc->zones);
+    free(acc);
+    errno = err;
+    return NULL;
+  }
+  raplcap_log(DEBUG, "raplcap_accumulator_init: Initialized, refresh_sec=%f\n", refresh_sec);
+  return acc;
+}
+
+int raplcap_accumulator_destroy(raplcap_accumulator* acc) {
+  int err = 0;
+  if (acc == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (acc->running) {
+    pthread_mutex_lock(&acc->lock);
+    acc->running = 0;
+    pthread_cond_signal(&acc->cond);
+    pthread_mutex_unlock(&acc->lock);
+    if ((err = pthread_join(acc->thread, NULL)) != 0) {
+      raplcap_log(ERROR, "raplcap_accumulator_destroy: pthread_join: %s\n", strerror(err));
+    }
+    pthread_cond_destroy(&acc->cond);
+  }
+  pthread_mutex_destroy(&acc->lock);
+  free(acc->zones);
+  free(acc);
+  raplcap_log(DEBUG, "raplcap_accumulator_destroy: Destroyed\n");
+  errno = err;
+  return err ? -1 : 0;
+}
+
+int raplcap_accumulator_update(raplcap_accumulator* acc) {
+  int ret;
+  if (acc == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&acc->lock);
+  ret = update_all(acc);
+  pthread_mutex_unlock(&acc->lock);
+  return ret;
+}
+
+double raplcap_pd_get_energy_total(raplcap_accumulator* acc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_accumulator_zone* z;
+  double joules = -1;
+  if (acc == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((z = get_zone(acc, pkg, die, zone)) == NULL) {
+    return -1;
+  }
+  if (!z->supported) {
+    raplcap_log(ERROR, "raplcap_pd_get_energy_total: Zone not supported: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+                pkg, die, zone);
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&acc->lock);
+  if (!update_zone(z, pkg, die, zone)) {
+    joules = (z->n_rollovers * z->joules_max) + z->joules_last - z->joules_start;
+  }
+  pthread_mutex_unlock(&acc->lock);
+  raplcap_log(DEBUG, "raplcap_pd_get_energy_total: pkg=%"PRIu32", die=%"PRIu32", zone=%d, joules=%.12f\n",
+              pkg, die, zone, joules);
+  return joules;
+}
@@ -0,0 +1,77 @@
+/**
+ * Energy counter reads aligned to hardware counter updates, built on the raplcap interface.
+ *
+ * @author Connor Imes
+ * @date 2020-10-14
+ */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include "raplcap.h"
+#include "raplcap-aligned.h"
+#include "raplcap-common.h"
+
+int raplcap_aligned_read(const raplcap_zone_handle* zh, double timeout_sec, raplcap_aligned_sample* sample) {
+  uint64_t deadline;
+  uint64_t ns_before;
+  uint64_t ns_after;
+  double joules_start;
+  double joules;
+  if (zh == NULL || sample == NULL || !(timeout_sec > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  // not subject to NTP frequency adjustments, which would skew short intervals
+  ns_before = raplcap_clock_ns(CLOCK_MONOTONIC_RAW);
+  deadline = ns_before + (uint64_t) (timeout_sec * 1000000000.0);
+  if ((joules_start = raplcap_zone_handle_get_energy_counter(zh)) < 0) {
+    return -1;
+  }
+  for (;;) {
+    // timestamp before each read, so the transition happened between the previous read and this one
+    ns_after = raplcap_clock_ns(CLOCK_MONOTONIC_RAW);
+    if ((joules = raplcap_zone_handle_get_energy_counter(zh)) < 0) {
+      return -1;
+    }
+    if (joules < joules_start || joules > joules_start) {
+      break;
+    }
+    if (ns_after > deadline) {
+      raplcap_log(DEBUG, "raplcap_aligned_read: Energy counter didn't change within %f sec\n", timeout_sec);
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    ns_before = ns_after;
+  }
+  sample->joules = joules;
+  sample->ns_error = (ns_after - ns_before) / 2;
+  sample->ns = ns_before + sample->ns_error;
+  raplcap_log(DEBUG, "raplcap_aligned_read: joules=%.12f, ns=%"PRIu64", ns_error=%"PRIu64"\n",
+              sample->joules, sample->ns, sample->ns_error);
+  return 0;
+}
+
+double raplcap_aligned_get_update_period(const raplcap_zone_handle* zh, uint32_t n_updates, double timeout_sec) {
+  raplcap_aligned_sample first;
+  raplcap_aligned_sample last;
+  uint32_t i;
+  double sec;
+  if (n_updates == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  // the first read is aligned to an update, so it only starts the timer
+  if (raplcap_aligned_read(zh, timeout_sec, &first)) {
+    return -1;
+  }
+  for (i = 0; i < n_updates; i++) {
+    if (raplcap_aligned_read(zh, timeout_sec, &last)) {
+      return -1;
+    }
+  }
+  sec = ((last.ns - first.ns) / 1000000000.0) / n_updates;
+  raplcap_log(DEBUG, "raplcap_aligned_get_update_period: n_updates=%"PRIu32", sec=%.9f\n", n_updates, sec);
+  return sec;
+}
@@ -0,0 +1,336 @@
+/**
+ * Asynchronous energy counter reads using io_uring system calls directly, without a dependency on liburing.
+ *
+ * @author Connor Imes
+ * @date 2020-10-05
+ */
+// for syscall
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "raplcap.h"
+#include "raplcap-async.h"
+#include "raplcap-async-common.h"
+#include "raplcap-common.h"
+
+#if defined(RAPLCAP_HAVE_IO_URING) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define RAPLCAP_ASYNC_SUPPORTED 1
+#include <linux/io_uring.h>
+#else
+#define RAPLCAP_ASYNC_SUPPORTED 0
+#endif
+
+#define SOURCE_BUF_SIZE (RAPLCAP_ASYNC_SOURCE_LEN_MAX + 1)
+
+struct raplcap_async {
+  const raplcap* rc;
+  raplcap_async_cb* cb;
+  void* arg;
+  raplcap_async_source* sources;
+  char* bufs;
+  uint32_t n_sources;
+  uint32_t n_outstanding;
+  int ring_fd;
+#if RAPLCAP_ASYNC_SUPPORTED
+  void* sq_ring;
+  size_t sq_ring_sz;
+  void* cq_ring;
+  size_t cq_ring_sz;
+  struct io_uring_sqe* sqes;
+  size_t sqes_sz;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+#endif
+};
+
+#if RAPLCAP_ASYNC_SUPPORTED
+
+static int ring_setup(unsigned entries, struct io_uring_params* p) {
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  int ret;
+  do {
+    ret = (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+static int ring_init(raplcap_async* ra, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  if ((ra->ring_fd = ring_setup(entries, &p)) < 0) {
+    raplcap_perror(ERROR, "ring_init: io_uring_setup");
+    return -1;
+  }
+  ra->sq_ring_sz = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+  ra->cq_ring_sz = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ra->cq_ring_sz > ra->sq_ring_sz) {
+      ra->sq_ring_sz = ra->cq_ring_sz;
+    }
+    ra->cq_ring_sz = ra->sq_ring_sz;
+  }
+  ra->sq_ring = mmap(NULL, ra->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ra->ring_fd, IORING_OFF_SQ_RING);
+  if (ra->sq_ring == MAP_FAILED) {
+    raplcap_perror(ERROR, "ring_init: mmap(sq_ring)");
+    ra->sq_ring = NULL;
+    return -1;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ra->cq_ring = ra->sq_ring;
+  } else {
+    ra->cq_ring = mmap(NULL, ra->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ra->ring_fd, IORING_OFF_CQ_RING);
+    if (ra->cq_ring == MAP_FAILED) {
+      raplcap_perror(ERROR, "ring_init: mmap(cq_ring)");
+      ra->cq_ring = NULL;
+      return -1;
+    }
+  }
+  ra->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+  ra->sqes = mmap(NULL, ra->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ra->ring_fd, IORING_OFF_SQES);
+  if (ra->sqes == MAP_FAILED) {
+    raplcap_perror(ERROR, "ring_init: mmap(sqes)");
+    ra->sqes = NULL;
+    return -1;
+  }
+  ra->sq_head = (unsigned*) ((char*) ra->sq_ring + p.sq_off.head);
+  ra->sq_tail = (unsigned*) ((char*) ra->sq_ring + p.sq_off.tail);
+  ra->sq_mask = (unsigned*) ((char*) ra->sq_ring + p.sq_off.ring_mask);
+  ra->sq_array = (unsigned*) ((char*) ra->sq_ring + p.sq_off.array);
+  ra->cq_head = (unsigned*) ((char*) ra->cq_ring + p.cq_off.head);
+  ra->cq_tail = (unsigned*) ((char*) ra->cq_ring + p.cq_off.tail);
+  ra->cq_mask = (unsigned*) ((char*) ra->cq_ring + p.cq_off.ring_mask);
+  ra->cqes = (struct io_uring_cqe*) ((char*) ra->cq_ring + p.cq_off.cqes);
+  return 0;
+}
+
+static void ring_destroy(raplcap_async* ra) {
+  if (ra->sqes != NULL) {
+    munmap(ra->sqes, ra->sqes_sz);
+  }
+  if (ra->cq_ring != NULL && ra->cq_ring != ra->sq_ring) {
+    munmap(ra->cq_ring, ra->cq_ring_sz);
+  }
+  if (ra->sq_ring != NULL) {
+    munmap(ra->sq_ring, ra->sq_ring_sz);
+  }
+  if (ra->ring_fd >= 0) {
+    close(ra->ring_fd);
+  }
+}
+
+static int ring_submit(raplcap_async* ra) {
+  struct io_uring_sqe* sqe;
+  unsigned tail = *ra->sq_tail;
+  unsigned idx;
+  uint32_t i;
+  int ret;
+  for (i = 0; i < ra->n_sources; i++, tail++) {
+    idx = tail & *ra->sq_mask;
+    sqe = &ra->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = ra->sources[i].fd;
+    sqe->addr = (uint64_t) (uintptr_t) &ra->bufs[i * SOURCE_BUF_SIZE];
+    sqe->len = (uint32_t) ra->sources[i].len;
+    sqe->off = (uint64_t) ra->sources[i].offset;
+    sqe->user_data = i;
+    ra->sq_array[idx] = idx;
+  }
+  // the kernel must see the SQEs before the new tail
+  __atomic_store_n(ra->sq_tail, tail, __ATOMIC_RELEASE);
+  // the kernel may consume fewer SQEs than requested, e.g., when short on resources, so submit the remainder
+  while (ra->n_outstanding < ra->n_sources) {
+    if ((ret = ring_enter(ra->ring_fd, ra->n_sources - ra->n_outstanding, 0, 0)) <= 0) {
+      if (ret == 0) {
+        errno = EAGAIN;
+      }
+      raplcap_perror(ERROR, "ring_submit: io_uring_enter");
+      raplcap_log(ERROR, "ring_submit: Only submitted %"PRIu32" of %"PRIu32" reads\n",
+                  ra->n_outstanding, ra->n_sources);
+      // without SQPOLL, the kernel only consumes SQEs in io_uring_enter, so the rest can be withdrawn
+      __atomic_store_n(ra->sq_tail, __atomic_load_n(ra->sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+      return -1;
+    }
+    ra->n_outstanding += (uint32_t) ret;
+  }
+  return 0;
+}
+
+// Process available completions, delivering them to the callback if requested
+static int ring_reap(raplcap_async* ra, int deliver) {
+  const struct io_uring_cqe* cqe;
+  const raplcap_async_source* src;
+  char* buf;
+  unsigned head = *ra->cq_head;
+  const unsigned tail = __atomic_load_n(ra->cq_tail, __ATOMIC_ACQUIRE);
+  double joules;
+  int n = 0;
+  for (; head != tail; head++, n++) {
+    cqe = &ra->cqes[head & *ra->cq_mask];
+    ra->n_outstanding--;
+    if (!deliver) {
+      continue;
+    }
+    src = &ra->sources[cqe->user_data];
+    if (cqe->res < 0) {
+      raplcap_log(DEBUG, "ring_reap: pkg=%"PRIu32", die=%"PRIu32", zone=%d: %s\n",
+                  src->pkg, src->die, src->zone, strerror(-cqe->res));
+      joules = -1;
+    } else {
+      buf = &ra->bufs[cqe->user_data * SOURCE_BUF_SIZE];
+      buf[cqe->res] = '\0';
+      joules = raplcap_async_impl_decode(ra->rc, src, buf, (size_t) cqe->res);
+    }
+    ra->cb(ra->arg, src->pkg, src->die, src->zone, joules);
+  }
+  // release the CQEs back to the kernel
+  __atomic_store_n(ra->cq_head, head, __ATOMIC_RELEASE);
+  return n;
+}
+
+#endif // RAPLCAP_ASYNC_SUPPORTED
+
+#if !RAPLCAP_ASYNC_SUPPORTED
+raplcap_async* raplcap_async_init(const raplcap* rc, raplcap_async_cb* cb, void* arg) {
+  (void) rc;
+  (void) cb;
+  (void) arg;
+  raplcap_log(ERROR, "raplcap_async_init: Not compiled with io_uring support\n");
+  errno = ENOSYS;
+  return NULL;
+}
+#else
+raplcap_async* raplcap_async_init(const raplcap* rc, raplcap_async_cb* cb, void* arg) {
+  raplcap_async* ra;
+  uint32_t n_max;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  int n;
+  int err_save;
+  if (cb == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((n_pkg = raplcap_get_num_packages(rc)) == 0 || (n_die = raplcap_get_num_die(rc, 0)) == 0) {
+    return NULL;
+  }
+  if ((ra = calloc(1, sizeof(*ra))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_async_init: calloc");
+    return NULL;
+  }
+  ra->ring_fd = -1;
+  n_max = n_pkg * n_die * RAPLCAP_NZONES;
+  if ((ra->sources = calloc(n_max, sizeof(*ra->sources))) == NULL ||
+      (ra->bufs = calloc(n_max, SOURCE_BUF_SIZE)) == NULL) {
+    err_save = errno;
+    raplcap_perror(ERROR, "raplcap_async_init: calloc");
+    raplcap_async_destroy(ra);
+    errno = err_save;
+    return NULL;
+  }
+  if ((n = raplcap_async_impl_get_sources(rc, ra->sources, n_max)) <= 0) {
+    if (n == 0) {
+      raplcap_log(ERROR, "raplcap_async_init: No supported energy counters\n");
+      errno = ENODEV;
+    }
+    err_save = errno;
+    raplcap_async_destroy(ra);
+    errno = err_save;
+    return NULL;
+  }
+  ra->n_sources = (uint32_t) n;
+  if (ring_init(ra, ra->n_sources)) {
+    err_save = errno;
+    raplcap_async_destroy(ra);
+    errno = err_save;
+    return NULL;
+  }
+  ra->rc = rc;
+  ra->cb = cb;
+  ra->arg = arg;
+  raplcap_log(DEBUG, "raplcap_async_init: sources=%"PRIu32"\n", ra->n_sources);
+  return ra;
+}
+#endif
+
+int raplcap_async_destroy(raplcap_async* ra) {
+  if (ra == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+#if RAPLCAP_ASYNC_SUPPORTED
+  // the kernel may still write to the buffers, so outstanding reads must finish before they're freed
+  while (ra->n_outstanding > 0 && ring_enter(ra->ring_fd, 0, ra->n_outstanding, IORING_ENTER_GETEVENTS) >= 0) {
+    ring_reap(ra, 0);
+  }
+  ring_destroy(ra);
+#endif
+  free(ra->bufs);
+  free(ra->sources);
+  free(ra);
+  return 0;
+}
+
+int raplcap_async_submit(raplcap_async* ra) {
+  if (ra == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (ra->n_outstanding > 0) {
+    raplcap_log(ERROR, "raplcap_async_submit: Reads from a previous submission are still outstanding\n");
+    errno = EBUSY;
+    return -1;
+  }
+#if RAPLCAP_ASYNC_SUPPORTED
+  return ring_submit(ra);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+int raplcap_async_get_fd(const raplcap_async* ra) {
+  if (ra == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  return ra->ring_fd;
+}
+
+int raplcap_async_complete(raplcap_async* ra, int wait) {
+  int n = 0;
+  if (ra == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+#if RAPLCAP_ASYNC_SUPPORTED
+  n = ring_reap(ra, 1);
+  while (wait && ra->n_outstanding > 0) {
+    if (ring_enter(ra->ring_fd, 0, ra->n_outstanding, IORING_ENTER_GETEVENTS) < 0) {
+      raplcap_perror(ERROR, "raplcap_async_complete: io_uring_enter");
+      return -1;
+    }
+    n += ring_reap(ra, 1);
+  }
+#else
+  (void) wait;
+#endif
+  return n;
+}
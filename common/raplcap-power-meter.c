@@ -0,0 +1,201 @@
+/**
+ * Average power meters built on the raplcap interface.
+ *
+ * @author Connor Imes
+ * @date 2020-10-14
+ */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "raplcap.h"
+#include "raplcap-power-meter.h"
+#include "raplcap-common.h"
+
+typedef struct power_meter_sample {
+  uint64_t ns;
+  // includes rollovers, so differences are always the energy consumed
+  double joules;
+} power_meter_sample;
+
+struct raplcap_power_meter {
+  const raplcap_zone_handle* zh;
+  double joules_max;
+  // the raw value of the last counter read
+  double joules_last;
+  double ewma_sec;
+  double ewma_watts;
+  // the first interval seeds the EWMA (can't use n, which stops growing when the ring is full)
+  int ewma_seeded;
+  pthread_mutex_t lock;
+  // index of the most recent sample
+  uint32_t head;
+  uint32_t n;
+  uint32_t n_samples;
+  power_meter_sample samples[];
+};
+
+static double get_watts(const power_meter_sample* older, const power_meter_sample* newer) {
+  // samples closer together than the clock resolution didn't take any measurable time
+  return newer->ns > older->ns ? (newer->joules - older->joules) / ((newer->ns - older->ns) / 1000000000.0) : 0;
+}
+
+// Must hold the lock
+static int add_sample(raplcap_power_meter* pm) {
+  const power_meter_sample* prev = &pm->samples[pm->head];
+  power_meter_sample* s;
+  double joules;
+  double delta;
+  double alpha;
+  uint64_t ns;
+  if ((joules = raplcap_zone_handle_get_energy_counter(pm->zh)) < 0) {
+    return -1;
+  }
+  ns = raplcap_clock_ns(CLOCK_MONOTONIC);
+  if (pm->n == 0) {
+    pm->samples[0].ns = ns;
+    pm->samples[0].joules = 0;
+    pm->joules_last = joules;
+    pm->n = 1;
+    return 0;
+  }
+  delta = joules - pm->joules_last;
+  if (delta < 0) {
+    // counter rolled over
+    delta += pm->joules_max;
+  }
+  pm->joules_last = joules;
+  pm->head = (pm->head + 1) % pm->n_samples;
+  s = &pm->samples[pm->head];
+  s->ns = ns;
+  s->joules = prev->joules + delta;
+  if (pm->n < pm->n_samples) {
+    pm->n++;
+  }
+  // weight by elapsed time so that irregular sampling intervals don't skew the average
+  if (!pm->ewma_seeded) {
+    pm->ewma_watts = get_watts(prev, s);
+    pm->ewma_seeded = 1;
+  } else {
+    alpha = 1.0 - exp(-((s->ns - prev->ns) / 1000000000.0) / pm->ewma_sec);
+    pm->ewma_watts += alpha * (get_watts(prev, s) - pm->ewma_watts);
+  }
+  return 0;
+}
+
+raplcap_power_meter* raplcap_power_meter_init(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                              uint32_t n_samples, double ewma_sec) {
+  raplcap_power_meter* pm;
+  const raplcap_zone_handle* zh;
+  int err;
+  if (n_samples < 2 || !(ewma_sec > 0)) {
+    raplcap_log(ERROR, "raplcap_power_meter_init: Must have n_samples >= 2 and ewma_sec > 0\n");
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((zh = raplcap_pd_get_zone_handle(rc, pkg, die, zone)) == NULL) {
+    return NULL;
+  }
+  if ((pm = calloc(1, sizeof(*pm) + n_samples * sizeof(power_meter_sample))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_power_meter_init: calloc");
+    return NULL;
+  }
+  pm->zh = zh;
+  pm->n_samples = n_samples;
+  pm->ewma_sec = ewma_sec;
+  if ((pm->joules_max = raplcap_zone_handle_get_energy_counter_max(zh)) <= 0 || add_sample(pm)) {
+    err = errno;
+    free(pm);
+    errno = err;
+    return NULL;
+  }
+  if ((err = pthread_mutex_init(&pm->lock, NULL)) != 0) {
+    free(pm);
+    errno = err;
+    return NULL;
+  }
+  raplcap_log(DEBUG, "raplcap_power_meter_init: pkg=%"PRIu32", die=%"PRIu32", zone=%d, n_samples=%"PRIu32
+              ", ewma_sec=%f\n", pkg, die, zone, n_samples, ewma_sec);
+  return pm;
+}
+
+int raplcap_power_meter_destroy(raplcap_power_meter* pm) {
+  if (pm == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_destroy(&pm->lock);
+  free(pm);
+  raplcap_log(DEBUG, "raplcap_power_meter_destroy: Destroyed\n");
+  return 0;
+}
+
+int raplcap_power_meter_sample(raplcap_power_meter* pm) {
+  int ret;
+  if (pm == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&pm->lock);
+  ret = add_sample(pm);
+  pthread_mutex_unlock(&pm->lock);
+  return ret;
+}
+
+// Must hold the lock
+static int has_interval(const raplcap_power_meter* pm, const char* fn) {
+  if (pm->n < 2) {
+    raplcap_log(DEBUG, "%s: Not enough samples\n", fn);
+    errno = ENODATA;
+    return 0;
+  }
+  return 1;
+}
+
+double raplcap_power_meter_get_instant(raplcap_power_meter* pm) {
+  double watts = -1;
+  if (pm == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&pm->lock);
+  if (has_interval(pm, "raplcap_power_meter_get_instant")) {
+    watts = get_watts(&pm->samples[(pm->head + pm->n_samples - 1) % pm->n_samples], &pm->samples[pm->head]);
+  }
+  pthread_mutex_unlock(&pm->lock);
+  return watts;
+}
+
+double raplcap_power_meter_get_window(raplcap_power_meter* pm) {
+  double watts = -1;
+  if (pm == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&pm->lock);
+  if (has_interval(pm, "raplcap_power_meter_get_window")) {
+    // the oldest sample is at index 0 until the ring fills, then it's the one after the head
+    watts = get_watts(&pm->samples[pm->n < pm->n_samples ? 0 : (pm->head + 1) % pm->n_samples],
+                      &pm->samples[pm->head]);
+  }
+  pthread_mutex_unlock(&pm->lock);
+  return watts;
+}
+
+double raplcap_power_meter_get_ewma(raplcap_power_meter* pm) {
+  double watts = -1;
+  if (pm == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&pm->lock);
+  if (has_interval(pm, "raplcap_power_meter_get_ewma")) {
+    watts = pm->ewma_watts;
+  }
+  pthread_mutex_unlock(&pm->lock);
+  return watts;
+}
@@ -0,0 +1,378 @@
+/**
+ * Named energy profiling regions built on energy accumulators.
+ *
+ * @author Connor Imes
+ * @date 2020-10-14
+ */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "raplcap.h"
+#include "raplcap-accumulator.h"
+#include "raplcap-region.h"
+#include "raplcap-common.h"
+
+// the zones that regions measure
+#define REGION_NZONES 2
+static const raplcap_zone REGION_ZONES[REGION_NZONES] = { RAPLCAP_ZONE_PACKAGE, RAPLCAP_ZONE_DRAM };
+
+typedef struct region_frame {
+  const char* name;
+  uint64_t ns;
+  double joules[REGION_NZONES];
+} region_frame;
+
+typedef struct region_stack {
+  region_frame frames[RAPLCAP_REGION_MAX_DEPTH];
+  uint32_t depth;
+  // regions begun past the max depth, which are not measured
+  uint32_t overflow;
+  int in_use;
+} region_stack;
+
+typedef struct region_entry {
+  char name[RAPLCAP_REGION_NAME_MAX];
+  raplcap_region_stats stats;
+  int used;
+} region_entry;
+
+typedef struct region_profiler {
+  raplcap_accumulator* acc;
+  // supported zones, as (pkg, die) pairs for each of REGION_ZONES
+  uint32_t* pkg_die[REGION_NZONES];
+  uint32_t n_pkg_die[REGION_NZONES];
+  // open addressing hash table with a power of 2 capacity, protected by the lock
+  region_entry* entries;
+  uint32_t capacity;
+  uint32_t n_entries;
+  uint32_t max_regions;
+  region_stack* stacks;
+  uint32_t max_threads;
+  pthread_key_t key;
+  pthread_mutex_t lock;
+} region_profiler;
+
+static region_profiler* prof;
+
+// FNV-1a
+static uint32_t hash_name(const char* name) {
+  uint32_t h = 2166136261U;
+  size_t i;
+  for (i = 0; name[i] != '\0' && i < RAPLCAP_REGION_NAME_MAX - 1; i++) {
+    h = (h ^ (uint8_t) name[i]) * 16777619U;
+  }
+  return h;
+}
+
+// Must hold the lock; returns NULL if not found and insert is 0, or if the table is full
+static region_entry* find_entry(region_profiler* p, const char* name, int insert) {
+  uint32_t i = hash_name(name) & (p->capacity - 1);
+  while (p->entries[i].used) {
+    if (strncmp(p->entries[i].name, name, RAPLCAP_REGION_NAME_MAX - 1) == 0) {
+      return &p->entries[i];
+    }
+    i = (i + 1) & (p->capacity - 1);
+  }
+  if (!insert || p->n_entries >= p->max_regions) {
+    return NULL;
+  }
+  snprintf(p->entries[i].name, sizeof(p->entries[i].name), "%s", name);
+  p->entries[i].used = 1;
+  p->n_entries++;
+  return &p->entries[i];
+}
+
+static int read_energy(region_profiler* p, double* joules) {
+  uint32_t i;
+  uint32_t z;
+  double j;
+  for (z = 0; z < REGION_NZONES; z++) {
+    joules[z] = 0;
+    for (i = 0; i < p->n_pkg_die[z]; i++) {
+      if ((j = raplcap_pd_get_energy_total(p->acc, p->pkg_die[z][2 * i], p->pkg_die[z][2 * i + 1],
+                                           REGION_ZONES[z])) < 0) {
+        return -1;
+      }
+      joules[z] += j;
+    }
+  }
+  return 0;
+}
+
+// Thread exit - return the stack to the pool
+static void release_stack(void* arg) {
+  region_stack* s = (region_stack*) arg;
+  pthread_mutex_lock(&prof->lock);
+  s->in_use = 0;
+  pthread_mutex_unlock(&prof->lock);
+}
+
+static region_stack* get_stack(region_profiler* p) {
+  region_stack* s;
+  uint32_t i;
+  int err;
+  if ((s = (region_stack*) pthread_getspecific(p->key)) != NULL) {
+    return s;
+  }
+  // first use by this thread
+  pthread_mutex_lock(&p->lock);
+  for (i = 0; i < p->max_threads && p->stacks[i].in_use; i++);
+  if (i < p->max_threads) {
+    s = &p->stacks[i];
+    s->in_use = 1;
+    s->depth = 0;
+    s->overflow = 0;
+  }
+  pthread_mutex_unlock(&p->lock);
+  if (s == NULL) {
+    raplcap_log(ERROR, "get_stack: Too many threads using regions: max=%"PRIu32"\n", p->max_threads);
+    errno = ENOSPC;
+    return NULL;
+  }
+  if ((err = pthread_setspecific(p->key, s)) != 0) {
+    release_stack(s);
+    errno = err;
+    return NULL;
+  }
+  return s;
+}
+
+static void free_profiler(region_profiler* p) {
+  uint32_t z;
+  for (z = 0; z < REGION_NZONES; z++) {
+    free(p->pkg_die[z]);
+  }
+  free(p->stacks);
+  free(p->entries);
+  free(p);
+}
+
+static int init_zones(region_profiler* p, const raplcap* rc) {
+  uint32_t n_pkg;
+  uint32_t n_die;
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t z;
+  int supported;
+  if ((n_pkg = raplcap_get_num_packages(rc)) == 0 || (n_die = raplcap_get_num_die(rc, 0)) == 0) {
+    return -1;
+  }
+  for (z = 0; z < REGION_NZONES; z++) {
+    if ((p->pkg_die[z] = malloc(2 * n_pkg * n_die * sizeof(uint32_t))) == NULL) {
+      raplcap_perror(ERROR, "init_zones: malloc");
+      return -1;
+    }
+    for (pkg = 0; pkg < n_pkg; pkg++) {
+      for (die = 0; die < n_die; die++) {
+        if ((supported = raplcap_pd_is_zone_supported(rc, pkg, die, REGION_ZONES[z])) < 0) {
+          return -1;
+        }
+        if (supported) {
+          p->pkg_die[z][2 * p->n_pkg_die[z]] = pkg;
+          p->pkg_die[z][2 * p->n_pkg_die[z] + 1] = die;
+          p->n_pkg_die[z]++;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+int raplcap_region_init(const raplcap* rc, uint32_t max_regions, uint32_t max_threads, double refresh_sec) {
+  region_profiler* p;
+  int err;
+  if (max_regions == 0 || max_threads == 0 || refresh_sec < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (prof != NULL) {
+    raplcap_log(ERROR, "raplcap_region_init: Already initialized\n");
+    errno = EBUSY;
+    return -1;
+  }
+  if ((p = calloc(1, sizeof(*p))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_region_init: calloc");
+    return -1;
+  }
+  p->max_regions = max_regions;
+  p->max_threads = max_threads;
+  // keep the load factor at or below 1/2 so probes stay short
+  for (p->capacity = 2; p->capacity < 2 * max_regions; p->capacity *= 2);
+  if ((p->entries = calloc(p->capacity, sizeof(*p->entries))) == NULL ||
+      (p->stacks = calloc(max_threads, sizeof(*p->stacks))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_region_init: calloc");
+    free_profiler(p);
+    return -1;
+  }
+  if (init_zones(p, rc) || (p->acc = raplcap_accumulator_init(rc, refresh_sec)) == NULL) {
+    err = errno;
+    free_profiler(p);
+    errno = err;
+    return -1;
+  }
+  if ((err = pthread_mutex_init(&p->lock, NULL)) != 0) {
+    raplcap_accumulator_destroy(p->acc);
+    free_profiler(p);
+    errno = err;
+    return -1;
+  }
+  if ((err = pthread_key_create(&p->key, release_stack)) != 0) {
+    pthread_mutex_destroy(&p->lock);
+    raplcap_accumulator_destroy(p->acc);
+    free_profiler(p);
+    errno = err;
+    return -1;
+  }
+  prof = p;
+  raplcap_log(DEBUG, "raplcap_region_init: Initialized, max_regions=%"PRIu32", max_threads=%"PRIu32"\n",
+              max_regions, max_threads);
+  return 0;
+}
+
+int raplcap_region_destroy(void) {
+  region_profiler* p = prof;
+  int ret;
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  prof = NULL;
+  // thread stack destructors no longer run after the key is deleted
+  pthread_key_delete(p->key);
+  pthread_mutex_destroy(&p->lock);
+  ret = raplcap_accumulator_destroy(p->acc);
+  free_profiler(p);
+  raplcap_log(DEBUG, "raplcap_region_destroy: Destroyed\n");
+  return ret;
+}
+
+int raplcap_region_begin(const char* name) {
+  region_profiler* p = prof;
+  region_stack* s;
+  region_frame* f;
+  if (p == NULL || name == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((s = get_stack(p)) == NULL) {
+    // nothing to push to, so the matching end call finds no active region - see header
+    return -1;
+  }
+  if (s->overflow > 0 || s->depth >= RAPLCAP_REGION_MAX_DEPTH) {
+    raplcap_log(WARN, "raplcap_region_begin: Regions nested too deeply, not measuring: %s\n", name);
+    s->overflow++;
+    errno = ENOSPC;
+    return -1;
+  }
+  f = &s->frames[s->depth];
+  f->name = name;
+  if (read_energy(p, f->joules)) {
+    // still pushed, so the matching end call pops it
+    f->name = NULL;
+    s->depth++;
+    return -1;
+  }
+  f->ns = raplcap_clock_ns(CLOCK_MONOTONIC);
+  s->depth++;
+  return 0;
+}
+
+int raplcap_region_end(void) {
+  region_profiler* p = prof;
+  region_stack* s;
+  region_frame* f;
+  region_entry* e;
+  double joules[REGION_NZONES];
+  uint64_t ns;
+  uint32_t z;
+  int ret = 0;
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  ns = raplcap_clock_ns(CLOCK_MONOTONIC);
+  if ((s = (region_stack*) pthread_getspecific(p->key)) == NULL || (s->depth == 0 && s->overflow == 0)) {
+    raplcap_log(ERROR, "raplcap_region_end: No active region\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (s->overflow > 0) {
+    s->overflow--;
+    errno = ENOSPC;
+    return -1;
+  }
+  f = &s->frames[--s->depth];
+  if (f->name == NULL || read_energy(p, joules)) {
+    // the begin or end read failed
+    return -1;
+  }
+  pthread_mutex_lock(&p->lock);
+  if ((e = find_entry(p, f->name, 1)) != NULL) {
+    e->stats.calls++;
+    e->stats.seconds += (ns - f->ns) / 1000000000.0;
+    for (z = 0; z < REGION_NZONES; z++) {
+      joules[z] -= f->joules[z];
+    }
+    e->stats.joules_package += joules[0];
+    e->stats.joules_dram += joules[1];
+  } else {
+    ret = -1;
+  }
+  pthread_mutex_unlock(&p->lock);
+  if (ret) {
+    raplcap_log(ERROR, "raplcap_region_end: Too many regions, not recording: %s\n", f->name);
+    errno = ENOSPC;
+  }
+  return ret;
+}
+
+int raplcap_region_get_stats(const char* name, raplcap_region_stats* stats) {
+  region_profiler* p = prof;
+  const region_entry* e;
+  if (p == NULL || name == NULL || stats == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&p->lock);
+  if ((e = find_entry(p, name, 0)) != NULL) {
+    *stats = e->stats;
+  }
+  pthread_mutex_unlock(&p->lock);
+  if (e == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  return 0;
+}
+
+int raplcap_region_report(FILE* f) {
+  region_profiler* p = prof;
+  const region_entry* e;
+  uint32_t i;
+  int ret = 0;
+  if (p == NULL || f == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (fprintf(f, "region,calls,seconds,package_joules,dram_joules,package_watts,dram_watts\n") < 0) {
+    return -1;
+  }
+  pthread_mutex_lock(&p->lock);
+  for (i = 0; i < p->capacity && ret == 0; i++) {
+    e = &p->entries[i];
+    if (e->used && fprintf(f, "%s,%"PRIu64",%.9f,%.6f,%.6f,%.6f,%.6f\n", e->name, e->stats.calls, e->stats.seconds,
+                           e->stats.joules_package, e->stats.joules_dram,
+                           e->stats.seconds > 0 ? e->stats.joules_package / e->stats.seconds : 0.0,
+                           e->stats.seconds > 0 ? e->stats.joules_dram / e->stats.seconds : 0.0) < 0) {
+      ret = -1;
+    }
+  }
+  pthread_mutex_unlock(&p->lock);
+  return ret;
+}
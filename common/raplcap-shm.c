@@ -0,0 +1,418 @@
+/**
+ * Publish energy counter readings in POSIX shared memory, protected by a sequence lock.
+ *
+ * @author Connor Imes
+ * @date 2020-10-15
+ */
+// for shm_open, pthread_condattr_setclock, clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "raplcap.h"
+#include "raplcap-shm.h"
+#include "raplcap-common.h"
+
+// "RPLC"
+#define SHM_MAGIC 0x52504C43
+// increment when the segment layout changes
+#define SHM_VERSION 1
+
+// bound how long readers wait for an update to finish, in case the publisher died during one
+#define SHM_READ_RETRIES_MAX 1000000
+
+typedef struct shm_segment {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  // odd while an update is in progress
+  uint64_t seq;
+  uint64_t ns;
+  raplcap_shm_zone zones[];
+} shm_segment;
+
+struct raplcap_shm_publisher {
+  char name[NAME_MAX];
+  shm_segment* seg;
+  size_t seg_size;
+  // indexed the same as the segment zones; NULL for unsupported zones
+  const raplcap_zone_handle** zh;
+  raplcap_shm_zone* readings;
+  uint32_t n_zones;
+  pthread_mutex_t lock;
+  // background publishing
+  pthread_t thread;
+  pthread_cond_t cond;
+  pthread_condattr_t cond_attr;
+  double interval_sec;
+  int running;
+};
+
+struct raplcap_shm_reader {
+  // mapped read-only
+  shm_segment* seg;
+  size_t seg_size;
+  uint32_t n_zones;
+};
+
+static size_t get_seg_size(uint32_t n_zones) {
+  return sizeof(shm_segment) + n_zones * sizeof(raplcap_shm_zone);
+}
+
+// Must hold the lock
+static int publish(raplcap_shm_publisher* pub) {
+  shm_segment* seg = pub->seg;
+  uint64_t seq;
+  uint32_t i;
+  double joules;
+  int ret = 0;
+  // read everything first so the update itself is short
+  for (i = 0; i < pub->n_zones; i++) {
+    if (pub->zh[i] != NULL) {
+      if ((joules = raplcap_zone_handle_get_energy_counter(pub->zh[i])) < 0) {
+        ret = -1;
+      } else {
+        pub->readings[i].joules = joules;
+      }
+    }
+  }
+  // only this thread writes seq
+  seq = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(seg->zones, pub->readings, pub->n_zones * sizeof(raplcap_shm_zone));
+  seg->ns = raplcap_clock_ns(CLOCK_MONOTONIC);
+  __atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+  return ret;
+}
+
+static void* publish_thread(void* arg) {
+  raplcap_shm_publisher* pub = (raplcap_shm_publisher*) arg;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // schedule on absolute deadlines so that the publishing rate doesn't drift
+  raplcap_timespec_add_sec(&ts, pub->interval_sec);
+  pthread_mutex_lock(&pub->lock);
+  while (pub->running) {
+    if (pthread_cond_timedwait(&pub->cond, &pub->lock, &ts) == ETIMEDOUT && pub->running) {
+      if (publish(pub)) {
+        raplcap_perror(WARN, "publish_thread: publish");
+      }
+      raplcap_timespec_add_sec(&ts, pub->interval_sec);
+    }
+  }
+  pthread_mutex_unlock(&pub->lock);
+  return NULL;
+}
+
+static int start_publish_thread(raplcap_shm_publisher* pub) {
+  int err;
+  // the condition variable must use the same clock as the publishing deadlines
+  if ((err = pthread_condattr_init(&pub->cond_attr)) != 0) {
+    errno = err;
+    return -1;
+  }
+  if ((err = pthread_condattr_setclock(&pub->cond_attr, CLOCK_MONOTONIC)) == 0) {
+    err = pthread_cond_init(&pub->cond, &pub->cond_attr);
+  }
+  pthread_condattr_destroy(&pub->cond_attr);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  pub->running = 1;
+  if ((err = pthread_create(&pub->thread, NULL, publish_thread, pub)) != 0) {
+    pub->running = 0;
+    pthread_cond_destroy(&pub->cond);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+static int init_zones(raplcap_shm_publisher* pub, const raplcap* rc, uint32_t n_pkg, uint32_t n_die) {
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t i;
+  int zone;
+  int supported;
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    for (die = 0; die < n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        i = ((pkg * n_die) + die) * RAPLCAP_NZONES + (uint32_t) zone;
+        pub->readings[i].joules = -1;
+        pub->readings[i].joules_max = -1;
+        if ((supported = raplcap_pd_is_zone_supported(rc, pkg, die, (raplcap_zone) zone)) < 0) {
+          return -1;
+        }
+        if (supported == 0 ||
+            (pub->zh[i] = raplcap_pd_get_zone_handle(rc, pkg, die, (raplcap_zone) zone)) == NULL ||
+            (pub->readings[i].joules_max = raplcap_zone_handle_get_energy_counter_max(pub->zh[i])) <= 0) {
+          raplcap_log(DEBUG, "init_zones: Skipping pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+          pub->zh[i] = NULL;
+          pub->readings[i].joules_max = -1;
+          continue;
+        }
+        pub->readings[i].supported = 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void free_publisher(raplcap_shm_publisher* pub) {
+  if (pub->seg != NULL) {
+    munmap(pub->seg, pub->seg_size);
+    shm_unlink(pub->name);
+  }
+  free(pub->readings);
+  free(pub->zh);
+  free(pub);
+}
+
+static int create_segment(raplcap_shm_publisher* pub, uint32_t n_pkg, uint32_t n_die) {
+  int fd;
+  int err;
+  // replace any stale segment from a previous publisher; its readers keep the old one
+  if (shm_unlink(pub->name) == 0) {
+    raplcap_log(INFO, "create_segment: Replaced existing segment: %s\n", pub->name);
+  }
+  // readable by anyone, so that consumers don't need privileges
+  if ((fd = shm_open(pub->name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+    raplcap_perror(ERROR, "create_segment: shm_open");
+    return -1;
+  }
+  if (ftruncate(fd, (off_t) pub->seg_size) ||
+      (pub->seg = mmap(NULL, pub->seg_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    raplcap_perror(ERROR, "create_segment: ftruncate/mmap");
+    err = errno;
+    pub->seg = NULL;
+    close(fd);
+    shm_unlink(pub->name);
+    errno = err;
+    return -1;
+  }
+  close(fd);
+  // magic is set after the first update, so readers don't see an incomplete segment
+  pub->seg->version = SHM_VERSION;
+  pub->seg->n_pkg = n_pkg;
+  pub->seg->n_die = n_die;
+  return 0;
+}
+
+raplcap_shm_publisher* raplcap_shm_publisher_init(const raplcap* rc, const char* name, double interval_sec) {
+  raplcap_shm_publisher* pub;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  int err;
+  if (name == NULL) {
+    name = RAPLCAP_SHM_DEFAULT_NAME;
+  }
+  if (name[0] != '/' || strlen(name) >= NAME_MAX || interval_sec < 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((n_pkg = raplcap_get_num_packages(rc)) == 0 || (n_die = raplcap_get_num_die(rc, 0)) == 0) {
+    return NULL;
+  }
+  if ((pub = calloc(1, sizeof(*pub))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_shm_publisher_init: calloc");
+    return NULL;
+  }
+  snprintf(pub->name, sizeof(pub->name), "%s", name);
+  pub->interval_sec = interval_sec;
+  pub->n_zones = n_pkg * n_die * RAPLCAP_NZONES;
+  pub->seg_size = get_seg_size(pub->n_zones);
+  if ((pub->zh = calloc(pub->n_zones, sizeof(*pub->zh))) == NULL ||
+      (pub->readings = calloc(pub->n_zones, sizeof(*pub->readings))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_shm_publisher_init: calloc");
+    free_publisher(pub);
+    return NULL;
+  }
+  if (init_zones(pub, rc, n_pkg, n_die) || create_segment(pub, n_pkg, n_die)) {
+    err = errno;
+    free_publisher(pub);
+    errno = err;
+    return NULL;
+  }
+  if ((err = pthread_mutex_init(&pub->lock, NULL)) != 0) {
+    free_publisher(pub);
+    errno = err;
+    return NULL;
+  }
+  if (publish(pub)) {
+    raplcap_perror(WARN, "raplcap_shm_publisher_init: publish");
+  }
+  __atomic_store_n(&pub->seg->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  if (interval_sec > 0 && start_publish_thread(pub)) {
+    raplcap_perror(ERROR, "raplcap_shm_publisher_init: start_publish_thread");
+    err = errno;
+    pthread_mutex_destroy(&pub->lock);
+    free_publisher(pub);
+    errno = err;
+    return NULL;
+  }
+  raplcap_log(DEBUG, "raplcap_shm_publisher_init: Initialized, name=%s, interval_sec=%f\n", name, interval_sec);
+  return pub;
+}
+
+int raplcap_shm_publisher_destroy(raplcap_shm_publisher* pub) {
+  int err = 0;
+  if (pub == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (pub->running) {
+    pthread_mutex_lock(&pub->lock);
+    pub->running = 0;
+    pthread_cond_signal(&pub->cond);
+    pthread_mutex_unlock(&pub->lock);
+    if ((err = pthread_join(pub->thread, NULL)) != 0) {
+      raplcap_log(ERROR, "raplcap_shm_publisher_destroy: pthread_join: %s\n", strerror(err));
+    }
+    pthread_cond_destroy(&pub->cond);
+  }
+  pthread_mutex_destroy(&pub->lock);
+  free_publisher(pub);
+  raplcap_log(DEBUG, "raplcap_shm_publisher_destroy: Destroyed\n");
+  errno = err;
+  return err ? -1 : 0;
+}
+
+int raplcap_shm_publish(raplcap_shm_publisher* pub) {
+  int ret;
+  if (pub == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&pub->lock);
+  ret = publish(pub);
+  pthread_mutex_unlock(&pub->lock);
+  return ret;
+}
+
+raplcap_shm_reader* raplcap_shm_reader_open(const char* name) {
+  raplcap_shm_reader* rd;
+  struct stat st;
+  void* addr;
+  int fd;
+  int err;
+  if (name == NULL) {
+    name = RAPLCAP_SHM_DEFAULT_NAME;
+  }
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+    raplcap_perror(ERROR, "raplcap_shm_reader_open: shm_open");
+    return NULL;
+  }
+  if (fstat(fd, &st) || (addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    raplcap_perror(ERROR, "raplcap_shm_reader_open: fstat/mmap");
+    err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+  close(fd);
+  if ((rd = malloc(sizeof(*rd))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_shm_reader_open: malloc");
+    munmap(addr, (size_t) st.st_size);
+    return NULL;
+  }
+  rd->seg = (shm_segment*) addr;
+  rd->seg_size = (size_t) st.st_size;
+  if (rd->seg_size < sizeof(shm_segment) ||
+      __atomic_load_n(&rd->seg->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || rd->seg->version != SHM_VERSION ||
+      rd->seg_size < get_seg_size(rd->seg->n_pkg * rd->seg->n_die * RAPLCAP_NZONES)) {
+    raplcap_log(ERROR, "raplcap_shm_reader_open: Not a compatible raplcap segment, or not yet published: %s\n", name);
+    raplcap_shm_reader_close(rd);
+    errno = EPROTO;
+    return NULL;
+  }
+  rd->n_zones = rd->seg->n_pkg * rd->seg->n_die * RAPLCAP_NZONES;
+  raplcap_log(DEBUG, "raplcap_shm_reader_open: Opened, name=%s, n_pkg=%"PRIu32", n_die=%"PRIu32"\n",
+              name, rd->seg->n_pkg, rd->seg->n_die);
+  return rd;
+}
+
+int raplcap_shm_reader_close(raplcap_shm_reader* rd) {
+  int ret;
+  if (rd == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((ret = munmap(rd->seg, rd->seg_size))) {
+    raplcap_perror(ERROR, "raplcap_shm_reader_close: munmap");
+  }
+  free(rd);
+  return ret;
+}
+
+uint32_t raplcap_shm_reader_get_num_packages(const raplcap_shm_reader* rd) {
+  if (rd == NULL) {
+    errno = EINVAL;
+    return 0;
+  }
+  return rd->seg->n_pkg;
+}
+
+uint32_t raplcap_shm_reader_get_num_die(const raplcap_shm_reader* rd) {
+  if (rd == NULL) {
+    errno = EINVAL;
+    return 0;
+  }
+  return rd->seg->n_die;
+}
+
+// Copy n zones starting at index i, returns the sequence number or 0 if an update doesn't finish
+static uint64_t read_zones(const raplcap_shm_reader* rd, raplcap_shm_zone* zones, uint32_t i, uint32_t n,
+                           uint64_t* ns) {
+  const shm_segment* seg = rd->seg;
+  uint64_t seq;
+  uint64_t t;
+  uint32_t retries;
+  for (retries = 0; retries < SHM_READ_RETRIES_MAX; retries++) {
+    if ((seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE)) & 1) {
+      // update in progress
+      continue;
+    }
+    memcpy(zones, &seg->zones[i], n * sizeof(raplcap_shm_zone));
+    t = seg->ns;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == seq) {
+      if (ns != NULL) {
+        *ns = t;
+      }
+      return seq / 2;
+    }
+  }
+  raplcap_log(ERROR, "read_zones: Publisher update didn't finish\n");
+  errno = EAGAIN;
+  return 0;
+}
+
+uint64_t raplcap_shm_read(raplcap_shm_reader* rd, raplcap_shm_zone* zones, uint32_t n_zones, uint64_t* ns) {
+  if (rd == NULL || zones == NULL || n_zones < rd->n_zones) {
+    errno = EINVAL;
+    return 0;
+  }
+  return read_zones(rd, zones, 0, rd->n_zones, ns);
+}
+
+uint64_t raplcap_shm_read_zone(raplcap_shm_reader* rd, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_shm_zone* z) {
+  if (rd == NULL || z == NULL || pkg >= rd->seg->n_pkg || die >= rd->seg->n_die ||
+      (int) zone < 0 || (int) zone >= RAPLCAP_NZONES) {
+    errno = EINVAL;
+    return 0;
+  }
+  return read_zones(rd, z, ((pkg * rd->seg->n_die) + die) * RAPLCAP_NZONES + (uint32_t) zone, 1, NULL);
+}
@@ -0,0 +1,75 @@
+/**
+ * Monotonic energy accumulators that extend RAPL energy counters beyond their rollover value.
+ *
+ * RAPL energy counters are typically only 32 bits wide, so they may roll over in a matter of minutes.
+ * An accumulator tracks counter rollovers for every supported package, die, and zone, so that the total energy
+ * consumed since the accumulator was initialized can be read at any time.
+ *
+ * Rollovers can only be detected if the counters are read at least once per rollover period.
+ * If callers may not poll frequently enough, a background refresh thread can be started to guarantee this.
+ *
+ * Accumulator functions are thread-safe, but the raplcap context must remain valid until the accumulator is destroyed.
+ *
+ * @author Connor Imes
+ * @date 2020-09-21
+ */
+#ifndef _RAPLCAP_ACCUMULATOR_H_
+#define _RAPLCAP_ACCUMULATOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <raplcap.h>
+
+/**
+ * An opaque energy accumulator
+ */
+typedef struct raplcap_accumulator raplcap_accumulator;
+
+/**
+ * Create an energy accumulator for all supported zones in an initialized RAPLCap context.
+ * If refresh_sec > 0, a background thread reads all counters at that interval so that no rollovers are missed.
+ * The interval must be shorter than the time it takes any counter to roll over at peak power, which is assumed to be
+ * at most 1000 W - longer intervals are rejected with errno set to EINVAL.
+ *
+ * @param rc
+ * @param refresh_sec
+ * @return an accumulator on success, NULL on error
+ */
+raplcap_accumulator* raplcap_accumulator_init(const raplcap* rc, double refresh_sec);
+
+/**
+ * Stop any background refresh thread and destroy an accumulator.
+ *
+ * @param acc
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_accumulator_destroy(raplcap_accumulator* acc);
+
+/**
+ * Read all supported energy counters and update their totals.
+ *
+ * @param acc
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_accumulator_update(raplcap_accumulator* acc);
+
+/**
+ * Get the total energy consumed by a zone in Joules since the accumulator was initialized.
+ * The counter is read and the total is updated before returning.
+ *
+ * @param acc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @return Joules on success, a negative value on error
+ */
+double raplcap_pd_get_energy_total(raplcap_accumulator* acc, uint32_t pkg, uint32_t die, raplcap_zone zone);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Energy counter reads aligned to hardware counter updates.
+ *
+ * RAPL energy counters are only updated periodically (typically about every millisecond), so a counter value read at
+ * an arbitrary time may be up to one update period old.
+ * For short measurements, this error at the start and end of the measurement can dominate.
+ * Aligned reads poll a counter until its value changes, and timestamp the transition with CLOCK_MONOTONIC_RAW, so
+ * the energy difference between two aligned reads corresponds to the time between their timestamps.
+ *
+ * Aligned reads spin on the calling thread, for up to one update period (or the timeout).
+ * If a zone consumes too little power for its counter to change every update, transitions can be missed, which
+ * delays aligned reads and inflates update period estimates.
+ *
+ * @author Connor Imes
+ * @date 2020-10-14
+ */
+#ifndef _RAPLCAP_ALIGNED_H_
+#define _RAPLCAP_ALIGNED_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <raplcap.h>
+
+/**
+ * An energy counter value and when it was updated.
+ */
+typedef struct raplcap_aligned_sample {
+  // the new counter value
+  double joules;
+  // CLOCK_MONOTONIC_RAW nanoseconds, midway between the last read of the old value and the first read of the new one
+  uint64_t ns;
+  // the maximum error of ns, i.e., half the time between those two reads
+  uint64_t ns_error;
+} raplcap_aligned_sample;
+
+/**
+ * Poll a zone's energy counter until its value changes.
+ * Fails with ETIMEDOUT if the value doesn't change within the timeout.
+ *
+ * @param zh
+ * @param timeout_sec
+ * @param sample
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_aligned_read(const raplcap_zone_handle* zh, double timeout_sec, raplcap_aligned_sample* sample);
+
+/**
+ * Estimate a zone's energy counter update period by timing consecutive counter changes.
+ * Fails with ETIMEDOUT if any change takes longer than the timeout.
+ *
+ * @param zh
+ * @param n_updates the number of update periods to average over (> 0)
+ * @param timeout_sec the timeout for each change
+ * @return seconds on success, a negative value on error
+ */
+double raplcap_aligned_get_update_period(const raplcap_zone_handle* zh, uint32_t n_updates, double timeout_sec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
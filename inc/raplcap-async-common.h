@@ -0,0 +1,55 @@
+/**
+ * Interface between the asynchronous reader and the implementations that provide its energy counter sources.
+ *
+ * @author Connor Imes
+ * @date 2020-10-05
+ */
+#ifndef _RAPLCAP_ASYNC_COMMON_H_
+#define _RAPLCAP_ASYNC_COMMON_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <raplcap.h>
+
+#pragma GCC visibility push(hidden)
+
+// The maximum number of bytes read from a source, leaving room for a terminating NUL
+#define RAPLCAP_ASYNC_SOURCE_LEN_MAX 31
+
+/**
+ * A file region to read an energy counter from.
+ */
+typedef struct raplcap_async_source {
+  uint32_t pkg;
+  uint32_t die;
+  raplcap_zone zone;
+  int fd;
+  off_t offset;
+  size_t len;
+} raplcap_async_source;
+
+/**
+ * Populate sources for all supported energy counters, up to max.
+ * Returns the number of sources on success, or -1 with errno set on error.
+ */
+int raplcap_async_impl_get_sources(const raplcap* rc, raplcap_async_source* sources, uint32_t max);
+
+/**
+ * Convert the data read from a source to Joules.
+ * The buffer is NUL-terminated after len bytes.
+ * Returns Joules on success, or a negative value on error.
+ */
+double raplcap_async_impl_decode(const raplcap* rc, const raplcap_async_source* src, const char* buf, size_t len);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
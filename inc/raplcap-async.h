@@ -0,0 +1,88 @@
+/**
+ * Asynchronous energy counter reads using Linux io_uring.
+ *
+ * All supported energy counters are read with a single submission, so the kernel can overlap the reads across
+ * packages instead of performing them one after another.
+ * Completions are delivered to a callback when reaped, either by blocking or after polling the file descriptor.
+ *
+ * Requires a kernel with io_uring support (Linux 5.6 or newer).
+ * The raplcap context must remain valid until the reader is destroyed.
+ * A reader is not thread-safe.
+ *
+ * @author Connor Imes
+ * @date 2020-10-05
+ */
+#ifndef _RAPLCAP_ASYNC_H_
+#define _RAPLCAP_ASYNC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <raplcap.h>
+
+/**
+ * An opaque asynchronous energy counter reader
+ */
+typedef struct raplcap_async raplcap_async;
+
+/**
+ * Called once for each completed read.
+ * The joules value is negative if the read failed.
+ */
+typedef void (raplcap_async_cb)(void* arg, uint32_t pkg, uint32_t die, raplcap_zone zone, double joules);
+
+/**
+ * Create an asynchronous reader for all supported energy counters in an initialized RAPLCap context.
+ *
+ * @param rc
+ * @param cb
+ * @param arg passed to cb
+ * @return a reader on success, NULL on error
+ */
+raplcap_async* raplcap_async_init(const raplcap* rc, raplcap_async_cb* cb, void* arg);
+
+/**
+ * Destroy an asynchronous reader, waiting for any outstanding reads without delivering them.
+ *
+ * @param ra
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_async_destroy(raplcap_async* ra);
+
+/**
+ * Submit reads of all supported energy counters with a single system call.
+ * Fails with EBUSY if reads from a previous submission are still outstanding.
+ * If the kernel doesn't accept all reads, fails after withdrawing the rest, but the accepted reads are still
+ * outstanding and must be completed before submitting again.
+ *
+ * @param ra
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_async_submit(raplcap_async* ra);
+
+/**
+ * Get a file descriptor that becomes readable (e.g., with poll or epoll) when completions are available.
+ * Do not read from or close it.
+ *
+ * @param ra
+ * @return a file descriptor on success, a negative value on error
+ */
+int raplcap_async_get_fd(const raplcap_async* ra);
+
+/**
+ * Deliver available completions to the callback.
+ * If wait is non-zero, block until all outstanding reads have completed.
+ *
+ * @param ra
+ * @param wait
+ * @return the number of completions delivered on success, a negative value on error
+ */
+int raplcap_async_complete(raplcap_async* ra, int wait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
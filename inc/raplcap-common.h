@@ -12,13 +12,21 @@ extern "C" {
 #endif
 
 #include <float.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 // Environment variable to request read-only access when the option is available
 // This is an undocumented capability and may be removed at any time
 #define ENV_RAPLCAP_READ_ONLY "RAPLCAP_READ_ONLY"
 
+// The number of zones in the raplcap_zone enum
+#define RAPLCAP_NZONES (RAPLCAP_ZONE_PSYS + 1)
+
+// A generous bound on any zone's power, for limiting how long energy counters may go unread without missing rollovers
+#define RAPLCAP_MAX_WATTS 1000.0
+
 typedef enum raplcap_loglevel {
   DEBUG = 0,
   INFO,
@@ -63,6 +71,31 @@ typedef enum raplcap_loglevel {
  */
 #define is_zero_dbl(val) ((val) >= 0 ? (val) < DBL_EPSILON : (val) > -DBL_EPSILON)
 
+// POSIX clocks are only declared when the including file requests them, e.g., with _POSIX_C_SOURCE
+#ifdef CLOCK_MONOTONIC
+/**
+ * Get a clock's current time in nanoseconds.
+ */
+static inline uint64_t raplcap_clock_ns(clockid_t clk) {
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Advance a time by a non-negative number of seconds, e.g., to compute absolute deadlines for timed waits.
+ */
+static inline void raplcap_timespec_add_sec(struct timespec* ts, double sec) {
+  const long NSEC_PER_SEC = 1000000000L;
+  ts->tv_sec += (time_t) sec;
+  ts->tv_nsec += (long) ((sec - (double) (time_t) sec) * NSEC_PER_SEC);
+  if (ts->tv_nsec >= NSEC_PER_SEC) {
+    ts->tv_sec++;
+    ts->tv_nsec -= NSEC_PER_SEC;
+  }
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
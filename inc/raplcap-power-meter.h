@@ -0,0 +1,92 @@
+/**
+ * Average power meters built on RAPL energy counters.
+ *
+ * A power meter samples the energy counter of a single package, die, and zone, and keeps a ring of timestamped
+ * samples with counter rollovers already accounted for.
+ * Instantaneous (last interval), fixed-window (all samples in the ring), and exponentially weighted moving average
+ * power are then available in constant time, without the caller managing counters or clocks.
+ *
+ * Samples are only taken when requested, so callers must sample at least once per counter rollover period, and
+ * frequently enough for the averages they need.
+ *
+ * Power meter functions are thread-safe, but the raplcap context must remain valid until the meter is destroyed.
+ *
+ * @author Connor Imes
+ * @date 2020-10-14
+ */
+#ifndef _RAPLCAP_POWER_METER_H_
+#define _RAPLCAP_POWER_METER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <raplcap.h>
+
+/**
+ * An opaque power meter
+ */
+typedef struct raplcap_power_meter raplcap_power_meter;
+
+/**
+ * Create a power meter for a supported zone in an initialized RAPLCap context.
+ * The energy counter is sampled once before returning.
+ *
+ * @param rc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param n_samples the ring size (>= 2), which determines the fixed averaging window
+ * @param ewma_sec the exponentially weighted moving average time constant (> 0)
+ * @return a power meter on success, NULL on error
+ */
+raplcap_power_meter* raplcap_power_meter_init(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                              uint32_t n_samples, double ewma_sec);
+
+/**
+ * Destroy a power meter.
+ *
+ * @param pm
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_power_meter_destroy(raplcap_power_meter* pm);
+
+/**
+ * Read the energy counter and add a sample, replacing the oldest one if the ring is full.
+ *
+ * @param pm
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_power_meter_sample(raplcap_power_meter* pm);
+
+/**
+ * Get the average power in Watts between the two most recent samples.
+ *
+ * @param pm
+ * @return Watts on success, a negative value on error (errno is ENODATA if there are not yet two samples)
+ */
+double raplcap_power_meter_get_instant(raplcap_power_meter* pm);
+
+/**
+ * Get the average power in Watts between the oldest and most recent samples in the ring.
+ *
+ * @param pm
+ * @return Watts on success, a negative value on error (errno is ENODATA if there are not yet two samples)
+ */
+double raplcap_power_meter_get_window(raplcap_power_meter* pm);
+
+/**
+ * Get the exponentially weighted moving average power in Watts.
+ * Each interval's power is weighted by how long it lasted relative to the time constant.
+ *
+ * @param pm
+ * @return Watts on success, a negative value on error (errno is ENODATA if there are not yet two samples)
+ */
+double raplcap_power_meter_get_ewma(raplcap_power_meter* pm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * Named energy profiling regions.
+ *
+ * Code regions are delimited with raplcap_region_begin and raplcap_region_end, which may be nested.
+ * Each thread has its own region stack, and statistics are aggregated per region name across all threads.
+ * Regions report the energy consumed by all packages (PACKAGE zones) and all DRAM (DRAM zones) while they were active,
+ * including any other work running at the same time - RAPL energy counters can't be attributed to threads.
+ * Statistics are inclusive: a region's totals include those of regions nested within it.
+ *
+ * There is a single, global profiler.
+ * All memory is allocated when the profiler is initialized, so beginning and ending regions never allocate.
+ * Profiler functions are thread-safe, but the raplcap context must remain valid until the profiler is destroyed.
+ *
+ * @author Connor Imes
+ * @date 2020-10-14
+ */
+#ifndef _RAPLCAP_REGION_H_
+#define _RAPLCAP_REGION_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <raplcap.h>
+
+/**
+ * The maximum nesting depth of regions in a thread
+ */
+#define RAPLCAP_REGION_MAX_DEPTH 32
+
+/**
+ * The maximum region name length, including the null terminator (longer names are truncated)
+ */
+#define RAPLCAP_REGION_NAME_MAX 64
+
+/**
+ * Aggregate statistics for a region
+ */
+typedef struct raplcap_region_stats {
+  uint64_t calls;
+  double seconds;
+  double joules_package;
+  double joules_dram;
+} raplcap_region_stats;
+
+/**
+ * Initialize the profiler for an initialized RAPLCap context.
+ * If refresh_sec > 0, energy counters are also read in the background at that interval so that regions can run for
+ * longer than it takes the counters to roll over (see raplcap_accumulator_init).
+ *
+ * @param rc
+ * @param max_regions the maximum number of distinct region names (> 0)
+ * @param max_threads the maximum number of live threads that may use regions (> 0) - a thread keeps its region stack
+ *                    from its first raplcap_region_begin call until it exits
+ * @param refresh_sec
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_region_init(const raplcap* rc, uint32_t max_regions, uint32_t max_threads, double refresh_sec);
+
+/**
+ * Destroy the profiler.
+ * No threads may begin or end regions during or after this call (until reinitialized).
+ *
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_region_destroy(void);
+
+/**
+ * Begin a region in the calling thread.
+ * The name is not copied until the region ends, so it must remain valid until then.
+ * Fails with ENOSPC if the thread's regions are nested too deeply or too many threads use regions.
+ * Every call must be matched with a call to raplcap_region_end, even if it fails.
+ * When too many threads use regions, the calling thread has no region stack, so nothing is begun and the matching
+ * raplcap_region_end call fails with EINVAL.
+ *
+ * @param name
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_region_begin(const char* name);
+
+/**
+ * End the calling thread's most recently begun region and add to its statistics.
+ * Fails with ENOSPC if the region is new and there are already max_regions region names.
+ *
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_region_end(void);
+
+/**
+ * Get the statistics for a region.
+ *
+ * @param name
+ * @param stats
+ * @return 0 on success, a negative value on error (errno is ENOENT if the region hasn't ended at least once)
+ */
+int raplcap_region_get_stats(const char* name, raplcap_region_stats* stats);
+
+/**
+ * Write statistics for all regions in CSV format, with a header row.
+ *
+ * @param f
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_region_report(FILE* f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
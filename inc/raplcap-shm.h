@@ -0,0 +1,144 @@
+/**
+ * Publish energy counter readings in POSIX shared memory.
+ *
+ * A single publisher process reads all supported energy counters and writes them to a named shared memory segment.
+ * Any number of reader processes can then get the latest readings without system calls, MSR access, or privileges
+ * (beyond read access to the segment), so adding consumers doesn't add RAPL reads.
+ *
+ * Updates are protected by a sequence lock: the publisher never waits for readers, and readers retry if they overlap
+ * with an update, so readers always get a consistent set of readings from a single update.
+ *
+ * Publisher functions are thread-safe, but the raplcap context must remain valid until the publisher is destroyed.
+ * A reader is not thread-safe.
+ *
+ * @author Connor Imes
+ * @date 2020-10-15
+ */
+#ifndef _RAPLCAP_SHM_H_
+#define _RAPLCAP_SHM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <raplcap.h>
+
+/**
+ * The shared memory segment name used if none is specified
+ */
+#define RAPLCAP_SHM_DEFAULT_NAME "/raplcap"
+
+/**
+ * An opaque shared memory publisher
+ */
+typedef struct raplcap_shm_publisher raplcap_shm_publisher;
+
+/**
+ * An opaque shared memory reader
+ */
+typedef struct raplcap_shm_reader raplcap_shm_reader;
+
+/**
+ * A published energy counter reading.
+ * Unsupported zones have supported=0 and negative values.
+ */
+typedef struct raplcap_shm_zone {
+  double joules;
+  double joules_max;
+  int supported;
+} raplcap_shm_zone;
+
+/**
+ * Create (or replace) a shared memory segment and publish the energy counters of all supported zones in an initialized
+ * RAPLCap context.
+ * If interval_sec > 0, a background thread publishes at that interval; otherwise, use raplcap_shm_publish.
+ * Readings are published once before returning.
+ *
+ * @param rc
+ * @param name the segment name, starting with '/' (NULL for RAPLCAP_SHM_DEFAULT_NAME)
+ * @param interval_sec
+ * @return a publisher on success, NULL on error
+ */
+raplcap_shm_publisher* raplcap_shm_publisher_init(const raplcap* rc, const char* name, double interval_sec);
+
+/**
+ * Stop any background thread, remove the shared memory segment, and destroy a publisher.
+ * Readers that already opened the segment can continue to read the last published values.
+ *
+ * @param pub
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_shm_publisher_destroy(raplcap_shm_publisher* pub);
+
+/**
+ * Read all supported energy counters and publish them.
+ * If a counter read fails, the previously published value is kept.
+ *
+ * @param pub
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_shm_publish(raplcap_shm_publisher* pub);
+
+/**
+ * Open a published shared memory segment.
+ *
+ * @param name the segment name (NULL for RAPLCAP_SHM_DEFAULT_NAME)
+ * @return a reader on success, NULL on error
+ */
+raplcap_shm_reader* raplcap_shm_reader_open(const char* name);
+
+/**
+ * Close a shared memory reader.
+ *
+ * @param rd
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_shm_reader_close(raplcap_shm_reader* rd);
+
+/**
+ * Get the number of packages in the published readings.
+ *
+ * @param rd
+ * @return the number of packages, 0 on error
+ */
+uint32_t raplcap_shm_reader_get_num_packages(const raplcap_shm_reader* rd);
+
+/**
+ * Get the number of die per package in the published readings.
+ *
+ * @param rd
+ * @return the number of die, 0 on error
+ */
+uint32_t raplcap_shm_reader_get_num_die(const raplcap_shm_reader* rd);
+
+/**
+ * Copy the latest readings for all packages, die, and zones.
+ * Zones are indexed by ((pkg * n_die) + die) * (RAPLCAP_ZONE_PSYS + 1) + zone.
+ *
+ * @param rd
+ * @param zones
+ * @param n_zones the length of zones, which must be at least n_pkg * n_die * (RAPLCAP_ZONE_PSYS + 1)
+ * @param ns the CLOCK_MONOTONIC time of the update in nanoseconds (may be NULL)
+ * @return the update sequence number (> 0) on success, 0 on error
+ */
+uint64_t raplcap_shm_read(raplcap_shm_reader* rd, raplcap_shm_zone* zones, uint32_t n_zones, uint64_t* ns);
+
+/**
+ * Copy the latest reading for a single zone.
+ *
+ * @param rd
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param z
+ * @return the update sequence number (> 0) on success, 0 on error
+ */
+uint64_t raplcap_shm_read_zone(raplcap_shm_reader* rd, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_shm_zone* z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
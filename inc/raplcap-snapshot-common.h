@@ -0,0 +1,125 @@
+/**
+ * Snapshot storage and helpers shared by all implementations.
+ * Implementations provide raplcap_snapshot_alloc and raplcap_snapshot_read.
+ *
+ * @author Connor Imes
+ * @date 2020-09-28
+ */
+#ifndef _RAPLCAP_SNAPSHOT_COMMON_H_
+#define _RAPLCAP_SNAPSHOT_COMMON_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+#include <raplcap.h>
+#include "raplcap-common.h"
+
+struct raplcap_snapshot {
+  uint64_t timestamp_ns;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  // indexed by ((pkg * n_die) + die) * RAPLCAP_NZONES + zone
+  raplcap_snapshot_zone zones[];
+};
+
+static uint64_t snapshot_now_ns(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (uint64_t) ((count.QuadPart / (double) freq.QuadPart) * 1000000000.0);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static raplcap_snapshot* snapshot_alloc(uint32_t n_pkg, uint32_t n_die) {
+  raplcap_snapshot* snap;
+  size_t n_zones = (size_t) n_pkg * n_die * RAPLCAP_NZONES;
+  if ((snap = (raplcap_snapshot*) calloc(1, sizeof(raplcap_snapshot) + n_zones * sizeof(raplcap_snapshot_zone))) == NULL) {
+    raplcap_perror(ERROR, "snapshot_alloc: calloc");
+    return NULL;
+  }
+  snap->n_pkg = n_pkg;
+  snap->n_die = n_die;
+  return snap;
+}
+
+static raplcap_snapshot_zone* snapshot_zone(raplcap_snapshot* snap, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  return &snap->zones[(((pkg * snap->n_die) + die) * RAPLCAP_NZONES) + zone];
+}
+
+// Reset a zone to the "unknown" state before it's read
+static void snapshot_zone_reset(raplcap_snapshot_zone* sz) {
+  sz->limit_long.seconds = -1;
+  sz->limit_long.watts = -1;
+  sz->limit_short.seconds = -1;
+  sz->limit_short.watts = -1;
+  sz->joules = -1;
+  sz->joules_max = -1;
+  sz->supported = 0;
+  sz->enabled = -1;
+  sz->clamped = -1;
+  sz->locked = -1;
+}
+
+void raplcap_snapshot_free(raplcap_snapshot* snap) {
+  free(snap);
+}
+
+uint64_t raplcap_snapshot_get_timestamp_ns(const raplcap_snapshot* snap) {
+  return snap == NULL ? 0 : snap->timestamp_ns;
+}
+
+const raplcap_snapshot_zone* raplcap_snapshot_get_zone(const raplcap_snapshot* snap,
+                                                       uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  if (snap == NULL || pkg >= snap->n_pkg || die >= snap->n_die || (int) zone < 0 || (int) zone >= RAPLCAP_NZONES) {
+    raplcap_log(ERROR, "raplcap_snapshot_get_zone: Invalid parameters\n");
+    errno = EINVAL;
+    return NULL;
+  }
+  return &snap->zones[(((pkg * snap->n_die) + die) * RAPLCAP_NZONES) + zone];
+}
+
+double raplcap_snapshot_get_watts(const raplcap_snapshot* prev, const raplcap_snapshot* cur,
+                                  uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  const raplcap_snapshot_zone* sz_prev = raplcap_snapshot_get_zone(prev, pkg, die, zone);
+  const raplcap_snapshot_zone* sz_cur = raplcap_snapshot_get_zone(cur, pkg, die, zone);
+  double joules;
+  if (sz_prev == NULL || sz_cur == NULL) {
+    return -1;
+  }
+  if (cur->timestamp_ns <= prev->timestamp_ns || sz_prev->joules < 0 || sz_cur->joules < 0) {
+    raplcap_log(ERROR, "raplcap_snapshot_get_watts: Snapshots are out of order or zone was not read\n");
+    errno = EINVAL;
+    return -1;
+  }
+  joules = sz_cur->joules - sz_prev->joules;
+  if (joules < 0) {
+    if (sz_cur->joules_max <= 0) {
+      raplcap_log(ERROR, "raplcap_snapshot_get_watts: Counter rolled over, but max value is unknown\n");
+      errno = EINVAL;
+      return -1;
+    }
+    joules += sz_cur->joules_max;
+  }
+  return joules / ((cur->timestamp_ns - prev->timestamp_ns) / 1000000000.0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -64,6 +64,55 @@ typedef enum raplcap_zone {
   RAPLCAP_ZONE_PSYS,
 } raplcap_zone;
 
+/**
+ * The enabled, clamped, and locked state and the limits of a zone.
+ * Values that the implementation cannot determine are negative.
+ * If the zone has no short term constraint, limit_short is zeroed.
+ */
+typedef struct raplcap_zone_status {
+  raplcap_limit limit_long;
+  raplcap_limit limit_short;
+  int enabled;
+  int clamped;
+  int locked;
+} raplcap_zone_status;
+
+/**
+ * Flags reported when limit values are outside the range that can be set and are clamped to the nearest bound.
+ */
+typedef enum raplcap_quantize_flag {
+  RAPLCAP_QUANTIZE_LONG_WATTS_CLAMPED = 0x1,
+  RAPLCAP_QUANTIZE_LONG_SECONDS_CLAMPED = 0x2,
+  RAPLCAP_QUANTIZE_SHORT_WATTS_CLAMPED = 0x4,
+  RAPLCAP_QUANTIZE_SHORT_SECONDS_CLAMPED = 0x8,
+} raplcap_quantize_flag;
+
+/**
+ * An opaque handle to a zone, resolved once for fast repeated access.
+ * Handles are owned by the RAPLCap context and remain valid until the context is destroyed.
+ */
+typedef struct raplcap_zone_handle raplcap_zone_handle;
+
+/**
+ * The state of a zone captured by a snapshot.
+ * Values that could not be determined (e.g., not supported by the implementation) are negative.
+ */
+typedef struct raplcap_snapshot_zone {
+  raplcap_limit limit_long;
+  raplcap_limit limit_short;
+  double joules;
+  double joules_max;
+  int supported;
+  int enabled;
+  int clamped;
+  int locked;
+} raplcap_snapshot_zone;
+
+/**
+ * An opaque snapshot of all packages, die, and zones.
+ */
+typedef struct raplcap_snapshot raplcap_snapshot;
+
 /**
  * Initialize a RAPLCap context.
  *
@@ -175,6 +224,40 @@ int raplcap_pd_get_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap
 int raplcap_pd_set_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
                           const raplcap_limit* limit_long, const raplcap_limit* limit_short);
 
+/**
+ * Convert limits to the values that raplcap_pd_set_limits would actually set, without accessing the hardware.
+ * Limits are modified in place, with the same rules as raplcap_pd_set_limits: power or time window values of 0 are
+ * not written, and remain 0.
+ * Values that would not be written (e.g., for a constraint the zone doesn't have) are set to 0.
+ * Some implementations only know the granularity of their own interface, which lower layers may round further.
+ * Clamping is only reported by implementations that know the hardware's encodable ranges (e.g., msr) - powercap
+ * always reports 0, since the kernel accepts any value and lower layers truncate out-of-range values silently.
+ *
+ * @param rc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param limit_long
+ * @param limit_short
+ * @return raplcap_quantize_flag values OR'd together on success (0 if nothing was clamped), a negative value on error
+ */
+int raplcap_pd_quantize_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_limit* limit_long, raplcap_limit* limit_short);
+
+/**
+ * Get the status and limits of a zone, if it is supported.
+ * Prefer this to separate queries when more than one value is needed - implementations read as little as possible.
+ *
+ * @param rc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param status
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_pd_get_zone_status(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_zone_status* status);
+
 /**
  * Get the current energy counter value for a zone in Joules.
  * Note that the counter rolls over - check the max value.
@@ -198,6 +281,121 @@ double raplcap_pd_get_energy_counter(const raplcap* rc, uint32_t pkg, uint32_t d
  */
 double raplcap_pd_get_energy_counter_max(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone);
 
+/**
+ * Get a handle to a supported zone.
+ * All parameter validation is performed here so that access through the handle can skip it.
+ *
+ * @param rc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @return a handle on success, NULL on error or if the zone is unsupported
+ */
+const raplcap_zone_handle* raplcap_pd_get_zone_handle(const raplcap* rc, uint32_t pkg, uint32_t die,
+                                                      raplcap_zone zone);
+
+/**
+ * Get the limits for a zone handle.
+ * The handle is not validated - it must have been returned by raplcap_pd_get_zone_handle.
+ * Not all zones use limit_short.
+ *
+ * @param zh
+ * @param limit_long
+ * @param limit_short
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_zone_handle_get_limits(const raplcap_zone_handle* zh, raplcap_limit* limit_long, raplcap_limit* limit_short);
+
+/**
+ * Set the limits for a zone handle.
+ * The handle is not validated - it must have been returned by raplcap_pd_get_zone_handle.
+ * Not all zones use limit_short.
+ * If the power or time window value is 0, it will not be written or the current value may be used.
+ *
+ * @param zh
+ * @param limit_long
+ * @param limit_short
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_zone_handle_set_limits(const raplcap_zone_handle* zh,
+                                   const raplcap_limit* limit_long, const raplcap_limit* limit_short);
+
+/**
+ * Get the current energy counter value for a zone handle in Joules.
+ * The handle is not validated - it must have been returned by raplcap_pd_get_zone_handle.
+ * Note that the counter rolls over - check the max value.
+ *
+ * @param zh
+ * @return Joules on success, a negative value on error
+ */
+double raplcap_zone_handle_get_energy_counter(const raplcap_zone_handle* zh);
+
+/**
+ * Get the maximum energy counter value for a zone handle in Joules.
+ * The handle is not validated - it must have been returned by raplcap_pd_get_zone_handle.
+ *
+ * @param zh
+ * @return Joules on success, a negative value on error
+ */
+double raplcap_zone_handle_get_energy_counter_max(const raplcap_zone_handle* zh);
+
+/**
+ * Allocate a snapshot sized for all packages, die, and zones in an initialized context.
+ *
+ * @param rc
+ * @return a snapshot on success, NULL on error
+ */
+raplcap_snapshot* raplcap_snapshot_alloc(const raplcap* rc);
+
+/**
+ * Free a snapshot.
+ *
+ * @param snap
+ */
+void raplcap_snapshot_free(raplcap_snapshot* snap);
+
+/**
+ * Read the energy counters, limits, and status of all zones, with as few system calls as the implementation allows.
+ *
+ * @param rc
+ * @param snap
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_snapshot_read(const raplcap* rc, raplcap_snapshot* snap);
+
+/**
+ * Get the monotonic time at which a snapshot was read, in nanoseconds.
+ *
+ * @param snap
+ * @return nanoseconds
+ */
+uint64_t raplcap_snapshot_get_timestamp_ns(const raplcap_snapshot* snap);
+
+/**
+ * Get a zone's state from a snapshot.
+ *
+ * @param snap
+ * @param pkg
+ * @param die
+ * @param zone
+ * @return the zone state on success, NULL on error
+ */
+const raplcap_snapshot_zone* raplcap_snapshot_get_zone(const raplcap_snapshot* snap,
+                                                       uint32_t pkg, uint32_t die, raplcap_zone zone);
+
+/**
+ * Get a zone's average power in Watts between two snapshots, accounting for (at most one) counter rollover.
+ *
+ * @param prev
+ * @param cur
+ * @param pkg
+ * @param die
+ * @param zone
+ * @return Watts on success, a negative value on error
+ */
+double raplcap_snapshot_get_watts(const raplcap_snapshot* prev, const raplcap_snapshot* cur,
+                                  uint32_t pkg, uint32_t die, raplcap_zone zone);
+
 /**
  * Assumes die=0.
  *
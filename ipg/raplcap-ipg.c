@@ -14,6 +14,7 @@
 #include "raplcap-wrappers.h"
 #define RAPLCAP_IMPL "raplcap-ipg"
 #include "raplcap-common.h"
+#include "raplcap-snapshot-common.h"
 #ifdef _WIN32
 #include <wchar.h>
 #include <Windows.h>
@@ -44,6 +45,12 @@ typedef bool (*IPGGetMsrFunc) (int iMsr, int* funcID);
 typedef bool (*IPGReadSample) ();
 typedef bool (*IPGGetPowerData) (int iNode, int iMSR, double* result, int* nResult);
 
+// IPG has no lower-level resources to resolve, so handles just remember their parameters
+struct raplcap_zone_handle {
+  const raplcap* rc;
+  uint32_t pkg;
+};
+
 typedef struct raplcap_ipg {
 #ifdef _WIN32
   HMODULE hMod;
@@ -55,6 +62,7 @@ typedef struct raplcap_ipg {
   IPGReadSample pReadSample;
   IPGGetPowerData pGetPowerData;
   uint32_t n_pkg;
+  raplcap_zone_handle* handles;
   int msr_pkg_power_energy;
   int msr_pkg_power_limit;
 } raplcap_ipg;
@@ -153,6 +161,7 @@ static int initEnergyLib(raplcap_ipg* state, int* nNodes) {
 
 int raplcap_init(raplcap* rc) {
   raplcap_ipg* state;
+  uint32_t i;
   int nNodes;
   if (rc == NULL) {
     rc = &rc_default;
@@ -161,6 +170,7 @@ int raplcap_init(raplcap* rc) {
     raplcap_perror(ERROR, "raplcap_init: malloc");
     return -1;
   }
+  state->handles = NULL;
   rc->state = state;
   if (getEnergyLib(state) || initEnergyLib(state, &nNodes)) {
     raplcap_destroy(rc);
@@ -168,6 +178,15 @@ int raplcap_init(raplcap* rc) {
   }
   assert(nNodes > 0);
   state->n_pkg = (uint32_t) nNodes;
+  if ((state->handles = (raplcap_zone_handle*) malloc(state->n_pkg * sizeof(raplcap_zone_handle))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_init: malloc");
+    raplcap_destroy(rc);
+    return -1;
+  }
+  for (i = 0; i < state->n_pkg; i++) {
+    state->handles[i].rc = rc;
+    state->handles[i].pkg = i;
+  }
   rc->nsockets = state->n_pkg;
   raplcap_log(DEBUG, "raplcap_init: Initialized\n");
   return 0;
@@ -185,6 +204,9 @@ int raplcap_destroy(raplcap* rc) {
     raplcap_log(DEBUG, "raplcap_destroy: Freed library handler\n");
   }
 #endif
+  if (state != NULL) {
+    free(state->handles);
+  }
   free(state);
   rc->state = NULL;
   rc->nsockets = 0;
@@ -323,6 +345,32 @@ int raplcap_pd_set_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap
   return -1;
 }
 
+int raplcap_pd_quantize_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  // not supported by IPG, since limits can't be set
+  (void) rc;
+  (void) pkg;
+  (void) die;
+  (void) zone;
+  (void) limit_long;
+  (void) limit_short;
+  errno = ENOSYS;
+  return -1;
+}
+
+int raplcap_pd_get_zone_status(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_zone_status* status) {
+  if (status == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  // enabled, clamped, and locked are not supported by IPG
+  status->enabled = -1;
+  status->clamped = -1;
+  status->locked = -1;
+  return raplcap_pd_get_limits(rc, pkg, die, zone, &status->limit_long, &status->limit_short);
+}
+
 double raplcap_pd_get_energy_counter(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
   int nResult = 0;
   double data[MSR_FUNC_N_RESULTS_MAX] = { 0 };
@@ -355,3 +403,72 @@ double raplcap_pd_get_energy_counter_max(const raplcap* rc, uint32_t pkg, uint32
   errno = ENOSYS;
   return -1;
 }
+
+const raplcap_zone_handle* raplcap_pd_get_zone_handle(const raplcap* rc, uint32_t pkg, uint32_t die,
+                                                      raplcap_zone zone) {
+  int supported = raplcap_pd_is_zone_supported(rc, pkg, die, zone);
+  if (supported <= 0) {
+    if (supported == 0) {
+      errno = ENOTSUP;
+    }
+    return NULL;
+  }
+  // will not be NULL if zone is supported
+  return &get_state(rc, pkg, die)->handles[pkg];
+}
+
+int raplcap_zone_handle_get_limits(const raplcap_zone_handle* zh, raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  return raplcap_pd_get_limits(zh->rc, zh->pkg, 0, RAPLCAP_ZONE_PACKAGE, limit_long, limit_short);
+}
+
+int raplcap_zone_handle_set_limits(const raplcap_zone_handle* zh,
+                                   const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  return raplcap_pd_set_limits(zh->rc, zh->pkg, 0, RAPLCAP_ZONE_PACKAGE, limit_long, limit_short);
+}
+
+double raplcap_zone_handle_get_energy_counter(const raplcap_zone_handle* zh) {
+  return raplcap_pd_get_energy_counter(zh->rc, zh->pkg, 0, RAPLCAP_ZONE_PACKAGE);
+}
+
+double raplcap_zone_handle_get_energy_counter_max(const raplcap_zone_handle* zh) {
+  return raplcap_pd_get_energy_counter_max(zh->rc, zh->pkg, 0, RAPLCAP_ZONE_PACKAGE);
+}
+
+raplcap_snapshot* raplcap_snapshot_alloc(const raplcap* rc) {
+  const raplcap_ipg* state = get_state(rc, 0, 0);
+  if (state == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return snapshot_alloc(state->n_pkg, 1);
+}
+
+int raplcap_snapshot_read(const raplcap* rc, raplcap_snapshot* snap) {
+  raplcap_snapshot_zone* sz;
+  const raplcap_ipg* state = get_state(rc, 0, 0);
+  uint32_t pkg;
+  int zone;
+  int ret = 0;
+  if (state == NULL || snap == NULL || snap->n_pkg != state->n_pkg || snap->n_die != 1) {
+    raplcap_log(ERROR, "raplcap_snapshot_read: Context not initialized or snapshot not allocated for it\n");
+    errno = EINVAL;
+    return -1;
+  }
+  for (pkg = 0; pkg < snap->n_pkg; pkg++) {
+    for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+      snapshot_zone_reset(snapshot_zone(snap, pkg, 0, (raplcap_zone) zone));
+    }
+    // only package is supported; enabled, clamped, and locked are unknown
+    sz = snapshot_zone(snap, pkg, 0, RAPLCAP_ZONE_PACKAGE);
+    sz->supported = 1;
+    if (raplcap_pd_get_limits(rc, pkg, 0, RAPLCAP_ZONE_PACKAGE, &sz->limit_long, &sz->limit_short)) {
+      ret = -1;
+    }
+    if ((sz->joules = raplcap_pd_get_energy_counter(rc, pkg, 0, RAPLCAP_ZONE_PACKAGE)) < 0 ||
+        (sz->joules_max = raplcap_pd_get_energy_counter_max(rc, pkg, 0, RAPLCAP_ZONE_PACKAGE)) < 0) {
+      ret = -1;
+    }
+  }
+  snap->timestamp_ns = snapshot_now_ns();
+  return ret;
+}
@@ -4,9 +4,15 @@
  * @author Connor Imes
  * @date 2017-12-16
  */
+// for PATH_MAX
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "raplcap-common.h"
 #include "raplcap-cpuid.h"
 #include "raplcap-msr-common.h"
@@ -40,15 +46,6 @@ static uint64_t pow2_u64(uint64_t y) {
   return ((uint64_t) 1) << y;
 }
 
-// log2(y); returns 0 for y = 0
-static uint64_t log2_u64(uint64_t y) {
-  uint64_t ret = 0;
-  while (y >>= 1) {
-    ret++;
-  }
-  return ret;
-}
-
 // Section 14.9.1
 static double from_msr_pu_default(uint64_t msrval) {
   return 1.0 / pow2_u64((msrval >> PU_SHIFT) & PU_MASK);
@@ -117,34 +114,6 @@ static double from_msr_tw_default(uint64_t bits, double time_units) {
   return seconds;
 }
 
-// Section 14.9.3
-static uint64_t to_msr_tw_default(double seconds, double time_units) {
-  assert(seconds > 0);
-  assert(time_units > 0);
-  // Seconds cannot be shorter than the smallest time unit - log2 would get a negative value and overflow "y".
-  // They also cannot be larger than 2^2^5-1 so that log2 doesn't produce a value that uses more than 5 bits for "y".
-  // Clamping prevents values outside the allowable range, but precision can still be lost in the conversion.
-  static const double MSR_TIME_MIN = 1.0;
-  static const double MSR_TIME_MAX = (double) 0xFFFFFFFF;
-  double t = seconds / time_units;
-  if (t < MSR_TIME_MIN) {
-    raplcap_log(WARN, "Time window too small: %.12f sec, using min: %.12f sec\n", seconds, MSR_TIME_MIN * time_units);
-    t = MSR_TIME_MIN;
-  } else if (t > MSR_TIME_MAX) {
-    // "trying" instead of "using" because precision loss will definitely throw off the final value at this extreme
-    raplcap_log(WARN, "Time window too large: %.12f sec, trying max: %.12f sec\n", seconds, MSR_TIME_MAX * time_units);
-    t = MSR_TIME_MAX;
-  }
-  // y = log2((4*t)/(4+f)); we can ignore "f" since t >= 1 and 0 <= f <= 3; we can also drop the real part of "t"
-  const uint64_t y = log2_u64((uint64_t) t);
-  // f = (4*t)/(2^y)-4; the real part of "t" only matters for t < 4, otherwise it's insignificant in computing "f"
-  const uint64_t f = (((uint64_t) (4 * t)) / pow2_u64(y)) - 4;
-  const uint64_t bits = ((y & 0x1F) | ((f & 0x3) << 5));
-  raplcap_log(DEBUG, "to_msr_tw_default: seconds=%.12f, time_units=%.12f, t=%.12f, y=0x%02lX, f=0x%lX, bits=0x%02lX\n",
-              seconds, time_units, t, y, f, bits);
-  return bits;
-}
-
 // Table 2-8
 static double from_msr_tw_atom(uint64_t bits, double time_units) {
   assert(time_units > 0);
@@ -154,28 +123,6 @@ static double from_msr_tw_atom(uint64_t bits, double time_units) {
   return seconds;
 }
 
-// Table 2-8
-static uint64_t to_msr_tw_atom(double seconds, double time_units) {
-  assert(seconds > 0);
-  assert(time_units > 0);
-  // time_units should be 1.0, but conceivably could be any whole number in 4 bit range: [1, 15]
-  static const uint64_t MSR_TIME_MAX = 0x7F;
-  const double t = seconds / time_units;
-  uint64_t bits;
-  if (seconds < 1) {
-    raplcap_log(WARN, "Time window too small: %.12f sec, using min: %.12f sec\n", seconds, 1.0);
-    bits = 0x0; // interpreted as 1 second
-  } else if (t > (double) MSR_TIME_MAX) {
-    raplcap_log(WARN, "Time window too large: %.12f sec, using max: %.12f sec\n", seconds, MSR_TIME_MAX * time_units);
-    bits = MSR_TIME_MAX;
-  } else {
-    // round to nearest MSR value ((s + u/2) / u)
-    bits = (uint64_t) (t + 0.5);
-  }
-  raplcap_log(DEBUG, "to_msr_tw_atom: seconds=%.12f, bits=0x%02lX\n", seconds, bits);
-  return bits;
-}
-
 // Table 2-11
 static double from_msr_tw_atom_airmont(uint64_t bits, double time_units) {
   // Used only for Airmont PP0 (CORE) zone
@@ -186,73 +133,126 @@ static double from_msr_tw_atom_airmont(uint64_t bits, double time_units) {
   return seconds;
 }
 
-// Table 2-11
-static uint64_t to_msr_tw_atom_airmont(double seconds, double time_units) {
-  // Used only for Airmont PP0 (CORE) zone
-  (void) time_units;
-  assert(seconds > 0);
-  static const uint64_t MSR_TIME_MIN = 0x0; // 1 second
-  static const uint64_t MSR_TIME_MAX = 0xA; // 50 seconds
-  uint64_t bits;
-  if (seconds < 1) {
-    raplcap_log(WARN, "Time window too small: %.12f sec, using min: 1 sec\n", seconds);
-    bits = MSR_TIME_MIN;
-  } else if (seconds > 50) {
-    raplcap_log(WARN, "Time window too large: %.12f sec, using max: 50 sec\n", seconds);
-    bits = MSR_TIME_MAX;
-  } else {
-    // round to nearest multiple of 5
-    bits = (uint64_t) ((seconds / 5.0) + 0.5);
-  }
-  raplcap_log(DEBUG, "to_msr_tw_atom_airmont: seconds=%.12f, time_units=%.12f, bits=0x%02lX\n",
-              seconds, time_units, bits);
-  return bits;
-}
-
-#define CFG_STATIC_INIT(ttw, ftw, tpl, fpl, c) { \
-  .to_msr_tw = ttw, \
+#define CFG_STATIC_INIT(ftw, tpl, fpl, c) { \
   .from_msr_tw = ftw, \
   .to_msr_pl = tpl, \
   .from_msr_pl = fpl, \
   .constraints = c }
 
 static const raplcap_msr_zone_cfg CFG_DEFAULT[RAPLCAP_NZONES] = {
-  CFG_STATIC_INIT(to_msr_tw_default, from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 2), // PACKAGE
-  CFG_STATIC_INIT(to_msr_tw_default, from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 1), // CORE
-  CFG_STATIC_INIT(to_msr_tw_default, from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 1), // UNCORE
-  CFG_STATIC_INIT(to_msr_tw_default, from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 1), // DRAM
-  CFG_STATIC_INIT(to_msr_tw_default, from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 2)  // PSYS
+  CFG_STATIC_INIT(from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 2), // PACKAGE
+  CFG_STATIC_INIT(from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 1), // CORE
+  CFG_STATIC_INIT(from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 1), // UNCORE
+  CFG_STATIC_INIT(from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 1), // DRAM
+  CFG_STATIC_INIT(from_msr_tw_default, to_msr_pl_default, from_msr_pl_default, 2)  // PSYS
 };
 
 static const raplcap_msr_zone_cfg CFG_ATOM[RAPLCAP_NZONES] = {
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // PACKAGE
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // CORE
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // UNCORE
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // DRAM
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 2), // PSYS
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // PACKAGE
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // CORE
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // UNCORE
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // DRAM
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 2), // PSYS
 };
 
 // only the CORE time window is different from other ATOM CPUs
 static const raplcap_msr_zone_cfg CFG_ATOM_AIRMONT[RAPLCAP_NZONES] = {
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // PACKAGE
-  CFG_STATIC_INIT(to_msr_tw_atom_airmont, from_msr_tw_atom_airmont, to_msr_pl_default, from_msr_pl_default, 1), // CORE
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // UNCORE
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // DRAM
-  CFG_STATIC_INIT(to_msr_tw_atom, from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 2), // PSYS
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // PACKAGE
+  CFG_STATIC_INIT(from_msr_tw_atom_airmont, to_msr_pl_default, from_msr_pl_default, 1), // CORE
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // UNCORE
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 1), // DRAM
+  CFG_STATIC_INIT(from_msr_tw_atom, to_msr_pl_default, from_msr_pl_default, 2), // PSYS
 };
 
+// Parse the vendor, family, and model of the first CPU in a simulated /proc/cpuinfo
+static int get_sim_cpuid(const char* root, int* is_intel, uint32_t* family, uint32_t* model) {
+  char fname[PATH_MAX];
+  char line[256];
+  char vendor[16] = { 0 };
+  FILE* f;
+  int found = 0;
+  snprintf(fname, sizeof(fname), "%s/proc/cpuinfo", root);
+  if ((f = fopen(fname, "r")) == NULL) {
+    raplcap_perror(ERROR, fname);
+    return -1;
+  }
+  while (found != 0x7 && fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "vendor_id : %15s", vendor) == 1) {
+      found |= 0x1;
+    } else if (sscanf(line, "cpu family : %"SCNu32, family) == 1) {
+      found |= 0x2;
+    } else if (sscanf(line, "model : %"SCNu32, model) == 1) {
+      found |= 0x4;
+    }
+  }
+  if (fclose(f)) {
+    raplcap_perror(WARN, "get_sim_cpuid: fclose");
+  }
+  if (found != 0x7) {
+    raplcap_log(ERROR, "get_sim_cpuid: Failed to parse vendor_id, cpu family, and model from %s\n", fname);
+    errno = ENODATA;
+    return -1;
+  }
+  *is_intel = !strncmp(vendor, CPUID_VENDOR_ID_GENUINE_INTEL, sizeof(CPUID_VENDOR_ID_GENUINE_INTEL));
+  raplcap_log(DEBUG, "get_sim_cpuid: vendor_id=%s, cpu_family=%02X, cpu_model=%02X\n", vendor, *family, *model);
+  return 0;
+}
+
 uint32_t msr_get_supported_cpu_model(void) {
+  const char* sim_root = getenv(ENV_RAPLCAP_MSR_SIM_ROOT);
   uint32_t cpu_family;
   uint32_t cpu_model;
-  cpuid_get_family_model(&cpu_family, &cpu_model);
-  if (!cpuid_is_vendor_intel() || !cpuid_is_cpu_supported(cpu_family, cpu_model)) {
+  int is_intel;
+  if (sim_root != NULL) {
+    if (get_sim_cpuid(sim_root, &is_intel, &cpu_family, &cpu_model)) {
+      return 0;
+    }
+  } else {
+    cpuid_get_family_model(&cpu_family, &cpu_model);
+    is_intel = cpuid_is_vendor_intel();
+  }
+  if (!is_intel || !cpuid_is_cpu_supported(cpu_family, cpu_model)) {
     raplcap_log(ERROR, "CPU not supported: Family=%"PRIu32", Model=%02X\n", cpu_family, cpu_model);
     return 0;
   }
   return cpu_model;
 }
 
+static int cmp_msr_tw_entry(const void* a, const void* b) {
+  const msr_tw_entry* ea = (const msr_tw_entry*) a;
+  const msr_tw_entry* eb = (const msr_tw_entry*) b;
+  if (ea->seconds < eb->seconds) {
+    return -1;
+  }
+  if (ea->seconds > eb->seconds) {
+    return 1;
+  }
+  return ea->bits > eb->bits ? 1 : (ea->bits < eb->bits ? -1 : 0);
+}
+
+// Decode every time window encoding, and sort the distinct encodable values for searching
+static void init_tw_table(msr_tw_table* tw, const raplcap_msr_zone_cfg* cfg, double time_units) {
+  // Airmont CORE zone only allows windows up to 50 seconds
+  const uint32_t n_encodable = cfg->from_msr_tw == from_msr_tw_atom_airmont ? 0xA + 1 : MSR_TW_NVALUES;
+  uint32_t i;
+  for (i = 0; i < MSR_TW_NVALUES; i++) {
+    tw->seconds[i] = cfg->from_msr_tw(i, time_units);
+  }
+  for (i = 0; i < n_encodable; i++) {
+    tw->sorted[i].seconds = tw->seconds[i];
+    tw->sorted[i].bits = (uint8_t) i;
+  }
+  qsort(tw->sorted, n_encodable, sizeof(tw->sorted[0]), cmp_msr_tw_entry);
+  // when encodings are equivalent (e.g., 0 means 1 second for Atom), keep the largest (the explicit encoding)
+  for (i = 1, tw->n_sorted = 0; i <= n_encodable; i++) {
+    if (i == n_encodable || tw->sorted[i].seconds > tw->sorted[i - 1].seconds) {
+      tw->sorted[tw->n_sorted++] = tw->sorted[i - 1];
+    }
+  }
+}
+
 void msr_get_context(raplcap_msr_ctx* ctx, uint32_t cpu_model, uint64_t units_msrval) {
+  int i;
   assert(ctx != NULL);
   assert(cpu_model > 0);
   ctx->cpu_model = cpu_model;
@@ -335,11 +335,81 @@ void msr_get_context(raplcap_msr_ctx* ctx, uint32_t cpu_model, uint64_t units_ms
       assert(0);
       break;
   }
+  for (i = 0; i < RAPLCAP_NZONES; i++) {
+    init_tw_table(&ctx->tw[i], &ctx->cfg[i], ctx->time_units);
+  }
+  ctx->tw_rounding = RAPLCAP_MSR_ROUND_NEAREST;
   raplcap_log(DEBUG, "msr_get_context: model=%02X, "
               "power_units=%.12f, energy_units=%.12f, energy_units_dram=%.12f, time_units=%.12f\n",
               ctx->cpu_model, ctx->power_units, ctx->energy_units, ctx->energy_units_dram, ctx->time_units);
 }
 
+// Search the table without logging; sets clamped if seconds is outside the encodable range
+static const msr_tw_entry* find_tw_entry(const msr_tw_table* tw, double seconds, raplcap_msr_rounding rounding,
+                                         int* clamped) {
+  const msr_tw_entry* min = &tw->sorted[0];
+  const msr_tw_entry* max = &tw->sorted[tw->n_sorted - 1];
+  const msr_tw_entry* e;
+  uint32_t lo = 0;
+  uint32_t hi = tw->n_sorted - 1;
+  uint32_t mid;
+  *clamped = seconds < min->seconds || seconds > max->seconds;
+  if (seconds < min->seconds) {
+    return min;
+  }
+  if (seconds > max->seconds) {
+    return max;
+  }
+  // find the largest value <= seconds, so sorted[lo].seconds <= seconds <= sorted[lo + 1].seconds
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (tw->sorted[mid].seconds <= seconds) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  e = &tw->sorted[lo];
+  if (e->seconds < seconds && e != max) {
+    switch (rounding) {
+      case RAPLCAP_MSR_ROUND_FLOOR:
+        break;
+      case RAPLCAP_MSR_ROUND_CEIL:
+        e++;
+        break;
+      case RAPLCAP_MSR_ROUND_NEAREST:
+      default:
+        // ties round up
+        if ((e + 1)->seconds - seconds <= seconds - e->seconds) {
+          e++;
+        }
+        break;
+    }
+  }
+  return e;
+}
+
+uint64_t msr_to_tw_bits(const raplcap_msr_ctx* ctx, raplcap_zone zone, double seconds, raplcap_msr_rounding rounding) {
+  assert(ctx != NULL);
+  assert(seconds > 0);
+  const msr_tw_table* tw = &ctx->tw[zone];
+  int clamped;
+  const msr_tw_entry* e = find_tw_entry(tw, seconds, rounding, &clamped);
+  if (clamped && e == &tw->sorted[0]) {
+    raplcap_log(WARN, "Time window too small: %.12f sec, using min: %.12f sec\n", seconds, e->seconds);
+  } else if (clamped) {
+    raplcap_log(WARN, "Time window too large: %.12f sec, using max: %.12f sec\n", seconds, e->seconds);
+  }
+  raplcap_log(DEBUG, "msr_to_tw_bits: zone=%d, seconds=%.12f, rounding=%d, bits=0x%02X, actual=%.12f\n",
+              zone, seconds, rounding, e->bits, e->seconds);
+  return e->bits;
+}
+
+double msr_from_tw_bits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t bits) {
+  assert(ctx != NULL);
+  return ctx->tw[zone].seconds[bits & TL_MASK];
+}
+
 // Replace the requested msrval bits with data the data in situ; first and last are inclusive
 static uint64_t replace_bits(uint64_t msrval, uint64_t data, uint8_t first, uint8_t last) {
   assert(first <= last);
@@ -430,7 +500,7 @@ void msr_get_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t msrv
   assert(ctx != NULL);
   if (limit_long != NULL) {
     limit_long->watts = ctx->cfg[zone].from_msr_pl((msrval >> PL1_SHIFT) & PL_MASK, ctx->power_units);
-    limit_long->seconds = ctx->cfg[zone].from_msr_tw((msrval >> TL1_SHIFT) & TL_MASK, ctx->time_units);
+    limit_long->seconds = msr_from_tw_bits(ctx, zone, (msrval >> TL1_SHIFT) & TL_MASK);
     raplcap_log(DEBUG, "msr_get_limits: zone=%d, long_term:\n\ttime=%.12f s\n\tpower=%.12f W\n",
                 zone, limit_long->seconds, limit_long->watts);
   }
@@ -439,7 +509,7 @@ void msr_get_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t msrv
     if (zone == RAPLCAP_ZONE_PSYS) {
       raplcap_log(DEBUG, "msr_get_limits: Documentation does not specify PSys/Platform short term time window\n");
     }
-    limit_short->seconds = ctx->cfg[zone].from_msr_tw((msrval >> TL2_SHIFT) & TL_MASK, ctx->time_units);
+    limit_short->seconds = msr_from_tw_bits(ctx, zone, (msrval >> TL2_SHIFT) & TL_MASK);
     raplcap_log(DEBUG, "msr_get_limits: zone=%d, short_term:\n\ttime=%.12f s\n\tpower=%.12f W\n",
                 zone, limit_short->seconds, limit_short->watts);
   }
@@ -455,7 +525,7 @@ uint64_t msr_set_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t
       msrval = replace_bits(msrval, ctx->cfg[zone].to_msr_pl(limit_long->watts, ctx->power_units), 0, 14);
     }
     if (limit_long->seconds > 0) {
-      msrval = replace_bits(msrval, ctx->cfg[zone].to_msr_tw(limit_long->seconds, ctx->time_units), 17, 23);
+      msrval = replace_bits(msrval, msr_to_tw_bits(ctx, zone, limit_long->seconds, ctx->tw_rounding), 17, 23);
     }
   }
   if (limit_short != NULL && HAS_SHORT_TERM(ctx, zone)) {
@@ -470,13 +540,65 @@ uint64_t msr_set_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t
         // Table 2-38: PSYS has power limit #2, but time window #2 is chosen by the processor
         raplcap_log(WARN, "Not allowed to set PSys/Platform short term time window\n");
       } else {
-        msrval = replace_bits(msrval, ctx->cfg[zone].to_msr_tw(limit_short->seconds, ctx->time_units), 49, 55);
+        msrval = replace_bits(msrval, msr_to_tw_bits(ctx, zone, limit_short->seconds, ctx->tw_rounding), 49, 55);
       }
     }
   }
   return msrval;
 }
 
+// Mirrors to_msr_pl_default, which all CPU models use, without logging
+static void quantize_pl(const raplcap_msr_ctx* ctx, double* watts, int* clamped) {
+  uint64_t bits;
+  *clamped = 0;
+  if (*watts > 0) {
+    bits = (uint64_t) (*watts / ctx->power_units);
+    if (bits > PL_MASK) {
+      bits = PL_MASK;
+      *clamped = 1;
+    }
+    *watts = bits * ctx->power_units;
+  }
+}
+
+static void quantize_tw(const raplcap_msr_ctx* ctx, raplcap_zone zone, double* seconds, int* clamped) {
+  *clamped = 0;
+  if (*seconds > 0) {
+    *seconds = find_tw_entry(&ctx->tw[zone], *seconds, ctx->tw_rounding, clamped)->seconds;
+  }
+}
+
+int msr_quantize_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone,
+                        raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  assert(ctx != NULL);
+  int clamped;
+  int flags = 0;
+  if (limit_long != NULL) {
+    quantize_pl(ctx, &limit_long->watts, &clamped);
+    flags |= clamped ? RAPLCAP_QUANTIZE_LONG_WATTS_CLAMPED : 0;
+    quantize_tw(ctx, zone, &limit_long->seconds, &clamped);
+    flags |= clamped ? RAPLCAP_QUANTIZE_LONG_SECONDS_CLAMPED : 0;
+  }
+  if (limit_short != NULL) {
+    if (HAS_SHORT_TERM(ctx, zone)) {
+      quantize_pl(ctx, &limit_short->watts, &clamped);
+      flags |= clamped ? RAPLCAP_QUANTIZE_SHORT_WATTS_CLAMPED : 0;
+      if (zone == RAPLCAP_ZONE_PSYS) {
+        // not written - see msr_set_limits
+        limit_short->seconds = 0;
+      } else {
+        quantize_tw(ctx, zone, &limit_short->seconds, &clamped);
+        flags |= clamped ? RAPLCAP_QUANTIZE_SHORT_SECONDS_CLAMPED : 0;
+      }
+    } else {
+      limit_short->watts = 0;
+      limit_short->seconds = 0;
+    }
+  }
+  raplcap_log(DEBUG, "msr_quantize_limits: zone=%d, flags=0x%X\n", zone, flags);
+  return flags;
+}
+
 double msr_get_energy_counter(const raplcap_msr_ctx* ctx, uint64_t msrval, raplcap_zone zone) {
   assert(ctx != NULL);
   const double joules = ((msrval >> EY_SHIFT) & EY_MASK) *
@@ -495,8 +617,8 @@ double msr_get_energy_counter_max(const raplcap_msr_ctx* ctx, raplcap_zone zone)
 
 double msr_get_time_units(const raplcap_msr_ctx* ctx, raplcap_zone zone) {
   assert(ctx != NULL);
-  // Airmont PACKAGE domain doesn't use normal time units
-  const double sec = ctx->cfg[zone].to_msr_tw == to_msr_tw_atom_airmont ? 5.0 : ctx->time_units;
+  // Airmont CORE domain doesn't use normal time units
+  const double sec = ctx->cfg[zone].from_msr_tw == from_msr_tw_atom_airmont ? 5.0 : ctx->time_units;
   raplcap_log(DEBUG, "msr_get_time_units: sec=%.12f\n", sec);
   return sec;
 }
@@ -7,6 +7,7 @@ extern "C" {
 
 #include <inttypes.h>
 #include "raplcap.h"
+#include "raplcap-msr.h"
 
 #pragma GCC visibility push(hidden)
 
@@ -29,17 +30,41 @@ extern "C" {
 
 #define RAPLCAP_NZONES (RAPLCAP_ZONE_PSYS + 1)
 
+// Environment variable naming a directory that simulates the root filesystem, for testing without MSR access.
+// CPU topology is read from sys/devices/system/cpu/cpu*/topology, the CPU model from proc/cpuinfo, and MSRs are
+// regular files at dev/cpu/*/msr, with MSR addresses as file offsets.
+#define ENV_RAPLCAP_MSR_SIM_ROOT "RAPLCAP_MSR_SIM_ROOT"
+
 typedef uint64_t (fn_to_msr) (double value, double units);
 typedef double (fn_from_msr) (uint64_t bits, double units);
 
 typedef struct raplcap_msr_zone_cfg {
-  fn_to_msr* to_msr_tw;
+  // time windows are encoded by searching a table built from this function - see msr_tw_table
   fn_from_msr* from_msr_tw;
   fn_to_msr* to_msr_pl;
   fn_from_msr* from_msr_pl;
   uint8_t constraints;
 } raplcap_msr_zone_cfg;
 
+// The number of 7-bit time window encodings
+#define MSR_TW_NVALUES 128
+
+typedef struct msr_tw_entry {
+  double seconds;
+  uint8_t bits;
+} msr_tw_entry;
+
+/**
+ * Time window encodings, precomputed for a zone's time units.
+ */
+typedef struct msr_tw_table {
+  // decoded seconds, indexed by encoding
+  double seconds[MSR_TW_NVALUES];
+  // distinct encodable values, sorted by seconds
+  msr_tw_entry sorted[MSR_TW_NVALUES];
+  uint32_t n_sorted;
+} msr_tw_table;
+
 typedef struct raplcap_msr_ctx {
   const raplcap_msr_zone_cfg* cfg;
   double power_units;
@@ -47,6 +72,8 @@ typedef struct raplcap_msr_ctx {
   double energy_units_dram;
   double time_units;
   uint32_t cpu_model;
+  msr_tw_table tw[RAPLCAP_NZONES];
+  raplcap_msr_rounding tw_rounding;
 } raplcap_msr_ctx;
 
 /**
@@ -59,6 +86,17 @@ uint32_t msr_get_supported_cpu_model(void);
  */
 void msr_get_context(raplcap_msr_ctx* ctx, uint32_t cpu_model, uint64_t units_msrval);
 
+/**
+ * Translate seconds to the nearest (or floor/ceiling) time window encoding using the precomputed table.
+ * Values outside the encodable range are clamped.
+ */
+uint64_t msr_to_tw_bits(const raplcap_msr_ctx* ctx, raplcap_zone zone, double seconds, raplcap_msr_rounding rounding);
+
+/**
+ * Translate a time window encoding to seconds using the precomputed table.
+ */
+double msr_from_tw_bits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t bits);
+
 /**
  * Parse msrval to determine if zone is enabled.
  */
@@ -105,6 +143,13 @@ void msr_get_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t msrv
 uint64_t msr_set_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t msrval,
                         const raplcap_limit* limit_long, const raplcap_limit* limit_short);
 
+/**
+ * Convert limit values > 0 in place to the values that msr_set_limits would encode, without logging.
+ * Returns raplcap_quantize_flag values for any that are clamped.
+ */
+int msr_quantize_limits(const raplcap_msr_ctx* ctx, raplcap_zone zone,
+                        raplcap_limit* limit_long, raplcap_limit* limit_short);
+
 /**
  * Get the energy counter value in Joules.
  */
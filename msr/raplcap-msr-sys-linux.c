@@ -4,25 +4,98 @@
  * @author Connor Imes
  * @date 2020-06-09
  */
-// for popen, pread, pwrite, sysconf
-#define _POSIX_C_SOURCE 200809L
+// for pread, pwrite, sysconf, pthread_setaffinity_np
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "raplcap-common.h"
+#include "raplcap-msr-common.h"
 #include "raplcap-msr-sys.h"
 
+// msr-safe batch interface - see msr_batch.h in https://github.com/LLNL/msr-safe
+#define MSR_SAFE_BATCH_FILE "%s/dev/cpu/msr_batch"
+
+struct msr_batch_op {
+  uint16_t cpu;     // In: CPU to execute {rd/wr}msr instruction
+  uint16_t isrdmsr; // In: 0=wrmsr, non-zero=rdmsr
+  int32_t err;      // Out: set if error occurred with this operation
+  uint32_t msr;     // In: MSR Address to perform operation
+  uint64_t msrdata; // In/Out: Input/Result to/from operation
+  uint64_t wmask;   // Out: Write mask applied to wrmsr
+};
+
+struct msr_batch_array {
+  uint32_t numops;
+  struct msr_batch_op* ops;
+};
+
+#define X86_IOC_MSR_BATCH _IOWR('c', 0xA2, struct msr_batch_array)
+
+// Environment variable to enable a pool of worker threads, one pinned to each package, to access MSRs concurrently
+#define ENV_RAPLCAP_MSR_WORKERS "RAPLCAP_MSR_WORKERS"
+
+// Environment variable with a comma-separated list of CPUs to prefer for MSR access when the caller isn't running on
+// the target package/die, e.g., to keep interrupts away from CPUs running latency-sensitive work
+#define ENV_RAPLCAP_MSR_HOUSEKEEPING_CPUS "RAPLCAP_MSR_HOUSEKEEPING_CPUS"
+
+// States of lazily-opened per-CPU file descriptors
+#define CPU_FD_UNOPENED -1
+#define CPU_FD_FAILED -2
+
+// Filter value for accessing ops on all packages
+#define ALL_PKGS UINT32_MAX
+
+typedef struct msr_sys_worker {
+  const struct raplcap_msr_sys_ctx* ctx;
+  pthread_t thread;
+  uint32_t pkg;
+} msr_sys_worker;
+
+typedef struct msr_sys_pool {
+  msr_sys_worker* workers;
+  uint32_t n_workers;
+  // serializes callers, since there's only one job at a time
+  pthread_mutex_t submit_lock;
+  pthread_mutex_t lock;
+  pthread_cond_t cond_work;
+  pthread_cond_t cond_done;
+  // the current job
+  msr_sys_op* ops;
+  uint32_t n_ops;
+  int is_read;
+  uint64_t generation;
+  uint32_t n_pending;
+  int stop;
+} msr_sys_pool;
+
 struct raplcap_msr_sys_ctx {
   int* fds;
+  uint32_t* cpus;
   uint32_t n_fds;
   uint32_t n_pkg;
   uint32_t n_die;
+  // only opened when msr-safe is in use for all fds, -1 otherwise
+  int batch_fd;
+  // NULL unless enabled with ENV_RAPLCAP_MSR_WORKERS
+  msr_sys_pool* pool;
+  // per-CPU file descriptors, opened lazily when the caller is running on a CPU in the target package/die
+  int* cpu_fds;
+  // the fds index (pkg/die) that each CPU belongs to
+  uint32_t* cpu_pkg_die;
+  uint32_t n_cpus;
+  int open_flags;
+  int is_msr_safe;
 };
 
 typedef struct msr_topology {
@@ -31,16 +104,24 @@ typedef struct msr_topology {
   uint32_t cpu;
 } msr_topology;
 
-static int open_msr(uint32_t core, int flags) {
-  char msr_filename[32];
+// Paths are relative to the simulation root directory when ENV_RAPLCAP_MSR_SIM_ROOT is set, otherwise to "/"
+static const char* get_root(void) {
+  const char* root = getenv(ENV_RAPLCAP_MSR_SIM_ROOT);
+  return root == NULL ? "" : root;
+}
+
+static int open_msr(uint32_t core, int flags, int* is_msr_safe) {
+  char msr_filename[PATH_MAX];
   int fd;
   // first try using the msr_safe kernel module
-  snprintf(msr_filename, sizeof(msr_filename), "/dev/cpu/%"PRIu32"/msr_safe", core);
+  snprintf(msr_filename, sizeof(msr_filename), "%s/dev/cpu/%"PRIu32"/msr_safe", get_root(), core);
+  *is_msr_safe = 1;
   if ((fd = open(msr_filename, flags)) < 0) {
     raplcap_perror(DEBUG, msr_filename);
     raplcap_log(INFO, "msr-safe not available, falling back on standard msr\n");
+    *is_msr_safe = 0;
     // fall back on the standard msr kernel module
-    snprintf(msr_filename, sizeof(msr_filename), "/dev/cpu/%"PRIu32"/msr", core);
+    snprintf(msr_filename, sizeof(msr_filename), "%s/dev/cpu/%"PRIu32"/msr", get_root(), core);
     if ((fd = open(msr_filename, flags)) < 0) {
       raplcap_perror(ERROR, msr_filename);
       if (errno == ENOENT) {
@@ -51,8 +132,40 @@ static int open_msr(uint32_t core, int flags) {
   return fd;
 }
 
+// Open the same kind of MSR device as the primary file descriptors, without error logging (failures are tolerated)
+static int open_msr_lazy(uint32_t cpu, int flags, int is_msr_safe) {
+  char msr_filename[PATH_MAX];
+  int fd;
+  snprintf(msr_filename, sizeof(msr_filename), "%s/dev/cpu/%"PRIu32"/%s", get_root(), cpu,
+           is_msr_safe ? "msr_safe" : "msr");
+  if ((fd = open(msr_filename, flags)) < 0) {
+    raplcap_perror(DEBUG, msr_filename);
+  }
+  return fd;
+}
+
+// Simulated CPUs are numbered from 0 to n-1 by their topology directories
+static uint32_t get_sim_cpu_count(const char* root) {
+  char fname[PATH_MAX];
+  struct stat ss;
+  uint32_t n = 0;
+  do {
+    snprintf(fname, sizeof(fname), "%s/sys/devices/system/cpu/cpu%"PRIu32"/topology", root, n);
+  } while (!stat(fname, &ss) && ++n < UINT32_MAX);
+  if (n == 0) {
+    raplcap_log(ERROR, "get_sim_cpu_count: No CPUs in simulation root: %s\n", root);
+    errno = ENODEV;
+  }
+  return n;
+}
+
 static uint32_t get_cpu_count(void) {
-  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* root = getenv(ENV_RAPLCAP_MSR_SIM_ROOT);
+  long n;
+  if (root != NULL) {
+    return get_sim_cpu_count(root);
+  }
+  n = sysconf(_SC_NPROCESSORS_ONLN);
   if (n <= 0 || n > UINT32_MAX) {
     errno = ENODEV;
     return 0;
@@ -61,10 +174,11 @@ static uint32_t get_cpu_count(void) {
 }
 
 static int get_physical_package_id(uint32_t cpu, uint32_t* pkg) {
-  char fname[92] = { 0 };
+  char fname[PATH_MAX] = { 0 };
   FILE* f;
   int fret;
-  snprintf(fname, sizeof(fname), "/sys/devices/system/cpu/cpu%"PRIu32"/topology/physical_package_id", cpu);
+  snprintf(fname, sizeof(fname), "%s/sys/devices/system/cpu/cpu%"PRIu32"/topology/physical_package_id",
+           get_root(), cpu);
   if ((f = fopen(fname, "r")) == NULL) {
     raplcap_perror(ERROR, fname);
     return -1;
@@ -83,11 +197,11 @@ static int get_physical_package_id(uint32_t cpu, uint32_t* pkg) {
 }
 
 static int get_die_id(uint32_t cpu, uint32_t* die) {
-  char fname[92] = { 0 };
+  char fname[PATH_MAX] = { 0 };
   struct stat ss;
   FILE* f;
   int fret;
-  snprintf(fname, sizeof(fname), "/sys/devices/system/cpu/cpu%"PRIu32"/topology/die_id", cpu);
+  snprintf(fname, sizeof(fname), "%s/sys/devices/system/cpu/cpu%"PRIu32"/topology/die_id", get_root(), cpu);
   // die_id does not exist on all systems, so check for it first
   if (stat(fname, &ss)) {
     raplcap_log(DEBUG, "get_die_id: %s: %s\n", fname, strerror(errno));
@@ -138,6 +252,30 @@ static int cmp_msr_topology_pkg_die(const void* a, const void* b) {
   return rc ? rc : cmp_u32(&ta->die, &tb->die);
 }
 
+// Sort by pkg, die, then cpu, so the lowest CPU id of each pkg/die comes first
+static int cmp_msr_topology(const void* a, const void* b) {
+  int rc = cmp_msr_topology_pkg_die(a, b);
+  return rc ? rc : cmp_u32(&((const msr_topology*) a)->cpu, &((const msr_topology*) b)->cpu);
+}
+
+// Parse a comma-separated list of CPUs, returning the number parsed (at most max)
+static uint32_t parse_cpu_list(const char* str, uint32_t* cpus, uint32_t max) {
+  char* end;
+  unsigned long cpu;
+  uint32_t n = 0;
+  while (str != NULL && *str != '\0' && n < max) {
+    errno = 0;
+    cpu = strtoul(str, &end, 10);
+    if (errno || end == str || cpu > UINT32_MAX) {
+      raplcap_log(WARN, "parse_cpu_list: Ignoring invalid CPU list remainder: %s\n", str);
+      break;
+    }
+    cpus[n++] = (uint32_t) cpu;
+    str = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
 // Count unique combinations of pkg and die in topo (must be pre-sorted).
 static uint32_t count_unique_pkg_die(const msr_topology* topo, uint32_t n) {
   assert(n > 0);
@@ -152,11 +290,18 @@ static uint32_t count_unique_pkg_die(const msr_topology* topo, uint32_t n) {
   return unique;
 }
 
-// Determine which CPUs to open MSRs for based on topo (must be pre-sorted)
+// Determine which CPUs to open MSRs for based on topo (must be pre-sorted).
+// Uses the lowest CPU of each pkg/die, unless a housekeeping CPU is configured for it.
 static void get_cpus_to_open(uint32_t* cpus_to_open, uint32_t n_cpus_to_open, const msr_topology* topo, uint32_t n_cpus) {
+  uint32_t* hk;
+  uint32_t n_hk = 0;
   uint32_t i;
   uint32_t j;
+  uint32_t k;
   assert(n_cpus > 0);
+  if ((hk = malloc(n_cpus * sizeof(*hk))) != NULL) {
+    n_hk = parse_cpu_list(getenv(ENV_RAPLCAP_MSR_HOUSEKEEPING_CPUS), hk, n_cpus);
+  }
   cpus_to_open[0] = topo[0].cpu;
   for (i = 1, j = 1; i < n_cpus; i++) {
     if (cmp_msr_topology_pkg_die(&topo[i], &topo[i - 1])) {
@@ -164,24 +309,217 @@ static void get_cpus_to_open(uint32_t* cpus_to_open, uint32_t n_cpus_to_open, co
     }
   }
   assert(j == n_cpus_to_open);
+  for (i = 0, j = 0; n_hk > 0 && i < n_cpus; i++) {
+    if (i > 0 && cmp_msr_topology_pkg_die(&topo[i], &topo[i - 1])) {
+      j++;
+    }
+    for (k = 0; k < n_hk; k++) {
+      if (topo[i].cpu == hk[k]) {
+        cpus_to_open[j] = topo[i].cpu;
+      }
+    }
+  }
+  free(hk);
   for (i = 0; i < n_cpus_to_open; i++) {
     raplcap_log(DEBUG, "get_cpus_to_open: cpu=%"PRIu32"\n", cpus_to_open[i]);
   }
 }
 
+// Map each CPU to its pkg/die index, and prepare for lazily opening per-CPU file descriptors
+static int init_cpu_fds(raplcap_msr_sys_ctx* ctx, const msr_topology* topo, uint32_t n_cpus) {
+  uint32_t i;
+  uint32_t j;
+  if ((ctx->cpu_fds = malloc(n_cpus * sizeof(*ctx->cpu_fds))) == NULL ||
+      (ctx->cpu_pkg_die = malloc(n_cpus * sizeof(*ctx->cpu_pkg_die))) == NULL) {
+    raplcap_perror(ERROR, "init_cpu_fds: malloc");
+    return -1;
+  }
+  for (i = 0, j = 0; i < n_cpus; i++) {
+    if (i > 0 && cmp_msr_topology_pkg_die(&topo[i], &topo[i - 1])) {
+      j++;
+    }
+    ctx->cpu_fds[topo[i].cpu] = CPU_FD_UNOPENED;
+    ctx->cpu_pkg_die[topo[i].cpu] = j;
+  }
+  ctx->n_cpus = n_cpus;
+  return 0;
+}
+
+// Get the fd to use for a pkg/die, preferring the caller's current CPU to avoid an IPI
+static int get_fd(const raplcap_msr_sys_ctx* ctx, uint32_t pkg, uint32_t die) {
+  const uint32_t idx = (pkg * ctx->n_die) + die;
+  const int cpu = sched_getcpu();
+  int expected = CPU_FD_UNOPENED;
+  int fd;
+  if (cpu < 0 || (uint32_t) cpu >= ctx->n_cpus || ctx->cpu_pkg_die[cpu] != idx || (uint32_t) cpu == ctx->cpus[idx]) {
+    return ctx->fds[idx];
+  }
+  if ((fd = __atomic_load_n(&ctx->cpu_fds[cpu], __ATOMIC_ACQUIRE)) == CPU_FD_UNOPENED) {
+    if ((fd = open_msr_lazy((uint32_t) cpu, ctx->open_flags, ctx->is_msr_safe)) < 0) {
+      fd = CPU_FD_FAILED;
+    }
+    // another thread may have raced to open the same CPU
+    if (!__atomic_compare_exchange_n(&ctx->cpu_fds[cpu], &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      fd = expected;
+    }
+  }
+  return fd >= 0 ? fd : ctx->fds[idx];
+}
+
 // Note: doesn't close previously opened file descriptors if one fails to open
-static int open_msrs(int* fds, const uint32_t* cpus_to_open, uint32_t n_fds) {
+static int open_msrs(int* fds, const uint32_t* cpus_to_open, uint32_t n_fds, int* batch_fd, int* flags,
+                     int* all_msr_safe) {
+  char batch_filename[PATH_MAX];
   uint32_t i;
+  int is_msr_safe;
   const char* env_ro = getenv(ENV_RAPLCAP_READ_ONLY);
   int ro = env_ro == NULL ? 0 : atoi(env_ro);
+  // don't leak privileged file descriptors to programs exec'd by the caller
+  *flags = (ro == 0 ? O_RDWR : O_RDONLY) | O_CLOEXEC;
+  *all_msr_safe = 1;
   for (i = 0; i < n_fds; i++) {
-    if ((fds[i] = open_msr(cpus_to_open[i], ro == 0 ? O_RDWR : O_RDONLY)) < 0) {
+    if ((fds[i] = open_msr(cpus_to_open[i], *flags, &is_msr_safe)) < 0) {
       return -1;
     }
+    *all_msr_safe &= is_msr_safe;
+  }
+  // batching is only possible through msr-safe, and not all versions support it
+  if (*all_msr_safe) {
+    snprintf(batch_filename, sizeof(batch_filename), MSR_SAFE_BATCH_FILE, get_root());
+    if ((*batch_fd = open(batch_filename, *flags)) < 0) {
+      raplcap_perror(DEBUG, batch_filename);
+      raplcap_log(INFO, "msr-safe batching not available, falling back on individual MSR access\n");
+    }
   }
   return 0;
 }
 
+// Access ops individually, only those for the given package unless it's ALL_PKGS
+static void msr_sys_batch_each(const raplcap_msr_sys_ctx* ctx, msr_sys_op* ops, uint32_t n_ops, int is_read,
+                               uint32_t pkg) {
+  uint32_t i;
+  int ret;
+  for (i = 0; i < n_ops; i++) {
+    if (pkg == ALL_PKGS || ops[i].pkg == pkg) {
+      ret = is_read ? msr_sys_read(ctx, &ops[i].msrval, ops[i].pkg, ops[i].die, ops[i].msr) :
+                      msr_sys_write(ctx, ops[i].msrval, ops[i].pkg, ops[i].die, ops[i].msr);
+      ops[i].err = ret ? (errno ? errno : EIO) : 0;
+    }
+  }
+}
+
+static void* msr_sys_worker_main(void* arg) {
+  const msr_sys_worker* w = (const msr_sys_worker*) arg;
+  msr_sys_pool* pool = w->ctx->pool;
+  msr_sys_op* ops;
+  uint64_t generation = 0;
+  uint32_t n_ops;
+  int is_read;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->generation == generation) {
+      pthread_cond_wait(&pool->cond_work, &pool->lock);
+    }
+    if (pool->stop) {
+      break;
+    }
+    generation = pool->generation;
+    ops = pool->ops;
+    n_ops = pool->n_ops;
+    is_read = pool->is_read;
+    pthread_mutex_unlock(&pool->lock);
+    // each worker only touches the ops for its own package
+    msr_sys_batch_each(w->ctx, ops, n_ops, is_read, w->pkg);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->n_pending == 0) {
+      pthread_cond_signal(&pool->cond_done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static void msr_sys_pool_run(msr_sys_pool* pool, msr_sys_op* ops, uint32_t n_ops, int is_read) {
+  pthread_mutex_lock(&pool->submit_lock);
+  pthread_mutex_lock(&pool->lock);
+  pool->ops = ops;
+  pool->n_ops = n_ops;
+  pool->is_read = is_read;
+  pool->n_pending = pool->n_workers;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->cond_work);
+  while (pool->n_pending > 0) {
+    pthread_cond_wait(&pool->cond_done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->submit_lock);
+}
+
+static void msr_sys_pool_destroy(msr_sys_pool* pool, uint32_t n_started) {
+  uint32_t i;
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->cond_work);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < n_started; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  pthread_cond_destroy(&pool->cond_done);
+  pthread_cond_destroy(&pool->cond_work);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->submit_lock);
+  free(pool->workers);
+  free(pool);
+}
+
+// Start one worker per package, pinned to the CPU whose MSRs are opened for that package's first die
+static msr_sys_pool* msr_sys_pool_init(raplcap_msr_sys_ctx* ctx) {
+  msr_sys_pool* pool;
+  cpu_set_t cpuset;
+  uint32_t i;
+  int ret;
+  if ((pool = calloc(1, sizeof(*pool))) == NULL ||
+      (pool->workers = calloc(ctx->n_pkg, sizeof(*pool->workers))) == NULL) {
+    raplcap_perror(ERROR, "msr_sys_pool_init: calloc");
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->submit_lock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond_work, NULL);
+  pthread_cond_init(&pool->cond_done, NULL);
+  pool->n_workers = ctx->n_pkg;
+  ctx->pool = pool;
+  for (i = 0; i < pool->n_workers; i++) {
+    pool->workers[i].ctx = ctx;
+    pool->workers[i].pkg = i;
+    if ((ret = pthread_create(&pool->workers[i].thread, NULL, msr_sys_worker_main, &pool->workers[i]))) {
+      errno = ret;
+      raplcap_perror(ERROR, "msr_sys_pool_init: pthread_create");
+      ctx->pool = NULL;
+      msr_sys_pool_destroy(pool, i);
+      errno = ret;
+      return NULL;
+    }
+    // simulated CPUs don't correspond to real ones
+    if (getenv(ENV_RAPLCAP_MSR_SIM_ROOT) != NULL) {
+      continue;
+    }
+    CPU_ZERO(&cpuset);
+    CPU_SET(ctx->cpus[i * ctx->n_die], &cpuset);
+    if ((ret = pthread_setaffinity_np(pool->workers[i].thread, sizeof(cpuset), &cpuset))) {
+      // still correct, just not as fast
+      raplcap_log(WARN, "msr_sys_pool_init: pthread_setaffinity_np: cpu=%"PRIu32": %s\n",
+                  ctx->cpus[i * ctx->n_die], strerror(ret));
+    }
+  }
+  raplcap_log(DEBUG, "msr_sys_pool_init: Started %"PRIu32" workers\n", pool->n_workers);
+  return pool;
+}
+
 int msr_sys_get_num_pkg_die(const raplcap_msr_sys_ctx* ctx, uint32_t *n_pkg, uint32_t* n_die) {
   msr_topology* topo;
   uint32_t ncpus;
@@ -215,6 +553,7 @@ int msr_sys_get_num_pkg_die(const raplcap_msr_sys_ctx* ctx, uint32_t *n_pkg, uin
 }
 
 raplcap_msr_sys_ctx* msr_sys_init(uint32_t* n_pkg, uint32_t* n_die) {
+  const char* env_workers;
   msr_topology* topo;
   raplcap_msr_sys_ctx* ctx;
   uint32_t* cpus_to_open;
@@ -236,9 +575,9 @@ raplcap_msr_sys_ctx* msr_sys_init(uint32_t* n_pkg, uint32_t* n_die) {
     free(topo);
     return NULL;
   }
-  qsort(topo, ncpus, sizeof(*topo), cmp_msr_topology_pkg_die);
-  if ((ctx = malloc(sizeof(*ctx))) == NULL) {
-    raplcap_perror(ERROR, "msr_sys_init: malloc");
+  qsort(topo, ncpus, sizeof(*topo), cmp_msr_topology);
+  if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+    raplcap_perror(ERROR, "msr_sys_init: calloc");
     free(topo);
     return NULL;
   }
@@ -256,6 +595,9 @@ raplcap_msr_sys_ctx* msr_sys_init(uint32_t* n_pkg, uint32_t* n_die) {
     return NULL;
   }
   get_cpus_to_open(cpus_to_open, ctx->n_fds, topo, ncpus);
+  ctx->cpus = cpus_to_open;
+  ctx->batch_fd = -1;
+  ctx->pool = NULL;
   if ((ctx->fds = calloc(ctx->n_fds, sizeof(int))) == NULL) {
     raplcap_perror(ERROR, "msr_sys_init: calloc");
     free(cpus_to_open);
@@ -263,16 +605,20 @@ raplcap_msr_sys_ctx* msr_sys_init(uint32_t* n_pkg, uint32_t* n_die) {
     free(topo);
     return NULL;
   }
-  if (open_msrs(ctx->fds, cpus_to_open, ctx->n_fds)) {
+  if (init_cpu_fds(ctx, topo, ncpus) ||
+      open_msrs(ctx->fds, cpus_to_open, ctx->n_fds, &ctx->batch_fd, &ctx->open_flags, &ctx->is_msr_safe)) {
     err_save = errno;
-    free(cpus_to_open);
     msr_sys_destroy(ctx);
     free(topo);
     errno = err_save;
     return NULL;
   }
-  free(cpus_to_open);
   free(topo);
+  // workers are optional, so proceed without them if they can't be started
+  env_workers = getenv(ENV_RAPLCAP_MSR_WORKERS);
+  if (env_workers != NULL && atoi(env_workers) != 0 && ctx->n_pkg > 1 && msr_sys_pool_init(ctx) == NULL) {
+    raplcap_log(WARN, "msr_sys_init: Failed to start worker pool, proceeding without it\n");
+  }
   *n_pkg = ctx->n_pkg;
   *n_die = ctx->n_die;
   return ctx;
@@ -282,6 +628,9 @@ int msr_sys_destroy(raplcap_msr_sys_ctx* ctx) {
   assert(ctx);
   uint32_t i;
   int err_save = 0;
+  if (ctx->pool != NULL) {
+    msr_sys_pool_destroy(ctx->pool, ctx->pool->n_workers);
+  }
   for (i = 0; ctx->fds != NULL && i < ctx->n_fds; i++) {
     raplcap_log(DEBUG, "msr_sys_destroy: i=%"PRIu32", fd=%d\n", i, ctx->fds[i]);
     if (ctx->fds[i] > 0 && close(ctx->fds[i])) {
@@ -289,18 +638,37 @@ int msr_sys_destroy(raplcap_msr_sys_ctx* ctx) {
       raplcap_perror(ERROR, "msr_sys_destroy: close");
     }
   }
+  for (i = 0; ctx->cpu_fds != NULL && i < ctx->n_cpus; i++) {
+    if (ctx->cpu_fds[i] >= 0 && close(ctx->cpu_fds[i])) {
+      err_save = errno;
+      raplcap_perror(ERROR, "msr_sys_destroy: close");
+    }
+  }
+  if (ctx->batch_fd >= 0 && close(ctx->batch_fd)) {
+    err_save = errno;
+    raplcap_perror(ERROR, "msr_sys_destroy: close");
+  }
+  free(ctx->cpu_fds);
+  free(ctx->cpu_pkg_die);
   free(ctx->fds);
+  free(ctx->cpus);
   free(ctx);
   errno = err_save;
   return err_save ? -1 : 0;
 }
 
+int msr_sys_get_fd(const raplcap_msr_sys_ctx* ctx, uint32_t pkg, uint32_t die) {
+  assert(ctx);
+  assert((pkg * ctx->n_die) + die < ctx->n_fds);
+  return ctx->fds[(pkg * ctx->n_die) + die];
+}
+
 int msr_sys_read(const raplcap_msr_sys_ctx* ctx, uint64_t* msrval, uint32_t pkg, uint32_t die, off_t msr) {
   assert(ctx);
   assert(msr >= 0);
   assert(msrval != NULL);
   assert((pkg * ctx->n_die) + die < ctx->n_fds);
-  if (pread(ctx->fds[(pkg * ctx->n_die) + die], msrval, sizeof(uint64_t), msr) == sizeof(uint64_t)) {
+  if (pread(get_fd(ctx, pkg, die), msrval, sizeof(uint64_t), msr) == sizeof(uint64_t)) {
     raplcap_log(DEBUG, "msr_sys_read: msr=0x%lX, msrval=0x%016lX\n", msr, *msrval);
     return 0;
   }
@@ -313,9 +681,95 @@ int msr_sys_write(const raplcap_msr_sys_ctx* ctx, uint64_t msrval, uint32_t pkg,
   assert(msr >= 0);
   assert((pkg * ctx->n_die) + die < ctx->n_fds);
   raplcap_log(DEBUG, "msr_sys_write: msr=0x%lX, msrval=0x%016lX\n", msr, msrval);
-  if (pwrite(ctx->fds[(pkg * ctx->n_die) + die], &msrval, sizeof(uint64_t), msr) == sizeof(uint64_t)) {
+  if (pwrite(get_fd(ctx, pkg, die), &msrval, sizeof(uint64_t), msr) == sizeof(uint64_t)) {
     return 0;
   }
   raplcap_log(DEBUG, "msr_sys_write(0x%lX): pwrite: %s\n", msr, strerror(errno));
   return -1;
 }
+
+static int msr_sys_batch_ioctl(const raplcap_msr_sys_ctx* ctx, msr_sys_op* ops, uint32_t n_ops, int is_read) {
+  struct msr_batch_array arr;
+  uint32_t i;
+  int ret = 0;
+  if ((arr.ops = calloc(n_ops, sizeof(*arr.ops))) == NULL) {
+    raplcap_perror(ERROR, "msr_sys_batch_ioctl: calloc");
+    return -1;
+  }
+  arr.numops = n_ops;
+  for (i = 0; i < n_ops; i++) {
+    assert((ops[i].pkg * ctx->n_die) + ops[i].die < ctx->n_fds);
+    arr.ops[i].cpu = (uint16_t) ctx->cpus[(ops[i].pkg * ctx->n_die) + ops[i].die];
+    arr.ops[i].isrdmsr = is_read ? 1 : 0;
+    arr.ops[i].msr = (uint32_t) ops[i].msr;
+    arr.ops[i].msrdata = is_read ? 0 : ops[i].msrval;
+  }
+  if (ioctl(ctx->batch_fd, X86_IOC_MSR_BATCH, &arr) < 0) {
+    raplcap_log(DEBUG, "msr_sys_batch_ioctl: ioctl: %s\n", strerror(errno));
+    ret = -1;
+  }
+  for (i = 0; i < n_ops; i++) {
+    // msr-safe reports a positive errno value for each failed operation
+    ops[i].err = arr.ops[i].err < 0 ? -arr.ops[i].err : arr.ops[i].err;
+    if (ops[i].err == 0 && is_read) {
+      ops[i].msrval = arr.ops[i].msrdata;
+    }
+    raplcap_log(DEBUG, "msr_sys_batch_ioctl: cpu=%"PRIu16", msr=0x%lX, msrval=0x%016lX, err=%d\n",
+                arr.ops[i].cpu, ops[i].msr, ops[i].msrval, ops[i].err);
+  }
+  free(arr.ops);
+  return ret;
+}
+
+// Returns 0 if all ops succeeded, otherwise -1 with errno set to the first failure
+static int msr_sys_batch_check(const msr_sys_op* ops, uint32_t n_ops) {
+  uint32_t i;
+  for (i = 0; i < n_ops; i++) {
+    if (ops[i].err) {
+      errno = ops[i].err;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Check if ops span more than one package, in which case they can be parallelized
+static int msr_sys_is_multi_pkg(const msr_sys_op* ops, uint32_t n_ops) {
+  uint32_t i;
+  for (i = 1; i < n_ops; i++) {
+    if (ops[i].pkg != ops[0].pkg) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int msr_sys_batch(const raplcap_msr_sys_ctx* ctx, msr_sys_op* ops, uint32_t n_ops, int is_read) {
+  int ret;
+  if (ctx->batch_fd >= 0) {
+    ret = msr_sys_batch_ioctl(ctx, ops, n_ops, is_read);
+    if (ret == 0 || msr_sys_batch_check(ops, n_ops)) {
+      // either success, or per-op errors were reported by msr-safe
+      return msr_sys_batch_check(ops, n_ops);
+    }
+    raplcap_log(INFO, "msr-safe batch failed, falling back on individual MSR access\n");
+  }
+  if (ctx->pool != NULL && msr_sys_is_multi_pkg(ops, n_ops)) {
+    msr_sys_pool_run(ctx->pool, ops, n_ops, is_read);
+  } else {
+    msr_sys_batch_each(ctx, ops, n_ops, is_read, ALL_PKGS);
+  }
+  return msr_sys_batch_check(ops, n_ops);
+}
+
+int msr_sys_read_batch(const raplcap_msr_sys_ctx* ctx, msr_sys_op* ops, uint32_t n_ops) {
+  assert(ctx);
+  assert(ops != NULL || n_ops == 0);
+  return msr_sys_batch(ctx, ops, n_ops, 1);
+}
+
+int msr_sys_write_batch(const raplcap_msr_sys_ctx* ctx, msr_sys_op* ops, uint32_t n_ops) {
+  assert(ctx);
+  assert(ops != NULL || n_ops == 0);
+  return msr_sys_batch(ctx, ops, n_ops, 0);
+}
@@ -18,16 +18,47 @@ extern "C" {
 
 typedef struct raplcap_msr_sys_ctx raplcap_msr_sys_ctx;
 
+/**
+ * A single MSR operation in a batch.
+ * For reads, msrval is populated on success; for writes, it is the value to write.
+ * The err field is set to 0 on success, or an errno value on failure.
+ */
+typedef struct msr_sys_op {
+  uint32_t pkg;
+  uint32_t die;
+  off_t msr;
+  uint64_t msrval;
+  int err;
+} msr_sys_op;
+
 int msr_sys_get_num_pkg_die(const raplcap_msr_sys_ctx* ctx, uint32_t *n_pkg, uint32_t* n_die);
 
 raplcap_msr_sys_ctx* msr_sys_init(uint32_t* n_pkg, uint32_t* n_die);
 
 int msr_sys_destroy(raplcap_msr_sys_ctx* ctx);
 
+/**
+ * Get the file descriptor used to access a package/die's MSRs, e.g., for asynchronous I/O.
+ * The MSR address is the file offset.
+ */
+int msr_sys_get_fd(const raplcap_msr_sys_ctx* ctx, uint32_t pkg, uint32_t die);
+
 int msr_sys_read(const raplcap_msr_sys_ctx* ctx, uint64_t* msrval, uint32_t pkg, uint32_t die, off_t msr);
 
 int msr_sys_write(const raplcap_msr_sys_ctx* ctx, uint64_t msrval, uint32_t pkg, uint32_t die, off_t msr);
 
+/**
+ * Read multiple MSRs, using a single msr-safe batch request when available.
+ * Returns 0 if all reads succeed, otherwise -1 with errno set from the first failed op.
+ */
+int msr_sys_read_batch(const raplcap_msr_sys_ctx* ctx, msr_sys_op* ops, uint32_t n_ops);
+
+/**
+ * Write multiple MSRs, using a single msr-safe batch request when available.
+ * Returns 0 if all writes succeed, otherwise -1 with errno set from the first failed op.
+ */
+int msr_sys_write_batch(const raplcap_msr_sys_ctx* ctx, msr_sys_op* ops, uint32_t n_ops);
+
 #pragma GCC visibility pop
 
 #ifdef __cplusplus
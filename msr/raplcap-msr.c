@@ -7,26 +7,71 @@
  * @author Connor Imes
  * @date 2016-10-19
  */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "raplcap.h"
+#include "raplcap-async-common.h"
 #include "raplcap-common.h"
 #include "raplcap-msr.h"
 #include "raplcap-msr-common.h"
 #include "raplcap-msr-sys.h"
+#include "raplcap-snapshot-common.h"
 #include "raplcap-wrappers.h"
 
+struct raplcap_zone_handle {
+  const raplcap_msr_ctx* ctx;
+  const raplcap_msr_sys_ctx* sys;
+  uint32_t pkg;
+  uint32_t die;
+  raplcap_zone zone;
+  off_t msr_pl;
+  off_t msr_energy;
+  double joules_max;
+  // bitmask of raplcap_msr_zone_cap values
+  int caps;
+};
+
 typedef struct raplcap_msr {
   // assuming consistent unit values between packages
   raplcap_msr_ctx ctx;
   raplcap_msr_sys_ctx* sys;
+  // indexed by ((pkg * n_die) + die) * RAPLCAP_NZONES + zone
+  raplcap_zone_handle* handles;
+  uint32_t n_die;
 } raplcap_msr;
 
+typedef struct raplcap_msr_txn_zone {
+  raplcap_limit limit_long;
+  raplcap_limit limit_short;
+  int enabled;
+  int clamped;
+  int set_long;
+  int set_short;
+  int set_enabled;
+  int set_clamped;
+  int set_locked;
+} raplcap_msr_txn_zone;
+
+struct raplcap_msr_txn {
+  const raplcap* rc;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  // preallocated for commit, one per zone
+  msr_sys_op* ops;
+  uint64_t* orig;
+  uint32_t* idx;
+  // indexed by ((pkg * n_die) + die) * RAPLCAP_NZONES + zone
+  raplcap_msr_txn_zone zones[];
+};
+
 static raplcap rc_default;
 
 static const off_t ZONE_OFFSETS_PL[RAPLCAP_NZONES] = {
@@ -45,6 +90,78 @@ static const off_t ZONE_OFFSETS_ENERGY[RAPLCAP_NZONES] = {
   MSR_PLATFORM_ENERGY_COUNTER // RAPLCAP_ZONE_PSYS
 };
 
+static raplcap_zone_handle* get_handle(const raplcap_msr* state, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  return &state->handles[(((pkg * state->n_die) + die) * RAPLCAP_NZONES) + zone];
+}
+
+// Capabilities can be revised after init (e.g., clamping rejected, zone locked) while other threads read them
+static int get_caps(const raplcap_zone_handle* zh) {
+  return __atomic_load_n(&zh->caps, __ATOMIC_RELAXED);
+}
+
+static void set_caps(raplcap_zone_handle* zh, int caps) {
+  __atomic_fetch_or(&zh->caps, caps, __ATOMIC_RELAXED);
+}
+
+static void clear_caps(raplcap_zone_handle* zh, int caps) {
+  __atomic_fetch_and(&zh->caps, ~caps, __ATOMIC_RELAXED);
+}
+
+// Probe all zones' power limit MSRs once so that capability queries don't need to access MSRs
+static int init_zone_handles(raplcap_msr* state, uint32_t n_pkg, uint32_t n_die) {
+  raplcap_zone_handle* zh;
+  msr_sys_op* ops;
+  uint32_t n_ops = n_pkg * n_die * RAPLCAP_NZONES;
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t i;
+  int zone;
+  if ((ops = malloc(n_ops * sizeof(*ops))) == NULL) {
+    raplcap_perror(ERROR, "init_zone_handles: malloc");
+    return -1;
+  }
+  for (i = 0, pkg = 0; pkg < n_pkg; pkg++) {
+    for (die = 0; die < n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++, i++) {
+        ops[i].pkg = pkg;
+        ops[i].die = die;
+        ops[i].msr = ZONE_OFFSETS_PL[zone];
+      }
+    }
+  }
+  // failures are expected for unsupported zones
+  msr_sys_read_batch(state->sys, ops, n_ops);
+  for (i = 0, pkg = 0; pkg < n_pkg; pkg++) {
+    for (die = 0; die < n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++, i++) {
+        zh = get_handle(state, pkg, die, (raplcap_zone) zone);
+        zh->ctx = &state->ctx;
+        zh->sys = state->sys;
+        zh->pkg = pkg;
+        zh->die = die;
+        zh->zone = (raplcap_zone) zone;
+        zh->msr_pl = ZONE_OFFSETS_PL[zone];
+        zh->msr_energy = ZONE_OFFSETS_ENERGY[zone];
+        zh->joules_max = msr_get_energy_counter_max(&state->ctx, (raplcap_zone) zone);
+        zh->caps = 0;
+        if (!ops[i].err) {
+          zh->caps |= RAPLCAP_MSR_ZONE_CAP_SUPPORTED | RAPLCAP_MSR_ZONE_CAP_CLAMPING;
+          if (state->ctx.cfg[zone].constraints > 1) {
+            zh->caps |= RAPLCAP_MSR_ZONE_CAP_SHORT_TERM;
+          }
+          if (msr_is_zone_locked(&state->ctx, (raplcap_zone) zone, ops[i].msrval)) {
+            zh->caps |= RAPLCAP_MSR_ZONE_CAP_LOCKED;
+          }
+        }
+        raplcap_log(DEBUG, "init_zone_handles: pkg=%"PRIu32", die=%"PRIu32", zone=%d, caps=0x%x\n",
+                    pkg, die, zone, zh->caps);
+      }
+    }
+  }
+  free(ops);
+  return 0;
+}
+
 static off_t zone_to_msr_offset(raplcap_zone zone, const off_t* offsets) {
   assert(offsets != NULL);
   if ((int) zone < 0 || (int) zone >= RAPLCAP_NZONES) {
@@ -78,8 +195,17 @@ int raplcap_init(raplcap* rc) {
     free(state);
     return -1;
   }
+  state->n_die = n_die;
+  state->handles = NULL;
   rc->nsockets = n_pkg;
   rc->state = state;
+  if ((state->handles = malloc(n_pkg * n_die * RAPLCAP_NZONES * sizeof(*state->handles))) == NULL) {
+    err_save = errno;
+    raplcap_perror(ERROR, "raplcap_init: malloc");
+    raplcap_destroy(rc);
+    errno = err_save;
+    return -1;
+  }
   if (msr_sys_read(state->sys, &msrval, 0, 0, MSR_RAPL_POWER_UNIT)) {
     err_save = errno;
     raplcap_destroy(rc);
@@ -88,6 +214,12 @@ int raplcap_init(raplcap* rc) {
   }
   // now populate context with unit conversions and function pointers
   msr_get_context(&state->ctx, cpu_model, msrval);
+  if (init_zone_handles(state, n_pkg, n_die)) {
+    err_save = errno;
+    raplcap_destroy(rc);
+    errno = err_save;
+    return -1;
+  }
   raplcap_log(DEBUG, "raplcap_init: Initialized\n");
   return 0;
 }
@@ -100,6 +232,7 @@ int raplcap_destroy(raplcap* rc) {
   }
   if ((state = (raplcap_msr*) rc->state) != NULL) {
     ret = msr_sys_destroy(state->sys);
+    free(state->handles);
     free(state);
     rc->state = NULL;
   }
@@ -189,22 +322,24 @@ int raplcap_pd_is_zone_enabled(const raplcap* rc, uint32_t pkg, uint32_t die, ra
   }
   msr_is_zone_enabled(&state->ctx, zone, msrval, &en[0], &en[1]);
   ret = en[0] && en[1];
-  if (ret && !raplcap_msr_is_zone_clamped(rc, pkg, zone)) {
-    raplcap_log(INFO, "Zone is enabled but clamping is not\n");
+  if (ret) {
+    // clamping is in the same register, so no need for another read
+    msr_is_zone_clamped(&state->ctx, zone, msrval, &en[0], &en[1]);
+    if (!(en[0] && en[1])) {
+      raplcap_log(INFO, "Zone is enabled but clamping is not\n");
+    }
   }
   return ret;
 }
 
 int raplcap_pd_is_zone_supported(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
-  uint64_t msrval;
   const raplcap_msr* state = get_state(rc, pkg, die);
   const off_t msr = zone_to_msr_offset(zone, ZONE_OFFSETS_PL);
   int ret;
-  raplcap_log(DEBUG, "raplcap_pd_is_zone_supported: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
   if (state == NULL || msr < 0) {
     return -1;
   }
-  ret = msr_sys_read(state->sys, &msrval, pkg, die, msr) ? 0 : 1;
+  ret = (get_caps(get_handle(state, pkg, die, zone)) & RAPLCAP_MSR_ZONE_CAP_SUPPORTED) ? 1 : 0;
   raplcap_log(DEBUG, "raplcap_pd_is_zone_supported: pkg=%"PRIu32", die=%"PRIu32", zone=%d, supported=%d\n",
               pkg, die, zone, ret);
   return ret;
@@ -213,19 +348,25 @@ int raplcap_pd_is_zone_supported(const raplcap* rc, uint32_t pkg, uint32_t die,
 // Enables or disables both the "enabled" and "clamped" bits for all constraints
 int raplcap_pd_set_zone_enabled(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone, int enabled) {
   uint64_t msrval;
+  raplcap_zone_handle* zh;
   const raplcap_msr* state = get_state(rc, pkg, die);
   const off_t msr = zone_to_msr_offset(zone, ZONE_OFFSETS_PL);
   int ret;
   raplcap_log(DEBUG, "raplcap_pd_set_zone_enabled: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
-  if (state == NULL || msr < 0 || msr_sys_read(state->sys, &msrval, pkg, 0, msr)) {
+  if (state == NULL || msr < 0 || msr_sys_read(state->sys, &msrval, pkg, die, msr)) {
     return -1;
   }
   msrval = msr_set_zone_enabled(&state->ctx, zone, msrval, &enabled, &enabled);
-  if ((ret = msr_sys_write(state->sys, msrval, pkg, die, msr)) == 0) {
+  zh = get_handle(state, pkg, die, zone);
+  if ((ret = msr_sys_write(state->sys, msrval, pkg, die, msr)) == 0 && (get_caps(zh) & RAPLCAP_MSR_ZONE_CAP_CLAMPING)) {
     // try to clamp (not supported by all zones or all CPUs)
     msrval = msr_set_zone_clamped(&state->ctx, zone, msrval, &enabled, &enabled);
     if (msr_sys_write(state->sys, msrval, pkg, die, msr)) {
       raplcap_log(INFO, "Clamping not available for this zone or platform\n");
+      // the msr driver reports EIO when the processor rejects the write, so don't try again
+      if (errno == EIO) {
+        clear_caps(zh, RAPLCAP_MSR_ZONE_CAP_CLAMPING);
+      }
     }
   }
   return ret;
@@ -254,7 +395,47 @@ int raplcap_pd_set_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap
     return -1;
   }
   msrval = msr_set_limits(&state->ctx, zone, msrval, limit_long, limit_short);
-  return msr_sys_write(state->sys, msrval, pkg, 0, msr);
+  return msr_sys_write(state->sys, msrval, pkg, die, msr);
+}
+
+int raplcap_pd_quantize_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  const raplcap_msr* state = get_state(rc, pkg, die);
+  raplcap_log(DEBUG, "raplcap_pd_quantize_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (state == NULL || zone_to_msr_offset(zone, ZONE_OFFSETS_PL) < 0) {
+    return -1;
+  }
+  return msr_quantize_limits(&state->ctx, zone, limit_long, limit_short);
+}
+
+int raplcap_pd_get_zone_status(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_zone_status* status) {
+  uint64_t msrval;
+  int en[2] = { 1, 1 };
+  int cl[2] = { 1, 1 };
+  const raplcap_msr* state = get_state(rc, pkg, die);
+  const off_t msr = zone_to_msr_offset(zone, ZONE_OFFSETS_PL);
+  raplcap_log(DEBUG, "raplcap_pd_get_zone_status: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (state == NULL || msr < 0) {
+    return -1;
+  }
+  if (status == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (msr_sys_read(state->sys, &msrval, pkg, die, msr)) {
+    return -1;
+  }
+  // decode everything from the single register value
+  msr_is_zone_enabled(&state->ctx, zone, msrval, &en[0], &en[1]);
+  msr_is_zone_clamped(&state->ctx, zone, msrval, &cl[0], &cl[1]);
+  status->enabled = en[0] && en[1];
+  status->clamped = cl[0] && cl[1];
+  status->locked = msr_is_zone_locked(&state->ctx, zone, msrval);
+  status->limit_short.seconds = 0;
+  status->limit_short.watts = 0;
+  msr_get_limits(&state->ctx, zone, msrval, &status->limit_long, &status->limit_short);
+  return 0;
 }
 
 double raplcap_pd_get_energy_counter(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
@@ -278,6 +459,64 @@ double raplcap_pd_get_energy_counter_max(const raplcap* rc, uint32_t pkg, uint32
   return msr_get_energy_counter_max(&state->ctx, zone);
 }
 
+const raplcap_zone_handle* raplcap_pd_get_zone_handle(const raplcap* rc, uint32_t pkg, uint32_t die,
+                                                      raplcap_zone zone) {
+  const raplcap_msr* state = get_state(rc, pkg, die);
+  const off_t msr = zone_to_msr_offset(zone, ZONE_OFFSETS_PL);
+  int supported;
+  raplcap_log(DEBUG, "raplcap_pd_get_zone_handle: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (state == NULL || msr < 0 || (supported = raplcap_pd_is_zone_supported(rc, pkg, die, zone)) < 0) {
+    return NULL;
+  }
+  if (!supported) {
+    raplcap_log(ERROR, "raplcap_pd_get_zone_handle: Zone not supported: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+                pkg, die, zone);
+    errno = ENOTSUP;
+    return NULL;
+  }
+  return get_handle(state, pkg, die, zone);
+}
+
+int raplcap_zone_handle_get_limits(const raplcap_zone_handle* zh, raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  uint64_t msrval;
+  if (msr_sys_read(zh->sys, &msrval, zh->pkg, zh->die, zh->msr_pl)) {
+    return -1;
+  }
+  msr_get_limits(zh->ctx, zh->zone, msrval, limit_long, limit_short);
+  return 0;
+}
+
+int raplcap_zone_handle_set_limits(const raplcap_zone_handle* zh,
+                                   const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  uint64_t msrval;
+  if (msr_sys_read(zh->sys, &msrval, zh->pkg, zh->die, zh->msr_pl)) {
+    return -1;
+  }
+  msrval = msr_set_limits(zh->ctx, zh->zone, msrval, limit_long, limit_short);
+  return msr_sys_write(zh->sys, msrval, zh->pkg, zh->die, zh->msr_pl);
+}
+
+double raplcap_zone_handle_get_energy_counter(const raplcap_zone_handle* zh) {
+  uint64_t msrval;
+  if (msr_sys_read(zh->sys, &msrval, zh->pkg, zh->die, zh->msr_energy)) {
+    return -1;
+  }
+  return msr_get_energy_counter(zh->ctx, msrval, zh->zone);
+}
+
+double raplcap_zone_handle_get_energy_counter_max(const raplcap_zone_handle* zh) {
+  return zh->joules_max;
+}
+
+int raplcap_msr_pd_get_zone_caps(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  const raplcap_msr* state = get_state(rc, pkg, die);
+  const off_t msr = zone_to_msr_offset(zone, ZONE_OFFSETS_PL);
+  if (state == NULL || msr < 0) {
+    return -1;
+  }
+  return get_caps(get_handle(state, pkg, die, zone));
+}
+
 int raplcap_msr_pd_is_zone_clamped(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
   uint64_t msrval;
   int cl[2] = { 1, 1 };
@@ -304,7 +543,13 @@ int raplcap_msr_pd_set_zone_clamped(const raplcap* rc, uint32_t pkg, uint32_t di
     return -1;
   }
   msrval = msr_set_zone_clamped(&state->ctx, zone, msrval, &clamped, &clamped);
-  return msr_sys_write(state->sys, msrval, pkg, 0, msr);
+  if (msr_sys_write(state->sys, msrval, pkg, die, msr)) {
+    if (clamped && errno == EIO) {
+      clear_caps(get_handle(state, pkg, die, zone), RAPLCAP_MSR_ZONE_CAP_CLAMPING);
+    }
+    return -1;
+  }
+  return 0;
 }
 
 int raplcap_msr_set_zone_clamped(const raplcap* rc, uint32_t pkg, raplcap_zone zone, int clamped) {
@@ -335,13 +580,36 @@ int raplcap_msr_pd_set_zone_locked(const raplcap* rc, uint32_t pkg, uint32_t die
     return -1;
   }
   msrval = msr_set_zone_locked(&state->ctx, zone, msrval, 1);
-  return msr_sys_write(state->sys, msrval, pkg, 0, msr);
+  if (msr_sys_write(state->sys, msrval, pkg, die, msr)) {
+    return -1;
+  }
+  set_caps(get_handle(state, pkg, die, zone), RAPLCAP_MSR_ZONE_CAP_LOCKED);
+  return 0;
 }
 
 int raplcap_msr_set_zone_locked(const raplcap* rc, uint32_t pkg, raplcap_zone zone) {
   return raplcap_msr_pd_set_zone_locked(rc, pkg, 0, zone);
 }
 
+int raplcap_msr_set_time_window_rounding(const raplcap* rc, raplcap_msr_rounding rounding) {
+  raplcap_msr* state = get_state(rc, 0, 0);
+  raplcap_log(DEBUG, "raplcap_msr_set_time_window_rounding: rounding=%d\n", rounding);
+  if (state == NULL) {
+    return -1;
+  }
+  switch (rounding) {
+    case RAPLCAP_MSR_ROUND_NEAREST:
+    case RAPLCAP_MSR_ROUND_FLOOR:
+    case RAPLCAP_MSR_ROUND_CEIL:
+      state->ctx.tw_rounding = rounding;
+      return 0;
+    default:
+      raplcap_log(ERROR, "raplcap_msr_set_time_window_rounding: Unknown rounding: %d\n", rounding);
+      errno = EINVAL;
+      return -1;
+  }
+}
+
 double raplcap_msr_pd_get_time_units(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
   const raplcap_msr* state = get_state(rc, pkg, die);
   const off_t msr = zone_to_msr_offset(zone, ZONE_OFFSETS_ENERGY);
@@ -383,3 +651,448 @@ double raplcap_msr_pd_get_energy_units(const raplcap* rc, uint32_t pkg, uint32_t
 double raplcap_msr_get_energy_units(const raplcap* rc, uint32_t pkg, raplcap_zone zone) {
   return raplcap_msr_pd_get_energy_units(rc, pkg, 0, zone);
 }
+
+int raplcap_msr_get_energy_counters(const raplcap* rc, raplcap_msr_energy_counter* counters, uint32_t n) {
+  msr_sys_op* ops;
+  const raplcap_msr* state;
+  uint32_t i;
+  int ret;
+  raplcap_log(DEBUG, "raplcap_msr_get_energy_counters: n=%"PRIu32"\n", n);
+  if (counters == NULL && n > 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  // validate all requests before doing any I/O
+  for (i = 0; i < n; i++) {
+    counters[i].joules = -1;
+    if ((state = get_state(rc, counters[i].pkg, counters[i].die)) == NULL ||
+        zone_to_msr_offset(counters[i].zone, ZONE_OFFSETS_ENERGY) < 0) {
+      return -1;
+    }
+  }
+  if (n == 0) {
+    return 0;
+  }
+  if ((ops = malloc(n * sizeof(*ops))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_msr_get_energy_counters: malloc");
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    ops[i].pkg = counters[i].pkg;
+    ops[i].die = counters[i].die;
+    ops[i].msr = ZONE_OFFSETS_ENERGY[counters[i].zone];
+  }
+  ret = msr_sys_read_batch(state->sys, ops, n);
+  for (i = 0; i < n; i++) {
+    if (ops[i].err == 0) {
+      counters[i].joules = msr_get_energy_counter(&state->ctx, ops[i].msrval, counters[i].zone);
+    }
+  }
+  free(ops);
+  return ret;
+}
+
+raplcap_snapshot* raplcap_snapshot_alloc(const raplcap* rc) {
+  uint32_t n_pkg;
+  uint32_t n_die;
+  const raplcap_msr* state = get_state(rc, 0, 0);
+  if (state == NULL || msr_sys_get_num_pkg_die(state->sys, &n_pkg, &n_die)) {
+    return NULL;
+  }
+  return snapshot_alloc(n_pkg, n_die);
+}
+
+// Reads both the power limit and energy MSRs for every zone in a single batch
+int raplcap_snapshot_read(const raplcap* rc, raplcap_snapshot* snap) {
+  raplcap_snapshot_zone* sz;
+  const raplcap_zone_handle* zh;
+  msr_sys_op* ops;
+  const msr_sys_op* op_pl;
+  const msr_sys_op* op_energy;
+  uint32_t n_ops;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t i;
+  int zone;
+  int en[2];
+  int cl[2];
+  const raplcap_msr* state = get_state(rc, 0, 0);
+  raplcap_log(DEBUG, "raplcap_snapshot_read\n");
+  if (state == NULL || msr_sys_get_num_pkg_die(state->sys, &n_pkg, &n_die)) {
+    return -1;
+  }
+  if (snap == NULL || snap->n_pkg != n_pkg || snap->n_die != n_die) {
+    raplcap_log(ERROR, "raplcap_snapshot_read: Snapshot was not allocated for this context\n");
+    errno = EINVAL;
+    return -1;
+  }
+  n_ops = 2 * snap->n_pkg * snap->n_die * RAPLCAP_NZONES;
+  if ((ops = malloc(n_ops * sizeof(*ops))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_snapshot_read: malloc");
+    return -1;
+  }
+  // only read supported zones
+  for (i = 0, pkg = 0; pkg < snap->n_pkg; pkg++) {
+    for (die = 0; die < snap->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        zh = get_handle(state, pkg, die, (raplcap_zone) zone);
+        if (get_caps(zh) & RAPLCAP_MSR_ZONE_CAP_SUPPORTED) {
+          ops[i].pkg = ops[i + 1].pkg = pkg;
+          ops[i].die = ops[i + 1].die = die;
+          ops[i].msr = zh->msr_pl;
+          ops[i + 1].msr = zh->msr_energy;
+          i += 2;
+        }
+      }
+    }
+  }
+  n_ops = i;
+  // individual failures are recorded in each op
+  msr_sys_read_batch(state->sys, ops, n_ops);
+  snap->timestamp_ns = snapshot_now_ns();
+  for (i = 0, pkg = 0; pkg < snap->n_pkg; pkg++) {
+    for (die = 0; die < snap->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        sz = snapshot_zone(snap, pkg, die, (raplcap_zone) zone);
+        snapshot_zone_reset(sz);
+        zh = get_handle(state, pkg, die, (raplcap_zone) zone);
+        if (!(get_caps(zh) & RAPLCAP_MSR_ZONE_CAP_SUPPORTED)) {
+          continue;
+        }
+        sz->supported = 1;
+        op_pl = &ops[i++];
+        op_energy = &ops[i++];
+        if (!op_pl->err) {
+          en[0] = en[1] = 1;
+          msr_is_zone_enabled(&state->ctx, (raplcap_zone) zone, op_pl->msrval, &en[0], &en[1]);
+          sz->enabled = en[0] && en[1];
+          cl[0] = cl[1] = 1;
+          msr_is_zone_clamped(&state->ctx, (raplcap_zone) zone, op_pl->msrval, &cl[0], &cl[1]);
+          sz->clamped = cl[0] && cl[1];
+          sz->locked = msr_is_zone_locked(&state->ctx, (raplcap_zone) zone, op_pl->msrval);
+          msr_get_limits(&state->ctx, (raplcap_zone) zone, op_pl->msrval, &sz->limit_long, &sz->limit_short);
+        }
+        if (!op_energy->err) {
+          sz->joules = msr_get_energy_counter(&state->ctx, op_energy->msrval, (raplcap_zone) zone);
+        }
+        sz->joules_max = zh->joules_max;
+      }
+    }
+  }
+  free(ops);
+  return 0;
+}
+
+int raplcap_async_impl_get_sources(const raplcap* rc, raplcap_async_source* sources, uint32_t max) {
+  const raplcap_zone_handle* zh;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  uint32_t n_zones;
+  uint32_t n;
+  uint32_t i;
+  const raplcap_msr* state = get_state(rc, 0, 0);
+  if (state == NULL) {
+    return -1;
+  }
+  if (msr_sys_get_num_pkg_die(state->sys, &n_pkg, &n_die)) {
+    return -1;
+  }
+  n_zones = n_pkg * n_die * RAPLCAP_NZONES;
+  for (n = 0, i = 0; i < n_zones && n < max; i++) {
+    zh = &state->handles[i];
+    if (get_caps(zh) & RAPLCAP_MSR_ZONE_CAP_SUPPORTED) {
+      sources[n].pkg = zh->pkg;
+      sources[n].die = zh->die;
+      sources[n].zone = zh->zone;
+      sources[n].fd = msr_sys_get_fd(state->sys, zh->pkg, zh->die);
+      sources[n].offset = zh->msr_energy;
+      sources[n].len = sizeof(uint64_t);
+      n++;
+    }
+  }
+  return (int) n;
+}
+
+double raplcap_async_impl_decode(const raplcap* rc, const raplcap_async_source* src, const char* buf, size_t len) {
+  uint64_t msrval;
+  const raplcap_msr* state = get_state(rc, src->pkg, src->die);
+  if (state == NULL || len != sizeof(msrval)) {
+    return -1;
+  }
+  memcpy(&msrval, buf, sizeof(msrval));
+  return msr_get_energy_counter(&state->ctx, msrval, src->zone);
+}
+
+raplcap_msr_txn* raplcap_msr_txn_alloc(const raplcap* rc) {
+  raplcap_msr_txn* txn;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  uint32_t n_zones;
+  const raplcap_msr* state = get_state(rc, 0, 0);
+  if (state == NULL || msr_sys_get_num_pkg_die(state->sys, &n_pkg, &n_die)) {
+    return NULL;
+  }
+  n_zones = n_pkg * n_die * RAPLCAP_NZONES;
+  if ((txn = calloc(1, sizeof(*txn) + n_zones * sizeof(raplcap_msr_txn_zone))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_msr_txn_alloc: calloc");
+    return NULL;
+  }
+  txn->ops = malloc(n_zones * sizeof(*txn->ops));
+  txn->orig = malloc(n_zones * sizeof(*txn->orig));
+  txn->idx = malloc(n_zones * sizeof(*txn->idx));
+  if (txn->ops == NULL || txn->orig == NULL || txn->idx == NULL) {
+    raplcap_perror(ERROR, "raplcap_msr_txn_alloc: malloc");
+    raplcap_msr_txn_free(txn);
+    return NULL;
+  }
+  txn->rc = rc;
+  txn->n_pkg = n_pkg;
+  txn->n_die = n_die;
+  return txn;
+}
+
+void raplcap_msr_txn_free(raplcap_msr_txn* txn) {
+  if (txn != NULL) {
+    free(txn->ops);
+    free(txn->orig);
+    free(txn->idx);
+    free(txn);
+  }
+}
+
+static raplcap_msr_txn_zone* txn_get_zone(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  const raplcap_msr* state;
+  if (txn == NULL || pkg >= txn->n_pkg || die >= txn->n_die || (int) zone < 0 || (int) zone >= RAPLCAP_NZONES) {
+    raplcap_log(ERROR, "txn_get_zone: Invalid parameters\n");
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((state = get_state(txn->rc, pkg, die)) == NULL) {
+    return NULL;
+  }
+  if (!(get_caps(get_handle(state, pkg, die, zone)) & RAPLCAP_MSR_ZONE_CAP_SUPPORTED)) {
+    raplcap_log(ERROR, "txn_get_zone: Zone not supported: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+    errno = ENOTSUP;
+    return NULL;
+  }
+  return &txn->zones[(((pkg * txn->n_die) + die) * RAPLCAP_NZONES) + zone];
+}
+
+int raplcap_msr_txn_set_limits(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  raplcap_msr_txn_zone* tz = txn_get_zone(txn, pkg, die, zone);
+  raplcap_log(DEBUG, "raplcap_msr_txn_set_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (tz == NULL) {
+    return -1;
+  }
+  if (limit_long != NULL) {
+    tz->limit_long = *limit_long;
+    tz->set_long = 1;
+  }
+  if (limit_short != NULL) {
+    tz->limit_short = *limit_short;
+    tz->set_short = 1;
+  }
+  return 0;
+}
+
+int raplcap_msr_txn_set_zone_enabled(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                     int enabled) {
+  raplcap_msr_txn_zone* tz = txn_get_zone(txn, pkg, die, zone);
+  raplcap_log(DEBUG, "raplcap_msr_txn_set_zone_enabled: pkg=%"PRIu32", die=%"PRIu32", zone=%d, enabled=%d\n",
+              pkg, die, zone, enabled);
+  if (tz == NULL) {
+    return -1;
+  }
+  tz->enabled = enabled;
+  tz->set_enabled = 1;
+  return 0;
+}
+
+int raplcap_msr_txn_set_zone_clamped(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                     int clamped) {
+  raplcap_msr_txn_zone* tz = txn_get_zone(txn, pkg, die, zone);
+  raplcap_log(DEBUG, "raplcap_msr_txn_set_zone_clamped: pkg=%"PRIu32", die=%"PRIu32", zone=%d, clamped=%d\n",
+              pkg, die, zone, clamped);
+  if (tz == NULL) {
+    return -1;
+  }
+  tz->clamped = clamped;
+  tz->set_clamped = 1;
+  return 0;
+}
+
+int raplcap_msr_txn_set_zone_locked(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  raplcap_msr_txn_zone* tz = txn_get_zone(txn, pkg, die, zone);
+  raplcap_log(DEBUG, "raplcap_msr_txn_set_zone_locked: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (tz == NULL) {
+    return -1;
+  }
+  tz->set_locked = 1;
+  return 0;
+}
+
+// Apply a staged zone's changes to a register value
+static uint64_t txn_apply(const raplcap_msr_ctx* ctx, raplcap_zone zone, uint64_t msrval,
+                          const raplcap_msr_txn_zone* tz, int implicit_clamp) {
+  if (tz->set_long || tz->set_short) {
+    msrval = msr_set_limits(ctx, zone, msrval, tz->set_long ? &tz->limit_long : NULL,
+                            tz->set_short ? &tz->limit_short : NULL);
+  }
+  if (tz->set_enabled) {
+    msrval = msr_set_zone_enabled(ctx, zone, msrval, &tz->enabled, &tz->enabled);
+    if (implicit_clamp && !tz->set_clamped) {
+      msrval = msr_set_zone_clamped(ctx, zone, msrval, &tz->enabled, &tz->enabled);
+    }
+  }
+  if (tz->set_clamped) {
+    msrval = msr_set_zone_clamped(ctx, zone, msrval, &tz->clamped, &tz->clamped);
+  }
+  return msrval;
+}
+
+static void txn_swap(raplcap_msr_txn* txn, uint32_t i, uint32_t j) {
+  const msr_sys_op op = txn->ops[i];
+  const uint64_t orig = txn->orig[i];
+  const uint32_t idx = txn->idx[i];
+  txn->ops[i] = txn->ops[j];
+  txn->orig[i] = txn->orig[j];
+  txn->idx[i] = txn->idx[j];
+  txn->ops[j] = op;
+  txn->orig[j] = orig;
+  txn->idx[j] = idx;
+}
+
+// Restore the original values of registers in [first, n) that were written, reusing the ops for only those registers
+static void txn_rollback(raplcap_msr_txn* txn, const raplcap_msr* state, uint32_t first, uint32_t n) {
+  uint32_t n_ops;
+  uint32_t i;
+  for (n_ops = 0, i = first; i < n; i++) {
+    if (txn->ops[i].err == 0 && txn->ops[i].msrval != txn->orig[i]) {
+      txn->ops[n_ops] = txn->ops[i];
+      txn->ops[n_ops].msrval = txn->orig[i];
+      n_ops++;
+    }
+  }
+  if (msr_sys_write_batch(state->sys, txn->ops, n_ops)) {
+    raplcap_perror(ERROR, "raplcap_msr_txn_commit: Rollback failed: msr_sys_write_batch");
+  }
+}
+
+static void txn_reset(raplcap_msr_txn* txn) {
+  memset(txn->zones, 0, txn->n_pkg * txn->n_die * RAPLCAP_NZONES * sizeof(raplcap_msr_txn_zone));
+}
+
+int raplcap_msr_txn_commit(raplcap_msr_txn* txn) {
+  const raplcap_msr* state;
+  const raplcap_msr_txn_zone* tz;
+  raplcap_zone_handle* zh;
+  msr_sys_op* op;
+  uint64_t msrval;
+  uint32_t n_zones;
+  uint32_t n_ops;
+  uint32_t n_writes;
+  uint32_t n_locks;
+  uint32_t n_locked;
+  uint32_t i;
+  int err_save = 0;
+  if (txn == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((state = get_state(txn->rc, 0, 0)) == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_msr_txn_commit\n");
+  // read the current value of every register with staged changes
+  n_zones = txn->n_pkg * txn->n_die * RAPLCAP_NZONES;
+  for (n_ops = 0, i = 0; i < n_zones; i++) {
+    tz = &txn->zones[i];
+    if (tz->set_long || tz->set_short || tz->set_enabled || tz->set_clamped || tz->set_locked) {
+      zh = &state->handles[i];
+      txn->idx[n_ops] = i;
+      txn->ops[n_ops].pkg = zh->pkg;
+      txn->ops[n_ops].die = zh->die;
+      txn->ops[n_ops].msr = zh->msr_pl;
+      n_ops++;
+    }
+  }
+  if (msr_sys_read_batch(state->sys, txn->ops, n_ops)) {
+    err_save = errno;
+    raplcap_perror(ERROR, "raplcap_msr_txn_commit: msr_sys_read_batch");
+    txn_reset(txn);
+    errno = err_save;
+    return -1;
+  }
+  // compute new values without lock bits, which are only written once all other changes succeed, since locked
+  // registers can't be rolled back
+  for (i = 0; i < n_ops; i++) {
+    zh = &state->handles[txn->idx[i]];
+    txn->orig[i] = txn->ops[i].msrval;
+    txn->ops[i].msrval = txn_apply(&state->ctx, zh->zone, txn->orig[i], &txn->zones[txn->idx[i]],
+                                   get_caps(zh) & RAPLCAP_MSR_ZONE_CAP_CLAMPING);
+  }
+  // only write registers that actually change, which are moved to the front
+  for (n_writes = 0, i = 0; i < n_ops; i++) {
+    if (txn->ops[i].msrval != txn->orig[i]) {
+      txn_swap(txn, i, n_writes++);
+    }
+  }
+  raplcap_log(DEBUG, "raplcap_msr_txn_commit: registers=%"PRIu32", writes=%"PRIu32"\n", n_ops, n_writes);
+  msr_sys_write_batch(state->sys, txn->ops, n_writes);
+  for (i = 0; i < n_writes; i++) {
+    op = &txn->ops[i];
+    zh = &state->handles[txn->idx[i]];
+    tz = &txn->zones[txn->idx[i]];
+    if (op->err == EIO && tz->set_enabled && !tz->set_clamped && (get_caps(zh) & RAPLCAP_MSR_ZONE_CAP_CLAMPING)) {
+      // the processor may reject the clamping bits, so try again without them, like raplcap_pd_set_zone_enabled
+      raplcap_log(INFO, "Clamping not available for this zone or platform\n");
+      clear_caps(zh, RAPLCAP_MSR_ZONE_CAP_CLAMPING);
+      op->msrval = txn_apply(&state->ctx, zh->zone, txn->orig[i], tz, 0);
+      op->err = msr_sys_write(state->sys, op->msrval, op->pkg, op->die, op->msr) ? errno : 0;
+    }
+    if (op->err && !err_save) {
+      err_save = op->err;
+    }
+  }
+  if (err_save) {
+    raplcap_log(ERROR, "raplcap_msr_txn_commit: Write failed, rolling back: %s\n", strerror(err_save));
+    txn_rollback(txn, state, 0, n_writes);
+  } else {
+    // lock registers that aren't already locked, which are moved to the front
+    for (n_locks = 0, i = 0; i < n_ops; i++) {
+      if (txn->zones[txn->idx[i]].set_locked) {
+        msrval = msr_set_zone_locked(&state->ctx, state->handles[txn->idx[i]].zone, txn->ops[i].msrval, 1);
+        if (msrval != txn->ops[i].msrval) {
+          txn->ops[i].msrval = msrval;
+          txn_swap(txn, i, n_locks++);
+        }
+      }
+    }
+    msr_sys_write_batch(state->sys, txn->ops, n_locks);
+    // registers that were locked are moved to the front
+    for (n_locked = 0, i = 0; i < n_locks; i++) {
+      if (txn->ops[i].err == 0) {
+        set_caps(&state->handles[txn->idx[i]], RAPLCAP_MSR_ZONE_CAP_LOCKED);
+        txn_swap(txn, i, n_locked++);
+      } else {
+        err_save = err_save ? err_save : txn->ops[i].err;
+        // the register still has its value from the first write
+        txn->ops[i].err = 0;
+      }
+    }
+    if (err_save) {
+      // registers that were locked can't be restored, so keep their new values
+      raplcap_log(ERROR, "raplcap_msr_txn_commit: Lock failed, rolling back: %s\n", strerror(err_save));
+      txn_rollback(txn, state, n_locked, n_ops);
+    }
+  }
+  txn_reset(txn);
+  if (err_save) {
+    errno = err_save;
+    return -1;
+  }
+  return 0;
+}
@@ -14,6 +14,49 @@ extern "C" {
 
 #include <raplcap.h>
 
+/**
+ * An energy counter request for batched reads.
+ * The pkg, die, and zone fields are inputs, joules is the output (a negative value on error).
+ */
+typedef struct raplcap_msr_energy_counter {
+  uint32_t pkg;
+  uint32_t die;
+  raplcap_zone zone;
+  double joules;
+} raplcap_msr_energy_counter;
+
+/**
+ * Zone capability flags, probed once when the context is initialized.
+ */
+typedef enum raplcap_msr_zone_cap {
+  RAPLCAP_MSR_ZONE_CAP_SUPPORTED = 0x1,
+  RAPLCAP_MSR_ZONE_CAP_SHORT_TERM = 0x2,
+  RAPLCAP_MSR_ZONE_CAP_LOCKED = 0x4,
+  RAPLCAP_MSR_ZONE_CAP_CLAMPING = 0x8
+} raplcap_msr_zone_cap;
+
+/**
+ * Rounding modes for translating time windows to the values the hardware can represent.
+ */
+typedef enum raplcap_msr_rounding {
+  RAPLCAP_MSR_ROUND_NEAREST = 0,
+  RAPLCAP_MSR_ROUND_FLOOR,
+  RAPLCAP_MSR_ROUND_CEIL
+} raplcap_msr_rounding;
+
+/**
+ * Get a zone's capabilities as a bitwise OR of raplcap_msr_zone_cap flags, without accessing MSRs.
+ * Capabilities are probed at initialization and updated by changes made through this context.
+ * Clamping is assumed to be available until an attempt to set it fails.
+ *
+ * @param rc
+ * @param pkg
+ * @param die
+ * @param zone
+ * @return a bitmask of raplcap_msr_zone_cap values on success, a negative value on error
+ */
+int raplcap_msr_pd_get_zone_caps(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone);
+
 /**
  * Check if a zone is clamped.
  *
@@ -94,6 +137,115 @@ double raplcap_msr_pd_get_power_units(const raplcap* rc, uint32_t pkg, uint32_t
  */
 double raplcap_msr_pd_get_energy_units(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone);
 
+/**
+ * Set how requested time windows are rounded to representable values when setting limits.
+ * The default is RAPLCAP_MSR_ROUND_NEAREST.
+ * Not thread-safe with respect to setting limits.
+ *
+ * @param rc
+ * @param rounding
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_msr_set_time_window_rounding(const raplcap* rc, raplcap_msr_rounding rounding);
+
+/**
+ * Get the current energy counter values for multiple zones in Joules.
+ * Uses a single msr-safe batch request when available, otherwise reads each MSR individually.
+ * Note that the counters roll over - check the max values.
+ *
+ * @param rc
+ * @param counters
+ * @param n
+ * @return 0 on success, a negative value if any counter could not be read
+ */
+int raplcap_msr_get_energy_counters(const raplcap* rc, raplcap_msr_energy_counter* counters, uint32_t n);
+
+/**
+ * A set of staged zone changes that are committed together.
+ */
+typedef struct raplcap_msr_txn raplcap_msr_txn;
+
+/**
+ * Allocate an empty transaction for an initialized context.
+ * The context must outlive the transaction.
+ *
+ * @param rc
+ * @return a transaction on success, NULL on error
+ */
+raplcap_msr_txn* raplcap_msr_txn_alloc(const raplcap* rc);
+
+/**
+ * Free a transaction, discarding any uncommitted changes.
+ *
+ * @param txn
+ */
+void raplcap_msr_txn_free(raplcap_msr_txn* txn);
+
+/**
+ * Stage new limits for a zone, with the same semantics as raplcap_pd_set_limits.
+ * Staging limits again for the same zone replaces the previously staged values.
+ *
+ * @param txn
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param limit_long
+ * @param limit_short
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_msr_txn_set_limits(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               const raplcap_limit* limit_long, const raplcap_limit* limit_short);
+
+/**
+ * Stage enabling/disabling a zone, with the same semantics as raplcap_pd_set_zone_enabled.
+ * Clamping is set to match unless also staged explicitly.
+ *
+ * @param txn
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param enabled
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_msr_txn_set_zone_enabled(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                     int enabled);
+
+/**
+ * Stage clamping/unclamping a zone.
+ *
+ * @param txn
+ * @param pkg
+ * @param die
+ * @param zone
+ * @param clamped
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_msr_txn_set_zone_clamped(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                                     int clamped);
+
+/**
+ * Stage locking a zone.
+ *
+ * @param txn
+ * @param pkg
+ * @param die
+ * @param zone
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_msr_txn_set_zone_locked(raplcap_msr_txn* txn, uint32_t pkg, uint32_t die, raplcap_zone zone);
+
+/**
+ * Commit all staged changes, writing each affected register at most once and skipping registers that don't change.
+ * Staged locks are written afterward, and only if all other writes succeed, since locked registers can't be restored.
+ * If any write fails, registers that were already written are restored to their original values (except for those
+ * that were locked before a later lock write failed, which hardware prevents).
+ * The transaction is emptied either way and may be reused.
+ *
+ * @param txn
+ * @return 0 on success, a negative value on error
+ */
+int raplcap_msr_txn_commit(raplcap_msr_txn* txn);
+
 /**
  * Assumes die=0.
  *
@@ -0,0 +1,169 @@
+/**
+ * Microbenchmarks for the MSR translation functions.
+ * Each function is run over its full encoding space (sampled for energy counters), and the average time per call is
+ * reported in nanoseconds.
+ *
+ * Usage: raplcap-msr-common-bench [max_ns_per_op]
+ *
+ * If max_ns_per_op is > 0, exits with failure if any function's average time per call exceeds it.
+ * The threshold is ignored if DEBUG logging is compiled in, since printing dominates the results.
+ *
+ * @author Connor Imes
+ * @date 2020-10-13
+ */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "raplcap-common.h"
+#include "../raplcap-msr-common.h"
+#include "../raplcap-cpuid.h"
+
+// Repeat each sweep to get at least this many calls
+#define MIN_OPS 1000000
+
+// Encoding space sizes
+#define TW_BITS_MAX 0x7F
+#define TW_BITS_MAX_AIRMONT 0xA
+#define PL_BITS_MAX 0x7FFF
+// Energy counters have 32 bits - sample 2^16 values spread across the range
+#define EY_STRIDE 0x10001
+
+// Prevent the compiler from discarding results
+static volatile double sink_dbl;
+static volatile uint64_t sink_u64;
+
+typedef struct bench_result {
+  const char* name;
+  uint64_t ops;
+  double ns_per_op;
+} bench_result;
+
+static void finish(bench_result* r, const char* name, uint64_t start, uint64_t ops) {
+  r->name = name;
+  r->ops = ops;
+  r->ns_per_op = (raplcap_clock_ns(CLOCK_MONOTONIC) - start) / (double) ops;
+  printf("%s,%"PRIu64",%.3f\n", r->name, r->ops, r->ns_per_op);
+}
+
+static void bench_from_tw_bits(bench_result* r, const char* name, const raplcap_msr_ctx* ctx, uint64_t bits_max) {
+  const uint64_t rounds = MIN_OPS / (bits_max + 1) + 1;
+  const uint64_t start = raplcap_clock_ns(CLOCK_MONOTONIC);
+  uint64_t i;
+  uint64_t bits;
+  double acc = 0;
+  for (i = 0; i < rounds; i++) {
+    for (bits = 0; bits <= bits_max; bits++) {
+      acc += msr_from_tw_bits(ctx, RAPLCAP_ZONE_CORE, bits);
+    }
+  }
+  sink_dbl = acc;
+  finish(r, name, start, rounds * (bits_max + 1));
+}
+
+static void bench_to_tw_bits(bench_result* r, const char* name, const raplcap_msr_ctx* ctx, uint64_t bits_max) {
+  const uint64_t rounds = MIN_OPS / (bits_max + 1) + 1;
+  double seconds[TW_BITS_MAX + 1];
+  uint64_t start;
+  uint64_t i;
+  uint64_t bits;
+  uint64_t acc = 0;
+  for (bits = 0; bits <= bits_max; bits++) {
+    seconds[bits] = msr_from_tw_bits(ctx, RAPLCAP_ZONE_CORE, bits);
+  }
+  start = raplcap_clock_ns(CLOCK_MONOTONIC);
+  for (i = 0; i < rounds; i++) {
+    for (bits = 0; bits <= bits_max; bits++) {
+      acc += msr_to_tw_bits(ctx, RAPLCAP_ZONE_CORE, seconds[bits], RAPLCAP_MSR_ROUND_NEAREST);
+    }
+  }
+  sink_u64 = acc;
+  finish(r, name, start, rounds * (bits_max + 1));
+}
+
+static void bench_from_msr_pl(bench_result* r, const char* name, const raplcap_msr_ctx* ctx) {
+  const uint64_t rounds = MIN_OPS / (PL_BITS_MAX + 1) + 1;
+  const uint64_t start = raplcap_clock_ns(CLOCK_MONOTONIC);
+  uint64_t i;
+  uint64_t bits;
+  double acc = 0;
+  for (i = 0; i < rounds; i++) {
+    for (bits = 0; bits <= PL_BITS_MAX; bits++) {
+      acc += ctx->cfg[RAPLCAP_ZONE_PACKAGE].from_msr_pl(bits, ctx->power_units);
+    }
+  }
+  sink_dbl = acc;
+  finish(r, name, start, rounds * (PL_BITS_MAX + 1));
+}
+
+static void bench_to_msr_pl(bench_result* r, const char* name, const raplcap_msr_ctx* ctx) {
+  const uint64_t rounds = MIN_OPS / (PL_BITS_MAX + 1) + 1;
+  const uint64_t start = raplcap_clock_ns(CLOCK_MONOTONIC);
+  uint64_t i;
+  uint64_t bits;
+  uint64_t acc = 0;
+  for (i = 0; i < rounds; i++) {
+    for (bits = 0; bits <= PL_BITS_MAX; bits++) {
+      acc += ctx->cfg[RAPLCAP_ZONE_PACKAGE].to_msr_pl(bits * ctx->power_units, ctx->power_units);
+    }
+  }
+  sink_u64 = acc;
+  finish(r, name, start, rounds * (PL_BITS_MAX + 1));
+}
+
+static void bench_get_energy_counter(bench_result* r, const char* name, const raplcap_msr_ctx* ctx) {
+  const uint64_t n = 0xFFFFFFFFULL / EY_STRIDE + 1;
+  const uint64_t rounds = MIN_OPS / n + 1;
+  const uint64_t start = raplcap_clock_ns(CLOCK_MONOTONIC);
+  uint64_t i;
+  uint64_t msrval;
+  double acc = 0;
+  for (i = 0; i < rounds; i++) {
+    for (msrval = 0; msrval <= 0xFFFFFFFFULL; msrval += EY_STRIDE) {
+      acc += msr_get_energy_counter(ctx, msrval, RAPLCAP_ZONE_PACKAGE);
+    }
+  }
+  sink_dbl = acc;
+  finish(r, name, start, rounds * n);
+}
+
+int main(int argc, char** argv) {
+  bench_result results[9];
+  raplcap_msr_ctx ctx_default;
+  raplcap_msr_ctx ctx_atom;
+  raplcap_msr_ctx ctx_airmont;
+  double max_ns_per_op = 0;
+  size_t i = 0;
+  size_t j;
+  int ret = 0;
+  if (argc > 1) {
+    max_ns_per_op = strtod(argv[1], NULL);
+  }
+  if (raplcap_is_log_enabled(DEBUG) && max_ns_per_op > 0) {
+    fprintf(stderr, "DEBUG logging is enabled, ignoring threshold\n");
+    max_ns_per_op = 0;
+  }
+  msr_get_context(&ctx_default, CPUID_MODEL_SANDYBRIDGE, 0x00000000000A0E03);
+  msr_get_context(&ctx_atom, CPUID_MODEL_ATOM_SILVERMONT, 0x5);
+  msr_get_context(&ctx_airmont, CPUID_MODEL_ATOM_AIRMONT, 0x5);
+  printf("function,ops,ns_per_op\n");
+  bench_from_tw_bits(&results[i++], "msr_from_tw_bits_default", &ctx_default, TW_BITS_MAX);
+  bench_from_tw_bits(&results[i++], "msr_from_tw_bits_atom", &ctx_atom, TW_BITS_MAX);
+  bench_from_tw_bits(&results[i++], "msr_from_tw_bits_atom_airmont", &ctx_airmont, TW_BITS_MAX_AIRMONT);
+  bench_to_tw_bits(&results[i++], "msr_to_tw_bits_default", &ctx_default, TW_BITS_MAX);
+  bench_to_tw_bits(&results[i++], "msr_to_tw_bits_atom", &ctx_atom, TW_BITS_MAX);
+  bench_to_tw_bits(&results[i++], "msr_to_tw_bits_atom_airmont", &ctx_airmont, TW_BITS_MAX_AIRMONT);
+  bench_from_msr_pl(&results[i++], "from_msr_pl_default", &ctx_default);
+  bench_to_msr_pl(&results[i++], "to_msr_pl_default", &ctx_default);
+  bench_get_energy_counter(&results[i++], "msr_get_energy_counter", &ctx_default);
+  for (j = 0; max_ns_per_op > 0 && j < i; j++) {
+    if (results[j].ns_per_op > max_ns_per_op) {
+      fprintf(stderr, "%s: %.3f ns/op exceeds threshold: %.3f ns/op\n",
+              results[j].name, results[j].ns_per_op, max_ns_per_op);
+      ret = 1;
+    }
+  }
+  return ret;
+}
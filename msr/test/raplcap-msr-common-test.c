@@ -10,6 +10,8 @@
 #include "../raplcap-msr-common.h"
 #include "../raplcap-cpuid.h"
 
+#define TL_BITS_MAX 0x7F
+
 static double abs_dbl(double a) {
   return a >= 0 ? a : -a;
 }
@@ -37,20 +39,20 @@ static void test_translate_default(void) {
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].from_msr_pl(0x00C8, PU), 25.0));
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_pl(25.0, PU), 0x00C8));
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].from_msr_tw(0x6E, TU), 28.0));
-  assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_tw(28.0, TU), 0x6E));
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_PACKAGE, 28.0, RAPLCAP_MSR_ROUND_NEAREST) == 0x6E);
   // example short term
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].from_msr_pl(0x0078, PU), 15.0));
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_pl(15.0, PU), 0x0078));
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].from_msr_tw(0x21, TU), 0.002441406250));
-  assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_tw(0.002441406250, TU), 0x21));
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_PACKAGE, 0.002441406250, RAPLCAP_MSR_ROUND_NEAREST) == 0x21);
   // too low (rounds to 0)
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_pl(0.0000001, PU), 0x0));
   // too high
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_pl(10000.0, PU), 0x7FFF));
   // too low (rounds to 0)
-  assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_tw(0.0000001, TU), 0x0));
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_PACKAGE, 0.0000001, RAPLCAP_MSR_ROUND_NEAREST) == 0x0);
   // too high
-  assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_tw(10000000.0, TU), 0x7F));
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_PACKAGE, 10000000.0, RAPLCAP_MSR_ROUND_NEAREST) == 0x7F);
   // TODO: More tests would be good
 }
 
@@ -73,16 +75,16 @@ static void test_translate_atom(void) {
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].from_msr_tw(0x1, TU), 1.0));
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].from_msr_tw(0x2, TU), 2.0));
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_PACKAGE].from_msr_tw(0x7F, TU), 127.0));
-  // too low
-  assert(ctx.cfg[RAPLCAP_ZONE_PACKAGE].to_msr_tw(0.99, TU) == 0x0);
+  // too low - 0x0 and 0x1 both mean 1 second, the explicit encoding is used
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_PACKAGE, 0.99, RAPLCAP_MSR_ROUND_NEAREST) == 0x1);
   // within range
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(1.0, TU) == 0x1);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(1.49, TU) == 0x1);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(1.51, TU) == 0x2);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(2.0, TU) == 0x2);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(127.0, TU) == 0x7F);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 1.0, RAPLCAP_MSR_ROUND_NEAREST) == 0x1);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 1.49, RAPLCAP_MSR_ROUND_NEAREST) == 0x1);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 1.51, RAPLCAP_MSR_ROUND_NEAREST) == 0x2);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 2.0, RAPLCAP_MSR_ROUND_NEAREST) == 0x2);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 127.0, RAPLCAP_MSR_ROUND_NEAREST) == 0x7F);
   // too high
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(128.0, TU) == 0x7F);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 128.0, RAPLCAP_MSR_ROUND_NEAREST) == 0x7F);
 }
 
 static void test_translate_atom_airmont(void) {
@@ -108,23 +110,73 @@ static void test_translate_atom_airmont(void) {
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_CORE].from_msr_tw(0x9, TU), 45.0));
   assert(equal_dbl(ctx.cfg[RAPLCAP_ZONE_CORE].from_msr_tw(0xA, TU), 50.0));
   // too low
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(0.99, TU) == 0x0);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 0.99, RAPLCAP_MSR_ROUND_NEAREST) == 0x0);
   // within range
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(1.0, TU) == 0x0);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(2.49, TU) == 0x0);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(2.51, TU) == 0x1);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(5, TU) == 0x1);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(10, TU) == 0x2);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(15, TU) == 0x3);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(20, TU) == 0x4);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(25, TU) == 0x5);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(30, TU) == 0x6);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(35, TU) == 0x7);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(40, TU) == 0x8);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(45, TU) == 0x9);
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(50, TU) == 0xA);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 1.0, RAPLCAP_MSR_ROUND_NEAREST) == 0x0);
+  // 0x0 means 1 second, so the midpoint with 0x1 (5 seconds) is 3 seconds
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 2.99, RAPLCAP_MSR_ROUND_NEAREST) == 0x0);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 3.01, RAPLCAP_MSR_ROUND_NEAREST) == 0x1);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 5, RAPLCAP_MSR_ROUND_NEAREST) == 0x1);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 10, RAPLCAP_MSR_ROUND_NEAREST) == 0x2);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 15, RAPLCAP_MSR_ROUND_NEAREST) == 0x3);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 20, RAPLCAP_MSR_ROUND_NEAREST) == 0x4);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 25, RAPLCAP_MSR_ROUND_NEAREST) == 0x5);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 30, RAPLCAP_MSR_ROUND_NEAREST) == 0x6);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 35, RAPLCAP_MSR_ROUND_NEAREST) == 0x7);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 40, RAPLCAP_MSR_ROUND_NEAREST) == 0x8);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 45, RAPLCAP_MSR_ROUND_NEAREST) == 0x9);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 50, RAPLCAP_MSR_ROUND_NEAREST) == 0xA);
   // too high
-  assert(ctx.cfg[RAPLCAP_ZONE_CORE].to_msr_tw(50.01, TU) == 0xA);
+  assert(msr_to_tw_bits(&ctx, RAPLCAP_ZONE_CORE, 50.01, RAPLCAP_MSR_ROUND_NEAREST) == 0xA);
+}
+
+static void test_tw_table(uint32_t cpu_model, uint64_t units_msrval, raplcap_zone zone, uint64_t bits_max) {
+  raplcap_msr_ctx ctx;
+  uint64_t bits;
+  uint64_t floor_bits;
+  uint64_t ceil_bits;
+  double seconds;
+  double lo;
+  double hi;
+  msr_get_context(&ctx, cpu_model, units_msrval);
+  for (bits = 0; bits <= TL_BITS_MAX; bits++) {
+    // decoding matches the translate functions
+    assert(equal_dbl(msr_from_tw_bits(&ctx, zone, bits), ctx.cfg[zone].from_msr_tw(bits, ctx.time_units)));
+  }
+  for (bits = 0; bits <= bits_max; bits++) {
+    // representable values are encoded exactly with any rounding
+    seconds = msr_from_tw_bits(&ctx, zone, bits);
+    assert(equal_dbl(msr_from_tw_bits(&ctx, zone, msr_to_tw_bits(&ctx, zone, seconds, RAPLCAP_MSR_ROUND_NEAREST)),
+                     seconds));
+    assert(equal_dbl(msr_from_tw_bits(&ctx, zone, msr_to_tw_bits(&ctx, zone, seconds, RAPLCAP_MSR_ROUND_FLOOR)),
+                     seconds));
+    assert(equal_dbl(msr_from_tw_bits(&ctx, zone, msr_to_tw_bits(&ctx, zone, seconds, RAPLCAP_MSR_ROUND_CEIL)),
+                     seconds));
+  }
+  for (bits = 0; bits < ctx.tw[zone].n_sorted - 1; bits++) {
+    // values between neighbors
+    lo = ctx.tw[zone].sorted[bits].seconds;
+    hi = ctx.tw[zone].sorted[bits + 1].seconds;
+    assert(lo < hi);
+    floor_bits = ctx.tw[zone].sorted[bits].bits;
+    ceil_bits = ctx.tw[zone].sorted[bits + 1].bits;
+    assert(msr_to_tw_bits(&ctx, zone, lo + (hi - lo) * 0.25, RAPLCAP_MSR_ROUND_NEAREST) == floor_bits);
+    assert(msr_to_tw_bits(&ctx, zone, lo + (hi - lo) * 0.75, RAPLCAP_MSR_ROUND_NEAREST) == ceil_bits);
+    assert(msr_to_tw_bits(&ctx, zone, lo + (hi - lo) * 0.75, RAPLCAP_MSR_ROUND_FLOOR) == floor_bits);
+    assert(msr_to_tw_bits(&ctx, zone, lo + (hi - lo) * 0.25, RAPLCAP_MSR_ROUND_CEIL) == ceil_bits);
+  }
+  // out of range values are clamped
+  lo = ctx.tw[zone].sorted[0].seconds;
+  hi = ctx.tw[zone].sorted[ctx.tw[zone].n_sorted - 1].seconds;
+  assert(msr_to_tw_bits(&ctx, zone, lo / 2, RAPLCAP_MSR_ROUND_CEIL) == ctx.tw[zone].sorted[0].bits);
+  assert(msr_to_tw_bits(&ctx, zone, hi * 2, RAPLCAP_MSR_ROUND_FLOOR) == ctx.tw[zone].sorted[ctx.tw[zone].n_sorted - 1].bits);
+}
+
+static void test_tw_tables(void) {
+  test_tw_table(CPUID_MODEL_SANDYBRIDGE, 0x00000000000A0E03, RAPLCAP_ZONE_PACKAGE, TL_BITS_MAX);
+  test_tw_table(CPUID_MODEL_ATOM_SILVERMONT, 0x5, RAPLCAP_ZONE_PACKAGE, TL_BITS_MAX);
+  test_tw_table(CPUID_MODEL_ATOM_AIRMONT, 0x5, RAPLCAP_ZONE_CORE, 0xA);
+  test_tw_table(CPUID_MODEL_ATOM_AIRMONT, 0x5, RAPLCAP_ZONE_PACKAGE, TL_BITS_MAX);
 }
 
 #define TEST_CPU_MODEL CPUID_MODEL_BROADWELL
@@ -280,15 +332,67 @@ static void test_clamping(void) {
   }
 }
 
+static void test_quantize_limit(const raplcap_msr_ctx* ctx, raplcap_zone zone, int has_short,
+                                double watts, double seconds, int flags_expected) {
+  raplcap_limit ll = { seconds, watts };
+  raplcap_limit ls = { seconds, watts };
+  raplcap_limit ll_get = { 0, 0 };
+  raplcap_limit ls_get = { 0, 0 };
+  const uint64_t msrval = msr_set_limits(ctx, zone, 0, &ll, &ls);
+  msr_get_limits(ctx, zone, msrval, &ll_get, &ls_get);
+  // quantized values are what would be read back after setting
+  assert(msr_quantize_limits(ctx, zone, &ll, &ls) ==
+         (has_short ? flags_expected : flags_expected & (RAPLCAP_QUANTIZE_LONG_WATTS_CLAMPED |
+                                                         RAPLCAP_QUANTIZE_LONG_SECONDS_CLAMPED)));
+  assert(equal_dbl(ll.watts, ll_get.watts));
+  assert(equal_dbl(ll.seconds, ll_get.seconds));
+  assert(equal_dbl(ls.watts, ls_get.watts));
+  assert(equal_dbl(ls.seconds, ls_get.seconds));
+}
+
+#define FLAGS_WATTS_CLAMPED (RAPLCAP_QUANTIZE_LONG_WATTS_CLAMPED | RAPLCAP_QUANTIZE_SHORT_WATTS_CLAMPED)
+#define FLAGS_SECONDS_CLAMPED (RAPLCAP_QUANTIZE_LONG_SECONDS_CLAMPED | RAPLCAP_QUANTIZE_SHORT_SECONDS_CLAMPED)
+
+static void test_quantize(void) {
+  raplcap_msr_ctx ctx;
+  raplcap_limit ll = { 0, 0 };
+  raplcap_limit ls = { 1, 1 };
+  unsigned int i;
+  msr_get_context(&ctx, TEST_CPU_MODEL, TEST_UNITS_MSRVAL);
+  for (i = 0; i < TEST_ZONE_COUNT; i++) {
+    // exact values
+    test_quantize_limit(&ctx, TEST_ZONES[i], TEST_ZONES_HAS_SHORT[i], 35.0, 28.0, 0);
+    // truncated power and rounded time window
+    test_quantize_limit(&ctx, TEST_ZONES[i], TEST_ZONES_HAS_SHORT[i], 35.06, 27.9, 0);
+    test_quantize_limit(&ctx, TEST_ZONES[i], TEST_ZONES_HAS_SHORT[i], 0.1, 0.01, 0);
+    // clamped
+    test_quantize_limit(&ctx, TEST_ZONES[i], TEST_ZONES_HAS_SHORT[i], 10000.0, 0.0001,
+                        FLAGS_WATTS_CLAMPED | FLAGS_SECONDS_CLAMPED);
+    test_quantize_limit(&ctx, TEST_ZONES[i], TEST_ZONES_HAS_SHORT[i], 1.0, 1.0e12, FLAGS_SECONDS_CLAMPED);
+  }
+  // values of 0 are unchanged
+  assert(msr_quantize_limits(&ctx, RAPLCAP_ZONE_PACKAGE, &ll, NULL) == 0);
+  assert(equal_dbl(ll.watts, 0));
+  assert(equal_dbl(ll.seconds, 0));
+  // zones without a short term constraint zero it
+  assert(msr_quantize_limits(&ctx, RAPLCAP_ZONE_CORE, NULL, &ls) == 0);
+  assert(equal_dbl(ls.watts, 0));
+  assert(equal_dbl(ls.seconds, 0));
+}
+
 int main(void) {
-  // test the private translate functions
+  // test the translate functions
   test_translate_default();
   test_translate_atom();
   test_translate_atom_airmont();
+  // test the precomputed time window tables
+  test_tw_tables();
   // test boolean bit fields
   test_locked();
   test_enabled();
   test_clamping();
+  // test limit quantization
+  test_quantize();
   // TODO: Test additional functions (power/time/energy units...)
   return 0;
 }
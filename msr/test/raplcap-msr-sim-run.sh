@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Run a command with a private simulated root filesystem - see raplcap-msr-sim-setup.
+# The root is created in a temporary directory, exported as RAPLCAP_MSR_SIM_ROOT, and removed when the command exits,
+# so concurrent commands don't share simulated MSR state.
+#
+# Usage: raplcap-msr-sim-run.sh <raplcap-msr-sim-setup> <n_pkg> <n_die> <n_cpus_per_die> <command> [args...]
+#
+
+if [ $# -lt 5 ]; then
+  echo "Usage: $0 <raplcap-msr-sim-setup> <n_pkg> <n_die> <n_cpus_per_die> <command> [args...]" >&2
+  exit 1
+fi
+
+SETUP=$1
+N_PKG=$2
+N_DIE=$3
+N_CPUS=$4
+shift 4
+
+ROOT=$(mktemp -d) || exit 1
+if ! "$SETUP" "$ROOT" "$N_PKG" "$N_DIE" "$N_CPUS"; then
+  rm -rf "$ROOT"
+  exit 1
+fi
+
+RAPLCAP_MSR_SIM_ROOT="$ROOT" "$@"
+RET=$?
+
+rm -rf "$ROOT"
+exit $RET
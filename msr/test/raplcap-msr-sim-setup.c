@@ -0,0 +1,201 @@
+/**
+ * Create a simulated root filesystem for running the msr implementation without MSR access.
+ * Point the ENV_RAPLCAP_MSR_SIM_ROOT environment variable at the directory to use it.
+ *
+ * Usage: raplcap-msr-sim-setup <root> [n_pkg] [n_die] [n_cpus_per_die] [cpu_model]
+ *
+ * @author Connor Imes
+ * @date 2020-10-12
+ */
+// for pwrite, ftruncate, link
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "../raplcap-cpuid.h"
+#include "../raplcap-msr-common.h"
+#include "../../test/raplcap-sim-util.h"
+
+// Large enough to contain all RAPL MSRs, but sparse so unused registers take no space and read as 0
+#define SIM_MSR_FILE_SIZE 0x1000
+
+// Power units = 1/8 W, energy units = 2^-14 J, time units = 2^-10 s
+#define SIM_RAPL_POWER_UNIT 0xA0E03
+// Long term: 35 W, enabled and clamped, 28 s; short term: 44 W, enabled, 2.44 ms
+#define SIM_POWER_LIMIT 0x0042816000DD8118
+
+static const off_t SIM_PL_MSRS[] = {
+  MSR_PKG_POWER_LIMIT, MSR_PP0_POWER_LIMIT, MSR_PP1_POWER_LIMIT, MSR_DRAM_POWER_LIMIT, MSR_PLATFORM_POWER_LIMIT
+};
+
+static const off_t SIM_ENERGY_MSRS[] = {
+  MSR_PKG_ENERGY_STATUS, MSR_PP0_ENERGY_STATUS, MSR_PP1_ENERGY_STATUS, MSR_DRAM_ENERGY_STATUS,
+  MSR_PLATFORM_ENERGY_COUNTER
+};
+
+static int write_u32_file(const char* dir, const char* name, uint32_t val) {
+  char fname[PATH_MAX];
+  FILE* f;
+  if (sim_path(fname, sizeof(fname), "%s/%s", dir, name)) {
+    return -1;
+  }
+  if ((f = fopen(fname, "w")) == NULL) {
+    perror(fname);
+    return -1;
+  }
+  fprintf(f, "%"PRIu32"\n", val);
+  if (fclose(f)) {
+    perror(fname);
+    return -1;
+  }
+  return 0;
+}
+
+static int write_msr(int fd, off_t msr, uint64_t msrval) {
+  if (pwrite(fd, &msrval, sizeof(msrval), msr) != sizeof(msrval)) {
+    perror("pwrite");
+    return -1;
+  }
+  return 0;
+}
+
+static int create_msr_file(const char* dir, uint32_t cpu) {
+  char fname[PATH_MAX];
+  size_t i;
+  int fd;
+  int ret = 0;
+  if (sim_path(fname, sizeof(fname), "%s/msr", dir)) {
+    return -1;
+  }
+  if ((fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror(fname);
+    return -1;
+  }
+  if (ftruncate(fd, SIM_MSR_FILE_SIZE)) {
+    perror(fname);
+    ret = -1;
+  }
+  ret |= write_msr(fd, MSR_RAPL_POWER_UNIT, SIM_RAPL_POWER_UNIT);
+  for (i = 0; i < sizeof(SIM_PL_MSRS) / sizeof(SIM_PL_MSRS[0]); i++) {
+    ret |= write_msr(fd, SIM_PL_MSRS[i], SIM_POWER_LIMIT);
+  }
+  // give each counter a different starting value
+  for (i = 0; i < sizeof(SIM_ENERGY_MSRS) / sizeof(SIM_ENERGY_MSRS[0]); i++) {
+    ret |= write_msr(fd, SIM_ENERGY_MSRS[i], 0x10000 * (cpu + 1) + i);
+  }
+  if (close(fd)) {
+    perror(fname);
+    ret = -1;
+  }
+  return ret;
+}
+
+// RAPL MSRs are package/die-scoped, so all CPUs in a die share the same file (like hardware, where any CPU in the
+// die reads and writes the same registers)
+static int link_msr_file(const char* root, const char* dir, uint32_t first_cpu) {
+  char src[PATH_MAX];
+  char dst[PATH_MAX];
+  if (sim_path(src, sizeof(src), "%s/dev/cpu/%"PRIu32"/msr", root, first_cpu) ||
+      sim_path(dst, sizeof(dst), "%s/msr", dir)) {
+    return -1;
+  }
+  if ((unlink(dst) && errno != ENOENT) || link(src, dst)) {
+    perror(dst);
+    return -1;
+  }
+  return 0;
+}
+
+static int create_cpu(const char* root, uint32_t cpu, uint32_t pkg, uint32_t die, uint32_t first_cpu) {
+  char dir[PATH_MAX];
+  if (sim_path(dir, sizeof(dir), "%s/sys/devices/system/cpu/cpu%"PRIu32"/topology", root, cpu) ||
+      sim_mkdirs(dir) ||
+      write_u32_file(dir, "physical_package_id", pkg) ||
+      write_u32_file(dir, "die_id", die)) {
+    return -1;
+  }
+  if (sim_path(dir, sizeof(dir), "%s/dev/cpu/%"PRIu32, root, cpu) || sim_mkdirs(dir) ||
+      (cpu == first_cpu ? create_msr_file(dir, cpu) : link_msr_file(root, dir, first_cpu))) {
+    return -1;
+  }
+  return 0;
+}
+
+static int create_cpuinfo(const char* root, uint32_t n_cpus, uint32_t model) {
+  char fname[PATH_MAX];
+  FILE* f;
+  uint32_t i;
+  if (sim_path(fname, sizeof(fname), "%s/proc", root) || sim_mkdirs(fname) ||
+      sim_path(fname, sizeof(fname), "%s/proc/cpuinfo", root)) {
+    return -1;
+  }
+  if ((f = fopen(fname, "w")) == NULL) {
+    perror(fname);
+    return -1;
+  }
+  for (i = 0; i < n_cpus; i++) {
+    fprintf(f, "processor\t: %"PRIu32"\nvendor_id\t: %s\ncpu family\t: 6\nmodel\t\t: %"PRIu32"\n"
+            "model name\t: Simulated CPU\n\n", i, CPUID_VENDOR_ID_GENUINE_INTEL, model);
+  }
+  if (fclose(f)) {
+    perror(fname);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  uint32_t n_pkg = 1;
+  uint32_t n_die = 1;
+  uint32_t n_cpus_per_die = 1;
+  uint32_t model = CPUID_MODEL_SKYLAKE_X;
+  uint32_t cpu = 0;
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t i;
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <root> [n_pkg] [n_die] [n_cpus_per_die] [cpu_model]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 2) {
+    n_pkg = (uint32_t) strtoul(argv[2], NULL, 0);
+  }
+  if (argc > 3) {
+    n_die = (uint32_t) strtoul(argv[3], NULL, 0);
+  }
+  if (argc > 4) {
+    n_cpus_per_die = (uint32_t) strtoul(argv[4], NULL, 0);
+  }
+  if (argc > 5) {
+    model = (uint32_t) strtoul(argv[5], NULL, 0);
+  }
+  if (n_pkg == 0 || n_die == 0 || n_cpus_per_die == 0) {
+    fprintf(stderr, "Counts must be > 0\n");
+    return 1;
+  }
+  if (sim_mkdirs(argv[1])) {
+    return 1;
+  }
+  // number CPUs like Linux usually does, interleaving packages
+  for (i = 0; i < n_cpus_per_die; i++) {
+    for (die = 0; die < n_die; die++) {
+      for (pkg = 0; pkg < n_pkg; pkg++) {
+        // the first round creates the lowest CPU of each die
+        if (create_cpu(argv[1], cpu++, pkg, die, die * n_pkg + pkg)) {
+          return 1;
+        }
+      }
+    }
+  }
+  if (create_cpuinfo(argv[1], cpu, model)) {
+    return 1;
+  }
+  return 0;
+}
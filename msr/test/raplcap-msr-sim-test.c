@@ -0,0 +1,586 @@
+/**
+ * Tests for raplcap-msr extensions that check results against the simulated MSR files.
+ * Must run with a simulated root filesystem - see raplcap-msr-sim-setup and raplcap-msr-sim-run.sh.
+ */
+// for pread, pwrite, syscall, clock_gettime, nanosleep
+#define _GNU_SOURCE
+/* force assertions */
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "raplcap.h"
+#include "raplcap-accumulator.h"
+#include "raplcap-async.h"
+#include "raplcap-common.h"
+#include "raplcap-power-meter.h"
+#include "../raplcap-msr.h"
+#include "../raplcap-msr-common.h"
+
+// must match raplcap-msr-sim-setup
+#define SIM_ENERGY_UNITS (1.0 / (1 << 14))
+#define SIM_ENERGY_INIT(cpu, zone) (0x10000 * ((cpu) + 1) + (zone))
+#define SIM_ENERGY_MASK 0xFFFFFFFFULL
+
+// Long term power limit enable and clamp bits
+#define PL1_EN (1ULL << 15)
+#define PL1_CL (1ULL << 16)
+
+static uint32_t n_pkg;
+static uint32_t n_die;
+
+// Write accounting and fault injection for pwrite, which the library uses for all MSR writes in the simulation
+static uint32_t n_writes;
+static ino_t fail_ino;
+static off_t fail_msr = -1;
+static uint64_t fail_bits;
+static int fail_errno;
+
+// Overrides the C library's pwrite - fails writes to fail_msr in the file fail_ino with fail_errno if the value being
+// written has all of fail_bits set, otherwise counts and performs the write
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+  struct stat st;
+  uint64_t msrval;
+  if (offset == fail_msr && count == sizeof(msrval) && fstat(fd, &st) == 0 && st.st_ino == fail_ino) {
+    memcpy(&msrval, buf, sizeof(msrval));
+    if ((msrval & fail_bits) == fail_bits) {
+      errno = fail_errno;
+      return -1;
+    }
+  }
+  n_writes++;
+  return syscall(SYS_pwrite64, fd, buf, count, offset);
+}
+
+static double abs_dbl(double a) {
+  return a >= 0 ? a : -a;
+}
+
+static int equal_dbl(double a, double b) {
+  return abs_dbl(a - b) < DBL_EPSILON;
+}
+
+// CPUs are numbered interleaving packages, and all CPUs in a die share the first CPU's MSR file
+static uint32_t sim_cpu(uint32_t pkg, uint32_t die) {
+  return die * n_pkg + pkg;
+}
+
+static int sim_open(uint32_t pkg, uint32_t die) {
+  char fname[PATH_MAX];
+  int fd;
+  snprintf(fname, sizeof(fname), "%s/dev/cpu/%"PRIu32"/msr", getenv(ENV_RAPLCAP_MSR_SIM_ROOT), sim_cpu(pkg, die));
+  fd = open(fname, O_RDWR);
+  assert(fd >= 0);
+  return fd;
+}
+
+static uint64_t sim_read(uint32_t pkg, uint32_t die, off_t msr) {
+  uint64_t msrval;
+  int fd = sim_open(pkg, die);
+  assert(pread(fd, &msrval, sizeof(msrval), msr) == sizeof(msrval));
+  close(fd);
+  return msrval;
+}
+
+static void sim_write(uint32_t pkg, uint32_t die, off_t msr, uint64_t msrval) {
+  int fd = sim_open(pkg, die);
+  assert(pwrite(fd, &msrval, sizeof(msrval), msr) == sizeof(msrval));
+  close(fd);
+}
+
+static void sim_fail_writes(uint32_t pkg, uint32_t die, off_t msr, uint64_t bits, int err) {
+  struct stat st;
+  int fd = sim_open(pkg, die);
+  assert(fstat(fd, &st) == 0);
+  close(fd);
+  fail_ino = st.st_ino;
+  fail_msr = msr;
+  fail_bits = bits;
+  fail_errno = err;
+}
+
+static void sim_fail_writes_clear(void) {
+  fail_msr = -1;
+}
+
+static void test_energy_counters(const raplcap* rc) {
+  raplcap_msr_energy_counter counters[2];
+  uint32_t pkg;
+  uint32_t die;
+  printf("test_energy_counters\n");
+  // no requests is a no-op
+  assert(raplcap_msr_get_energy_counters(rc, NULL, 0) == 0);
+  errno = 0;
+  assert(raplcap_msr_get_energy_counters(rc, NULL, 1) < 0);
+  assert(errno == EINVAL);
+  // counters come from their own package/die's register
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    for (die = 0; die < n_die; die++) {
+      counters[0].pkg = pkg;
+      counters[0].die = die;
+      counters[0].zone = RAPLCAP_ZONE_PACKAGE;
+      counters[1].pkg = pkg;
+      counters[1].die = die;
+      counters[1].zone = RAPLCAP_ZONE_CORE;
+      assert(raplcap_msr_get_energy_counters(rc, counters, 2) == 0);
+      assert(equal_dbl(counters[0].joules,
+                       SIM_ENERGY_INIT(sim_cpu(pkg, die), RAPLCAP_ZONE_PACKAGE) * SIM_ENERGY_UNITS));
+      assert(equal_dbl(counters[1].joules,
+                       SIM_ENERGY_INIT(sim_cpu(pkg, die), RAPLCAP_ZONE_CORE) * SIM_ENERGY_UNITS));
+    }
+  }
+  // a new register value is visible on the next read, and matches the single-counter API
+  sim_write(n_pkg - 1, n_die - 1, MSR_PKG_ENERGY_STATUS, 0x28000);
+  counters[0].pkg = n_pkg - 1;
+  counters[0].die = n_die - 1;
+  counters[0].zone = RAPLCAP_ZONE_PACKAGE;
+  assert(raplcap_msr_get_energy_counters(rc, counters, 1) == 0);
+  assert(equal_dbl(counters[0].joules, 10.0));
+  assert(equal_dbl(counters[0].joules, raplcap_pd_get_energy_counter(rc, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_PACKAGE)));
+  // invalid requests fail before any I/O and leave all outputs negative
+  counters[0].pkg = 0;
+  counters[0].die = 0;
+  counters[1].pkg = n_pkg;
+  counters[1].die = 0;
+  counters[1].zone = RAPLCAP_ZONE_PACKAGE;
+  assert(raplcap_msr_get_energy_counters(rc, counters, 2) < 0);
+  assert(counters[0].joules < 0);
+  assert(counters[1].joules < 0);
+  counters[1].pkg = 0;
+  counters[1].zone = (raplcap_zone) (RAPLCAP_ZONE_PSYS + 1);
+  assert(raplcap_msr_get_energy_counters(rc, counters, 2) < 0);
+  assert(counters[0].joules < 0);
+}
+
+typedef struct async_result {
+  uint32_t n;
+  double joules[2][2][RAPLCAP_NZONES];
+} async_result;
+
+static void async_cb(void* arg, uint32_t pkg, uint32_t die, raplcap_zone zone, double joules) {
+  async_result* res = (async_result*) arg;
+  assert(pkg < n_pkg && pkg < 2);
+  assert(die < n_die && die < 2);
+  assert(res->joules[pkg][die][zone] < 0);
+  res->joules[pkg][die][zone] = joules;
+  res->n++;
+}
+
+static void test_async(const raplcap* rc) {
+  async_result res;
+  raplcap_async* ra;
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t round;
+  int zone;
+  printf("test_async\n");
+  if ((ra = raplcap_async_init(rc, async_cb, &res)) == NULL) {
+    // not compiled in, or the kernel doesn't support (or allow) io_uring
+    assert(errno == ENOSYS || errno == EPERM);
+    printf("  io_uring not available, skipping\n");
+    return;
+  }
+  // the second round sees new register values
+  for (round = 0; round < 2; round++) {
+    if (round > 0) {
+      sim_write(n_pkg - 1, n_die - 1, MSR_PKG_ENERGY_STATUS, 0x30000);
+    }
+    res.n = 0;
+    for (pkg = 0; pkg < 2; pkg++) {
+      for (die = 0; die < 2; die++) {
+        for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+          res.joules[pkg][die][zone] = -1;
+        }
+      }
+    }
+    assert(raplcap_async_submit(ra) == 0);
+    errno = 0;
+    assert(raplcap_async_submit(ra) < 0);
+    assert(errno == EBUSY);
+    assert(raplcap_async_complete(ra, 1) >= 0);
+    // every supported counter was read from its own package/die's register
+    assert(res.n == n_pkg * n_die * RAPLCAP_NZONES);
+    for (pkg = 0; pkg < n_pkg; pkg++) {
+      for (die = 0; die < n_die; die++) {
+        for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+          assert(equal_dbl(res.joules[pkg][die][zone],
+                           raplcap_pd_get_energy_counter(rc, pkg, die, (raplcap_zone) zone)));
+        }
+      }
+    }
+  }
+  assert(equal_dbl(res.joules[n_pkg - 1][n_die - 1][RAPLCAP_ZONE_PACKAGE], 12.0));
+  assert(raplcap_async_destroy(ra) == 0);
+}
+
+#define METER_SIM_MAX_SAMPLES 64
+#define METER_SIM_SLEEP_NS 5000000
+
+// Drives a power meter on pkg=0, die=0, zone=PACKAGE by setting the sim energy counter before each sample
+typedef struct meter_sim {
+  raplcap_power_meter* pm;
+  uint64_t raw;
+  uint32_t n;
+  // each sample's cumulative energy, and when it was requested and returned
+  double joules[METER_SIM_MAX_SAMPLES];
+  uint64_t ns_before[METER_SIM_MAX_SAMPLES];
+  uint64_t ns_after[METER_SIM_MAX_SAMPLES];
+} meter_sim;
+
+static void meter_sim_init(meter_sim* ms, const raplcap* rc, uint64_t raw, uint32_t n_samples, double ewma_sec) {
+  sim_write(0, 0, MSR_PKG_ENERGY_STATUS, raw);
+  ms->raw = raw;
+  ms->joules[0] = 0;
+  ms->ns_before[0] = raplcap_clock_ns(CLOCK_MONOTONIC);
+  ms->pm = raplcap_power_meter_init(rc, 0, 0, RAPLCAP_ZONE_PACKAGE, n_samples, ewma_sec);
+  ms->ns_after[0] = raplcap_clock_ns(CLOCK_MONOTONIC);
+  assert(ms->pm != NULL);
+  ms->n = 1;
+}
+
+// Consume joules (a multiple of the energy units) over a short period, then sample
+static void meter_sim_sample(meter_sim* ms, double joules) {
+  const struct timespec ts = { .tv_sec = 0, .tv_nsec = METER_SIM_SLEEP_NS };
+  assert(ms->n < METER_SIM_MAX_SAMPLES);
+  nanosleep(&ts, NULL);
+  ms->raw = (ms->raw + (uint64_t) (joules / SIM_ENERGY_UNITS)) & SIM_ENERGY_MASK;
+  sim_write(0, 0, MSR_PKG_ENERGY_STATUS, ms->raw);
+  ms->joules[ms->n] = ms->joules[ms->n - 1] + joules;
+  ms->ns_before[ms->n] = raplcap_clock_ns(CLOCK_MONOTONIC);
+  assert(raplcap_power_meter_sample(ms->pm) == 0);
+  ms->ns_after[ms->n] = raplcap_clock_ns(CLOCK_MONOTONIC);
+  ms->n++;
+}
+
+// The meter's timestamps aren't known exactly, but bound the average power between samples i and j
+static void meter_sim_bounds(const meter_sim* ms, uint32_t i, uint32_t j, double* watts_min, double* watts_max) {
+  const double joules = ms->joules[j] - ms->joules[i];
+  *watts_min = joules / ((ms->ns_after[j] - ms->ns_before[i]) / 1000000000.0) * (1 - 1e-9);
+  *watts_max = joules / ((ms->ns_before[j] - ms->ns_after[i]) / 1000000000.0) * (1 + 1e-9);
+}
+
+static void assert_meter_sim_watts(const meter_sim* ms, uint32_t i, uint32_t j, double watts) {
+  double watts_min;
+  double watts_max;
+  meter_sim_bounds(ms, i, j, &watts_min, &watts_max);
+  assert(watts >= watts_min);
+  assert(watts <= watts_max);
+}
+
+static void test_power_meter(const raplcap* rc) {
+  // consumption per interval, starting just below the counter's max value so that it rolls over in the second interval
+  static const double JOULES[] = { 1.0, 2.0, 3.0, 1.0, 2.0, 3.0, 1.0, 2.0 };
+  const uint32_t n_joules = sizeof(JOULES) / sizeof(JOULES[0]);
+  meter_sim ms;
+  double watts_min;
+  double watts_max;
+  double ewma_min = 0;
+  double ewma_max = 0;
+  double ewma;
+  double ewma_prev;
+  uint32_t i;
+  printf("test_power_meter\n");
+  meter_sim_init(&ms, rc, SIM_ENERGY_MASK + 1 - (uint64_t) (1.5 / SIM_ENERGY_UNITS), 3, 0.01);
+  errno = 0;
+  assert(raplcap_power_meter_get_instant(ms.pm) < 0);
+  assert(errno == ENODATA);
+  for (i = 0; i < n_joules; i++) {
+    meter_sim_sample(&ms, JOULES[i]);
+    assert_meter_sim_watts(&ms, ms.n - 2, ms.n - 1, raplcap_power_meter_get_instant(ms.pm));
+    // the window is the 3-sample ring, so it spans the last 2 intervals once full
+    assert_meter_sim_watts(&ms, ms.n > 3 ? ms.n - 3 : 0, ms.n - 1, raplcap_power_meter_get_window(ms.pm));
+    // the EWMA is a weighted average of all intervals so far
+    meter_sim_bounds(&ms, ms.n - 2, ms.n - 1, &watts_min, &watts_max);
+    ewma_min = i == 0 || watts_min < ewma_min ? watts_min : ewma_min;
+    ewma_max = i == 0 || watts_max > ewma_max ? watts_max : ewma_max;
+    ewma = raplcap_power_meter_get_ewma(ms.pm);
+    assert(ewma >= ewma_min);
+    assert(ewma <= ewma_max);
+  }
+  // with no more consumption, the EWMA decays toward 0 (~15 time constants)
+  for (i = 0; i < 30; i++) {
+    ewma_prev = ewma;
+    meter_sim_sample(&ms, 0);
+    assert(equal_dbl(raplcap_power_meter_get_instant(ms.pm), 0));
+    ewma = raplcap_power_meter_get_ewma(ms.pm);
+    assert(ewma <= ewma_prev);
+  }
+  assert(equal_dbl(raplcap_power_meter_get_window(ms.pm), 0));
+  assert(ewma < 0.01 * ewma_min);
+  assert(raplcap_power_meter_destroy(ms.pm) == 0);
+
+  // the minimum ring size must still average, not just report the last interval
+  meter_sim_init(&ms, rc, 0, 2, 10.0);
+  meter_sim_sample(&ms, 1.0);
+  meter_sim_bounds(&ms, 0, 1, &watts_min, &watts_max);
+  for (i = 0; i < 3; i++) {
+    meter_sim_sample(&ms, 0);
+  }
+  assert(equal_dbl(raplcap_power_meter_get_instant(ms.pm), 0));
+  assert(equal_dbl(raplcap_power_meter_get_window(ms.pm), 0));
+  assert(raplcap_power_meter_get_ewma(ms.pm) > 0.9 * watts_min);
+  assert(raplcap_power_meter_destroy(ms.pm) == 0);
+}
+
+// Set the PACKAGE counter of package 0, die 0 - negative values are below the max value
+static void accumulator_sim_set(double joules) {
+  const double joules_max = (SIM_ENERGY_MASK + 1) * SIM_ENERGY_UNITS;
+  sim_write(0, 0, MSR_PKG_ENERGY_STATUS, (uint64_t) ((joules + joules_max) / SIM_ENERGY_UNITS) & SIM_ENERGY_MASK);
+}
+
+static void test_accumulator(const raplcap* rc) {
+  const double joules_max = (SIM_ENERGY_MASK + 1) * SIM_ENERGY_UNITS;
+  const struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000000 };
+  raplcap_accumulator* acc;
+  double total;
+  double prev;
+  printf("test_accumulator\n");
+  // refresh periods must be shorter than the fastest rollover at 1000 W
+  errno = 0;
+  assert(raplcap_accumulator_init(rc, joules_max / 1000.0) == NULL);
+  assert(errno == EINVAL);
+
+  // without a refresh thread, each read detects at most one rollover
+  accumulator_sim_set(-2.0);
+  assert((acc = raplcap_accumulator_init(rc, 0)) != NULL);
+  assert(equal_dbl(raplcap_pd_get_energy_total(acc, 0, 0, RAPLCAP_ZONE_PACKAGE), 0));
+  accumulator_sim_set(-1.0);
+  assert(equal_dbl((prev = raplcap_pd_get_energy_total(acc, 0, 0, RAPLCAP_ZONE_PACKAGE)), 1.0));
+  accumulator_sim_set(2.0);
+  assert(equal_dbl((total = raplcap_pd_get_energy_total(acc, 0, 0, RAPLCAP_ZONE_PACKAGE)), 4.0));
+  assert(total > prev);
+  accumulator_sim_set(10.0);
+  assert(raplcap_accumulator_update(acc) == 0);
+  assert(equal_dbl(raplcap_pd_get_energy_total(acc, 0, 0, RAPLCAP_ZONE_PACKAGE), 12.0));
+  assert(raplcap_accumulator_destroy(acc) == 0);
+
+  // the refresh thread catches a rollover that a later read alone would miss
+  accumulator_sim_set(-2.0);
+  assert((acc = raplcap_accumulator_init(rc, 0.001)) != NULL);
+  accumulator_sim_set(1.0);
+  nanosleep(&ts, NULL);
+  accumulator_sim_set(-1.0);
+  assert(equal_dbl(raplcap_pd_get_energy_total(acc, 0, 0, RAPLCAP_ZONE_PACKAGE), joules_max + 1.0));
+  assert(raplcap_accumulator_destroy(acc) == 0);
+}
+
+static void test_txn_coalesce(const raplcap* rc, raplcap_msr_txn* txn) {
+  const raplcap_limit ll_first = { .seconds = 1.0, .watts = 20.0 };
+  const raplcap_limit ll = { .seconds = 2.0, .watts = 30.0 };
+  const raplcap_limit ls = { .seconds = 0.0078125, .watts = 40.0 };
+  raplcap_limit ll_verify;
+  raplcap_limit ls_verify;
+  uint64_t pkg_orig = sim_read(0, 0, MSR_PKG_POWER_LIMIT);
+  printf("test_txn_coalesce\n");
+  // limits, enabled, and clamped changes to the same register are merged, and staging limits again replaces them
+  assert(raplcap_msr_txn_set_limits(txn, 0, 0, RAPLCAP_ZONE_PACKAGE, &ll_first, NULL) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, 0, 0, RAPLCAP_ZONE_PACKAGE, &ll, &ls) == 0);
+  assert(raplcap_msr_txn_set_zone_enabled(txn, 0, 0, RAPLCAP_ZONE_PACKAGE, 1) == 0);
+  assert(raplcap_msr_txn_set_zone_clamped(txn, 0, 0, RAPLCAP_ZONE_PACKAGE, 0) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, 0, 0, RAPLCAP_ZONE_CORE, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_PACKAGE, &ll, NULL) == 0);
+  // nothing is written until commit
+  n_writes = 0;
+  assert(sim_read(0, 0, MSR_PKG_POWER_LIMIT) == pkg_orig);
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(n_writes == 3);
+  assert(raplcap_pd_get_limits(rc, 0, 0, RAPLCAP_ZONE_PACKAGE, &ll_verify, &ls_verify) == 0);
+  assert(equal_dbl(ll_verify.watts, ll.watts));
+  assert(equal_dbl(ll_verify.seconds, ll.seconds));
+  assert(equal_dbl(ls_verify.watts, ls.watts));
+  assert(equal_dbl(ls_verify.seconds, ls.seconds));
+  assert(raplcap_pd_is_zone_enabled(rc, 0, 0, RAPLCAP_ZONE_PACKAGE) == 1);
+  assert(raplcap_msr_pd_is_zone_clamped(rc, 0, 0, RAPLCAP_ZONE_PACKAGE) == 0);
+  assert(raplcap_pd_get_limits(rc, 0, 0, RAPLCAP_ZONE_CORE, &ll_verify, NULL) == 0);
+  assert(equal_dbl(ll_verify.watts, ll.watts));
+  assert(raplcap_pd_get_limits(rc, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_PACKAGE, &ll_verify, NULL) == 0);
+  assert(equal_dbl(ll_verify.watts, ll.watts));
+  // an empty transaction writes nothing
+  n_writes = 0;
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(n_writes == 0);
+}
+
+static void test_txn_unchanged(const raplcap* rc, raplcap_msr_txn* txn) {
+  raplcap_limit ll;
+  raplcap_limit ls;
+  uint64_t pkg_orig = sim_read(0, 0, MSR_PKG_POWER_LIMIT);
+  uint64_t core_orig = sim_read(0, 0, MSR_PP0_POWER_LIMIT);
+  printf("test_txn_unchanged\n");
+  // registers whose values wouldn't change aren't written
+  assert(raplcap_pd_get_limits(rc, 0, 0, RAPLCAP_ZONE_PACKAGE, &ll, &ls) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, 0, 0, RAPLCAP_ZONE_PACKAGE, &ll, &ls) == 0);
+  assert(raplcap_msr_txn_set_zone_clamped(txn, 0, 0, RAPLCAP_ZONE_PACKAGE,
+                                          raplcap_msr_pd_is_zone_clamped(rc, 0, 0, RAPLCAP_ZONE_PACKAGE)) == 0);
+  assert(raplcap_pd_get_limits(rc, 0, 0, RAPLCAP_ZONE_CORE, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, 0, 0, RAPLCAP_ZONE_CORE, &ll, NULL) == 0);
+  n_writes = 0;
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(n_writes == 0);
+  assert(sim_read(0, 0, MSR_PKG_POWER_LIMIT) == pkg_orig);
+  assert(sim_read(0, 0, MSR_PP0_POWER_LIMIT) == core_orig);
+}
+
+static void test_txn_rollback(const raplcap* rc, raplcap_msr_txn* txn) {
+  const raplcap_limit ll = { .seconds = 4.0, .watts = 25.0 };
+  uint64_t pkg_orig = sim_read(0, 0, MSR_PKG_POWER_LIMIT);
+  uint64_t core_orig = sim_read(n_pkg - 1, 0, MSR_PP0_POWER_LIMIT);
+  uint64_t dram_orig = sim_read(n_pkg - 1, n_die - 1, MSR_DRAM_POWER_LIMIT);
+  uint64_t uncore_orig = sim_read(0, n_die - 1, MSR_PP1_POWER_LIMIT);
+  printf("test_txn_rollback\n");
+  assert(raplcap_msr_txn_set_limits(txn, 0, 0, RAPLCAP_ZONE_PACKAGE, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, n_pkg - 1, 0, RAPLCAP_ZONE_CORE, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_DRAM, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_zone_locked(txn, 0, n_die - 1, RAPLCAP_ZONE_UNCORE) == 0);
+  sim_fail_writes(n_pkg - 1, n_die - 1, MSR_DRAM_POWER_LIMIT, 0, EPERM);
+  errno = 0;
+  assert(raplcap_msr_txn_commit(txn) < 0);
+  assert(errno == EPERM);
+  sim_fail_writes_clear();
+  // registers that were written are restored, and locks aren't written unless everything else succeeds
+  assert(sim_read(0, 0, MSR_PKG_POWER_LIMIT) == pkg_orig);
+  assert(sim_read(n_pkg - 1, 0, MSR_PP0_POWER_LIMIT) == core_orig);
+  assert(sim_read(n_pkg - 1, n_die - 1, MSR_DRAM_POWER_LIMIT) == dram_orig);
+  assert(sim_read(0, n_die - 1, MSR_PP1_POWER_LIMIT) == uncore_orig);
+  assert(!(raplcap_msr_pd_get_zone_caps(rc, 0, n_die - 1, RAPLCAP_ZONE_UNCORE) & RAPLCAP_MSR_ZONE_CAP_LOCKED));
+  // the transaction was emptied
+  n_writes = 0;
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(n_writes == 0);
+
+  // if a lock fails, the other changes are rolled back too, including those to the register that wasn't locked
+  assert(raplcap_msr_txn_set_limits(txn, 0, 0, RAPLCAP_ZONE_PACKAGE, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_limits(txn, 0, n_die - 1, RAPLCAP_ZONE_UNCORE, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_zone_locked(txn, 0, n_die - 1, RAPLCAP_ZONE_UNCORE) == 0);
+  sim_fail_writes(0, n_die - 1, MSR_PP1_POWER_LIMIT, 1ULL << 31, EPERM);
+  errno = 0;
+  assert(raplcap_msr_txn_commit(txn) < 0);
+  assert(errno == EPERM);
+  sim_fail_writes_clear();
+  assert(sim_read(0, 0, MSR_PKG_POWER_LIMIT) == pkg_orig);
+  assert(sim_read(0, n_die - 1, MSR_PP1_POWER_LIMIT) == uncore_orig);
+  assert(!(raplcap_msr_pd_get_zone_caps(rc, 0, n_die - 1, RAPLCAP_ZONE_UNCORE) & RAPLCAP_MSR_ZONE_CAP_LOCKED));
+
+  // a successful lock is written after the zone's other changes, and is cached
+  assert(raplcap_msr_txn_set_limits(txn, 0, n_die - 1, RAPLCAP_ZONE_UNCORE, &ll, NULL) == 0);
+  assert(raplcap_msr_txn_set_zone_locked(txn, 0, n_die - 1, RAPLCAP_ZONE_UNCORE) == 0);
+  n_writes = 0;
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(n_writes == 2);
+  assert(sim_read(0, n_die - 1, MSR_PP1_POWER_LIMIT) & (1ULL << 31));
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, n_die - 1, RAPLCAP_ZONE_UNCORE) & RAPLCAP_MSR_ZONE_CAP_LOCKED);
+  // locking again doesn't write anything
+  assert(raplcap_msr_txn_set_zone_locked(txn, 0, n_die - 1, RAPLCAP_ZONE_UNCORE) == 0);
+  n_writes = 0;
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(n_writes == 0);
+}
+
+static void test_txn_clamp_retry(const raplcap* rc, raplcap_msr_txn* txn) {
+  const uint64_t dram_orig = sim_read(0, 0, MSR_DRAM_POWER_LIMIT) & ~(PL1_EN | PL1_CL);
+  uint64_t msrval;
+  printf("test_txn_clamp_retry\n");
+  // the processor rejects clamping for this zone
+  sim_write(0, 0, MSR_DRAM_POWER_LIMIT, dram_orig);
+  sim_fail_writes(0, 0, MSR_DRAM_POWER_LIMIT, PL1_CL, EIO);
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, 0, RAPLCAP_ZONE_DRAM) & RAPLCAP_MSR_ZONE_CAP_CLAMPING);
+  // enabling implicitly clamps, so is retried without clamping
+  assert(raplcap_msr_txn_set_zone_enabled(txn, 0, 0, RAPLCAP_ZONE_DRAM, 1) == 0);
+  n_writes = 0;
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(n_writes == 1);
+  msrval = sim_read(0, 0, MSR_DRAM_POWER_LIMIT);
+  assert(msrval == (dram_orig | PL1_EN));
+  assert(!(raplcap_msr_pd_get_zone_caps(rc, 0, 0, RAPLCAP_ZONE_DRAM) & RAPLCAP_MSR_ZONE_CAP_CLAMPING));
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, n_die - 1, RAPLCAP_ZONE_DRAM) & RAPLCAP_MSR_ZONE_CAP_CLAMPING);
+  // clamping isn't attempted again
+  assert(raplcap_msr_txn_set_zone_enabled(txn, 0, 0, RAPLCAP_ZONE_DRAM, 0) == 0);
+  assert(raplcap_msr_txn_commit(txn) == 0);
+  assert(sim_read(0, 0, MSR_DRAM_POWER_LIMIT) == dram_orig);
+  // explicit clamping isn't retried
+  assert(raplcap_msr_txn_set_zone_clamped(txn, 0, 0, RAPLCAP_ZONE_DRAM, 1) == 0);
+  errno = 0;
+  assert(raplcap_msr_txn_commit(txn) < 0);
+  assert(errno == EIO);
+  assert(sim_read(0, 0, MSR_DRAM_POWER_LIMIT) == dram_orig);
+  sim_fail_writes_clear();
+}
+
+static void test_txn(const raplcap* rc) {
+  raplcap_msr_txn* txn;
+  printf("test_txn\n");
+  assert((txn = raplcap_msr_txn_alloc(rc)) != NULL);
+  assert(raplcap_msr_txn_set_limits(txn, n_pkg, 0, RAPLCAP_ZONE_PACKAGE, NULL, NULL) < 0);
+  assert(raplcap_msr_txn_set_zone_enabled(txn, 0, n_die, RAPLCAP_ZONE_PACKAGE, 1) < 0);
+  test_txn_coalesce(rc, txn);
+  test_txn_unchanged(rc, txn);
+  test_txn_rollback(rc, txn);
+  test_txn_clamp_retry(rc, txn);
+  raplcap_msr_txn_free(txn);
+}
+
+// locks zones, so must run last
+static void test_zone_caps(const raplcap* rc) {
+  const int caps_expected = RAPLCAP_MSR_ZONE_CAP_SUPPORTED | RAPLCAP_MSR_ZONE_CAP_CLAMPING;
+  raplcap rc2;
+  uint64_t msrval;
+  printf("test_zone_caps\n");
+  assert(raplcap_msr_pd_get_zone_caps(rc, n_pkg, 0, RAPLCAP_ZONE_PACKAGE) < 0);
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, n_die, RAPLCAP_ZONE_PACKAGE) < 0);
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, 0, (raplcap_zone) (RAPLCAP_ZONE_PSYS + 1)) < 0);
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, 0, RAPLCAP_ZONE_PACKAGE) ==
+         (caps_expected | RAPLCAP_MSR_ZONE_CAP_SHORT_TERM));
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, 0, RAPLCAP_ZONE_CORE) == caps_expected);
+  // capabilities are cached, so they don't follow register changes made behind the context's back
+  msrval = sim_read(0, 0, MSR_PP0_POWER_LIMIT);
+  sim_write(0, 0, MSR_PP0_POWER_LIMIT, msrval | (1ULL << 31));
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, 0, RAPLCAP_ZONE_CORE) == caps_expected);
+  sim_write(0, 0, MSR_PP0_POWER_LIMIT, msrval);
+  // locking through the context updates its capabilities, but only for that package/die and zone
+  assert(raplcap_msr_pd_set_zone_locked(rc, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_CORE) == 0);
+  assert(sim_read(n_pkg - 1, n_die - 1, MSR_PP0_POWER_LIMIT) & (1ULL << 31));
+  assert(raplcap_msr_pd_get_zone_caps(rc, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_CORE) ==
+         (caps_expected | RAPLCAP_MSR_ZONE_CAP_LOCKED));
+  assert(raplcap_msr_pd_get_zone_caps(rc, 0, 0, RAPLCAP_ZONE_CORE) == caps_expected);
+  assert(raplcap_msr_pd_get_zone_caps(rc, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_PACKAGE) ==
+         (caps_expected | RAPLCAP_MSR_ZONE_CAP_SHORT_TERM));
+  // a new context probes the lock from the register
+  assert(raplcap_init(&rc2) == 0);
+  assert(raplcap_msr_pd_get_zone_caps(&rc2, n_pkg - 1, n_die - 1, RAPLCAP_ZONE_CORE) ==
+         (caps_expected | RAPLCAP_MSR_ZONE_CAP_LOCKED));
+  assert(raplcap_msr_pd_get_zone_caps(&rc2, 0, 0, RAPLCAP_ZONE_CORE) == caps_expected);
+  assert(raplcap_destroy(&rc2) == 0);
+}
+
+int main(void) {
+  raplcap rc;
+  if (getenv(ENV_RAPLCAP_MSR_SIM_ROOT) == NULL) {
+    fprintf(stderr, "%s must be set\n", ENV_RAPLCAP_MSR_SIM_ROOT);
+    return 1;
+  }
+  assert(raplcap_init(&rc) == 0);
+  n_pkg = raplcap_get_num_packages(&rc);
+  n_die = raplcap_get_num_die(&rc, 0);
+  assert(n_pkg > 0);
+  assert(n_die > 0);
+  test_energy_counters(&rc);
+  test_async(&rc);
+  test_power_meter(&rc);
+  test_accumulator(&rc);
+  test_txn(&rc);
+  test_zone_caps(&rc);
+  assert(raplcap_destroy(&rc) == 0);
+  printf("Success\n");
+  return 0;
+}
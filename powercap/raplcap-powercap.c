@@ -4,6 +4,8 @@
  * @author Connor Imes
  * @date 2016-05-13
  */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -14,6 +16,8 @@
 #include "raplcap-wrappers.h"
 #define RAPLCAP_IMPL "raplcap-powercap"
 #include "raplcap-common.h"
+#include "raplcap-async-common.h"
+#include "raplcap-snapshot-common.h"
 // powercap header
 #include <powercap-rapl.h>
 #include <powercap-sysfs.h>
@@ -24,12 +28,21 @@
 
 #define HAS_SHORT_TERM(p, z) (powercap_rapl_is_constraint_supported(p, z, POWERCAP_RAPL_CONSTRAINT_SHORT) > 0)
 
+struct raplcap_zone_handle {
+  const powercap_rapl_pkg* p;
+  powercap_rapl_zone z;
+  int has_short;
+  double joules_max;
+};
+
 typedef struct raplcap_powercap {
   powercap_rapl_pkg* parent_zones;
   uint32_t n_parent_zones;
   uint32_t n_pkg;
   // currently only support homogeneous die count per package
   uint32_t n_die;
+  // resolved during init so they're read-only after, indexed by ((pkg * n_die) + die) * RAPLCAP_NZONES + zone
+  raplcap_zone_handle* handles;
 } raplcap_powercap;
 
 static raplcap rc_default;
@@ -296,6 +309,36 @@ static int sort_parent_zones(const void* a, const void* b) {
   return ret;
 }
 
+// Resolve handles for all supported zones, leaving others unresolved (p == NULL)
+static void init_zone_handles(const raplcap* rc, raplcap_powercap* state) {
+  raplcap_zone_handle* zh;
+  const powercap_rapl_pkg* p;
+  powercap_rapl_zone z;
+  uint64_t uj;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  for (pkg = 0; pkg < state->n_pkg; pkg++) {
+    for (die = 0; die < state->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        if ((p = get_parent_zone(rc, pkg, die, (raplcap_zone) zone, &z)) == NULL ||
+            powercap_rapl_is_zone_supported(p, z) <= 0) {
+          continue;
+        }
+        if (powercap_rapl_get_max_energy_range_uj(p, z, &uj)) {
+          raplcap_perror(WARN, "init_zone_handles: powercap_rapl_get_max_energy_range_uj");
+          continue;
+        }
+        zh = &state->handles[(((pkg * state->n_die) + die) * RAPLCAP_NZONES) + zone];
+        zh->z = z;
+        zh->has_short = HAS_SHORT_TERM(p, z);
+        zh->joules_max = uj / 1000000.0;
+        zh->p = p;
+      }
+    }
+  }
+}
+
 int raplcap_init(raplcap* rc) {
   raplcap_powercap* state;
   uint32_t n_parent_zones;
@@ -327,6 +370,12 @@ int raplcap_init(raplcap* rc) {
   state->n_parent_zones = n_parent_zones;
   state->n_pkg = n_pkg;
   state->n_die = n_die;
+  if ((state->handles = calloc(n_pkg * n_die * RAPLCAP_NZONES, sizeof(*state->handles))) == NULL) {
+    raplcap_perror(ERROR, "raplcap_init: calloc");
+    free(state->parent_zones);
+    free(state);
+    return -1;
+  }
   rc->state = state;
   for (i = 0; i < state->n_parent_zones; i++) {
     if (powercap_rapl_init(i, &state->parent_zones[i], ro)) {
@@ -349,6 +398,8 @@ int raplcap_init(raplcap* rc) {
     errno = err_save;
     return -1;
   }
+  // resolve handles now rather than on first use so concurrent callers never race to initialize them
+  init_zone_handles(rc, state);
   rc->nsockets = n_pkg;
   raplcap_log(DEBUG, "raplcap_init: Initialized\n");
   return 0;
@@ -369,6 +420,8 @@ int raplcap_destroy(raplcap* rc) {
         err_save = errno;
       }
     }
+    free(state->handles);
+    free(state->parent_zones);
     free(state);
     rc->state = NULL;
   }
@@ -507,13 +560,19 @@ int raplcap_pd_get_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap
   return 0;
 }
 
+// Convert to micro-units, where values that aren't positive (including NaN) become 0 and aren't written, like msr
+static uint64_t to_micros(double val) {
+  static const uint64_t ONE_MILLION = 1000000;
+  // converting a negative double to an unsigned integer is undefined
+  return val > 0 ? (uint64_t) (ONE_MILLION * val) : 0;
+}
+
 static int set_constraint(const powercap_rapl_pkg* p, powercap_rapl_zone z,
                           powercap_rapl_constraint constraint, const raplcap_limit* limit) {
   assert(p != NULL);
   assert(limit != NULL);
-  static const uint64_t ONE_MILLION = 1000000;
-  uint64_t us = ONE_MILLION * limit->seconds;
-  uint64_t uw = ONE_MILLION * limit->watts;
+  uint64_t us = to_micros(limit->seconds);
+  uint64_t uw = to_micros(limit->watts);
   raplcap_log(DEBUG, "set_constraint: zone=%d, constraint=%d:\n"
               "\ttime=%.12f s (%"PRIu64" us)\n\tpower=%.12f W (%"PRIu64" uW)\n",
               z, constraint, limit->seconds, us, limit->watts, uw);
@@ -544,6 +603,69 @@ int raplcap_pd_set_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap
   return 0;
 }
 
+// Powercap only exposes microwatt and microsecond granularity - the kernel may round further
+static void quantize_constraint(raplcap_limit* limit) {
+  assert(limit != NULL);
+  static const uint64_t ONE_MILLION = 1000000;
+  // same conversions as set_constraint
+  const uint64_t us = to_micros(limit->seconds);
+  const uint64_t uw = to_micros(limit->watts);
+  limit->seconds = ((double) us) / ONE_MILLION;
+  limit->watts = ((double) uw) / ONE_MILLION;
+}
+
+int raplcap_pd_quantize_limits(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  powercap_rapl_zone z;
+  const powercap_rapl_pkg* p = get_parent_zone(rc, pkg, die, zone, &z);
+  if (p == NULL) {
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_pd_quantize_limits: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (limit_long != NULL) {
+    quantize_constraint(limit_long);
+  }
+  if (limit_short != NULL) {
+    if (HAS_SHORT_TERM(p, z)) {
+      quantize_constraint(limit_short);
+    } else {
+      limit_short->seconds = 0;
+      limit_short->watts = 0;
+    }
+  }
+  // constraints advertise max_power_uw, but the kernel doesn't enforce it - out-of-range values are passed on to the
+  // driver, which truncates them to the register fields without reporting it, so there's no clamping to report here
+  return 0;
+}
+
+int raplcap_pd_get_zone_status(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               raplcap_zone_status* status) {
+  powercap_rapl_zone z;
+  const powercap_rapl_pkg* p = get_parent_zone(rc, pkg, die, zone, &z);
+  if (p == NULL) {
+    return -1;
+  }
+  if (status == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  raplcap_log(DEBUG, "raplcap_pd_get_zone_status: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if ((status->enabled = powercap_rapl_is_enabled(p, z)) < 0) {
+    raplcap_perror(ERROR, "raplcap_pd_get_zone_status: powercap_rapl_is_enabled");
+    return -1;
+  }
+  // not exposed by powercap
+  status->clamped = -1;
+  status->locked = -1;
+  status->limit_short.seconds = 0;
+  status->limit_short.watts = 0;
+  if (get_constraint(p, z, POWERCAP_RAPL_CONSTRAINT_LONG, &status->limit_long) ||
+      (HAS_SHORT_TERM(p, z) && get_constraint(p, z, POWERCAP_RAPL_CONSTRAINT_SHORT, &status->limit_short))) {
+    return -1;
+  }
+  return 0;
+}
+
 double raplcap_pd_get_energy_counter(const raplcap* rc, uint32_t pkg, uint32_t die, raplcap_zone zone) {
   powercap_rapl_zone z;
   uint64_t uj;
@@ -575,3 +697,187 @@ double raplcap_pd_get_energy_counter_max(const raplcap* rc, uint32_t pkg, uint32
               pkg, die, zone, uj);
   return uj / 1000000.0;
 }
+
+const raplcap_zone_handle* raplcap_pd_get_zone_handle(const raplcap* rc, uint32_t pkg, uint32_t die,
+                                                      raplcap_zone zone) {
+  powercap_rapl_zone z;
+  const raplcap_zone_handle* zh;
+  const raplcap_powercap* state;
+  const powercap_rapl_pkg* p = get_parent_zone(rc, pkg, die, zone, &z);
+  int supported;
+  raplcap_log(DEBUG, "raplcap_pd_get_zone_handle: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n", pkg, die, zone);
+  if (p == NULL) {
+    return NULL;
+  }
+  if ((supported = powercap_rapl_is_zone_supported(p, z)) <= 0) {
+    if (supported == 0) {
+      raplcap_log(ERROR, "raplcap_pd_get_zone_handle: Zone not supported: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+                  pkg, die, zone);
+      errno = ENOTSUP;
+    } else {
+      raplcap_perror(ERROR, "raplcap_pd_get_zone_handle: powercap_rapl_is_zone_supported");
+    }
+    return NULL;
+  }
+  state = (const raplcap_powercap*) (rc == NULL ? rc_default.state : rc->state);
+  zh = &state->handles[(((pkg * state->n_die) + die) * RAPLCAP_NZONES) + zone];
+  if (zh->p == NULL) {
+    // supported, but its energy counter range couldn't be read during init
+    raplcap_log(ERROR, "raplcap_pd_get_zone_handle: Zone not resolved: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+                pkg, die, zone);
+    errno = EIO;
+    return NULL;
+  }
+  return zh;
+}
+
+int raplcap_zone_handle_get_limits(const raplcap_zone_handle* zh, raplcap_limit* limit_long, raplcap_limit* limit_short) {
+  if ((limit_long != NULL && get_constraint(zh->p, zh->z, POWERCAP_RAPL_CONSTRAINT_LONG, limit_long)) ||
+      (limit_short != NULL && zh->has_short &&
+       get_constraint(zh->p, zh->z, POWERCAP_RAPL_CONSTRAINT_SHORT, limit_short))) {
+    return -1;
+  }
+  return 0;
+}
+
+int raplcap_zone_handle_set_limits(const raplcap_zone_handle* zh,
+                                   const raplcap_limit* limit_long, const raplcap_limit* limit_short) {
+  if ((limit_long != NULL && set_constraint(zh->p, zh->z, POWERCAP_RAPL_CONSTRAINT_LONG, limit_long)) ||
+      (limit_short != NULL && zh->has_short &&
+       set_constraint(zh->p, zh->z, POWERCAP_RAPL_CONSTRAINT_SHORT, limit_short))) {
+    return -1;
+  }
+  return 0;
+}
+
+double raplcap_zone_handle_get_energy_counter(const raplcap_zone_handle* zh) {
+  uint64_t uj;
+  if (powercap_rapl_get_energy_uj(zh->p, zh->z, &uj)) {
+    return -1;
+  }
+  return uj / 1000000.0;
+}
+
+double raplcap_zone_handle_get_energy_counter_max(const raplcap_zone_handle* zh) {
+  return zh->joules_max;
+}
+
+raplcap_snapshot* raplcap_snapshot_alloc(const raplcap* rc) {
+  const raplcap_powercap* state = (const raplcap_powercap*) (rc == NULL ? rc_default.state : rc->state);
+  if (state == NULL) {
+    raplcap_log(ERROR, "raplcap_snapshot_alloc: Context not initialized\n");
+    errno = EINVAL;
+    return NULL;
+  }
+  return snapshot_alloc(state->n_pkg, state->n_die);
+}
+
+int raplcap_snapshot_read(const raplcap* rc, raplcap_snapshot* snap) {
+  powercap_rapl_zone z;
+  raplcap_snapshot_zone* sz;
+  const raplcap_zone_handle* zh;
+  const powercap_rapl_pkg* p;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  int ret = 0;
+  const raplcap_powercap* state = (const raplcap_powercap*) (rc == NULL ? rc_default.state : rc->state);
+  raplcap_log(DEBUG, "raplcap_snapshot_read\n");
+  if (state == NULL || snap == NULL || snap->n_pkg != state->n_pkg || snap->n_die != state->n_die) {
+    raplcap_log(ERROR, "raplcap_snapshot_read: Context not initialized or snapshot not allocated for it\n");
+    errno = EINVAL;
+    return -1;
+  }
+  for (pkg = 0; pkg < snap->n_pkg; pkg++) {
+    for (die = 0; die < snap->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        sz = snapshot_zone(snap, pkg, die, (raplcap_zone) zone);
+        snapshot_zone_reset(sz);
+        // check support first to avoid logging errors for zones that aren't expected to exist
+        if ((p = get_parent_zone(rc, pkg, die, (raplcap_zone) zone, &z)) == NULL ||
+            powercap_rapl_is_zone_supported(p, z) <= 0 ||
+            (zh = raplcap_pd_get_zone_handle(rc, pkg, die, (raplcap_zone) zone)) == NULL) {
+          continue;
+        }
+        sz->supported = 1;
+        sz->enabled = powercap_rapl_is_enabled(zh->p, zh->z);
+        if (raplcap_zone_handle_get_limits(zh, &sz->limit_long, &sz->limit_short)) {
+          ret = -1;
+        }
+        if ((sz->joules = raplcap_zone_handle_get_energy_counter(zh)) < 0) {
+          ret = -1;
+        }
+        sz->joules_max = zh->joules_max;
+      }
+    }
+  }
+  snap->timestamp_ns = snapshot_now_ns();
+  return ret;
+}
+
+static int get_energy_fd(const powercap_rapl_pkg* p, powercap_rapl_zone z) {
+  switch (z) {
+    case POWERCAP_RAPL_ZONE_PACKAGE:
+      return p->pkg.zone.energy_uj;
+    case POWERCAP_RAPL_ZONE_CORE:
+      return p->core.zone.energy_uj;
+    case POWERCAP_RAPL_ZONE_UNCORE:
+      return p->uncore.zone.energy_uj;
+    case POWERCAP_RAPL_ZONE_DRAM:
+      return p->dram.zone.energy_uj;
+    case POWERCAP_RAPL_ZONE_PSYS:
+      return p->psys.zone.energy_uj;
+    default:
+      return 0;
+  }
+}
+
+int raplcap_async_impl_get_sources(const raplcap* rc, raplcap_async_source* sources, uint32_t max) {
+  powercap_rapl_zone z;
+  const powercap_rapl_pkg* p;
+  uint32_t n = 0;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  int fd;
+  const raplcap_powercap* state = (const raplcap_powercap*) (rc == NULL ? rc_default.state : rc->state);
+  if (state == NULL) {
+    raplcap_log(ERROR, "raplcap_async_impl_get_sources: Context not initialized\n");
+    errno = EINVAL;
+    return -1;
+  }
+  for (pkg = 0; pkg < state->n_pkg; pkg++) {
+    for (die = 0; die < state->n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES && n < max; zone++) {
+        // libpowercap doesn't open files that don't exist
+        if ((p = get_parent_zone(rc, pkg, die, (raplcap_zone) zone, &z)) == NULL ||
+            powercap_rapl_is_zone_supported(p, z) <= 0 || (fd = get_energy_fd(p, z)) <= 0) {
+          continue;
+        }
+        sources[n].pkg = pkg;
+        sources[n].die = die;
+        sources[n].zone = (raplcap_zone) zone;
+        sources[n].fd = fd;
+        sources[n].offset = 0;
+        sources[n].len = RAPLCAP_ASYNC_SOURCE_LEN_MAX;
+        n++;
+      }
+    }
+  }
+  return (int) n;
+}
+
+double raplcap_async_impl_decode(const raplcap* rc, const raplcap_async_source* src, const char* buf, size_t len) {
+  char* end;
+  uint64_t uj;
+  (void) rc;
+  (void) len;
+  errno = 0;
+  uj = strtoull(buf, &end, 10);
+  if (errno || end == buf) {
+    raplcap_log(ERROR, "raplcap_async_impl_decode: Failed to parse energy: pkg=%"PRIu32", die=%"PRIu32", zone=%d\n",
+                src->pkg, src->die, src->zone);
+    return -1;
+  }
+  return uj / 1000000.0;
+}
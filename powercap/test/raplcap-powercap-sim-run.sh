@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Run a command with a simulated powercap tree in place of /sys/class/powercap.
+# The simulation root stands in for /sys/class - see raplcap-powercap-sim-setup.
+# Uses an unprivileged user and mount namespace, so root privileges aren't required.
+# Exits with 77 (skipped) if namespaces aren't available.
+#
+# Usage: raplcap-powercap-sim-run.sh <root> <command> [args...]
+#
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <root> <command> [args...]" >&2
+  exit 1
+fi
+
+ROOT=$(cd "$1" && pwd) || exit 1
+shift
+
+if ! unshare -rm true 2>/dev/null; then
+  echo "$0: user and mount namespaces are not available" >&2
+  exit 77
+fi
+
+# Bind over the real powercap directory if it exists, otherwise over /sys/class (/sys doesn't allow mkdir)
+exec unshare -rm sh -c '
+  if [ -d /sys/class/powercap ]; then
+    mount --bind "$0/powercap" /sys/class/powercap
+  else
+    mount --bind "$0" /sys/class
+  fi || exit 1
+  exec "$@"' "$ROOT" "$@"
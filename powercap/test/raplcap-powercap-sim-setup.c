@@ -0,0 +1,191 @@
+/**
+ * Create a simulated powercap sysfs tree for running the powercap implementation without RAPL support.
+ * The root directory stands in for /sys/class, so the tree is created in its "powercap" subdirectory.
+ * Use raplcap-powercap-sim-run.sh to run a program with the tree mounted in place of the real one.
+ *
+ * Usage: raplcap-powercap-sim-setup <root> [n_pkg] [n_die] [psys] [shuffle_seed]
+ *
+ * If psys is non-zero, a PSYS zone is created.
+ * If shuffle_seed is non-zero, top-level zone numbering is shuffled so it doesn't match package/die order.
+ * Existing files are overwritten, but extra zones from a previous, larger tree are not removed.
+ * Energy counters are static - write to their energy_uj files to simulate consumption or rollover.
+ *
+ * @author Connor Imes
+ * @date 2020-10-12
+ */
+// for PATH_MAX
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../test/raplcap-sim-util.h"
+
+#define CONTROL_TYPE "intel-rapl"
+
+// 2^32 * 2^-14 J, as reported for typical 32-bit energy counters
+#define SIM_MAX_ENERGY_RANGE_UJ 262143328850ULL
+
+typedef struct sim_constraint {
+  const char* name;
+  uint64_t power_limit_uw;
+  uint64_t time_window_us;
+} sim_constraint;
+
+static const sim_constraint SIM_LONG_TERM = { "long_term", 35000000, 27983872 };
+static const sim_constraint SIM_SHORT_TERM = { "short_term", 44000000, 2440 };
+
+// subzones of each package/die, in the order the kernel usually numbers them
+static const char* SIM_SUBZONES[] = { "core", "uncore", "dram" };
+
+static int write_file(const char* dir, const char* name, const char* val) {
+  char fname[PATH_MAX];
+  FILE* f;
+  if (sim_path(fname, sizeof(fname), "%s/%s", dir, name)) {
+    return -1;
+  }
+  if ((f = fopen(fname, "w")) == NULL) {
+    perror(fname);
+    return -1;
+  }
+  fprintf(f, "%s\n", val);
+  if (fclose(f)) {
+    perror(fname);
+    return -1;
+  }
+  return 0;
+}
+
+static int write_u64_file(const char* dir, const char* name, uint64_t val) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%"PRIu64, val);
+  return write_file(dir, name, buf);
+}
+
+static int write_constraint(const char* dir, int idx, const sim_constraint* c) {
+  char name[40];
+  int ret = 0;
+  snprintf(name, sizeof(name), "constraint_%d_name", idx);
+  ret |= write_file(dir, name, c->name);
+  snprintf(name, sizeof(name), "constraint_%d_power_limit_uw", idx);
+  ret |= write_u64_file(dir, name, c->power_limit_uw);
+  snprintf(name, sizeof(name), "constraint_%d_time_window_us", idx);
+  ret |= write_u64_file(dir, name, c->time_window_us);
+  snprintf(name, sizeof(name), "constraint_%d_max_power_uw", idx);
+  ret |= write_u64_file(dir, name, c->power_limit_uw * 2);
+  return ret;
+}
+
+static int create_zone(const char* dir, const char* name, uint64_t energy_uj, int has_short) {
+  int ret;
+  if (sim_mkdirs(dir)) {
+    return -1;
+  }
+  ret = write_file(dir, "name", name) |
+        write_file(dir, "enabled", "1") |
+        write_u64_file(dir, "energy_uj", energy_uj) |
+        write_u64_file(dir, "max_energy_range_uj", SIM_MAX_ENERGY_RANGE_UJ) |
+        write_constraint(dir, 0, &SIM_LONG_TERM);
+  if (has_short) {
+    ret |= write_constraint(dir, 1, &SIM_SHORT_TERM);
+  }
+  return ret;
+}
+
+static int create_pkg_die(const char* root, uint32_t id, uint32_t pkg, uint32_t die, uint32_t n_die) {
+  char dir[PATH_MAX];
+  char name[48];
+  uint32_t i;
+  // kernel only includes the die in the name on multi-die systems
+  if (n_die > 1) {
+    snprintf(name, sizeof(name), "package-%"PRIu32"-die-%"PRIu32, pkg, die);
+  } else {
+    snprintf(name, sizeof(name), "package-%"PRIu32, pkg);
+  }
+  if (sim_path(dir, sizeof(dir), "%s/powercap/"CONTROL_TYPE":%"PRIu32, root, id)) {
+    return -1;
+  }
+  // give each counter a different starting value
+  if (create_zone(dir, name, 1000000 * (uint64_t) (id + 1), 1)) {
+    return -1;
+  }
+  for (i = 0; i < sizeof(SIM_SUBZONES) / sizeof(SIM_SUBZONES[0]); i++) {
+    if (sim_path(dir, sizeof(dir), "%s/powercap/"CONTROL_TYPE":%"PRIu32":%"PRIu32, root, id, i) ||
+        create_zone(dir, SIM_SUBZONES[i], 1000000 * (uint64_t) (id + 1) + i + 1, 0)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  char dir[PATH_MAX];
+  uint32_t* ids;
+  uint32_t n_pkg = 1;
+  uint32_t n_die = 1;
+  uint32_t n_zones;
+  uint32_t seed = 0;
+  uint32_t tmp;
+  uint32_t i;
+  uint32_t j;
+  int psys = 0;
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <root> [n_pkg] [n_die] [psys] [shuffle_seed]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 2) {
+    n_pkg = (uint32_t) strtoul(argv[2], NULL, 0);
+  }
+  if (argc > 3) {
+    n_die = (uint32_t) strtoul(argv[3], NULL, 0);
+  }
+  if (argc > 4) {
+    psys = atoi(argv[4]);
+  }
+  if (argc > 5) {
+    seed = (uint32_t) strtoul(argv[5], NULL, 0);
+  }
+  if (n_pkg == 0 || n_die == 0 || n_die > 32) {
+    fprintf(stderr, "Counts must be > 0, with no more than 32 die\n");
+    return 1;
+  }
+  n_zones = n_pkg * n_die + (psys ? 1 : 0);
+  if ((ids = malloc(n_zones * sizeof(*ids))) == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  // zone IDs, in package/die order, with PSYS last
+  for (i = 0; i < n_zones; i++) {
+    ids[i] = i;
+  }
+  if (seed) {
+    // Fisher-Yates shuffle with a deterministic LCG
+    for (i = n_zones - 1; i > 0; i--) {
+      seed = seed * 1103515245 + 12345;
+      j = (seed >> 16) % (i + 1);
+      tmp = ids[i];
+      ids[i] = ids[j];
+      ids[j] = tmp;
+    }
+  }
+  if (sim_path(dir, sizeof(dir), "%s/powercap/"CONTROL_TYPE, argv[1]) || sim_mkdirs(dir) ||
+      write_file(dir, "enabled", "1")) {
+    free(ids);
+    return 1;
+  }
+  for (i = 0; i < n_pkg * n_die; i++) {
+    if (create_pkg_die(argv[1], ids[i], i / n_die, i % n_die, n_die)) {
+      free(ids);
+      return 1;
+    }
+  }
+  if (psys) {
+    if (sim_path(dir, sizeof(dir), "%s/powercap/"CONTROL_TYPE":%"PRIu32, argv[1], ids[n_zones - 1]) ||
+        create_zone(dir, "psys", 1000000 * (uint64_t) (ids[n_zones - 1] + 1), 1)) {
+      free(ids);
+      return 1;
+    }
+  }
+  free(ids);
+  return 0;
+}
@@ -14,9 +14,25 @@
 #include <getopt.h>
 #include "raplcap.h"
 #include "raplcap-common.h"
-#ifdef RAPLCAP_msr
+#if defined(RAPLCAP_msr) || defined(RAPL_CONFIGURE_MSR_TXN)
 #include "raplcap-msr.h"
-#endif // RAPLCAP_msr
+#endif // RAPLCAP_msr || RAPL_CONFIGURE_MSR_TXN
+
+// monitoring uses timerfd for drift-free periodic sampling
+#if defined(__linux__)
+#define RAPL_CONFIGURE_MONITOR
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#endif // __linux__
+
+#ifdef RAPL_CONFIGURE_MONITOR
+typedef enum monitor_format {
+  MONITOR_FORMAT_CSV = 0,
+  MONITOR_FORMAT_JSON,
+} monitor_format;
+#endif // RAPL_CONFIGURE_MONITOR
 
 typedef struct rapl_configure_ctx {
   int get_packages;
@@ -24,6 +40,11 @@ typedef struct rapl_configure_ctx {
   raplcap_zone zone;
   unsigned int pkg;
   unsigned int die;
+  int set_zone;
+  int set_pkg;
+  int set_die;
+  int all;
+  const char* apply_path;
   int enabled;
   int set_enabled;
   int set_long;
@@ -37,10 +58,24 @@ typedef struct rapl_configure_ctx {
   int set_clamped;
   int set_locked;
 #endif // RAPLCAP_msr
+#ifdef RAPL_CONFIGURE_MONITOR
+  int monitor;
+  double interval;
+  unsigned long count;
+  monitor_format format;
+#endif // RAPL_CONFIGURE_MONITOR
 } rapl_configure_ctx;
 
+static const char* const ZONE_NAMES[RAPLCAP_NZONES] = {
+  "PACKAGE",
+  "CORE",
+  "UNCORE",
+  "DRAM",
+  "PSYS",
+};
+
 static const char* prog;
-static const char short_options[] = "nNc:d:z:e:s:w:S:W:C:Lh";
+static const char short_options[] = "nNc:d:z:aA:e:s:w:S:W:C:Lmi:k:f:h";
 static const struct option long_options[] = {
   {"npackages",no_argument,       NULL, 'n'},
   {"nsockets", no_argument,       NULL, 'n'},
@@ -49,6 +84,8 @@ static const struct option long_options[] = {
   {"die",      required_argument, NULL, 'd'},
   {"socket",   required_argument, NULL, 'c'},
   {"zone",     required_argument, NULL, 'z'},
+  {"all",      no_argument,       NULL, 'a'},
+  {"apply",    required_argument, NULL, 'A'},
   {"enabled",  required_argument, NULL, 'e'},
   {"seconds0", required_argument, NULL, 's'},
   {"watts0",   required_argument, NULL, 'w'},
@@ -58,6 +95,12 @@ static const struct option long_options[] = {
   {"clamped",  required_argument, NULL, 'C'},
   {"locked",   no_argument,       NULL, 'L'},
 #endif // RAPLCAP_msr
+#ifdef RAPL_CONFIGURE_MONITOR
+  {"monitor",  no_argument,       NULL, 'm'},
+  {"interval", required_argument, NULL, 'i'},
+  {"count",    required_argument, NULL, 'k'},
+  {"format",   required_argument, NULL, 'f'},
+#endif // RAPL_CONFIGURE_MONITOR
   {"help",     no_argument,       NULL, 'h'},
   {0, 0, 0, 0}
 };
@@ -78,6 +121,9 @@ static void print_usage(int exit_code) {
           "                           UNCORE - uncore power plane (client systems only)\n"
           "                           DRAM - main memory (server systems only)\n"
           "                           PSYS - the entire platform (Skylake and newer only)\n"
+          "  -a, --all                Print all zones of all packages and die, unless\n"
+          "                           package, die, and/or zone flags are specified\n"
+          "  -A, --apply=FILE         Apply settings for any number of zones from FILE\n"
           "  -e, --enabled=1|0        Enable/disable a zone\n"
           "  -s, --seconds0=SECONDS   Long term time window\n"
           "  -w, --watts0=WATTS       Long term power limit\n"
@@ -90,6 +136,15 @@ static void print_usage(int exit_code) {
           "                           setting limits (since zones are auto-enabled)\n"
           "  -L, --locked             Lock a zone (a core RESET is required to unlock)\n"
 #endif // RAPLCAP_msr
+#ifdef RAPL_CONFIGURE_MONITOR
+          "  -m, --monitor            Periodically print average power, limits, and\n"
+          "                           enabled state until interrupted\n"
+          "                           Monitors all zones, unless package, die, and/or\n"
+          "                           zone flags are specified\n"
+          "  -i, --interval=SECONDS   Monitor sampling interval (1 by default)\n"
+          "  -k, --count=COUNT        Stop monitoring after COUNT intervals\n"
+          "  -f, --format=CSV|JSON    Monitor output format (CSV by default)\n"
+#endif // RAPL_CONFIGURE_MONITOR
           "  -h, --help               Print this message and exit\n\n"
           "Current values are printed if no flags, or only package and/or zone flags, are specified.\n"
           "Otherwise, specified values are set while other values remain unmodified.\n"
@@ -184,40 +239,617 @@ static int configure_limits(const rapl_configure_ctx* c) {
 }
 
 static int get_limits(unsigned int pkg, unsigned int die, raplcap_zone zone) {
-  raplcap_limit ll = { 0 };
-  raplcap_limit ls = { 0 };
+  raplcap_zone_status status;
   double joules;
   double joules_max;
-  int locked = PRINT_LIMIT_IGNORE;
-  int clamped = PRINT_LIMIT_IGNORE;
   int ret;
-  int enabled = raplcap_pd_is_zone_enabled(NULL, pkg, die, zone);
-  if (enabled < 0) {
-    print_error_continue("Failed to determine if zone is enabled");
-  }
-#ifdef RAPLCAP_msr
-  locked = raplcap_msr_pd_is_zone_locked(NULL, pkg, die, zone);
-  if (locked < 0) {
-    print_error_continue("Failed to determine if zone is locked");
-  }
-  clamped = raplcap_msr_pd_is_zone_clamped(NULL, pkg, die, zone);
-  if (clamped < 0) {
-    print_error_continue("Failed to determine if zone is clamped");
-  }
-#endif // RAPLCAP_msr
-  if ((ret = raplcap_pd_get_limits(NULL, pkg, die, zone, &ll, &ls))) {
-    perror("Failed to get limits");
+  if ((ret = raplcap_pd_get_zone_status(NULL, pkg, die, zone, &status))) {
+    perror("Failed to get zone status");
     return ret;
   }
+#ifndef RAPLCAP_msr
+  status.locked = PRINT_LIMIT_IGNORE;
+  status.clamped = PRINT_LIMIT_IGNORE;
+#endif // RAPLCAP_msr
   // we'll consider energy counter information to be optional
   joules = raplcap_pd_get_energy_counter(NULL, pkg, die, zone);
   joules_max = raplcap_pd_get_energy_counter_max(NULL, pkg, die, zone);
-  print_limits(enabled, locked, clamped,
-               ll.watts, ll.seconds, ls.watts, ls.seconds,
+  print_limits(status.enabled, status.locked, status.clamped,
+               status.limit_long.watts, status.limit_long.seconds,
+               status.limit_short.watts, status.limit_short.seconds,
                joules, joules_max);
   return ret;
 }
 
+// package, die, and zone flags select zones when specified, otherwise all zones are selected
+static int is_selected(const rapl_configure_ctx* c, uint32_t pkg, uint32_t die, raplcap_zone zone) {
+  return (!c->set_pkg || pkg == c->pkg) && (!c->set_die || die == c->die) && (!c->set_zone || zone == c->zone);
+}
+
+// returns the number of packages, or 0 on error
+static uint32_t check_selection(const rapl_configure_ctx* c) {
+  uint32_t n_pkg = raplcap_get_num_packages(NULL);
+  if (n_pkg == 0) {
+    perror("Failed to get number of packages");
+    return 0;
+  }
+  if ((c->set_pkg && c->pkg >= n_pkg) || ((c->set_pkg || c->set_die) && c->die >= raplcap_get_num_die(NULL, c->pkg))) {
+    fprintf(stderr, "Package or die not found\n");
+    return 0;
+  }
+  return n_pkg;
+}
+
+static int print_all(const rapl_configure_ctx* c) {
+  raplcap_snapshot* snap;
+  const raplcap_snapshot_zone* z;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  int clamped;
+  int locked;
+  int first = 1;
+  int ret = -1;
+  if ((n_pkg = check_selection(c)) == 0) {
+    return -1;
+  }
+  // read everything at once
+  if ((snap = raplcap_snapshot_alloc(NULL)) == NULL) {
+    perror("Failed to allocate snapshot");
+    return -1;
+  }
+  if (raplcap_snapshot_read(NULL, snap)) {
+    perror("Failed to read snapshot");
+    goto out;
+  }
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    n_die = raplcap_get_num_die(NULL, pkg);
+    for (die = 0; die < n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        if (!is_selected(c, pkg, die, (raplcap_zone) zone)) {
+          continue;
+        }
+        z = raplcap_snapshot_get_zone(snap, pkg, die, (raplcap_zone) zone);
+        if (z == NULL || z->supported <= 0) {
+          continue;
+        }
+#ifdef RAPLCAP_msr
+        clamped = z->clamped;
+        locked = z->locked;
+#else
+        clamped = PRINT_LIMIT_IGNORE;
+        locked = PRINT_LIMIT_IGNORE;
+#endif // RAPLCAP_msr
+        if (!first) {
+          printf("\n");
+        }
+        first = 0;
+        printf("%13s: %"PRIu32"\n", "package", pkg);
+        printf("%13s: %"PRIu32"\n", "die", die);
+        printf("%13s: %s\n", "zone", ZONE_NAMES[zone]);
+        print_limits(z->enabled, locked, clamped,
+                     z->limit_long.watts, z->limit_long.seconds,
+                     z->limit_short.watts, z->limit_short.seconds,
+                     z->joules, z->joules_max);
+      }
+    }
+  }
+  ret = 0;
+out:
+  raplcap_snapshot_free(snap);
+  return ret;
+}
+
+#ifdef RAPL_CONFIGURE_MONITOR
+static volatile sig_atomic_t monitor_running = 1;
+
+static void monitor_handle_signal(int sig) {
+  (void) sig;
+  monitor_running = 0;
+}
+
+// unknown or inapplicable values are negative and printed as empty (CSV) or null (JSON) values
+static void monitor_print_value(monitor_format fmt, const char* key, int precision, double val) {
+  if (fmt == MONITOR_FORMAT_JSON) {
+    printf(",\"%s\":", key);
+    if (val < 0) {
+      fputs("null", stdout);
+    } else {
+      printf("%.*f", precision, val);
+    }
+  } else {
+    putchar(',');
+    if (val >= 0) {
+      printf("%.*f", precision, val);
+    }
+  }
+}
+
+static void monitor_print_bool(monitor_format fmt, const char* key, int val) {
+  if (fmt == MONITOR_FORMAT_JSON) {
+    printf(",\"%s\":%s", key, val < 0 ? "null" : (val ? "true" : "false"));
+  } else if (val < 0) {
+    putchar(',');
+  } else {
+    printf(",%d", val ? 1 : 0);
+  }
+}
+
+static void monitor_print_header(monitor_format fmt) {
+  if (fmt == MONITOR_FORMAT_CSV) {
+    printf("time,package,die,zone,watts,enabled,watts_long,seconds_long,watts_short,seconds_short\n");
+  }
+}
+
+static void monitor_print_zone(monitor_format fmt, double t, uint32_t pkg, uint32_t die, raplcap_zone zone,
+                               double watts, const raplcap_snapshot_zone* z) {
+  // time window can never be 0, so if it's > 0, the short term constraint exists
+  int has_short = z->limit_short.seconds > 0;
+  if (fmt == MONITOR_FORMAT_JSON) {
+    printf("{\"time\":%.6f,\"package\":%"PRIu32",\"die\":%"PRIu32",\"zone\":\"%s\"", t, pkg, die, ZONE_NAMES[zone]);
+  } else {
+    printf("%.6f,%"PRIu32",%"PRIu32",%s", t, pkg, die, ZONE_NAMES[zone]);
+  }
+  monitor_print_value(fmt, "watts", 6, watts);
+  monitor_print_bool(fmt, "enabled", z->enabled);
+  monitor_print_value(fmt, "watts_long", 12, z->limit_long.watts);
+  monitor_print_value(fmt, "seconds_long", 12, z->limit_long.seconds);
+  monitor_print_value(fmt, "watts_short", 12, has_short ? z->limit_short.watts : -1);
+  monitor_print_value(fmt, "seconds_short", 12, has_short ? z->limit_short.seconds : -1);
+  fputs(fmt == MONITOR_FORMAT_JSON ? "}\n" : "\n", stdout);
+}
+
+static void monitor_print(const rapl_configure_ctx* c, const raplcap_snapshot* prev, const raplcap_snapshot* cur,
+                          uint32_t n_pkg, uint64_t t0_ns) {
+  const raplcap_snapshot_zone* z;
+  double t = (raplcap_snapshot_get_timestamp_ns(cur) - t0_ns) / 1000000000.0;
+  uint32_t n_die;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    n_die = raplcap_get_num_die(NULL, pkg);
+    for (die = 0; die < n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        if (!is_selected(c, pkg, die, (raplcap_zone) zone)) {
+          continue;
+        }
+        z = raplcap_snapshot_get_zone(cur, pkg, die, (raplcap_zone) zone);
+        if (z == NULL || z->supported <= 0) {
+          continue;
+        }
+        monitor_print_zone(c->format, t, pkg, die, (raplcap_zone) zone,
+                           raplcap_snapshot_get_watts(prev, cur, pkg, die, (raplcap_zone) zone), z);
+      }
+    }
+  }
+  // one write per interval
+  fflush(stdout);
+}
+
+// power is only correct if there's at most one energy counter rollover per interval
+static int monitor_check_interval(const rapl_configure_ctx* c, const raplcap_snapshot* snap, uint32_t n_pkg) {
+  const raplcap_snapshot_zone* z;
+  uint32_t n_die;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    n_die = raplcap_get_num_die(NULL, pkg);
+    for (die = 0; die < n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        if (!is_selected(c, pkg, die, (raplcap_zone) zone)) {
+          continue;
+        }
+        z = raplcap_snapshot_get_zone(snap, pkg, die, (raplcap_zone) zone);
+        // some zones can be capped but don't have energy counters
+        if (z == NULL || z->supported <= 0 || z->joules_max <= 0) {
+          continue;
+        }
+        if (c->interval >= z->joules_max / RAPLCAP_MAX_WATTS) {
+          fprintf(stderr, "Monitor interval must be < %f seconds to detect energy counter rollovers of "
+                  "package %"PRIu32", die %"PRIu32", zone %s\n",
+                  z->joules_max / RAPLCAP_MAX_WATTS, pkg, die, ZONE_NAMES[zone]);
+          return -1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static int monitor(const rapl_configure_ctx* c) {
+  raplcap_snapshot* snaps[2] = { NULL, NULL };
+  struct sigaction sa;
+  struct itimerspec its;
+  uint64_t interval_ns = (uint64_t) (c->interval * 1000000000.0);
+  uint64_t t0_ns;
+  uint64_t expirations;
+  uint64_t missed = 0;
+  unsigned long n = 0;
+  uint32_t n_pkg;
+  int cur = 0;
+  int fd = -1;
+  int ret = -1;
+
+  if (interval_ns == 0) {
+    fprintf(stderr, "Monitor interval is too small\n");
+    return -1;
+  }
+  if ((n_pkg = check_selection(c)) == 0) {
+    return -1;
+  }
+  // all zones are read at once each interval, only selected ones are printed
+  if ((snaps[0] = raplcap_snapshot_alloc(NULL)) == NULL || (snaps[1] = raplcap_snapshot_alloc(NULL)) == NULL) {
+    perror("Failed to allocate snapshots");
+    goto out;
+  }
+  if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+    perror("Failed to create timer");
+    goto out;
+  }
+  if (raplcap_snapshot_read(NULL, snaps[cur])) {
+    perror("Failed to read snapshot");
+    goto out;
+  }
+  if (monitor_check_interval(c, snaps[cur], n_pkg)) {
+    goto out;
+  }
+  // expirations are absolute multiples of the interval from the first snapshot, so sampling doesn't drift
+  t0_ns = raplcap_snapshot_get_timestamp_ns(snaps[cur]);
+  its.it_interval.tv_sec = (time_t) (interval_ns / 1000000000);
+  its.it_interval.tv_nsec = (long) (interval_ns % 1000000000);
+  its.it_value.tv_sec = (time_t) ((t0_ns + interval_ns) / 1000000000);
+  its.it_value.tv_nsec = (long) ((t0_ns + interval_ns) % 1000000000);
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+    perror("Failed to start timer");
+    goto out;
+  }
+  // no SA_RESTART, so signals interrupt waiting on the timer
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = monitor_handle_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  monitor_print_header(c->format);
+  ret = 0;
+  while (monitor_running && (c->count == 0 || n < c->count)) {
+    if (read(fd, &expirations, sizeof(expirations)) != (ssize_t) sizeof(expirations)) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Failed to wait for timer");
+      ret = -1;
+      break;
+    }
+    // power is averaged over the actual time between snapshots, so late samples are still accurate
+    missed += expirations - 1;
+    if (raplcap_snapshot_read(NULL, snaps[!cur])) {
+      perror("Failed to read snapshot");
+      ret = -1;
+      break;
+    }
+    monitor_print(c, snaps[cur], snaps[!cur], n_pkg, t0_ns);
+    cur = !cur;
+    n++;
+  }
+  if (missed > 0) {
+    fprintf(stderr, "Missed %"PRIu64" intervals - consider increasing the interval\n", missed);
+  }
+
+out:
+  if (fd >= 0) {
+    close(fd);
+  }
+  raplcap_snapshot_free(snaps[1]);
+  raplcap_snapshot_free(snaps[0]);
+  return ret;
+}
+#endif // RAPL_CONFIGURE_MONITOR
+
+// desired settings for a zone; limit values of 0 are not written
+typedef struct apply_zone {
+  raplcap_limit limit_long;
+  raplcap_limit limit_short;
+  int enabled;
+  int set_enabled;
+#ifdef RAPLCAP_msr
+  int clamped;
+  int set_clamped;
+#endif // RAPLCAP_msr
+  int matched;
+} apply_zone;
+
+#define APPLY_LINE_MAX 1024
+#define APPLY_WILDCARD UINT32_MAX
+
+// later lines override values from earlier lines, so wildcard defaults can precede specific settings
+static void apply_merge(apply_zone* dst, const apply_zone* src) {
+  dst->limit_long.watts = src->limit_long.watts > 0 ? src->limit_long.watts : dst->limit_long.watts;
+  dst->limit_long.seconds = src->limit_long.seconds > 0 ? src->limit_long.seconds : dst->limit_long.seconds;
+  dst->limit_short.watts = src->limit_short.watts > 0 ? src->limit_short.watts : dst->limit_short.watts;
+  dst->limit_short.seconds = src->limit_short.seconds > 0 ? src->limit_short.seconds : dst->limit_short.seconds;
+  if (src->set_enabled) {
+    dst->enabled = src->enabled;
+    dst->set_enabled = 1;
+  }
+#ifdef RAPLCAP_msr
+  if (src->set_clamped) {
+    dst->clamped = src->clamped;
+    dst->set_clamped = 1;
+  }
+#endif // RAPLCAP_msr
+  dst->matched = 1;
+}
+
+static int apply_parse_index(const char* tok, uint32_t* idx) {
+  char* end;
+  unsigned long val;
+  if (!strcmp(tok, "*")) {
+    *idx = APPLY_WILDCARD;
+    return 0;
+  }
+  errno = 0;
+  val = strtoul(tok, &end, 10);
+  if (errno || end == tok || *end != '\0' || val >= APPLY_WILDCARD) {
+    return -1;
+  }
+  *idx = (uint32_t) val;
+  return 0;
+}
+
+static int apply_parse_bool(const char* val, int* b) {
+  if (!strcmp(val, "1")) {
+    *b = 1;
+  } else if (!strcmp(val, "0")) {
+    *b = 0;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static int apply_parse_setting(char* tok, apply_zone* az) {
+  double* dbl = NULL;
+  char* val = strchr(tok, '=');
+  char* end;
+  int ret = -1;
+  if (val == NULL) {
+    return -1;
+  }
+  // terminate the key temporarily
+  *val = '\0';
+  if (!strcmp(tok, "watts_long")) {
+    dbl = &az->limit_long.watts;
+  } else if (!strcmp(tok, "seconds_long")) {
+    dbl = &az->limit_long.seconds;
+  } else if (!strcmp(tok, "watts_short")) {
+    dbl = &az->limit_short.watts;
+  } else if (!strcmp(tok, "seconds_short")) {
+    dbl = &az->limit_short.seconds;
+  } else if (!strcmp(tok, "enabled")) {
+    az->set_enabled = 1;
+    ret = apply_parse_bool(val + 1, &az->enabled);
+#ifdef RAPLCAP_msr
+  } else if (!strcmp(tok, "clamped")) {
+    az->set_clamped = 1;
+    ret = apply_parse_bool(val + 1, &az->clamped);
+#endif // RAPLCAP_msr
+  }
+  *val++ = '=';
+  if (dbl != NULL) {
+    *dbl = strtod(val, &end);
+    ret = (end == val || *end != '\0' || *dbl <= 0) ? -1 : 0;
+  }
+  return ret;
+}
+
+static int apply_parse(const char* path, apply_zone* zones, uint32_t n_pkg, uint32_t max_die) {
+  char line[APPLY_LINE_MAX];
+  apply_zone az;
+  const char* delim = " \t\r\n";
+  char* saveptr;
+  char* tok[3];
+  char* setting;
+  uint32_t lineno = 0;
+  uint32_t n_matched;
+  uint32_t pkg;
+  uint32_t die;
+  uint32_t p;
+  uint32_t d;
+  int zone;
+  int i;
+  int ret = 0;
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  while (!ret && fgets(line, sizeof(line), f) != NULL) {
+    lineno++;
+    if (strchr(line, '\n') == NULL && !feof(f)) {
+      fprintf(stderr, "%s:%"PRIu32": Line is too long\n", path, lineno);
+      ret = -1;
+      break;
+    }
+    // strip comments
+    if ((setting = strchr(line, '#')) != NULL) {
+      *setting = '\0';
+    }
+    if ((tok[0] = strtok_r(line, delim, &saveptr)) == NULL) {
+      continue;
+    }
+    tok[1] = strtok_r(NULL, delim, &saveptr);
+    tok[2] = strtok_r(NULL, delim, &saveptr);
+    if (tok[1] == NULL || tok[2] == NULL || apply_parse_index(tok[0], &pkg) || apply_parse_index(tok[1], &die)) {
+      fprintf(stderr, "%s:%"PRIu32": Expected: PACKAGE|* DIE|* ZONE SETTING=VALUE...\n", path, lineno);
+      ret = -1;
+      break;
+    }
+    for (zone = 0; zone < RAPLCAP_NZONES && strcmp(tok[2], ZONE_NAMES[zone]); zone++);
+    if (zone == RAPLCAP_NZONES) {
+      fprintf(stderr, "%s:%"PRIu32": Unknown zone: %s\n", path, lineno, tok[2]);
+      ret = -1;
+      break;
+    }
+    memset(&az, 0, sizeof(az));
+    for (i = 0; (setting = strtok_r(NULL, delim, &saveptr)) != NULL; i++) {
+      if (apply_parse_setting(setting, &az)) {
+        fprintf(stderr, "%s:%"PRIu32": Invalid setting: %s\n", path, lineno, setting);
+        ret = -1;
+        break;
+      }
+    }
+    if (!ret && i == 0) {
+      fprintf(stderr, "%s:%"PRIu32": No settings\n", path, lineno);
+      ret = -1;
+    }
+    // a wildcard package may match packages that don't have a specific die
+    n_matched = 0;
+    for (p = 0; !ret && p < n_pkg; p++) {
+      for (d = 0; d < raplcap_get_num_die(NULL, p); d++) {
+        if ((pkg == APPLY_WILDCARD || pkg == p) && (die == APPLY_WILDCARD || die == d)) {
+          apply_merge(&zones[(p * max_die + d) * RAPLCAP_NZONES + zone], &az);
+          n_matched++;
+        }
+      }
+    }
+    if (!ret && n_matched == 0) {
+      fprintf(stderr, "%s:%"PRIu32": Package or die not found\n", path, lineno);
+      ret = -1;
+    }
+  }
+  if (!ret && ferror(f)) {
+    perror(path);
+    ret = -1;
+  }
+  fclose(f);
+  return ret;
+}
+
+static int apply_commit(const apply_zone* zones, uint32_t n_pkg, uint32_t max_die) {
+  const apply_zone* az;
+  const raplcap_limit* ll;
+  const raplcap_limit* ls;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  int ret = 0;
+#ifdef RAPL_CONFIGURE_MSR_TXN
+  // stage everything, then write each register at most once
+  raplcap_msr_txn* txn = raplcap_msr_txn_alloc(NULL);
+  if (txn == NULL) {
+    perror("Failed to allocate transaction");
+    return -1;
+  }
+#endif // RAPL_CONFIGURE_MSR_TXN
+  for (pkg = 0; !ret && pkg < n_pkg; pkg++) {
+    for (die = 0; !ret && die < max_die; die++) {
+      for (zone = 0; !ret && zone < RAPLCAP_NZONES; zone++) {
+        az = &zones[(pkg * max_die + die) * RAPLCAP_NZONES + zone];
+        if (!az->matched) {
+          continue;
+        }
+        ll = (az->limit_long.watts > 0 || az->limit_long.seconds > 0) ? &az->limit_long : NULL;
+        ls = (az->limit_short.watts > 0 || az->limit_short.seconds > 0) ? &az->limit_short : NULL;
+#ifdef RAPL_CONFIGURE_MSR_TXN
+        if ((ll != NULL || ls != NULL) &&
+            (ret = raplcap_msr_txn_set_limits(txn, pkg, die, (raplcap_zone) zone, ll, ls))) {
+          perror("Failed to stage limits");
+        } else if (az->set_enabled &&
+                   (ret = raplcap_msr_txn_set_zone_enabled(txn, pkg, die, (raplcap_zone) zone, az->enabled))) {
+          perror("Failed to stage enabling/disabling zone");
+        }
+#ifdef RAPLCAP_msr
+        else if (az->set_clamped &&
+                 (ret = raplcap_msr_txn_set_zone_clamped(txn, pkg, die, (raplcap_zone) zone, az->clamped))) {
+          perror("Failed to stage clamping/unclamping zone");
+        }
+#endif // RAPLCAP_msr
+#else
+        if ((ll != NULL || ls != NULL) && (ret = raplcap_pd_set_limits(NULL, pkg, die, (raplcap_zone) zone, ll, ls))) {
+          perror("Failed to set limits");
+        } else if (az->set_enabled &&
+                   (ret = raplcap_pd_set_zone_enabled(NULL, pkg, die, (raplcap_zone) zone, az->enabled))) {
+          perror("Failed to enable/disable zone");
+        }
+#ifdef RAPLCAP_msr
+        // clamping must follow enabling, which also sets clamping
+        else if (az->set_clamped &&
+                 (ret = raplcap_msr_pd_set_zone_clamped(NULL, pkg, die, (raplcap_zone) zone, az->clamped))) {
+          perror("Failed to clamp/unclamp zone");
+        }
+#endif // RAPLCAP_msr
+#endif // RAPL_CONFIGURE_MSR_TXN
+      }
+    }
+  }
+#ifdef RAPL_CONFIGURE_MSR_TXN
+  if (!ret && (ret = raplcap_msr_txn_commit(txn))) {
+    perror("Failed to apply configuration");
+  }
+  raplcap_msr_txn_free(txn);
+#endif // RAPL_CONFIGURE_MSR_TXN
+  return ret;
+}
+
+static int apply_config(const char* path) {
+  apply_zone* zones;
+  const apply_zone* az;
+  uint32_t n_pkg;
+  uint32_t n_die;
+  uint32_t max_die = 0;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  int supported;
+  int ret = -1;
+  if ((n_pkg = raplcap_get_num_packages(NULL)) == 0) {
+    perror("Failed to get number of packages");
+    return -1;
+  }
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    if ((n_die = raplcap_get_num_die(NULL, pkg)) == 0) {
+      perror("Failed to get number of die");
+      return -1;
+    }
+    max_die = n_die > max_die ? n_die : max_die;
+  }
+  if ((zones = calloc((size_t) n_pkg * max_die * RAPLCAP_NZONES, sizeof(apply_zone))) == NULL) {
+    perror("Failed to allocate configuration");
+    return -1;
+  }
+  if (apply_parse(path, zones, n_pkg, max_die)) {
+    goto out;
+  }
+  // nothing is written unless all configured zones are supported
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    for (die = 0; die < max_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        az = &zones[(pkg * max_die + die) * RAPLCAP_NZONES + zone];
+        if (!az->matched) {
+          continue;
+        }
+        supported = raplcap_pd_is_zone_supported(NULL, pkg, die, (raplcap_zone) zone);
+        if (supported == 0) {
+          fprintf(stderr, "Zone not supported: package %"PRIu32", die %"PRIu32", zone %s\n",
+                  pkg, die, ZONE_NAMES[zone]);
+          goto out;
+        } else if (supported < 0) {
+          print_error_continue("Failed to determine if zone is supported");
+        }
+      }
+    }
+  }
+  ret = apply_commit(zones, n_pkg, max_die);
+out:
+  free(zones);
+  return ret;
+}
+
 #define SET_VAL(optarg, val, set_val) \
   if ((val = atof(optarg)) <= 0) { \
     fprintf(stderr, "Time window and power limit values must be > 0\n"); \
@@ -229,10 +861,14 @@ int main(int argc, char** argv) {
   rapl_configure_ctx ctx = { 0 };
   int ret = 0;
   int c;
+  int i;
   int supported;
   uint32_t count;
   prog = argv[0];
   int is_read_only;
+#ifdef RAPL_CONFIGURE_MONITOR
+  ctx.interval = 1;
+#endif // RAPL_CONFIGURE_MONITOR
 
   // parse parameters
   while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
@@ -242,9 +878,11 @@ int main(int argc, char** argv) {
         break;
       case 'c':
         ctx.pkg = atoi(optarg);
+        ctx.set_pkg = 1;
         break;
       case 'd':
         ctx.die = atoi(optarg);
+        ctx.set_die = 1;
         break;
       case 'n':
         ctx.get_packages = 1;
@@ -253,19 +891,18 @@ int main(int argc, char** argv) {
         ctx.get_die = 1;
         break;
       case 'z':
-        if (!strcmp(optarg, "PACKAGE")) {
-          ctx.zone = RAPLCAP_ZONE_PACKAGE;
-        } else if (!strcmp(optarg, "CORE")) {
-          ctx.zone = RAPLCAP_ZONE_CORE;
-        } else if (!strcmp(optarg, "UNCORE")) {
-          ctx.zone = RAPLCAP_ZONE_UNCORE;
-        } else if (!strcmp(optarg, "DRAM")) {
-          ctx.zone = RAPLCAP_ZONE_DRAM;
-        } else if (!strcmp(optarg, "PSYS")) {
-          ctx.zone = RAPLCAP_ZONE_PSYS;
-        } else {
+        for (i = 0; i < RAPLCAP_NZONES && strcmp(optarg, ZONE_NAMES[i]); i++);
+        if (i == RAPLCAP_NZONES) {
           print_usage(1);
         }
+        ctx.zone = (raplcap_zone) i;
+        ctx.set_zone = 1;
+        break;
+      case 'a':
+        ctx.all = 1;
+        break;
+      case 'A':
+        ctx.apply_path = optarg;
         break;
       case 'e':
         ctx.enabled = atoi(optarg);
@@ -292,6 +929,29 @@ int main(int argc, char** argv) {
         ctx.set_locked = 1;
         break;
 #endif // RAPLCAP_msr
+#ifdef RAPL_CONFIGURE_MONITOR
+      case 'm':
+        ctx.monitor = 1;
+        break;
+      case 'i':
+        if ((ctx.interval = atof(optarg)) <= 0) {
+          fprintf(stderr, "Monitor interval must be > 0\n");
+          print_usage(1);
+        }
+        break;
+      case 'k':
+        ctx.count = strtoul(optarg, NULL, 0);
+        break;
+      case 'f':
+        if (!strcmp(optarg, "CSV")) {
+          ctx.format = MONITOR_FORMAT_CSV;
+        } else if (!strcmp(optarg, "JSON")) {
+          ctx.format = MONITOR_FORMAT_JSON;
+        } else {
+          print_usage(1);
+        }
+        break;
+#endif // RAPL_CONFIGURE_MONITOR
       case '?':
       default:
         print_usage(1);
@@ -325,6 +985,21 @@ int main(int argc, char** argv) {
 #ifdef RAPLCAP_msr
   is_read_only &= !ctx.set_clamped && !ctx.set_locked;
 #endif // RAPLCAP_msr
+#ifdef RAPL_CONFIGURE_MONITOR
+  if (ctx.monitor && (!is_read_only || ctx.all || ctx.apply_path != NULL)) {
+    fprintf(stderr, "Cannot print or set other values while monitoring\n");
+    print_usage(1);
+  }
+#endif // RAPL_CONFIGURE_MONITOR
+  if (ctx.apply_path != NULL && (!is_read_only || ctx.all)) {
+    fprintf(stderr, "Cannot print or set other values while applying a configuration\n");
+    print_usage(1);
+  }
+  if (ctx.all && !is_read_only) {
+    fprintf(stderr, "Cannot set values while printing all zones\n");
+    print_usage(1);
+  }
+  is_read_only &= ctx.apply_path == NULL;
 #ifndef _WIN32
   if (is_read_only) {
     // request read-only access (not supported by all implementations, therefore not guaranteed)
@@ -336,6 +1011,23 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+#ifdef RAPL_CONFIGURE_MONITOR
+  if (ctx.monitor) {
+    ret = monitor(&ctx);
+    if (raplcap_destroy(NULL)) {
+      perror("Failed to clean up");
+    }
+    return ret;
+  }
+#endif // RAPL_CONFIGURE_MONITOR
+  if (ctx.all || ctx.apply_path != NULL) {
+    ret = ctx.all ? print_all(&ctx) : apply_config(ctx.apply_path);
+    if (raplcap_destroy(NULL)) {
+      perror("Failed to clean up");
+    }
+    return ret;
+  }
+
   supported = raplcap_pd_is_zone_supported(NULL, ctx.pkg, ctx.die, ctx.zone);
   if (supported == 0) {
     fprintf(stderr, "Zone not supported\n");
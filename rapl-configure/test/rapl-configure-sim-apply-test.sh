@@ -0,0 +1,88 @@
+#!/bin/sh
+#
+# Apply configuration files with rapl-configure and check the zones with -a/--all.
+# Must run with a simulated root with at least 2 packages of 2 die each - see raplcap-msr-sim-run.sh.
+#
+# Usage: rapl-configure-sim-apply-test.sh <rapl-configure>
+#
+
+if [ $# -ne 1 ]; then
+  echo "Usage: $0 <rapl-configure>" >&2
+  exit 1
+fi
+
+BIN=$1
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+RET=0
+
+fail() {
+  echo "$0: $*" >&2
+  RET=1
+}
+
+# Usage: check <package> <die> <zone> <key> <value>
+check() {
+  val=$("$BIN" -a -c "$1" -d "$2" -z "$3" | awk -v k="$4:" '$1 == k { print $2 }')
+  if [ -z "$val" ] || ! awk -v a="$val" -v b="$5" 'BEGIN { exit !(a == b) }'; then
+    fail "$1 $2 $3: expected $4=$5, got '$val'"
+  fi
+}
+
+# Usage: check_error <line> <message>
+# The line follows a valid one, which must not be applied either
+check_error() {
+  printf '0 0 PACKAGE watts_long=50\n%s\n' "$1" > "$DIR/bad.conf"
+  if "$BIN" -A "$DIR/bad.conf" 2> "$DIR/err"; then
+    fail "'$1': expected failure"
+  elif ! grep -qF "$DIR/bad.conf:2: $2" "$DIR/err"; then
+    fail "'$1': expected error '$2', got '$(cat "$DIR/err")'"
+  fi
+  check 0 0 PACKAGE watts_long 100
+}
+
+echo "Testing applying a configuration"
+cat > "$DIR/good.conf" <<EOC
+# defaults for every package and die
+* * PACKAGE watts_long=100 seconds_long=1 watts_short=150 enabled=1
+
+	* *	DRAM watts_long=20   # whitespace and trailing comments are allowed
+# later lines override earlier ones, one setting at a time
+1 * PACKAGE watts_long=80
+1 1 PACKAGE watts_short=120 enabled=0
+EOC
+if ! "$BIN" -A "$DIR/good.conf"; then
+  fail "failed to apply configuration"
+fi
+for die in 0 1; do
+  check 0 $die PACKAGE watts_long 100
+  check 0 $die PACKAGE seconds_long 1
+  check 0 $die PACKAGE watts_short 150
+  check 0 $die PACKAGE enabled true
+done
+check 1 0 PACKAGE watts_long 80
+check 1 0 PACKAGE seconds_long 1
+check 1 0 PACKAGE watts_short 150
+check 1 0 PACKAGE enabled true
+check 1 1 PACKAGE watts_long 80
+check 1 1 PACKAGE watts_short 120
+check 1 1 PACKAGE enabled false
+for pkg in 0 1; do
+  for die in 0 1; do
+    check $pkg $die DRAM watts 20
+  done
+done
+
+echo "Testing invalid configurations"
+check_error "0 0 PACKAGE watts_long=abc" "Invalid setting: watts_long=abc"
+check_error "0 0 PACKAGE watts_long=-1" "Invalid setting: watts_long=-1"
+check_error "0 0 PACKAGE foo=1" "Invalid setting: foo=1"
+check_error "0 0 PACKAGE" "No settings"
+check_error "0 0 FOO watts_long=1" "Unknown zone: FOO"
+check_error "0 PACKAGE watts_long=1" "Expected: PACKAGE|* DIE|* ZONE SETTING=VALUE..."
+check_error "2 * PACKAGE watts_long=1" "Package or die not found"
+
+if [ $RET -eq 0 ]; then
+  echo "Tests successful"
+fi
+exit $RET
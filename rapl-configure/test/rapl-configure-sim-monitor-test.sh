@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+# Monitor zones with rapl-configure and check the rows and fields that are printed.
+# Must run with a simulated root with 2 packages of 2 die each - see raplcap-msr-sim-run.sh.
+#
+# Usage: rapl-configure-sim-monitor-test.sh <rapl-configure>
+#
+
+if [ $# -ne 1 ]; then
+  echo "Usage: $0 <rapl-configure>" >&2
+  exit 1
+fi
+
+BIN=$1
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+RET=0
+FIELDS="time,package,die,zone,watts,enabled,watts_long,seconds_long,watts_short,seconds_short"
+# 2 packages * 2 die * 5 zones
+N_ZONES=20
+
+fail() {
+  echo "$0: $*" >&2
+  RET=1
+}
+
+echo "Testing JSON output"
+if ! "$BIN" -m -k 3 -i 0.01 -f JSON > "$DIR/out"; then
+  fail "JSON: monitoring failed"
+fi
+# builds with DEBUG logging also log to stdout
+grep '^{' "$DIR/out" > "$DIR/out.json"
+n=$(wc -l < "$DIR/out.json")
+if [ "$n" -ne $((3 * N_ZONES)) ]; then
+  fail "JSON: expected $((3 * N_ZONES)) rows, got $n"
+fi
+# every row is an object with the fields in order, and the simulated counters don't change
+re='^\{"time":[0-9.]+,"package":[01],"die":[01],"zone":"(PACKAGE|CORE|UNCORE|DRAM|PSYS)","watts":0\.000000,'
+re="$re"'"enabled":(true|false),"watts_long":[0-9.]+,"seconds_long":[0-9.]+,'
+re="$re"'"watts_short":([0-9.]+|null),"seconds_short":([0-9.]+|null)\}$'
+n=$(grep -cE "$re" "$DIR/out.json")
+if [ "$n" -ne $((3 * N_ZONES)) ]; then
+  fail "JSON: $(($(wc -l < "$DIR/out.json") - n)) malformed rows"
+fi
+# each interval has one row per zone, at increasing times
+if ! awk -F'[:,]' -v n="$N_ZONES" '
+    { t[NR] = $2 }
+    END {
+      for (i = 1; i <= NR; i++) {
+        if ((i - 1) % n == 0 ? (i > 1 && t[i] <= t[i - 1]) : t[i] != t[i - 1]) { exit 1 }
+      }
+    }' "$DIR/out.json"; then
+  fail "JSON: rows aren't grouped by interval at increasing times"
+fi
+if [ "$(sed 's/^{"time":[0-9.]*,//' "$DIR/out.json" | sort -u | wc -l)" -ne "$N_ZONES" ]; then
+  fail "JSON: zones aren't the same every interval"
+fi
+
+echo "Testing CSV output for a selected zone"
+if ! "$BIN" -m -k 2 -i 0.01 -c 1 -d 1 -z DRAM > "$DIR/out"; then
+  fail "CSV: monitoring failed"
+fi
+grep -E '^(time|[0-9.]+),' "$DIR/out" > "$DIR/out.csv"
+if [ "$(head -n 1 "$DIR/out.csv")" != "$FIELDS" ]; then
+  fail "CSV: unexpected header: $(head -n 1 "$DIR/out.csv")"
+fi
+n=$(tail -n +2 "$DIR/out.csv" | grep -cE '^[0-9.]+,1,1,DRAM,0\.000000,[01],[0-9.]+,[0-9.]+,,$')
+if [ "$n" -ne 2 ] || [ "$(wc -l < "$DIR/out.csv")" -ne 3 ]; then
+  fail "CSV: expected 2 DRAM rows, got: $(tail -n +2 "$DIR/out.csv")"
+fi
+
+echo "Testing rejected intervals"
+# the simulated DRAM counter rolls over after about 65713 J, or 65.713 seconds at 1000 W
+if "$BIN" -m -k 1 -i 66 -z DRAM > /dev/null 2> "$DIR/err"; then
+  fail "interval: expected failure for an interval that allows multiple rollovers"
+elif ! grep -q "^Monitor interval must be < 65.71" "$DIR/err"; then
+  fail "interval: unexpected error: $(cat "$DIR/err")"
+fi
+if "$BIN" -m -k 1 -i 0.0000000001 > /dev/null 2>&1; then
+  fail "interval: expected failure for an interval that's too small"
+fi
+
+exit $RET
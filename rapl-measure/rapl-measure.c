@@ -0,0 +1,570 @@
+/**
+ * Measure the energy consumption of a command.
+ *
+ * @author Connor Imes
+ * @date 2020-10-18
+ */
+// for pthread_setaffinity_np, CPU_SET
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "raplcap.h"
+#include "raplcap-common.h"
+
+static const char* const ZONE_NAMES[RAPLCAP_NZONES] = {
+  "PACKAGE",
+  "CORE",
+  "UNCORE",
+  "DRAM",
+  "PSYS",
+};
+
+// running mean and variance (Welford's algorithm)
+typedef struct measure_stat {
+  double mean;
+  double m2;
+} measure_stat;
+
+typedef struct measure_zone {
+  uint32_t pkg;
+  uint32_t die;
+  raplcap_zone zone;
+  double joules_max;
+  double joules_last;
+  // for the current run
+  double joules;
+  double peak_watts;
+  double interval_joules;
+  // across runs
+  measure_stat stat_joules;
+  measure_stat stat_watts;
+  measure_stat stat_peak;
+} measure_zone;
+
+typedef struct rapl_measure_ctx {
+  // options
+  unsigned int pkg;
+  unsigned int die;
+  raplcap_zone zone;
+  int set_pkg;
+  int set_die;
+  int set_zone;
+  unsigned long repeat;
+  double sample_sec;
+  double interval_sec;
+  long cpu;
+  FILE* out;
+  // state
+  measure_zone* zones;
+  uint32_t n_zones;
+  measure_stat stat_elapsed;
+  uint64_t start_ns;
+  uint64_t last_ns;
+  uint64_t interval_start_ns;
+  unsigned long interval_samples;
+  unsigned long n_samples;
+  // sampler thread
+  pthread_mutex_t lock;
+  pthread_t thread;
+  pthread_cond_t cond;
+  pthread_condattr_t cond_attr;
+  int running;
+} rapl_measure_ctx;
+
+static const char* prog;
+static const char short_options[] = "+c:d:z:r:s:I:C:o:h";
+static const struct option long_options[] = {
+  {"package",  required_argument, NULL, 'c'},
+  {"die",      required_argument, NULL, 'd'},
+  {"zone",     required_argument, NULL, 'z'},
+  {"repeat",   required_argument, NULL, 'r'},
+  {"sample",   required_argument, NULL, 's'},
+  {"interval", required_argument, NULL, 'I'},
+  {"cpu",      required_argument, NULL, 'C'},
+  {"output",   required_argument, NULL, 'o'},
+  {"help",     no_argument,       NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+static void print_usage(int exit_code) {
+  fprintf(exit_code ? stderr : stdout,
+          "Usage: %s [OPTION]... COMMAND [ARG]...\n"
+          "Run a command and report the energy consumed while it runs.\n\n"
+          "Options:\n"
+          "  -c, --package=PACKAGE    Only measure the processor package\n"
+          "  -d, --die=DIE            Only measure the package die\n"
+          "  -z, --zone=ZONE          Only measure the zone/domain. Allowable values:\n"
+          "                           PACKAGE - a processor package\n"
+          "                           CORE - core power plane\n"
+          "                           UNCORE - uncore power plane (client systems only)\n"
+          "                           DRAM - main memory (server systems only)\n"
+          "                           PSYS - the entire platform (Skylake and newer only)\n"
+          "  -r, --repeat=N           Run the command N times and report the mean,\n"
+          "                           standard deviation, and 95%% confidence interval\n"
+          "  -s, --sample=SECONDS     Sampling period for peak power and counter\n"
+          "                           rollover detection (0.1 by default)\n"
+          "  -I, --interval=SECONDS   Print average power at this interval while the\n"
+          "                           command runs (rounded up to the sampling period)\n"
+          "  -C, --cpu=CPU            Pin the sampling thread to a (housekeeping) CPU\n"
+          "  -o, --output=FILE        Write measurements to FILE instead of stderr\n"
+          "  -h, --help               Print this message and exit\n\n"
+          "All supported zones of all packages and die are measured, unless package, die,\n"
+          "and/or zone flags are specified.\n",
+          prog);
+  exit(exit_code);
+}
+
+static void stat_add(measure_stat* s, unsigned long n, double val) {
+  // n is the number of values including this one
+  const double delta = val - s->mean;
+  s->mean += delta / n;
+  s->m2 += delta * (val - s->mean);
+}
+
+static double stat_stddev(const measure_stat* s, unsigned long n) {
+  return n > 1 ? sqrt(s->m2 / (n - 1)) : 0;
+}
+
+// two-sided 95% critical values of Student's t distribution, by degrees of freedom
+static double t_critical_95(unsigned long df) {
+  static const double T[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+  };
+  // between table entries, use the value for fewer degrees of freedom (a slightly wider interval)
+  if (df <= sizeof(T) / sizeof(T[0])) {
+    return T[df - 1];
+  }
+  return df < 40 ? 2.042 : (df < 60 ? 2.021 : (df < 120 ? 2.000 : (df < 1000 ? 1.980 : 1.960)));
+}
+
+// the half-width of the 95% confidence interval of the mean
+static double stat_ci95(const measure_stat* s, unsigned long n) {
+  return n > 1 ? t_critical_95(n - 1) * stat_stddev(s, n) / sqrt((double) n) : 0;
+}
+
+static int zones_init(rapl_measure_ctx* c) {
+  uint32_t n_pkg;
+  uint32_t n_die;
+  uint32_t pkg;
+  uint32_t die;
+  int zone;
+  double joules_max;
+  measure_zone* z;
+  if ((n_pkg = raplcap_get_num_packages(NULL)) == 0) {
+    perror("Failed to get number of packages");
+    return -1;
+  }
+  if (c->set_pkg && c->pkg >= n_pkg) {
+    fprintf(stderr, "Package not found\n");
+    return -1;
+  }
+  for (pkg = 0; pkg < n_pkg; pkg++) {
+    if ((n_die = raplcap_get_num_die(NULL, pkg)) == 0) {
+      perror("Failed to get number of die");
+      return -1;
+    }
+    for (die = 0; die < n_die; die++) {
+      for (zone = 0; zone < RAPLCAP_NZONES; zone++) {
+        if ((c->set_pkg && pkg != c->pkg) || (c->set_die && die != c->die) || (c->set_zone && zone != (int) c->zone) ||
+            raplcap_pd_is_zone_supported(NULL, pkg, die, (raplcap_zone) zone) != 1) {
+          continue;
+        }
+        // some zones can be capped but don't have energy counters
+        if ((joules_max = raplcap_pd_get_energy_counter_max(NULL, pkg, die, (raplcap_zone) zone)) <= 0) {
+          continue;
+        }
+        // rollovers are only detected if there's at most one per sampling period
+        if (c->sample_sec >= joules_max / RAPLCAP_MAX_WATTS) {
+          fprintf(stderr, "Sampling period must be < %f seconds to detect energy counter rollovers of "
+                  "package %"PRIu32", die %"PRIu32", zone %s\n",
+                  joules_max / RAPLCAP_MAX_WATTS, pkg, die, ZONE_NAMES[zone]);
+          return -1;
+        }
+        if ((z = realloc(c->zones, (c->n_zones + 1) * sizeof(measure_zone))) == NULL) {
+          perror("Failed to allocate zones");
+          return -1;
+        }
+        c->zones = z;
+        z = &c->zones[c->n_zones++];
+        memset(z, 0, sizeof(*z));
+        z->pkg = pkg;
+        z->die = die;
+        z->zone = (raplcap_zone) zone;
+        z->joules_max = joules_max;
+      }
+    }
+  }
+  if (c->n_zones == 0) {
+    fprintf(stderr, "No zones with energy counters found\n");
+    return -1;
+  }
+  return 0;
+}
+
+static void print_interval(rapl_measure_ctx* c, uint64_t ns) {
+  const double t = (ns - c->start_ns) / 1000000000.0;
+  const double dt = (ns - c->interval_start_ns) / 1000000000.0;
+  uint32_t i;
+  for (i = 0; i < c->n_zones; i++) {
+    fprintf(c->out, "%14.6f %7"PRIu32" %4"PRIu32" %-8s %14.6f W\n", t, c->zones[i].pkg, c->zones[i].die,
+            ZONE_NAMES[c->zones[i].zone], c->zones[i].interval_joules / dt);
+    c->zones[i].interval_joules = 0;
+  }
+  fflush(c->out);
+  c->interval_start_ns = ns;
+}
+
+// Must hold the lock
+static int sample(rapl_measure_ctx* c, int periodic) {
+  const uint64_t ns = raplcap_clock_ns(CLOCK_MONOTONIC);
+  const double dt = (ns - c->last_ns) / 1000000000.0;
+  double joules;
+  double delta;
+  uint32_t i;
+  int ret = 0;
+  for (i = 0; i < c->n_zones; i++) {
+    if ((joules = raplcap_pd_get_energy_counter(NULL, c->zones[i].pkg, c->zones[i].die, c->zones[i].zone)) < 0) {
+      ret = -1;
+      continue;
+    }
+    // at most one rollover per sampling period
+    if ((delta = joules - c->zones[i].joules_last) < 0) {
+      delta += c->zones[i].joules_max;
+    }
+    c->zones[i].joules_last = joules;
+    c->zones[i].joules += delta;
+    c->zones[i].interval_joules += delta;
+    // only full sampling periods count toward peak power, the last one may be very short
+    if (periodic && dt > 0 && delta / dt > c->zones[i].peak_watts) {
+      c->zones[i].peak_watts = delta / dt;
+    }
+  }
+  c->last_ns = ns;
+  if (periodic && c->interval_samples > 0 && ++c->n_samples % c->interval_samples == 0) {
+    print_interval(c, ns);
+  }
+  return ret;
+}
+
+static void* sampler_thread(void* arg) {
+  rapl_measure_ctx* c = (rapl_measure_ctx*) arg;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // schedule on absolute deadlines so that the sampling rate doesn't drift
+  raplcap_timespec_add_sec(&ts, c->sample_sec);
+  pthread_mutex_lock(&c->lock);
+  while (c->running) {
+    if (pthread_cond_timedwait(&c->cond, &c->lock, &ts) == ETIMEDOUT && c->running) {
+      if (sample(c, 1)) {
+        perror("Failed to read energy counter");
+      }
+      raplcap_timespec_add_sec(&ts, c->sample_sec);
+    }
+  }
+  pthread_mutex_unlock(&c->lock);
+  return NULL;
+}
+
+static int sampler_start(rapl_measure_ctx* c) {
+  cpu_set_t cpuset;
+  uint32_t i;
+  int err;
+  c->start_ns = raplcap_clock_ns(CLOCK_MONOTONIC);
+  c->last_ns = c->start_ns;
+  c->interval_start_ns = c->start_ns;
+  c->n_samples = 0;
+  for (i = 0; i < c->n_zones; i++) {
+    if ((c->zones[i].joules_last = raplcap_pd_get_energy_counter(NULL, c->zones[i].pkg, c->zones[i].die,
+                                                                 c->zones[i].zone)) < 0) {
+      perror("Failed to read energy counter");
+      return -1;
+    }
+    c->zones[i].joules = 0;
+    c->zones[i].peak_watts = 0;
+    c->zones[i].interval_joules = 0;
+  }
+  c->running = 1;
+  if ((err = pthread_create(&c->thread, NULL, sampler_thread, c)) != 0) {
+    c->running = 0;
+    errno = err;
+    perror("Failed to start sampling thread");
+    return -1;
+  }
+  if (c->cpu >= 0) {
+    CPU_ZERO(&cpuset);
+    CPU_SET((size_t) c->cpu, &cpuset);
+    if ((err = pthread_setaffinity_np(c->thread, sizeof(cpuset), &cpuset)) != 0) {
+      errno = err;
+      perror("Failed to pin sampling thread");
+      fprintf(stderr, "Trying to proceed anyway...\n");
+    }
+  }
+  return 0;
+}
+
+static int sampler_stop(rapl_measure_ctx* c) {
+  int ret;
+  int err;
+  pthread_mutex_lock(&c->lock);
+  c->running = 0;
+  pthread_cond_signal(&c->cond);
+  ret = sample(c, 0);
+  pthread_mutex_unlock(&c->lock);
+  if ((err = pthread_join(c->thread, NULL)) != 0) {
+    errno = err;
+    perror("Failed to join sampling thread");
+    ret = -1;
+  }
+  if (ret) {
+    perror("Failed to read energy counter");
+  }
+  return ret;
+}
+
+// returns the command's exit status, or -1 on error
+static int run_command(char** argv) {
+  struct sigaction sa_ign;
+  struct sigaction sa_int;
+  struct sigaction sa_quit;
+  pid_t pid;
+  int status;
+  // like time(1), let the command handle interrupts while we wait for it
+  memset(&sa_ign, 0, sizeof(sa_ign));
+  sa_ign.sa_handler = SIG_IGN;
+  sigemptyset(&sa_ign.sa_mask);
+  sigaction(SIGINT, &sa_ign, &sa_int);
+  sigaction(SIGQUIT, &sa_ign, &sa_quit);
+  if ((pid = fork()) < 0) {
+    perror("Failed to fork");
+    status = -1;
+  } else if (pid == 0) {
+    sigaction(SIGINT, &sa_int, NULL);
+    sigaction(SIGQUIT, &sa_quit, NULL);
+    execvp(argv[0], argv);
+    status = errno;
+    perror(argv[0]);
+    _exit(status == ENOENT ? 127 : 126);
+  } else {
+    while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+        perror("Failed to wait for command");
+        status = -1;
+        break;
+      }
+    }
+    if (status >= 0) {
+      status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+  }
+  sigaction(SIGINT, &sa_int, NULL);
+  sigaction(SIGQUIT, &sa_quit, NULL);
+  return status;
+}
+
+static void print_row(FILE* out, const char* label, double joules, double watts, double peak) {
+  fprintf(out, "%21s %14.6f %14.6f %14.6f  %s\n", "", joules, watts, peak, label);
+}
+
+static void print_report(const rapl_measure_ctx* c, int argc, char** argv, unsigned long n) {
+  const measure_zone* z;
+  uint32_t i;
+  int j;
+  fprintf(c->out, "\nEnergy stats for '");
+  for (j = 0; j < argc; j++) {
+    fprintf(c->out, "%s%s", j ? " " : "", argv[j]);
+  }
+  fprintf(c->out, n > 1 ? "' (%lu runs):\n\n" : "':\n\n", n);
+  fprintf(c->out, "%7s %4s %-8s %14s %14s %14s\n", "package", "die", "zone", "joules", "avg_watts", "peak_watts");
+  for (i = 0; i < c->n_zones; i++) {
+    z = &c->zones[i];
+    fprintf(c->out, "%7"PRIu32" %4"PRIu32" %-8s %14.6f %14.6f %14.6f%s\n", z->pkg, z->die, ZONE_NAMES[z->zone],
+            z->stat_joules.mean, z->stat_watts.mean, z->stat_peak.mean, n > 1 ? "  mean" : "");
+    if (n > 1) {
+      print_row(c->out, "stddev", stat_stddev(&z->stat_joules, n), stat_stddev(&z->stat_watts, n),
+                stat_stddev(&z->stat_peak, n));
+      print_row(c->out, "+- 95% CI", stat_ci95(&z->stat_joules, n), stat_ci95(&z->stat_watts, n),
+                stat_ci95(&z->stat_peak, n));
+    }
+  }
+  fprintf(c->out, "\n%14.6f seconds elapsed", c->stat_elapsed.mean);
+  if (n > 1) {
+    fprintf(c->out, " (stddev %.6f, +- %.6f 95%% CI)", stat_stddev(&c->stat_elapsed, n),
+            stat_ci95(&c->stat_elapsed, n));
+  }
+  fprintf(c->out, "\n\n");
+  fflush(c->out);
+}
+
+static int measure(rapl_measure_ctx* c, int argc, char** argv) {
+  measure_zone* z;
+  double elapsed;
+  unsigned long n;
+  uint32_t i;
+  int status = 0;
+  int err;
+  // the condition variable must use the same clock as the sampling deadlines
+  if ((err = pthread_condattr_init(&c->cond_attr)) == 0) {
+    if ((err = pthread_condattr_setclock(&c->cond_attr, CLOCK_MONOTONIC)) == 0) {
+      err = pthread_cond_init(&c->cond, &c->cond_attr);
+    }
+    pthread_condattr_destroy(&c->cond_attr);
+  }
+  if (err || (err = pthread_mutex_init(&c->lock, NULL)) != 0) {
+    errno = err;
+    perror("Failed to initialize sampling");
+    return -1;
+  }
+  for (n = 0; n < c->repeat; n++) {
+    if (sampler_start(c)) {
+      status = -1;
+      break;
+    }
+    status = run_command(argv);
+    if (sampler_stop(c) || status < 0) {
+      status = -1;
+      break;
+    }
+    if (status == 127) {
+      // the command couldn't be executed
+      break;
+    }
+    elapsed = (c->last_ns - c->start_ns) / 1000000000.0;
+    stat_add(&c->stat_elapsed, n + 1, elapsed);
+    for (i = 0; i < c->n_zones; i++) {
+      z = &c->zones[i];
+      stat_add(&z->stat_joules, n + 1, z->joules);
+      stat_add(&z->stat_watts, n + 1, elapsed > 0 ? z->joules / elapsed : 0);
+      // very short runs may not have any full sampling periods
+      stat_add(&z->stat_peak, n + 1, z->peak_watts > 0 ? z->peak_watts : (elapsed > 0 ? z->joules / elapsed : 0));
+    }
+  }
+  if (n > 0) {
+    print_report(c, argc, argv, n);
+  }
+  pthread_cond_destroy(&c->cond);
+  pthread_mutex_destroy(&c->lock);
+  return status;
+}
+
+static double parse_positive(const char* optarg, const char* name) {
+  double val = atof(optarg);
+  if (val <= 0) {
+    fprintf(stderr, "%s must be > 0\n", name);
+    print_usage(1);
+  }
+  return val;
+}
+
+int main(int argc, char** argv) {
+  rapl_measure_ctx ctx = { 0 };
+  double interval_samples;
+  int ret;
+  int c;
+  int i;
+  prog = argv[0];
+  ctx.repeat = 1;
+  ctx.sample_sec = 0.1;
+  ctx.cpu = -1;
+  ctx.out = stderr;
+
+  // parse parameters, stopping at the command
+  while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+    switch (c) {
+      case 'h':
+        print_usage(0);
+        break;
+      case 'c':
+        ctx.pkg = atoi(optarg);
+        ctx.set_pkg = 1;
+        break;
+      case 'd':
+        ctx.die = atoi(optarg);
+        ctx.set_die = 1;
+        break;
+      case 'z':
+        for (i = 0; i < RAPLCAP_NZONES && strcmp(optarg, ZONE_NAMES[i]); i++);
+        if (i == RAPLCAP_NZONES) {
+          print_usage(1);
+        }
+        ctx.zone = (raplcap_zone) i;
+        ctx.set_zone = 1;
+        break;
+      case 'r':
+        if ((ctx.repeat = strtoul(optarg, NULL, 0)) == 0) {
+          fprintf(stderr, "Repeat count must be > 0\n");
+          print_usage(1);
+        }
+        break;
+      case 's':
+        ctx.sample_sec = parse_positive(optarg, "Sampling period");
+        break;
+      case 'I':
+        ctx.interval_sec = parse_positive(optarg, "Interval");
+        break;
+      case 'C':
+        if ((ctx.cpu = atol(optarg)) < 0 || ctx.cpu >= CPU_SETSIZE) {
+          fprintf(stderr, "Invalid CPU\n");
+          print_usage(1);
+        }
+        break;
+      case 'o':
+        // the command doesn't inherit the file
+        if ((ctx.out = fopen(optarg, "we")) == NULL) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case '?':
+      default:
+        print_usage(1);
+        break;
+    }
+  }
+  if (ctx.interval_sec > 0) {
+    // intervals are counted in samples, so they don't depend on sampling jitter
+    interval_samples = ceil(ctx.interval_sec / ctx.sample_sec - 1e-9);
+    ctx.interval_samples = (unsigned long) interval_samples;
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "No command specified\n");
+    print_usage(1);
+  }
+
+  // only reads are needed (not supported by all implementations, therefore not guaranteed)
+  setenv(ENV_RAPLCAP_READ_ONLY, "1", 0);
+  if (raplcap_init(NULL)) {
+    perror("Failed to initialize");
+    return 1;
+  }
+  if (zones_init(&ctx)) {
+    ret = 1;
+  } else {
+    // report the command's exit status, like time(1)
+    ret = measure(&ctx, argc - optind, &argv[optind]);
+    ret = ret < 0 ? 1 : ret;
+  }
+
+  // cleanup
+  free(ctx.zones);
+  if (raplcap_destroy(NULL)) {
+    perror("Failed to clean up");
+  }
+  if (ctx.out != stderr) {
+    fclose(ctx.out);
+  }
+  return ret;
+}
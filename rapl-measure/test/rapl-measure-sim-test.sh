@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# Measure commands that step the simulated PACKAGE energy counter of package 0, die 0 by known amounts.
+# Must run with a simulated root - see raplcap-msr-sim-run.sh.
+#
+# Usage: rapl-measure-sim-test.sh <rapl-measure>
+#
+
+if [ $# -ne 1 ] || [ -z "$RAPLCAP_MSR_SIM_ROOT" ]; then
+  echo "Usage: RAPLCAP_MSR_SIM_ROOT=<root> $0 <rapl-measure>" >&2
+  exit 1
+fi
+
+BIN=$1
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+RET=0
+
+fail() {
+  echo "$0: $*" >&2
+  RET=1
+}
+
+# Usage: check <name> <actual> <expected>
+check() {
+  if ! awk -v a="$2" -v b="$3" 'BEGIN { d = a - b; exit !(a != "" && d < 1e-6 && d > -1e-6) }'; then
+    fail "$1: expected $3, got '$2'"
+  fi
+}
+
+# The simulated counter uses the low 32 bits of MSR_PKG_ENERGY_STATUS with 2^-14 J units, so it rolls over at 2^18 J
+cat > "$DIR/step.sh" <<'EOS'
+#!/bin/sh
+# Usage: step.sh <joules> - adds to the counter, or sets it if the argument starts with '='
+MSR="$RAPLCAP_MSR_SIM_ROOT/dev/cpu/0/msr"
+OFF=$((0x611))
+case $1 in
+  =*) v=$(awk -v j="${1#=}" 'BEGIN { printf "%.0f", j * 16384 }') ;;
+  *)
+    # shellcheck disable=SC2046
+    set -- "$1" $(od -An -tu1 -j $OFF -N4 "$MSR")
+    v=$(($2 + ($3 << 8) + ($4 << 16) + ($5 << 24) + $(awk -v j="$1" 'BEGIN { printf "%.0f", j * 16384 }')))
+    ;;
+esac
+v=$((v & 0xFFFFFFFF))
+b=
+for i in 0 1 2 3; do
+  b="$b\\$(printf %03o $(((v >> (i * 8)) & 255)))"
+done
+# write all bytes at once so the sampler never reads a partially written counter
+# shellcheck disable=SC2059
+printf "$b" | dd of="$MSR" bs=4 count=1 seek=$OFF iflag=fullblock oflag=seek_bytes conv=notrunc 2>/dev/null
+EOS
+chmod +x "$DIR/step.sh"
+
+# Usage: measure <options>... -- <command>... - measures PACKAGE of package 0, die 0, writing the report to $DIR/out
+measure() {
+  "$BIN" -c 0 -d 0 -z PACKAGE -o "$DIR/out" "$@"
+}
+
+# Usage: get <awk condition> <field>
+get() {
+  awk "$1 { print \$$2; exit }" "$DIR/out"
+}
+
+echo "Testing counter rollover"
+"$DIR/step.sh" =262143
+measure -s 0.01 -- sh -c "sleep 0.05; '$DIR/step.sh' 3; sleep 0.05"
+check "exit status" $? 0
+check "joules" "$(get '$3 == "PACKAGE"' 4)" 3
+# the last sample, taken when the command exits, also detects rollovers
+"$DIR/step.sh" =262143.5
+measure -- "$DIR/step.sh" 1
+check "joules" "$(get '$3 == "PACKAGE"' 4)" 1
+
+echo "Testing repeated runs"
+echo 0 > "$DIR/n"
+# each run consumes 1 J more than the last
+measure -r 3 -- sh -c "n=\$((\$(cat '$DIR/n') + 1)); echo \$n > '$DIR/n'; '$DIR/step.sh' \$n"
+check "exit status" $? 0
+check "mean joules" "$(get '$NF == "mean"' 4)" 2
+check "stddev joules" "$(get '$NF == "stddev"' 1)" 1
+check "95% CI joules" "$(get '$NF == "CI" && $(NF - 1) == "95%"' 1)" "$(awk 'BEGIN { printf "%.6f", 4.303 / sqrt(3) }')"
+
+echo "Testing exit status"
+measure -- sh -c "exit 3"
+check "exit status" $? 3
+measure -r 2 -- sh -c "kill -TERM \$\$"
+check "exit status" $? $((128 + 15))
+measure -- "$DIR/does-not-exist" 2> /dev/null
+check "exit status" $? 127
+
+echo "Testing sampling period limits"
+# at 1000 W, the counter could roll over more than once in 262.144 seconds
+if measure -s 262.144 -- true 2> "$DIR/err"; then
+  fail "expected sampling period to be rejected"
+elif ! grep -q "Sampling period must be < 262.144" "$DIR/err"; then
+  fail "expected sampling period error, got '$(cat "$DIR/err")'"
+fi
+measure -s 262.143 -- true
+check "exit status" $? 0
+
+if [ $RET -eq 0 ]; then
+  echo "Tests successful"
+fi
+exit $RET
@@ -0,0 +1,292 @@
+/**
+ * Benchmark raplcap function latencies.
+ * Requires a functioning RAPL implementation with appropriate privileges to run, or a simulated one.
+ *
+ * Results are printed in CSV format, one row per function and zone, with latencies in nanoseconds.
+ *
+ * @author Connor Imes
+ * @date 2020-10-13
+ */
+// for clock_gettime, getopt
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "raplcap.h"
+#include "raplcap-common.h"
+
+#define NZONES (RAPLCAP_ZONE_PSYS + 1)
+
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_INIT_ITERATIONS 20
+
+static const char* ZONE_NAMES[NZONES] = {
+  "PACKAGE",
+  "CORE",
+  "UNCORE",
+  "DRAM",
+  "PSYS"
+};
+
+typedef struct bench_ctx {
+  raplcap rc;
+  uint32_t pkg;
+  uint32_t die;
+  raplcap_zone zone;
+  raplcap_limit ll;
+  raplcap_limit ls;
+  int enabled;
+  raplcap_snapshot* snap;
+} bench_ctx;
+
+typedef int (bench_fn)(bench_ctx* bc);
+
+typedef struct bench {
+  const char* name;
+  bench_fn* fn;
+  // whether the benchmark writes to the hardware
+  int is_write;
+} bench;
+
+static int cmp_u64(const void* a, const void* b) {
+  return *((const uint64_t*) a) > *((const uint64_t*) b) ? 1 :
+         ((*((const uint64_t*) a) < *((const uint64_t*) b)) ? -1 : 0);
+}
+
+static void print_header(void) {
+  printf("benchmark,pkg,die,zone,iterations,min_ns,p50_ns,p99_ns,max_ns,mean_ns,ops_per_sec\n");
+}
+
+// Sorts samples
+static void print_result(const char* name, const bench_ctx* bc, const char* zone, uint64_t* samples, uint32_t n) {
+  uint64_t total = 0;
+  uint32_t i;
+  double mean;
+  qsort(samples, n, sizeof(*samples), cmp_u64);
+  for (i = 0; i < n; i++) {
+    total += samples[i];
+  }
+  mean = total / (double) n;
+  printf("%s,%"PRIu32",%"PRIu32",%s,%"PRIu32",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%.1f,%.1f\n",
+         name, bc->pkg, bc->die, zone, n, samples[0], samples[(n - 1) / 2], samples[((n - 1) * 99) / 100],
+         samples[n - 1], mean, mean > 0 ? 1000000000.0 / mean : 0.0);
+}
+
+static int bench_is_zone_supported(bench_ctx* bc) {
+  return raplcap_pd_is_zone_supported(&bc->rc, bc->pkg, bc->die, bc->zone);
+}
+
+static int bench_is_zone_enabled(bench_ctx* bc) {
+  return raplcap_pd_is_zone_enabled(&bc->rc, bc->pkg, bc->die, bc->zone);
+}
+
+static int bench_get_limits(bench_ctx* bc) {
+  raplcap_limit ll;
+  raplcap_limit ls;
+  return raplcap_pd_get_limits(&bc->rc, bc->pkg, bc->die, bc->zone, &ll, &ls);
+}
+
+static int bench_get_zone_status(bench_ctx* bc) {
+  raplcap_zone_status status;
+  return raplcap_pd_get_zone_status(&bc->rc, bc->pkg, bc->die, bc->zone, &status);
+}
+
+static int bench_get_energy_counter(bench_ctx* bc) {
+  return raplcap_pd_get_energy_counter(&bc->rc, bc->pkg, bc->die, bc->zone) < 0 ? -1 : 0;
+}
+
+static int bench_get_energy_counter_max(bench_ctx* bc) {
+  return raplcap_pd_get_energy_counter_max(&bc->rc, bc->pkg, bc->die, bc->zone) < 0 ? -1 : 0;
+}
+
+// writes back the original values
+static int bench_set_zone_enabled(bench_ctx* bc) {
+  return raplcap_pd_set_zone_enabled(&bc->rc, bc->pkg, bc->die, bc->zone, bc->enabled);
+}
+
+// writes back the original values
+static int bench_set_limits(bench_ctx* bc) {
+  return raplcap_pd_set_limits(&bc->rc, bc->pkg, bc->die, bc->zone, &bc->ll, &bc->ls);
+}
+
+static const bench BENCHES[] = {
+  { "raplcap_pd_is_zone_supported", bench_is_zone_supported, 0 },
+  { "raplcap_pd_is_zone_enabled", bench_is_zone_enabled, 0 },
+  { "raplcap_pd_get_limits", bench_get_limits, 0 },
+  { "raplcap_pd_get_zone_status", bench_get_zone_status, 0 },
+  { "raplcap_pd_get_energy_counter", bench_get_energy_counter, 0 },
+  { "raplcap_pd_get_energy_counter_max", bench_get_energy_counter_max, 0 },
+  { "raplcap_pd_set_zone_enabled", bench_set_zone_enabled, 1 },
+  { "raplcap_pd_set_limits", bench_set_limits, 1 },
+};
+
+static int run(const bench* b, bench_ctx* bc, const char* zone, uint64_t* samples, uint32_t n) {
+  uint64_t start;
+  uint32_t i;
+  // warm up, and skip functions that fail (e.g., unsupported features)
+  if (b->fn(bc) < 0) {
+    fprintf(stderr, "%s: %s: %s\n", b->name, zone, strerror(errno));
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    start = raplcap_clock_ns(CLOCK_MONOTONIC);
+    b->fn(bc);
+    samples[i] = raplcap_clock_ns(CLOCK_MONOTONIC) - start;
+  }
+  print_result(b->name, bc, zone, samples, n);
+  return 0;
+}
+
+static int bench_snapshot_read(bench_ctx* bc) {
+  return raplcap_snapshot_read(&bc->rc, bc->snap);
+}
+
+static const bench BENCH_SNAPSHOT = { "raplcap_snapshot_read", bench_snapshot_read, 0 };
+
+static int run_init_destroy(bench_ctx* bc, uint64_t* samples_init, uint64_t* samples_destroy, uint32_t n) {
+  uint64_t start;
+  uint32_t i;
+  for (i = 0; i < n; i++) {
+    start = raplcap_clock_ns(CLOCK_MONOTONIC);
+    if (raplcap_init(&bc->rc)) {
+      perror("raplcap_init");
+      return -1;
+    }
+    samples_init[i] = raplcap_clock_ns(CLOCK_MONOTONIC) - start;
+    start = raplcap_clock_ns(CLOCK_MONOTONIC);
+    if (raplcap_destroy(&bc->rc)) {
+      perror("raplcap_destroy");
+      return -1;
+    }
+    samples_destroy[i] = raplcap_clock_ns(CLOCK_MONOTONIC) - start;
+  }
+  print_result("raplcap_init", bc, "ALL", samples_init, n);
+  print_result("raplcap_destroy", bc, "ALL", samples_destroy, n);
+  return 0;
+}
+
+static void print_usage(const char* prog, int exit_code) {
+  fprintf(exit_code ? stderr : stdout,
+          "Usage: %s [OPTION]...\n"
+          "Options:\n"
+          "  -p, PACKAGE     The package to benchmark (default: 0)\n"
+          "  -d, DIE         The die to benchmark (default: 0)\n"
+          "  -i, ITERATIONS  The number of iterations per function (default: %d)\n"
+          "  -I, ITERATIONS  The number of init/destroy iterations (default: %d)\n"
+          "  -w              Include functions that write (the current values are written back)\n"
+          "  -h              Print this message and exit\n",
+          prog, DEFAULT_ITERATIONS, DEFAULT_INIT_ITERATIONS);
+  exit(exit_code);
+}
+
+int main(int argc, char** argv) {
+  bench_ctx bc;
+  uint64_t* samples;
+  uint64_t* samples2;
+  uint32_t iterations = DEFAULT_ITERATIONS;
+  uint32_t init_iterations = DEFAULT_INIT_ITERATIONS;
+  uint32_t i;
+  int zone;
+  int write = 0;
+  int ret = 0;
+  int c;
+  memset(&bc, 0, sizeof(bc));
+  while ((c = getopt(argc, argv, "p:d:i:I:wh")) != -1) {
+    switch (c) {
+      case 'p':
+        bc.pkg = (uint32_t) strtoul(optarg, NULL, 0);
+        break;
+      case 'd':
+        bc.die = (uint32_t) strtoul(optarg, NULL, 0);
+        break;
+      case 'i':
+        iterations = (uint32_t) strtoul(optarg, NULL, 0);
+        break;
+      case 'I':
+        init_iterations = (uint32_t) strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        write = 1;
+        break;
+      case 'h':
+        print_usage(argv[0], 0);
+        break;
+      case '?':
+      default:
+        print_usage(argv[0], 1);
+        break;
+    }
+  }
+  if (iterations == 0 || init_iterations == 0) {
+    fprintf(stderr, "Iterations must be > 0\n");
+    return 1;
+  }
+  if ((samples = malloc((iterations > init_iterations ? iterations : init_iterations) * sizeof(*samples))) == NULL ||
+      (samples2 = malloc(init_iterations * sizeof(*samples2))) == NULL) {
+    perror("malloc");
+    free(samples);
+    return 1;
+  }
+  print_header();
+  if (run_init_destroy(&bc, samples, samples2, init_iterations)) {
+    free(samples2);
+    free(samples);
+    return 1;
+  }
+  if (raplcap_init(&bc.rc)) {
+    perror("raplcap_init");
+    free(samples2);
+    free(samples);
+    return 1;
+  }
+  if (bc.pkg >= raplcap_get_num_packages(&bc.rc) || bc.die >= raplcap_get_num_die(&bc.rc, bc.pkg)) {
+    fprintf(stderr, "Package or die not found: pkg=%"PRIu32", die=%"PRIu32"\n", bc.pkg, bc.die);
+    raplcap_destroy(&bc.rc);
+    free(samples2);
+    free(samples);
+    return 1;
+  }
+  for (zone = 0; zone < NZONES; zone++) {
+    bc.zone = (raplcap_zone) zone;
+    if (raplcap_pd_is_zone_supported(&bc.rc, bc.pkg, bc.die, bc.zone) <= 0) {
+      continue;
+    }
+    // original values for write benchmarks
+    if ((bc.enabled = raplcap_pd_is_zone_enabled(&bc.rc, bc.pkg, bc.die, bc.zone)) < 0 ||
+        raplcap_pd_get_limits(&bc.rc, bc.pkg, bc.die, bc.zone, &bc.ll, &bc.ls)) {
+      perror("Failed to get original zone values");
+      ret = 1;
+      continue;
+    }
+    if (bc.zone == RAPLCAP_ZONE_PSYS) {
+      // the PSYS short term time window is chosen by the processor, and some implementations warn if it's set
+      bc.ls.seconds = 0;
+    }
+    for (i = 0; i < sizeof(BENCHES) / sizeof(BENCHES[0]); i++) {
+      if (!BENCHES[i].is_write || write) {
+        // failures are reported, but aren't fatal
+        run(&BENCHES[i], &bc, ZONE_NAMES[zone], samples, iterations);
+      }
+    }
+  }
+  if ((bc.snap = raplcap_snapshot_alloc(&bc.rc)) == NULL) {
+    perror("raplcap_snapshot_alloc");
+    ret = 1;
+  } else {
+    if (run(&BENCH_SNAPSHOT, &bc, "ALL", samples, iterations)) {
+      ret = 1;
+    }
+    raplcap_snapshot_free(bc.snap);
+  }
+  if (raplcap_destroy(&bc.rc)) {
+    perror("raplcap_destroy");
+    ret = 1;
+  }
+  free(samples2);
+  free(samples);
+  return ret;
+}
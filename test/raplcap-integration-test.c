@@ -1,18 +1,31 @@
 /**
  * Requires a functioning RAPL implementation with appropriate privileges to run.
  */
+// for nanosleep, pthread_barrier_t
+#define _POSIX_C_SOURCE 200809L
 /* force assertions */
 #undef NDEBUG
 #include <assert.h>
+#include <errno.h>
 #include <float.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "raplcap.h"
+#include "raplcap-aligned.h"
+#include "raplcap-power-meter.h"
+#include "raplcap-region.h"
+#include "raplcap-shm.h"
 
 #define NZONES (RAPLCAP_ZONE_PSYS + 1)
 
+#define REGION_THREADS 3
+#define REGION_THREAD_ITERS 100
+
 static const char* ZONE_NAMES[NZONES] = {
   "PACKAGE",
   "CORE",
@@ -59,8 +72,205 @@ static void test_set(const raplcap_limit* ll, const raplcap_limit* ls, raplcap*
   equal_dbl(ls->seconds, ls_verify.seconds);
 }
 
+static void test_aligned(const raplcap_zone_handle* zh) {
+  raplcap_aligned_sample s1, s2;
+  // counters might not change, e.g., if the zone is idle or simulated
+  errno = 0;
+  if (raplcap_aligned_read(zh, 0.01, &s1)) {
+    assert(errno == ETIMEDOUT);
+    printf("    Energy counter didn't change, skipping\n");
+    return;
+  }
+  assert(s1.joules >= 0);
+  if (raplcap_aligned_read(zh, 0.01, &s2) == 0) {
+    assert(s2.ns > s1.ns);
+  }
+}
+
+static void test_power_meter(raplcap* rc, uint32_t p, uint32_t i) {
+  const struct timespec ts = { .tv_sec = 0, .tv_nsec = 2000000 };
+  raplcap_power_meter* pm;
+  double instant[5];
+  double instant_min = 0;
+  double instant_max = 0;
+  double watts;
+  uint32_t n;
+  errno = 0;
+  pm = raplcap_power_meter_init(rc, p, 0, (raplcap_zone) i, 3, 1.0);
+  assert(pm != NULL);
+  assert(raplcap_power_meter_get_instant(pm) < 0);
+  assert(errno == ENODATA);
+  for (n = 0; n < sizeof(instant) / sizeof(instant[0]); n++) {
+    nanosleep(&ts, NULL);
+    assert(raplcap_power_meter_sample(pm) == 0);
+    instant[n] = raplcap_power_meter_get_instant(pm);
+    assert(instant[n] >= 0);
+    instant_min = n == 0 || instant[n] < instant_min ? instant[n] : instant_min;
+    instant_max = n == 0 || instant[n] > instant_max ? instant[n] : instant_max;
+    // the 3-sample window averages the last two intervals, and the EWMA averages all of them
+    if (n > 0) {
+      watts = raplcap_power_meter_get_window(pm);
+      assert(watts >= (instant[n - 1] < instant[n] ? instant[n - 1] : instant[n]) * (1 - 1e-9));
+      assert(watts <= (instant[n - 1] > instant[n] ? instant[n - 1] : instant[n]) * (1 + 1e-9));
+    }
+    watts = raplcap_power_meter_get_ewma(pm);
+    assert(watts >= instant_min * (1 - 1e-9));
+    assert(watts <= instant_max * (1 + 1e-9));
+  }
+  assert(raplcap_power_meter_destroy(pm) == 0);
+}
+
+static void* region_thread(void* arg) {
+  uint32_t i;
+  pthread_barrier_wait((pthread_barrier_t*) arg);
+  for (i = 0; i < REGION_THREAD_ITERS; i++) {
+    assert(raplcap_region_begin("outer") == 0);
+    assert(raplcap_region_begin("inner") == 0);
+    assert(raplcap_region_end() == 0);
+    assert(raplcap_region_end() == 0);
+  }
+  return NULL;
+}
+
+// Holds a region open until released, so the thread keeps its stack
+static void* region_hold_thread(void* arg) {
+  pthread_barrier_t* barrier = (pthread_barrier_t*) arg;
+  assert(raplcap_region_begin("outer") == 0);
+  pthread_barrier_wait(barrier);
+  pthread_barrier_wait(barrier);
+  assert(raplcap_region_end() == 0);
+  return NULL;
+}
+
+static void* region_no_stack_thread(void* arg) {
+  (void) arg;
+  errno = 0;
+  assert(raplcap_region_begin("outer") < 0);
+  assert(errno == ENOSPC);
+  // nothing was begun
+  errno = 0;
+  assert(raplcap_region_end() < 0);
+  assert(errno == EINVAL);
+  return NULL;
+}
+
+// The main thread already has a stack, so the other threads can use the rest
+static void test_region_threads(void) {
+  pthread_t threads[REGION_THREADS];
+  pthread_t extra;
+  pthread_barrier_t barrier;
+  raplcap_region_stats stats_outer;
+  raplcap_region_stats stats_inner;
+  raplcap_region_stats stats;
+  uint32_t i;
+  assert(raplcap_region_get_stats("outer", &stats_outer) == 0);
+  assert(raplcap_region_get_stats("inner", &stats_inner) == 0);
+  // threads nest regions concurrently on their own stacks, and statistics aggregate across them
+  assert(pthread_barrier_init(&barrier, NULL, REGION_THREADS) == 0);
+  for (i = 0; i < REGION_THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, region_thread, &barrier) == 0);
+  }
+  for (i = 0; i < REGION_THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  assert(pthread_barrier_destroy(&barrier) == 0);
+  assert(raplcap_region_get_stats("outer", &stats) == 0);
+  assert(stats.calls == stats_outer.calls + REGION_THREADS * REGION_THREAD_ITERS);
+  assert(stats.seconds > stats_outer.seconds);
+  assert(stats.joules_package >= stats_outer.joules_package);
+  assert(raplcap_region_get_stats("inner", &stats) == 0);
+  assert(stats.calls == stats_inner.calls + REGION_THREADS * REGION_THREAD_ITERS);
+  // exited threads returned their stacks, but live ones keep them, so another thread can't get one
+  assert(pthread_barrier_init(&barrier, NULL, REGION_THREADS + 1) == 0);
+  for (i = 0; i < REGION_THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, region_hold_thread, &barrier) == 0);
+  }
+  pthread_barrier_wait(&barrier);
+  assert(pthread_create(&extra, NULL, region_no_stack_thread, NULL) == 0);
+  assert(pthread_join(extra, NULL) == 0);
+  pthread_barrier_wait(&barrier);
+  for (i = 0; i < REGION_THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  assert(pthread_barrier_destroy(&barrier) == 0);
+  assert(raplcap_region_get_stats("outer", &stats) == 0);
+  assert(stats.calls == stats_outer.calls + REGION_THREADS * (REGION_THREAD_ITERS + 1));
+}
+
+static void test_region(raplcap* rc) {
+  raplcap_region_stats stats;
+  printf("  Testing raplcap_region_*(...)\n");
+  assert(raplcap_region_init(rc, 2, 1 + REGION_THREADS, 0) == 0);
+  assert(raplcap_region_begin("outer") == 0);
+  assert(raplcap_region_begin("inner") == 0);
+  assert(raplcap_region_end() == 0);
+  assert(raplcap_region_begin("inner") == 0);
+  assert(raplcap_region_end() == 0);
+  assert(raplcap_region_end() == 0);
+  assert(raplcap_region_end() < 0);
+  assert(raplcap_region_get_stats("inner", &stats) == 0);
+  assert(stats.calls == 2);
+  assert(stats.joules_package >= 0);
+  assert(raplcap_region_get_stats("outer", &stats) == 0);
+  assert(stats.calls == 1);
+  assert(stats.seconds > 0);
+  errno = 0;
+  assert(raplcap_region_get_stats("none", &stats) < 0);
+  assert(errno == ENOENT);
+  test_region_threads();
+  // exceeds max_regions
+  assert(raplcap_region_begin("third") == 0);
+  errno = 0;
+  assert(raplcap_region_end() < 0);
+  assert(errno == ENOSPC);
+  assert(raplcap_region_report(stdout) == 0);
+  assert(raplcap_region_destroy() == 0);
+}
+
+static void test_shm(raplcap* rc, uint32_t n_pkg) {
+  raplcap_shm_publisher* pub;
+  raplcap_shm_reader* rd;
+  raplcap_shm_zone* zones;
+  raplcap_shm_zone z;
+  char name[32];
+  uint32_t n_die;
+  uint32_t n_zones;
+  uint64_t seq;
+  uint64_t ns;
+  printf("  Testing raplcap_shm_*(...)\n");
+  snprintf(name, sizeof(name), "/raplcap-test-%ld", (long) getpid());
+  n_die = raplcap_get_num_die(rc, 0);
+  n_zones = n_pkg * n_die * NZONES;
+  zones = malloc(n_zones * sizeof(*zones));
+  assert(zones != NULL);
+  pub = raplcap_shm_publisher_init(rc, name, 0);
+  assert(pub != NULL);
+  rd = raplcap_shm_reader_open(name);
+  assert(rd != NULL);
+  assert(raplcap_shm_reader_get_num_packages(rd) == n_pkg);
+  assert(raplcap_shm_reader_get_num_die(rd) == n_die);
+  seq = raplcap_shm_read(rd, zones, n_zones, &ns);
+  assert(seq == 1);
+  assert(ns > 0);
+  assert(zones[0].supported == raplcap_is_zone_supported(rc, 0, RAPLCAP_ZONE_PACKAGE));
+  assert(raplcap_shm_publish(pub) == 0);
+  assert(raplcap_shm_read_zone(rd, 0, 0, RAPLCAP_ZONE_PACKAGE, &z) == 2);
+  assert(z.supported == zones[0].supported);
+  assert(raplcap_shm_read_zone(rd, n_pkg, 0, RAPLCAP_ZONE_PACKAGE, &z) == 0);
+  assert(raplcap_shm_publisher_destroy(pub) == 0);
+  // readers can still read the last update
+  assert(raplcap_shm_read(rd, zones, n_zones, NULL) == 2);
+  assert(raplcap_shm_reader_close(rd) == 0);
+  assert(raplcap_shm_reader_open(name) == NULL);
+  free(zones);
+}
+
 static void test(raplcap* rc, int ro) {
-  raplcap_limit ll, ls;
+  const raplcap_zone_handle* zh;
+  const raplcap_snapshot_zone* sz;
+  raplcap_zone_status status;
+  raplcap_snapshot* snap;
+  raplcap_limit ll, ls, ll_q;
   uint32_t i, p;
   int supported, enabled;
   double joules;
@@ -106,12 +316,33 @@ static void test(raplcap* rc, int ro) {
           assert(ls.seconds > 0);
           assert(ls.watts >= 0);
         }
+        printf("    Testing raplcap_pd_get_zone_status(...)\n");
+        assert(raplcap_pd_get_zone_status(rc, p, 0, (raplcap_zone) i, &status) == 0);
+        assert(status.enabled == enabled);
+        assert(equal_dbl(status.limit_long.seconds, ll.seconds));
+        assert(equal_dbl(status.limit_long.watts, ll.watts));
+        printf("    Testing raplcap_pd_quantize_limits(...)\n");
+        memcpy(&ll_q, &ll, sizeof(raplcap_limit));
+        assert(raplcap_pd_quantize_limits(rc, p, 0, (raplcap_zone) i, &ll_q, NULL) >= 0);
+        assert(ll_q.seconds > 0);
+        assert(ll_q.watts >= 0);
         printf("    Testing raplcap_get_energy_counter(...)\n");
         joules = raplcap_get_energy_counter(rc, p, (raplcap_zone) i);
         assert(joules >= 0);
         printf("    Testing raplcap_get_energy_counter_max(...)\n");
         joules = raplcap_get_energy_counter_max(rc, p, (raplcap_zone) i);
         assert(joules >= 0);
+        printf("    Testing raplcap_pd_get_zone_handle(...)\n");
+        zh = raplcap_pd_get_zone_handle(rc, p, 0, (raplcap_zone) i);
+        assert(zh != NULL);
+        assert(raplcap_pd_get_zone_handle(rc, p, 0, (raplcap_zone) i) == zh);
+        assert(raplcap_zone_handle_get_limits(zh, &ll, &ls) == 0);
+        assert(raplcap_zone_handle_get_energy_counter(zh) >= 0);
+        assert(equal_dbl(raplcap_zone_handle_get_energy_counter_max(zh), joules));
+        printf("    Testing raplcap_power_meter_*(...)\n");
+        test_power_meter(rc, p, i);
+        printf("    Testing raplcap_aligned_read(...)\n");
+        test_aligned(zh);
         if (!ro) {
           test_set(&ll, &ls, rc, p, i);
         }
@@ -120,6 +351,19 @@ static void test(raplcap* rc, int ro) {
       }
     }
   }
+  test_region(rc);
+  test_shm(rc, n_pkg);
+  printf("  Testing raplcap_snapshot_read(...)\n");
+  snap = raplcap_snapshot_alloc(rc);
+  assert(snap != NULL);
+  assert(raplcap_snapshot_read(rc, snap) == 0);
+  for (p = 0; p < n_pkg; p++) {
+    sz = raplcap_snapshot_get_zone(snap, p, 0, RAPLCAP_ZONE_PACKAGE);
+    assert(sz != NULL);
+    assert(sz->supported == raplcap_is_zone_supported(rc, p, RAPLCAP_ZONE_PACKAGE));
+  }
+  assert(raplcap_snapshot_get_zone(snap, n_pkg, 0, RAPLCAP_ZONE_PACKAGE) == NULL);
+  raplcap_snapshot_free(snap);
   // test bad zone values
   printf("  Testing bad zone values\n");
   assert(raplcap_is_zone_supported(rc, 0, (raplcap_zone) NZONES) < 0);
@@ -0,0 +1,55 @@
+/**
+ * Utilities shared by the simulation setup programs.
+ *
+ * @author Connor Imes
+ * @date 2020-10-18
+ */
+// for mkdir
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "raplcap-sim-util.h"
+
+int sim_mkdirs(const char* path) {
+  char buf[PATH_MAX];
+  char* p;
+  if (sim_path(buf, sizeof(buf), "%s", path)) {
+    return -1;
+  }
+  for (p = buf + 1; *p != '\0'; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      if (mkdir(buf, 0755) && errno != EEXIST) {
+        perror(buf);
+        return -1;
+      }
+      *p = '/';
+    }
+  }
+  if (mkdir(buf, 0755) && errno != EEXIST) {
+    perror(buf);
+    return -1;
+  }
+  return 0;
+}
+
+int sim_path(char* buf, size_t len, const char* fmt, ...) {
+  va_list args;
+  int ret;
+  va_start(args, fmt);
+  ret = vsnprintf(buf, len, fmt, args);
+  va_end(args);
+  if (ret < 0) {
+    perror("vsnprintf");
+    return -1;
+  }
+  if ((size_t) ret >= len) {
+    fprintf(stderr, "Path too long: %s...\n", buf);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,30 @@
+/**
+ * Utilities shared by the simulation setup programs.
+ *
+ * @author Connor Imes
+ * @date 2020-10-18
+ */
+#ifndef _RAPLCAP_SIM_UTIL_H_
+#define _RAPLCAP_SIM_UTIL_H_
+
+#include <stddef.h>
+
+/**
+ * Like "mkdir -p".
+ *
+ * @param path
+ * @return 0 on success, -1 on error (with the error printed)
+ */
+int sim_mkdirs(const char* path);
+
+/**
+ * Like "snprintf", but fails if the result doesn't fit in the buffer.
+ *
+ * @param buf
+ * @param len
+ * @param fmt
+ * @return 0 on success, -1 on error (with the error printed)
+ */
+int sim_path(char* buf, size_t len, const char* fmt, ...);
+
+#endif
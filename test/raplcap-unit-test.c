@@ -8,8 +8,15 @@
 #include <errno.h>
 #include <stdlib.h>
 #include "raplcap.h"
+#include "raplcap-accumulator.h"
+#include "raplcap-aligned.h"
+#include "raplcap-async.h"
+#include "raplcap-power-meter.h"
+#include "raplcap-region.h"
+#include "raplcap-shm.h"
 
 int main(void) {
+  raplcap_zone_status status;
   // basically all we can test is some uninitialized parameters
   // the context can't be complete garbage though, it must be zeroed out - we'll just use the global context
   errno = 0;
@@ -33,6 +40,72 @@ int main(void) {
   errno = 0;
   assert(raplcap_get_energy_counter_max(NULL, 0, RAPLCAP_ZONE_PACKAGE) < 0);
   assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_pd_get_zone_status(NULL, 0, 0, RAPLCAP_ZONE_PACKAGE, &status) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_pd_quantize_limits(NULL, 0, 0, RAPLCAP_ZONE_PACKAGE, NULL, NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_pd_get_zone_handle(NULL, 0, 0, RAPLCAP_ZONE_PACKAGE) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_accumulator_init(NULL, 0) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_accumulator_init(NULL, -1) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_aligned_read(NULL, 1.0, NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_aligned_get_update_period(NULL, 0, 1.0) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_async_submit(NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_async_destroy(NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_power_meter_init(NULL, 0, 0, RAPLCAP_ZONE_PACKAGE, 1, 1.0) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_power_meter_init(NULL, 0, 0, RAPLCAP_ZONE_PACKAGE, 2, 0) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_power_meter_init(NULL, 0, 0, RAPLCAP_ZONE_PACKAGE, 2, 1.0) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_power_meter_sample(NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_region_init(NULL, 0, 1, 0) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_region_begin("test") < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_region_end() < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_shm_publisher_init(NULL, "no-slash", 0) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_shm_publish(NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_shm_read(NULL, NULL, 0, NULL) == 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_snapshot_alloc(NULL) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_snapshot_read(NULL, NULL) < 0);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(raplcap_snapshot_get_zone(NULL, 0, 0, RAPLCAP_ZONE_PACKAGE) == NULL);
+  assert(errno == EINVAL);
   // just verify that it doesn't crash (API doesn't specify what to return or whether to set errno in this case)
   raplcap_destroy(NULL);
   // also verifying that it doesn't crash